@@ -17,6 +17,7 @@
 
 #include <aos/aos.h>
 #include <fs/fs.h>
+#include <mm/mm.h>
 
 typedef void *handle_t;
 
@@ -55,11 +56,26 @@ enum aos_rpc_identifier {
     RPC_CLOSEDIR,
     RPC_FSTAT,
     RPC_BIND_NAMESERVER,        // may return MON_ERR_RETRY
+    RPC_BENCH_ECHO,
+    RPC_CHAN_STATS,
+    RPC_MEM_STATS,
+    RPC_RAM_FREE,
+    RPC_PROCESS_GET_MEM,
     RPC_MSG_COUNT,
 };
 STATIC_ASSERT(RPC_MSG_COUNT <= RPC_IDENTIFIER_USER_END, "RPC_MSG_COUNT too large");
 
 
+/**
+ * Names a capability handed to init for another domain (RPC_TRANSFER_CAP), so that the
+ * receiver can claim it (RPC_ACCEPT_CAP). Also appended to UMP messages that carry a cap.
+ */
+struct aos_rpc_cap_ticket {
+    domainid_t from;  ///< Sender, filled in by init on RPC_TRANSFER_CAP
+    domainid_t to;    ///< Receiver
+    uint32_t seq;     ///< Chosen by the sender, unique among its transfers in flight
+};
+
 struct aos_rpc_msg_ram {
     size_t size;
     size_t alignment;
@@ -71,6 +87,25 @@ struct rpc_process_spawn_call_msg {
     char cmdline[0];
 } __attribute__((packed));
 
+/// Echoed back by init on the given core, see aos_rpc_bench_echo
+struct rpc_bench_echo_msg {
+    coreid_t core;
+    uint8_t payload[0];
+} __attribute__((packed));
+
+/// Statistics of one channel of init, see aos_rpc_get_chan_stats
+struct rpc_chan_stats_entry {
+    domainid_t pid;              ///< Process at the other end, 0 if it is not a process
+    coreid_t core;               ///< Core of init owning the channel
+    char name[DISP_NAME_LEN];    ///< Name of the process or of the channel
+    struct aos_chan_stats stats;
+};
+
+struct rpc_chan_stats_reply {
+    uint32_t count;
+    struct rpc_chan_stats_entry entries[0];
+};
+
 struct rpc_process_get_all_pids_return_msg {
     uint32_t count;
     domainid_t pids[0];
@@ -86,6 +121,26 @@ errval_t aos_rpc_send_number(struct aos_rpc *chan, uintptr_t val);
  */
 errval_t aos_rpc_stress_test(struct aos_rpc *chan, uint8_t *val, size_t len);
 
+/**
+ * \brief Round trip for benchmarking, msg is echoed back by init on msg->core.
+ * \arg ret_buf Malloced by this function, should be freed outside.
+ */
+errval_t aos_rpc_bench_echo(struct aos_rpc *chan, struct rpc_bench_echo_msg *msg,
+                            size_t size, void **ret_buf, size_t *ret_size);
+
+/**
+ * \brief Get the statistics of the channels of init on a core.
+ * \arg entries Allocated by the rpc implementation. Freeing is the caller's
+ * responsibility.
+ */
+errval_t aos_rpc_get_chan_stats(struct aos_rpc *chan, coreid_t core,
+                                struct rpc_chan_stats_entry **entries, size_t *count);
+
+/**
+ * \brief Get the statistics of the RAM allocator of init on a core.
+ */
+errval_t aos_rpc_get_mem_stats(struct aos_rpc *chan, coreid_t core, struct mm_stats *stats);
+
 /**
  * \brief Send a string.
  */
@@ -99,6 +154,16 @@ errval_t aos_rpc_send_string(struct aos_rpc *chan, const char *string);
 errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t bytes, size_t alignment,
                              struct capref *retcap, size_t *ret_bytes);
 
+/**
+ * \brief Give RAM obtained with aos_rpc_get_ram_cap() back to the memory server.
+ *
+ * The cap may also be a Frame retyped from the whole RAM cap. The memory server revokes
+ * it, so all copies and mappings of the memory are gone on success.
+ *
+ * \return MM_ERR_NO_PENDING_CAP if the cap does not cover exactly what the server handed out.
+ */
+errval_t aos_rpc_free_ram_cap(struct aos_rpc *chan, struct capref cap);
+
 /**
  * \brief Get one character from the serial port
  */
@@ -157,6 +222,11 @@ errval_t aos_rpc_process_spawn_with_terminal_state(struct aos_rpc *rpc, char *cm
  */
 errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid, char **name);
 
+/**
+ * \brief Get how much RAM the process with the given PID holds from the memory server.
+ */
+errval_t aos_rpc_process_get_mem(struct aos_rpc *chan, domainid_t pid, size_t *ram_bytes);
+
 
 /**
  * \brief Get PIDs of all running processes.
@@ -188,6 +258,20 @@ errval_t aos_rpc_closedir(struct aos_rpc *chan, handle_t handle);
 errval_t aos_rpc_readdir_next(struct aos_rpc *chan, handle_t handle, char **name);
 errval_t aos_rpc_fstat(struct aos_rpc *chan, handle_t handle, struct fs_fileinfo *info);
 
+/**
+ * \brief Asynchronous variants of aos_rpc_fread and aos_rpc_fstat. Several of them can be
+ *        in flight on one channel, each with its own future, see aos_chan_call_async.
+ *        The *_wait function collects the result and releases the future.
+ */
+errval_t aos_rpc_fread_async(struct aos_rpc *chan, handle_t handle, size_t bytes,
+                             struct aos_chan_future *future);
+errval_t aos_rpc_fread_wait(struct aos_rpc *chan, struct aos_chan_future *future,
+                            void *buffer, size_t *ret_bytes);
+errval_t aos_rpc_fstat_async(struct aos_rpc *chan, handle_t handle,
+                             struct aos_chan_future *future);
+errval_t aos_rpc_fstat_wait(struct aos_rpc *chan, struct aos_chan_future *future,
+                            struct fs_fileinfo *info);
+
 
 /**
  * \brief Returns the RPC channel to init.
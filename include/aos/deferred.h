@@ -50,6 +50,12 @@ errval_t periodic_event_cancel(struct periodic_event *event);
 
 // XXX: internal to libbarrelfish; should be in another header file
 void trigger_deferred_events_disabled(dispatcher_handle_t dh, systime_t now);
+errval_t deferred_event_register_disabled(struct deferred_event *event,
+                                          struct waitset *ws, delayus_t delay,
+                                          struct event_closure closure,
+                                          dispatcher_handle_t dh);
+errval_t deferred_event_cancel_disabled(struct deferred_event *event,
+                                        dispatcher_handle_t handle);
 
 __END_DECLS
 
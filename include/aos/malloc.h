@@ -0,0 +1,70 @@
+/**
+ * \file
+ * \brief Size-class malloc with per-thread caches
+ *
+ * Requests up to MALLOC_MAX_CLASS_SIZE bytes are rounded up to one of MALLOC_CLASS_COUNT
+ * size classes. Each class is a slab allocator over spans of MALLOC_SPAN_SIZE bytes,
+ * carved out of a window of virtual memory reserved at startup and populated on page
+ * faults. Every thread keeps a short list of free blocks per class, so that most malloc
+ * and free calls take no lock at all; the lists are refilled from and flushed to the
+ * class in batches. Larger requests, and requests the classes cannot serve, go to the
+ * K&R free list of the morecore.
+ */
+
+#ifndef LIBBARRELFISH_MALLOC_H
+#define LIBBARRELFISH_MALLOC_H
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errors/errno.h>
+
+__BEGIN_DECLS
+
+/// Number of size classes: 16 to 128 bytes in steps of 16, then four per power of two
+#define MALLOC_CLASS_COUNT 28
+
+/// Largest request served by the size classes
+#define MALLOC_MAX_CLASS_SIZE 4096
+
+/// Unit the window is carved into, each span serves a single class
+#define MALLOC_SPAN_SIZE (64 * 1024)
+
+/// Virtual memory reserved for the spans
+#define MALLOC_WINDOW_SIZE (256UL * 1024 * 1024)
+
+/// A thread caches up to this many bytes of free blocks per class
+#define MALLOC_CACHE_BYTES (32 * 1024)
+
+/// Free blocks of a class cached by a thread, linked through the blocks themselves
+struct malloc_cache_bin {
+    void *head;
+    uint32_t count;
+};
+
+/// Per-thread cache, part of the thread control block
+struct malloc_thread_cache {
+    struct malloc_cache_bin bins[MALLOC_CLASS_COUNT];
+};
+
+/**
+ * \brief Reserve the window and route malloc, free and realloc through the size classes.
+ *        Called once by libaos after morecore_init().
+ */
+errval_t malloc_init(void);
+
+/**
+ * \brief Turn the size classes on or off for new allocations, for comparison with the
+ *        K&R allocator. Blocks already handed out are freed where they came from.
+ */
+void malloc_set_size_classes(bool enable);
+
+/**
+ * \brief Give the blocks cached by a thread back to their classes. Called when the
+ *        thread control block is freed.
+ */
+void malloc_thread_cache_flush(struct malloc_thread_cache *cache);
+
+__END_DECLS
+
+#endif // LIBBARRELFISH_MALLOC_H
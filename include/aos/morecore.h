@@ -20,6 +20,14 @@
 
 __BEGIN_DECLS
 
+/// Free heap spans are given back in multiples of this, see PAGING_FAULT_AROUND_ALIGN
+#define MORECORE_FREE_ALIGN PAGING_FAULT_AROUND_ALIGN
+/// Free heap spans of at least this many bytes are given back to the memory server
+#define MORECORE_FREE_THRESHOLD (4 * MORECORE_FREE_ALIGN)
+/// Bytes at the end of such a span that stay committed, so freeing and allocating around
+/// the threshold does not give back and fault in the same memory over and over
+#define MORECORE_FREE_KEEP MORECORE_FREE_ALIGN
+
 errval_t morecore_init(size_t alignment);
 void morecore_use_optimal(void);
 errval_t morecore_reinit(void);
@@ -36,10 +36,17 @@ errval_t paging_init(void);
 errval_t paging_init_onthread(struct thread *t);
 
 
+/// Alignments for paging_alloc() so that the region can be mapped with 2 MiB or 1 GiB blocks
+#define PAGING_ALIGN_LARGE LARGE_PAGE_SIZE
+#define PAGING_ALIGN_HUGE  HUGE_PAGE_SIZE
+
 /**
  * \brief Find a bit of free virtual address space that is large enough to
  *        accomodate a buffer of size `bytes`.
  * \note  The alignment must be a power of two and a multiple of base page size.
+ * \note  Frames mapped later into the region use block mappings where the region and the
+ *        frames are aligned to PAGING_ALIGN_LARGE or PAGING_ALIGN_HUGE. Regions are
+ *        aligned to their size rounded up to a power of two anyway.
  */
 errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes,
                       size_t alignment);
@@ -57,6 +64,25 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
 
 
 
+/**
+ * \brief Set how many pages a page fault in a placeholder region populates at once.
+ *
+ * An isolated fault populates min_pages pages from the faulting one on, clipped to the
+ * region and to pages that are already mapped. Every fault right after the previously
+ * populated window doubles the window, up to max_pages, which is at most
+ * PAGING_FAULT_AROUND_MAX_PAGES. 1 and 1 populate single pages.
+ */
+void paging_set_fault_around(struct paging_state *st, size_t min_pages, size_t max_pages);
+
+/**
+ * \brief Give back the memory populated on page faults within [vaddr, vaddr + bytes).
+ *
+ * The range stays reserved, and is populated again on the next access. Pages populated
+ * on page faults are only given back in the windows they were populated in, so all of
+ * them are given back if the range is aligned to PAGING_FAULT_AROUND_ALIGN.
+ */
+errval_t paging_decommit(struct paging_state *st, lvaddr_t vaddr, size_t bytes);
+
 /**
  * \brief unmap region starting at address `region`.
  * NOTE: this function is currently here to make libbarrelfish compile. As
@@ -40,6 +40,21 @@ typedef int paging_flags_t;
 #define PAGING_ADDR_BITS 48
 #define PAGING_TABLE_LEVELS 4
 
+// Default window of pages populated on a page fault in a placeholder region. The window
+// doubles up to the maximum as long as faults hit right after the previous window.
+#define PAGING_FAULT_AROUND_MIN_PAGES 16
+#define PAGING_FAULT_AROUND_MAX_PAGES 64
+
+// Windows never cross a multiple of this, so that giving back an aligned range frees all
+// pages populated in it. Divides the range of an L3 table.
+#define PAGING_FAULT_AROUND_ALIGN (PAGING_FAULT_AROUND_MAX_PAGES * BASE_PAGE_SIZE)
+
+// Page faults populating their window at the same time, see struct paging_fault_claim
+#define PAGING_FAULT_MAX_CLAIMS 8
+
+// Page tables per level remembered for lookups without a lock, a power of two
+#define PAGING_VNODE_CACHE_SLOTS 64
+
 // General node type to work with RB trees
 struct paging_rb_tree_node {
     RB_ENTRY(paging_rb_tree_node) rb_entry;
@@ -68,10 +83,15 @@ struct paging_region_node {
 };
 
 struct paging_mapping_child_node {
+    // "Inherit" struct paging_general_node
+    RB_ENTRY(paging_rb_tree_node) rb_entry;
+    lvaddr_t addr;  // virtual range covered by this mapping
+    // Other fields
     LIST_ENTRY(paging_mapping_child_node) link;
     struct capref vnode_cap;
     struct capref mapping_cap;
     struct capref self_paging_frame_cap;
+    size_t bytes;
 };
 
 struct paging_mapping_node {
@@ -83,23 +103,46 @@ struct paging_mapping_node {
     struct paging_region_node *region;
 };
 
+// Window a page fault is populating. The frame is allocated without holding a lock, so
+// that faults elsewhere proceed meanwhile, and other faults keep out of the window.
+struct paging_fault_claim {
+    lvaddr_t start;
+    lvaddr_t end;          // may be cut short by a nested fault of the owner
+    struct thread *owner;  // NULL if the claim is unused
+};
+
 // struct to store the paging status of a process
+//
+// Locks are taken in the order mapping_mutex, free_list_mutex, region_mutex, and
+// mapping_mutex before vnode_mutex. None of them is held while allocating the frame for
+// a page fault.
 struct paging_state {
     struct paging_rb_tree vnode_tree[PAGING_TABLE_LEVELS];
     struct paging_rb_tree region_tree;
     struct paging_rb_tree mapping_tree;
+    struct paging_rb_tree child_tree;  // children of all mapping nodes, by address
     struct slot_allocator *slot_alloc;
     struct slab_allocator vnode_slabs;
     struct slab_allocator region_slabs;
     struct slab_allocator mapping_node_slabs;
     struct slab_allocator mapping_child_slabs;
-    struct thread_mutex frame_alloc_mutex;
-    struct thread_mutex free_list_mutex;
-    struct thread_mutex vnode_mutex;
-    struct thread_mutex region_mutex;
+    struct thread_mutex mapping_mutex;    // mapping_tree, child_tree, children of mapping nodes
+    struct thread_mutex free_list_mutex;  // free_list
+    struct thread_mutex region_mutex;     // region_tree
+    struct thread_mutex vnode_mutex;      // vnode_tree, creating page tables
+    // Page tables found by address without a lock. Vnode nodes are never freed once
+    // installed, so an entry is valid whenever its address matches.
+    struct paging_vnode_node *vnode_cache[PAGING_TABLE_LEVELS][PAGING_VNODE_CACHE_SLOTS];
     LIST_HEAD(paging_free_list_head, paging_region_node) free_list[PAGING_ADDR_BITS - BASE_PAGE_BITS + 1];
     lvaddr_t start_addr;
-    bool refilling;
+    struct thread *refilling;  // thread refilling the slab allocators, see ensure_enough_slabs
+    size_t slab_refills;  // slab allocators refilled ahead of time, for benchmarks
+    // Fault-around, protected by mapping_mutex
+    size_t fault_min_pages;  // pages populated by an isolated page fault
+    size_t fault_max_pages;  // upper limit of the window for sequential faults
+    size_t fault_window;     // pages populated by the last fault
+    lvaddr_t fault_next;     // end of the last populated window
+    struct paging_fault_claim fault_claims[PAGING_FAULT_MAX_CLAIMS];
 };
 
 #endif  /// PAGING_TYPES_H_
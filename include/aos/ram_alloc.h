@@ -29,6 +29,7 @@ typedef errval_t (* ram_alloc_func_t)(struct capref *ret, size_t size, size_t al
 errval_t ram_alloc_fixed(struct capref *ret, size_t size, size_t alignment);
 errval_t ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment);
 errval_t ram_alloc(struct capref *retcap, size_t size);
+errval_t ram_free(struct capref cap);
 errval_t ram_available(genpaddr_t *available, genpaddr_t *total);
 errval_t ram_alloc_set(ram_alloc_func_t local_allocator);
 void ram_set_affinity(uint64_t minbase, uint64_t maxlimit);
@@ -26,6 +26,23 @@ enum {
 #define RPC_IDENTIFIER_USER_START 8
 #define RPC_IDENTIFIER_USER_END ((1U << (sizeof(rpc_identifier_t) * 8 - 1)) - 1)
 
+/// Carried by every message right before the identifier, echoed by the reply
+typedef uint8_t rpc_request_id_t;
+
+/// Request ID of messages that are not calls or whose reply is received by hand
+#define RPC_REQUEST_ID_NONE 0
+
+/// Largest payload sent inline in a single LMP message, larger ones go as a fragment train
+#define RPC_LMP_INLINE_PAYLOAD_SIZE                                                      \
+    (LMP_MSG_LENGTH * sizeof(uintptr_t) - sizeof(uint8_t) - sizeof(rpc_request_id_t)     \
+     - sizeof(rpc_identifier_t))
+
+/// Largest payload sent as a train of LMP messages, larger ones go through a frame
+#define RPC_LMP_TRAIN_MAX_PAYLOAD_SIZE 256
+
+/// At most this many calls can be in flight on one channel, see aos_chan_call_async
+#define AOS_CHAN_MAX_PENDING 32
+
 typedef errval_t (*aos_chan_handler_t)(void *arg, rpc_identifier_t identifier,
                                        void *in_payload, size_t in_size,
                                        struct capref in_cap, void **out_payload,
@@ -38,15 +55,106 @@ typedef errval_t (*aos_chan_handler_t)(void *arg, rpc_identifier_t identifier,
                   size_t *out_size, struct capref *out_cap, bool *free_out_payload,      \
                   bool *re_register)
 
+/**
+ * Ticket of a call made with aos_chan_call_async. Owned by the caller, and must stay valid
+ * until it is done.
+ */
+struct aos_chan_future {
+    volatile bool done;
+    errval_t err;                  ///< Error in the call or carried by the reply
+    void *ret_buf;                 ///< Reply payload, malloced, should be freed outside
+    size_t ret_size;
+    struct capref ret_cap;         ///< Cap carried by the reply, NULL_CAP if none
+    struct event_closure closure;  ///< Optional, called once done, see aos_chan_future_init
+
+    // Internal
+    rpc_request_id_t id;
+    rpc_identifier_t identifier;
+    struct capref call_cap;
+    void *call_buf;                ///< Kept for aos_chan_resubmit
+    size_t call_size;
+    bool owns_call_buf;
+    struct aos_chan_future *next;  ///< In the pending list of the channel
+};
+
+/// Number of payload slots in the frame pool of an LMP channel
+#define RPC_LMP_POOL_SLOTS 8
+
+/// Size of one slot, including its header
+#define RPC_LMP_POOL_SLOT_SIZE BASE_PAGE_SIZE
+
+/**
+ * Frames mapped once per LMP channel for large messages, see rpc_lmp_serialize. Each end
+ * owns the pool it writes to (tx) and maps the one of the other end (rx) when it is
+ * announced. A slot is taken by the sender and released by the receiver once handled.
+ */
+struct rpc_lmp_pool {
+    struct thread_mutex mutex;  ///< Protects the tx side
+    struct capref tx_frame;
+    uint8_t *tx;                ///< NULL until the first large message
+    bool tx_ready;              ///< The other end has been sent tx_frame
+    bool tx_setting_up;         ///< Some thread is allocating tx
+    size_t tx_next;             ///< Next slot to try
+    struct capref rx_frame;
+    uint8_t *rx;                ///< NULL until the other end announces its pool
+};
+
+/// Set to 0 to drop the per-channel statistics from the hot paths
+#define AOS_CHAN_STATS 1
+
+#define AOS_CHAN_STATS_HIST_BUCKETS 16
+
+/**
+ * Statistics of a channel, see aos_chan_get_stats. Counted without locking, so they are
+ * approximate when several threads use the channel.
+ */
+struct aos_chan_stats {
+    uint64_t msgs_sent;   ///< Calls, replies and plain messages
+    uint64_t msgs_recv;
+    uint64_t bytes_sent;  ///< Payload bytes
+    uint64_t bytes_recv;
+    uint64_t caps_sent;
+    uint64_t caps_recv;
+    uint64_t retries;     ///< Calls sent again after MON_ERR_RETRY
+    uint64_t handled;     ///< Calls given to the receive handler
+    uint64_t handler_ns;  ///< Total time spent in the receive handler
+    /// Handler time, bucket 0 is < 1 us, bucket i is [2^(i-1), 2^i) us, the last one is
+    /// everything above
+    uint32_t handler_hist[AOS_CHAN_STATS_HIST_BUCKETS];
+};
+
+/**
+ * Fragment trains of an LMP channel, see rpc_lmp_serialize. Only one train is sent at a
+ * time on a channel, but single messages may come in between its fragments.
+ */
+struct rpc_lmp_train {
+    struct thread_mutex send_mutex;  ///< Keeps trains from interleaving
+    uint8_t *recv_buf;               ///< Identifier then payload, NULL if no train is coming
+    size_t recv_size;                ///< Size of the payload
+    size_t recv_received;            ///< Payload bytes received so far
+    rpc_request_id_t recv_request_id;
+    struct capref recv_cap;          ///< Came with the first fragment
+};
+
 struct aos_chan {
     enum aos_chan_type type;
     union {
         struct lmp_chan lc;
         struct ump_chan uc;
     };
-    struct thread_mutex mutex;  // make one respond associated with one request
+    struct thread_mutex mutex;  // protect sending, receiving replies and the pending list
     aos_chan_handler_t handler;
     void *arg;
+    struct aos_chan_future *pending;  // calls waiting for their reply, in sending order
+    size_t pending_count;
+    rpc_request_id_t next_request_id;
+    struct waitset *async_ws;  // see aos_chan_register_async
+    struct rpc_lmp_pool lmp_pool;  // LMP only
+    struct rpc_lmp_train lmp_train;  // LMP only
+    struct thread *ump_large_sender;  // UMP only, sending a message in pieces, see rpc_ump_submit
+#if AOS_CHAN_STATS
+    struct aos_chan_stats stats;
+#endif
 };
 
 struct aos_rpc {
@@ -57,8 +165,6 @@ struct aos_rpc {
 
 #define CAST_DEREF(type, ptr, offset_in_byte) (*((type *)OFFSET(ptr, offset_in_byte)))
 
-errval_t rpc_lmp_put_cap(struct lmp_chan *lc, struct capref cap);
-
 /**
  * \brief Initialize an aos_chan with a disconnected LMP channel.
  */
@@ -123,12 +229,75 @@ errval_t aos_chan_call(struct aos_chan *chan, rpc_identifier_t identifier,
                        struct capref *ret_cap, void **ret_buf, size_t *ret_size);
 
 
+/**
+ * \brief Initialize a future for aos_chan_call_async.
+ * \param closure Optional (NOP_CLOSURE), called once the future is done by the thread that
+ *                receives the reply, in aos_chan_poll, aos_chan_wait or an event handler
+ *                installed by aos_chan_register_async.
+ */
+void aos_chan_future_init(struct aos_chan_future *future, struct event_closure closure);
+
+/**
+ * \brief Make an RPC call without waiting for the reply.
+ *
+ * Several calls can be in flight on one channel. The server handles them in order and each
+ * reply is matched to its future by the request ID it echoes. If AOS_CHAN_MAX_PENDING calls
+ * are already in flight, this function receives replies until one completes.
+ *
+ * \note  call_buf is copied and can be reused right after.
+ */
+errval_t aos_chan_call_async(struct aos_chan *chan, rpc_identifier_t identifier,
+                             struct capref call_cap, const void *call_buf,
+                             size_t call_size, struct aos_chan_future *future);
+
+/**
+ * \brief Send the call of a done future again, for example after MON_ERR_RETRY.
+ */
+errval_t aos_chan_resubmit(struct aos_chan *chan, struct aos_chan_future *future);
+
+/**
+ * \brief Receive the replies that have arrived, without blocking, and complete their
+ *        futures. Does nothing if another thread is receiving on the channel.
+ */
+errval_t aos_chan_poll(struct aos_chan *chan);
+
+/**
+ * \brief Wait until the future is done, completing the other futures on the way.
+ * \return future->err, or the error in receiving replies.
+ */
+errval_t aos_chan_wait(struct aos_chan *chan, struct aos_chan_future *future);
+
+/**
+ * \brief Release the copy of the call kept by a done future. The reply buffer and cap
+ *        are left to the caller.
+ */
+void aos_chan_future_destroy(struct aos_chan_future *future);
+
+/**
+ * \brief Complete futures from events on a waitset, so that their closures are called by
+ *        event_dispatch instead of aos_chan_poll.
+ * \note  Only for channels without a receive handler (aos_chan_register_recv).
+ */
+errval_t aos_chan_register_async(struct aos_chan *chan, struct waitset *ws);
+
 /**
  * \brief Unified interface to send a message
+ * \note  Over UMP, init queues the cap until the receiver claims it. The send fails with
+ *        PROC_MGMT_ERR_CAP_MAILBOX_FULL (under LIB_ERR_UMP_CHAN_SEND_CAP) if
+ *        PROC_CAP_MAILBOX_MAX caps wait for the receiver already.
  */
 errval_t aos_chan_send(struct aos_chan *chan, rpc_identifier_t identifier,
                        struct capref cap, const void *buf, size_t size, bool non_blocking);
 
+/**
+ * \brief Receive the reply to a message sent with aos_chan_send, without blocking.
+ * \note  Only for UMP channels and replies without cap. ret_buf should be freed outside.
+ * \return LIB_ERR_RING_NO_MSG if the reply has not arrived yet, otherwise the error
+ *         in receiving the reply or the one carried by the reply.
+ */
+errval_t aos_chan_ump_try_recv_reply(struct aos_chan *chan, void **ret_buf,
+                                     size_t *ret_size);
+
 /**
  * \brief Reply a successful RPC call.
  */
@@ -146,6 +315,18 @@ errval_t aos_chan_nack(struct aos_chan *chan, errval_t err);
  */
 bool aos_chan_is_connected(struct aos_chan *chan);
 
+/**
+ * \brief Get a copy of the statistics of a channel. All zero if AOS_CHAN_STATS is off.
+ */
+void aos_chan_get_stats(struct aos_chan *chan, struct aos_chan_stats *ret);
+
+static inline void aos_chan_stats_retry(struct aos_chan *chan)
+{
+#if AOS_CHAN_STATS
+    chan->stats.retries++;
+#endif
+}
+
 
 /**
  * \brief Initialize an aos_rpc struct. chan is set to AOS_CHAN_TYPE_UNKNOWN
@@ -171,11 +352,45 @@ static inline errval_t aos_rpc_call(struct aos_rpc *rpc, rpc_identifier_t identi
         err = aos_chan_call(&rpc->chan, identifier, call_cap, call_buf, call_size, ret_cap,
                       ret_buf, ret_size);
         if (err == MON_ERR_RETRY) {
+            aos_chan_stats_retry(&rpc->chan);
+            thread_yield();
+        } else {
+            break;
+        }
+    } while (1);
+    return err;
+}
+
+static inline errval_t aos_rpc_call_async(struct aos_rpc *rpc, rpc_identifier_t identifier,
+                                          struct capref call_cap, const void *call_buf,
+                                          size_t call_size, struct aos_chan_future *future)
+{
+    return aos_chan_call_async(&rpc->chan, identifier, call_cap, call_buf, call_size,
+                               future);
+}
+
+/**
+ * \brief Wait for an asynchronous call, sending it again on MON_ERR_RETRY as aos_rpc_call
+ *        does. The copy of the call is released once the future is done.
+ * \note  ret_buf of the future should be freed outside.
+ */
+static inline errval_t aos_rpc_wait(struct aos_rpc *rpc, struct aos_chan_future *future)
+{
+    errval_t err;
+    do {
+        err = aos_chan_wait(&rpc->chan, future);
+        if (err == MON_ERR_RETRY) {
+            aos_chan_stats_retry(&rpc->chan);
             thread_yield();
+            err = aos_chan_resubmit(&rpc->chan, future);
+            if (err_is_fail(err)) {
+                break;
+            }
         } else {
             break;
         }
     } while (1);
+    aos_chan_future_destroy(future);
     return err;
 }
 
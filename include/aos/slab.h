@@ -16,39 +16,88 @@
 #define LIBBARRELFISH_SLAB_H
 
 #include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
+/// A slab holds at least this many blocks, unless it is grown from a smaller buffer
+#define SLAB_MIN_BLOCKS 4
+
+/// slab_default_refill() adds this many slabs at once
+#define SLAB_REFILL_SLABS 4
+
+/// See slab_needs_refill()
+#define SLAB_LOW_FREE_DIV 8
+
 // forward declarations
 struct slab_allocator;
 struct block_head;
 
 typedef errval_t (*slab_refill_func_t)(struct slab_allocator *slabs);
 
+/// Lists a slab can be on, by occupancy
+enum slab_list {
+    SLAB_LIST_PARTIAL,
+    SLAB_LIST_FULL,    ///< No free block
+    SLAB_LIST_EMPTY,   ///< All blocks free
+    SLAB_LIST_COUNT
+};
+
 struct slab_head {
-    struct slab_head *next; ///< Next slab in the allocator
-    uint32_t total, free;   ///< Count of total and free blocks in this slab
-    struct block_head *blocks; ///< Pointer to free block list
+    struct slab_head *next, *prev;     ///< Neighbours on the list of the slab
+    struct slab_allocator *owner;      ///< Allocator the slab belongs to
+    struct block_head *blocks;         ///< Pointer to free block list
+    struct slab_head *next_unaligned;  ///< Next slab not starting at a slab_size boundary
+    uintptr_t limit;                   ///< End of the blocks
+    uint32_t total, free;              ///< Count of total and free blocks in this slab
+    uint32_t list;                     ///< enum slab_list the slab is on
+    uint32_t reserved;                 ///< Keeps the blocks after the head 16-byte aligned
 };
 
 struct slot_allocator;
 
 struct slab_allocator {
-    struct slab_head *slabs;    ///< Pointer to list of slabs
-    size_t blocksize;           ///< Size of blocks managed by this allocator
+    struct slab_head *lists[SLAB_LIST_COUNT];  ///< Slabs by occupancy
+    struct slab_head *unaligned;  ///< Slabs whose owner is not found by alignment
+    size_t blocksize;             ///< Size of blocks managed by this allocator
+    size_t slab_size;             ///< Power of two, slabs never cross a multiple of it
+    size_t total_blocks;          ///< Blocks in all slabs
+    size_t free_blocks;           ///< Free blocks in all slabs
     slab_refill_func_t refill_func;  ///< Refill function
 };
 
+/// Occupancy of a slab allocator, see slab_get_stats()
+struct slab_stats {
+    size_t slabs[SLAB_LIST_COUNT];  ///< Slabs on each list
+    size_t total_blocks;
+    size_t free_blocks;
+    size_t unaligned_slabs;         ///< Slabs searched linearly on slab_free()
+};
+
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func);
 void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen);
 void *slab_alloc(struct slab_allocator *slabs);
 void slab_free(struct slab_allocator *slabs, void *block);
 size_t slab_freecount(struct slab_allocator *slabs);
+void slab_get_stats(struct slab_allocator *slabs, struct slab_stats *stats);
 errval_t slab_default_refill(struct slab_allocator *slabs);
 errval_t slab_refill_no_pagefault(struct slab_allocator *slabs,
                                   struct capref frame, size_t minbytes);
 
+/**
+ * \brief Check whether a slab allocator should be refilled before it runs out
+ *
+ * True once fewer than min_free blocks are free, or once less than 1/SLAB_LOW_FREE_DIV
+ * of all blocks is free, so that growing allocators refill ahead of their demand.
+ */
+static inline bool slab_needs_refill(struct slab_allocator *slabs, size_t min_free)
+{
+    return slabs->free_blocks < min_free
+           || slabs->free_blocks * SLAB_LOW_FREE_DIV < slabs->total_blocks;
+}
+
 // size of block header
 #define SLAB_BLOCK_HDRSIZE (sizeof(void *))
 // should be able to fit the header into the block
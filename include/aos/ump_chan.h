@@ -8,6 +8,7 @@
 #include <aos/capabilities.h>
 #include <aos/waitset.h>
 #include <aos/waitset_chan.h>
+#include <aos/deferred.h>
 #include <ringbuffer/ringbuffer.h>
 #include <assert.h>
 
@@ -15,11 +16,45 @@ __BEGIN_DECLS
 
 #define UMP_CHAN_SHARED_FRAME_SIZE (RING_BUFFER_SIZE * 2)
 
+/// How both ends of a UMP channel publish messages in the rings
+#define UMP_CHAN_RING_MODE RING_MODE_INDEX
+
+/// The first cacheline of a bulk region holds the position consumed by the receiver
+#define UMP_BULK_CONTROL_SIZE CACHE_LINE_SIZE
+
+/// Bulk allocations are aligned to this
+#define UMP_BULK_ALIGNMENT CACHE_LINE_SIZE
+
+/// Messages larger than this go through the bulk regions, if the channel has them
+#define UMP_CHAN_BULK_THRESHOLD RING_MAX_INPLACE_SIZE
+
+/// Default wait policy of a UMP channel: spin for 1 ms, then sleep for up to 4 ms at a time
+#define UMP_CHAN_WAIT_POLICY_DEFAULT ((struct ring_wait_policy){ 1000000, 100, 4000 })
+
+/// How a UMP channel waits for the other end, see ump_chan_set_wait_policy()
+struct ump_chan_wait {
+    struct ring_wait_policy policy;     ///< Applies to the waitset and to both rings
+    systime_t last_active;              ///< Last time the waitset saw a message
+    bool parked;                        ///< Not polled by the waitset, rechecked by wake_event
+    delayus_t park_us;                  ///< Current recheck interval while parked
+    struct deferred_event wake_event;   ///< Rechecks a parked channel
+};
+
+/// Optional pair of pre-shared regions for payloads too large for the ring
+struct ump_bulk {
+    uint8_t *tx;     ///< Region written by us, NULL if the channel has no bulk regions
+    uint8_t *rx;     ///< Region written by the other end
+    size_t size;     ///< Size of the data area of each region
+    size_t tx_head;  ///< Bytes allocated in tx so far
+};
+
 /// A bidirectional UMP channel
 struct ump_chan {
     struct waitset_chanstate recv_waitset;  ///< State belonging to waitset (for recv)
     struct ring_consumer recv;              ///< Ringbuffer receiver
     struct ring_producer send;              ///< Ringbuffer sender
+    struct ump_bulk bulk;                   ///< Bulk regions for large payloads
+    struct ump_chan_wait wait;              ///< Wait policy and parking state
     domainid_t pid;                         ///< PID of the other end
 };
 
@@ -32,6 +67,43 @@ errval_t ump_chan_init(struct ump_chan *uc, struct capref zeroed_frame, enum UMP
 errval_t ump_chan_init_from_buf(struct ump_chan *uc, void *zeroed_buf, enum UMP_CHAN_ROLE role, domainid_t pid);
 void ump_chan_destroy(struct ump_chan *uc);
 
+/**
+ * \brief Attach a pair of shared bulk regions to a UMP channel
+ *
+ * The other end must attach the same regions with tx and rx swapped.
+ *
+ * \param uc UMP channel
+ * \param zeroed_tx Region this end writes payloads into, zeroed
+ * \param zeroed_rx Region the other end writes payloads into, zeroed
+ * \param region_size Size of each region, including UMP_BULK_CONTROL_SIZE
+ */
+void ump_chan_attach_bulk(struct ump_chan *uc, void *zeroed_tx, void *zeroed_rx,
+                          size_t region_size);
+
+/**
+ * \brief Set how the channel waits for the other end, trading latency for CPU time
+ *
+ * Both the blocking calls on the rings and the waitset follow the policy. A channel that
+ * is registered on a waitset and sees no message for policy.spin_ns is parked: it is no
+ * longer polled on every dispatch, so that an otherwise idle dispatcher can sleep, and it
+ * is rechecked at intervals growing from policy.sleep_min_us to policy.sleep_max_us.
+ * RING_WAIT_POLICY_POLL keeps the channel polled all the time.
+ *
+ * \param uc UMP channel
+ * \param policy Wait policy, UMP_CHAN_WAIT_POLICY_DEFAULT after initialization
+ */
+void ump_chan_set_wait_policy(struct ump_chan *uc, struct ring_wait_policy policy);
+
+static inline bool ump_chan_has_bulk(struct ump_chan *uc)
+{
+    return uc->bulk.tx != NULL;
+}
+
+bool ump_chan_bulk_can_alloc(struct ump_chan *uc, size_t size);
+errval_t ump_chan_bulk_alloc(struct ump_chan *uc, size_t size, void **buf, size_t *pos);
+void *ump_chan_bulk_rx_buf(struct ump_chan *uc, size_t pos, size_t size);
+void ump_chan_bulk_release(struct ump_chan *uc, size_t end_pos);
+
 /**
  * \brief Transmit a payload through the UMP channel
  *
@@ -43,6 +115,19 @@ static inline errval_t ump_chan_send(struct ump_chan *uc, const void *payload, s
     return ring_producer_send(&uc->send, payload, size);
 }
 
+/**
+ * \brief Transmit as much of a payload as fits without waiting for the other end
+ *
+ * \param uc UMP channel
+ * \param payload Payload to transmit
+ * \param size Size of the payload
+ * \param offset Position to continue from, advanced past what was sent
+ */
+static inline errval_t ump_chan_send_some(struct ump_chan *uc, const void *payload,
+                                          size_t size, size_t *offset) {
+    return ring_producer_send_some(&uc->send, payload, size, offset);
+}
+
 /**
  * \brief Retrieve an UMP payload, if possible
  *
@@ -69,6 +154,68 @@ static inline errval_t ump_chan_recv_blocking(struct ump_chan *uc, void **payloa
     return ring_consumer_recv(&uc->recv, payload, size);
 }
 
+/**
+ * \brief Reserve space for an outgoing payload directly in the shared ring
+ *
+ * \param uc UMP channel
+ * \param size Size of the payload, at most RING_MAX_INPLACE_SIZE
+ * \param buf Filled with the location to write the payload to
+ */
+static inline errval_t ump_chan_reserve(struct ump_chan *uc, size_t size, void **buf) {
+    return ring_producer_reserve(&uc->send, size, buf);
+}
+
+/**
+ * \brief Check if ump_chan_reserve() would return without waiting for the other end
+ *
+ * \param uc UMP channel
+ * \param size Size of the payload, at most RING_MAX_INPLACE_SIZE
+ */
+static inline bool ump_chan_can_reserve(struct ump_chan *uc, size_t size) {
+    return ring_producer_can_reserve(&uc->send, size);
+}
+
+/**
+ * \brief Send the payload written into the space returned by ump_chan_reserve()
+ *
+ * \param uc UMP channel
+ */
+static inline errval_t ump_chan_publish(struct ump_chan *uc) {
+    return ring_producer_publish(&uc->send);
+}
+
+/**
+ * \brief Get a view of the next UMP payload without copying it, if possible
+ *
+ * \param uc UMP channel
+ * \param view Filled with the payload, valid until ump_chan_commit()
+ *
+ * \return LIB_ERR_RING_NO_MSG if no message is available
+ */
+static inline errval_t ump_chan_peek(struct ump_chan *uc, struct ring_msg_view *view) {
+    return ring_consumer_peek(&uc->recv, view);
+}
+
+/**
+ * \brief Get a view of the next UMP payload without copying it, wait if none available
+ *
+ * \param uc UMP channel
+ * \param view Filled with the payload, valid until ump_chan_commit()
+ */
+static inline errval_t ump_chan_peek_blocking(struct ump_chan *uc, struct ring_msg_view *view) {
+    return ring_consumer_peek_blocking(&uc->recv, view);
+}
+
+/**
+ * \brief Release the payload obtained by ump_chan_peek() back to the channel
+ *
+ * \param uc UMP channel
+ * \param view View to release
+ */
+static inline errval_t ump_chan_commit(struct ump_chan *uc, struct ring_msg_view *view) {
+    return ring_consumer_commit(&uc->recv, view);
+}
+
 /**
  * \brief Register an event handler to be notified when messages can be received
  *
@@ -79,20 +226,19 @@ static inline errval_t ump_chan_recv_blocking(struct ump_chan *uc, void **payloa
  * \param ws Waitset
  * \param closure Event handler
  */
-static inline errval_t ump_chan_register_recv(struct ump_chan *uc, struct waitset *ws,
-                                              struct event_closure closure)
-{
-    return waitset_chan_register_polled(ws, &uc->recv_waitset, closure);
-}
+errval_t ump_chan_register_recv(struct ump_chan *uc, struct waitset *ws,
+                                struct event_closure closure);
 
 /**
  * \brief Cancel an event registration made with ump_chan_register_recv()
  *
  * \param uc UMP channel
  */
-static inline errval_t ump_chan_deregister_recv(struct ump_chan *uc) {
-    return waitset_chan_deregister(&uc->recv_waitset);
-}
+errval_t ump_chan_deregister_recv(struct ump_chan *uc);
+
+// Internal to libaos, called by the waitset while polling
+bool ump_chan_poll_idle_disabled(struct ump_chan *uc, bool ready, systime_t now);
+void ump_chan_park_disabled(struct ump_chan *uc, dispatcher_handle_t handle);
 
 static inline bool ump_chan_can_recv(struct ump_chan *uc)
 {
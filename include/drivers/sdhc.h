@@ -20,6 +20,9 @@
 #define SDHC_BLOCK_SIZE 512
 #define SDHC_TEST_BLOCK 20
 
+/// Most blocks moved by one multi-block transfer
+#define SDHC_MAX_BLOCKS 1024
+
 struct sdhc_s;
 /**
  * Allocate and initialize the SDHC driver. Ensure that base is mapped as
@@ -66,4 +69,28 @@ errval_t sdhc_write_block(struct sdhc_s* sd, int index, lpaddr_t source);
  */
 errval_t sdhc_read_block(struct sdhc_s* sd, int index, lpaddr_t dest);
 
+/**
+ * Read count consecutive blocks starting at index with a single command
+ * (CMD18) into the physically contiguous memory at dest. Otherwise as
+ * sdhc_read_block. count must be at most SDHC_MAX_BLOCKS.
+ *
+ * \param sd        The driver struct
+ * \param index     The first block index to read
+ * \param count     The number of blocks to read
+ * \param dest      Physical address where to write
+ */
+errval_t sdhc_read_blocks(struct sdhc_s* sd, int index, size_t count, lpaddr_t dest);
+
+/**
+ * Write count consecutive blocks starting at index with a single command
+ * (CMD25) from the physically contiguous memory at source. Otherwise as
+ * sdhc_write_block. count must be at most SDHC_MAX_BLOCKS.
+ *
+ * \param sd        The driver struct
+ * \param index     The first block index to write
+ * \param count     The number of blocks to write
+ * \param source    Physical address of the data to read from
+ */
+errval_t sdhc_write_blocks(struct sdhc_s* sd, int index, size_t count, lpaddr_t source);
+
 #endif
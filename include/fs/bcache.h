@@ -0,0 +1,74 @@
+/**
+ * \file
+ * \brief Write-back buffer cache of block device sectors
+ *
+ * Single sectors are read and written through the cache, which keeps up to its memory
+ * budget of them and evicts the least recently used one when it is full. Written
+ * sectors are only marked dirty, they go to the device when they are evicted or when
+ * the cache is synced. Runs of sectors bypass the cache but see and update the sectors
+ * it holds, so the device and the cache never disagree for the user.
+ */
+
+#ifndef FS_BCACHE_H_
+#define FS_BCACHE_H_
+
+#include <aos/aos.h>
+#include <fs/blockdev.h>
+
+struct bcache_buf;
+
+struct bcache_stats {
+    size_t hits;
+    size_t misses;
+    size_t writebacks;       ///< Dirty sectors written to the device
+};
+
+struct bcache {
+    struct blockdev *dev;
+    struct thread_mutex mutex;         ///< Protects everything below
+
+    struct bcache_buf *bufs;           ///< All buffers, allocated at init
+    size_t buf_count;
+    struct bcache_buf **buckets;       ///< Hash table of the cached sectors
+    size_t bucket_mask;
+    struct bcache_buf *lru_head;       ///< Most recently used
+    struct bcache_buf *lru_tail;       ///< Least recently used, evicted first
+    struct bcache_buf *free;           ///< Buffers not holding a sector
+
+    struct bcache_stats stats;
+};
+
+/**
+ * \brief Set up a cache of at most budget bytes of sectors in front of dev
+ */
+errval_t bcache_init(struct bcache *c, struct blockdev *dev, size_t budget);
+
+/**
+ * \brief Read a sector, from the cache if it holds it
+ */
+errval_t bcache_read(struct bcache *c, size_t sector, void *buf);
+
+/**
+ * \brief Write a sector into the cache, it goes to the device later
+ */
+errval_t bcache_write(struct bcache *c, size_t sector, const void *buf);
+
+/**
+ * \brief Read count sectors from the device, with the newer data of cached ones
+ */
+errval_t bcache_read_run(struct bcache *c, size_t sector, size_t count, void *buf);
+
+/**
+ * \brief Write count sectors to the device, and update the cached ones
+ */
+errval_t bcache_write_run(struct bcache *c, size_t sector, size_t count,
+                          const void *buf);
+
+/**
+ * \brief Write all dirty sectors to the device
+ */
+errval_t bcache_sync(struct bcache *c);
+
+void bcache_get_stats(struct bcache *c, struct bcache_stats *stats);
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * \file
+ * \brief Block devices underneath the filesystems
+ *
+ * A request covers a run of sectors and is submitted asynchronously: the device starts
+ * up to queue_depth requests at a time and queues the rest, and calls the completion
+ * handler of a request once it is done. Backends that can only poll for completion do
+ * so in their poll operation, which blockdev_wait() calls until the request is done.
+ */
+
+#ifndef FS_BLOCKDEV_H_
+#define FS_BLOCKDEV_H_
+
+#include <aos/aos.h>
+
+#define BLOCKDEV_SECTOR_SIZE 512
+
+struct blockdev;
+struct blockdev_request;
+struct sdhc_s;
+
+enum blockdev_op {
+    BLOCKDEV_READ,
+    BLOCKDEV_WRITE,
+};
+
+typedef void (*blockdev_done_fn)(struct blockdev_request *req, void *arg);
+
+struct blockdev_request {
+    enum blockdev_op op;
+    size_t sector;                   ///< First sector
+    size_t count;                    ///< Number of sectors
+    void *buf;                       ///< count * BLOCKDEV_SECTOR_SIZE bytes
+    blockdev_done_fn done;           ///< Called on completion, may be NULL
+    void *arg;
+
+    errval_t err;                    ///< Result, valid once completed is set
+    volatile bool completed;
+    struct blockdev_request *next;   ///< Queue link, owned by the device
+};
+
+struct blockdev_ops {
+    /// Start a request, the backend calls blockdev_complete() on it once it is done
+    errval_t (*submit)(struct blockdev *dev, struct blockdev_request *req);
+    /// Make progress on started requests, may be NULL if they complete on their own
+    errval_t (*poll)(struct blockdev *dev);
+};
+
+/// A thread starting requests. Requests given the slot of one it completes meanwhile
+/// are started by its loop rather than recursively, see blockdev_complete().
+struct blockdev_starter {
+    struct thread *thread;
+    struct blockdev_request *head, *tail;
+    struct blockdev_starter *next;
+};
+
+struct blockdev {
+    const char *name;
+    const struct blockdev_ops *ops;
+    void *st;                        ///< State of the backend
+    size_t sector_count;
+    size_t queue_depth;              ///< Requests started at a time
+
+    struct thread_mutex mutex;       ///< Protects everything below
+    size_t in_flight;
+    struct blockdev_request *queue_head, *queue_tail;   ///< Waiting to be started
+    struct blockdev_starter *starters;
+};
+
+/**
+ * \brief Set up the generic part of a device, called by the backends
+ */
+void blockdev_init(struct blockdev *dev, const char *name, const struct blockdev_ops *ops,
+                   void *st, size_t sector_count, size_t queue_depth);
+
+/**
+ * \brief Submit a request. It is started right away if the device has a free slot and
+ *        queued otherwise. The request must stay valid until it is completed.
+ */
+errval_t blockdev_submit(struct blockdev *dev, struct blockdev_request *req);
+
+/**
+ * \brief Complete a started request, called by the backends
+ */
+void blockdev_complete(struct blockdev *dev, struct blockdev_request *req, errval_t err);
+
+/**
+ * \brief Wait for a submitted request to complete and return its result
+ */
+errval_t blockdev_wait(struct blockdev *dev, struct blockdev_request *req);
+
+/**
+ * \brief Read count sectors starting at sector into buf and wait for the result
+ */
+errval_t blockdev_read(struct blockdev *dev, size_t sector, size_t count, void *buf);
+
+/**
+ * \brief Write count sectors from buf starting at sector and wait for the result
+ */
+errval_t blockdev_write(struct blockdev *dev, size_t sector, size_t count,
+                        const void *buf);
+
+/**
+ * \brief Create a device on the SD card behind an initialized SDHC driver
+ */
+errval_t blockdev_sdhc_create(struct sdhc_s *sd, struct blockdev **retdev);
+
+/**
+ * \brief Create a RAM disk on a frame, e.g. a disk image loaded as multiboot module.
+ *        Writes go to the frame only.
+ */
+errval_t blockdev_ramdisk_create(struct capref frame, size_t bytes,
+                                 struct blockdev **retdev);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <fs/fs.h>
 
+#include <fs/blockdev.h>
+#include <fs/bcache.h>
 #include <drivers/sdhc.h>
 
 //BPB Info
@@ -18,6 +20,9 @@
 
 #define DATA_CLUSTER_START 2
 
+//memory for sectors in the buffer cache: FAT, directories and partial file sectors
+#define FAT32_CACHE_BYTES (256 * 1024)
+
 //special cluster symbols
 #define CLUSTER_FREE   0x0
 #define CLUSTER_FREE_MASK ~(0b1111 >> 4)
@@ -57,7 +62,8 @@ struct Date {
 };
 
 struct fat32_manager {
-    struct sdhc_s *sd;
+    struct blockdev *dev;
+    struct bcache cache;
 
     //meta data
     int BytsPerSec;
@@ -161,11 +167,13 @@ errval_t fat32_closedir(fat32_handle_t dhandle);
 
 errval_t fat32_mkdir(const char *path);
 
+errval_t fat32_sync(void);
+
 errval_t fat32_rmdir(const char *path);
 
 errval_t fat32_mount(const char *uri, fat32_mount_t *retst);
 
-void set_sd(struct sdhc_s *sd);
+void set_blockdev(struct blockdev *dev);
 
 errval_t fat32_init(char *mnt);
 
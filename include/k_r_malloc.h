@@ -2,6 +2,7 @@
 #define _LIBC_K_R_MALLOC_H_
 
 #include <sys/cdefs.h>
+#include <stddef.h>
 
 __BEGIN_DECLS
 
@@ -23,6 +24,8 @@ typedef union header Header;
 Header  *morecore(unsigned nu);
 void lesscore(void);
 void __free_locked(void *ap);
+void *__kr_malloc(size_t nbytes);
+void __kr_free(void *ap);
 void __malloc_init(void*, void*);
 
 __END_DECLS
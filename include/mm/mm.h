@@ -45,7 +45,9 @@ struct mm_node {
     struct mm_node *parent; // The node this one resulted from through splitting (or NULL if the block was added during mm_add)
     struct mm_node *left, *right; // In pending tree: left/right child. In free-list: left/right sibling
     capaddr_t key; // Only used in pending tree: contains the key (i.e. reversed capability address of sub cap) associated with this node
-    bool is_pending; // True iff element is in pending tree
+    struct mm_node *carve_next; // Only used for pending blocks: the next block covered by the same capability (exact allocations span several blocks)
+    gensize_t requested_size; // Only used in pending tree: the size the capability was requested with
+    bool is_pending; // True iff element is in pending tree (or covered by the capability of a node in the pending tree)
     bool is_leaf; // True iff element is a leaf (i.e. has not yet been split)
 };
 
@@ -63,6 +65,13 @@ struct mm_node {
 #define MM_NODE_TABLE_SIZE MM_NODE_TABLE_ROW_OFFSET(BASE_PAGE_BITS - 1)
 
 
+/**
+ * @brief Hand out exactly the page-rounded size instead of the whole power-of-2 block, the rest of the block stays free
+ * 
+ */
+#define MM_EXACT_ALLOC 1
+
+
 /**
  * @brief Reversed 0x00000001, hence half the keys should be smaller and half the keys should be larger than this
  * 
@@ -70,6 +79,22 @@ struct mm_node {
 #define MM_PENDING_TREE_PIVOT (0x80000000)
 
 
+/**
+ * @brief Allocation statistics of a mm instance, see mm_get_stats
+ * 
+ */
+struct mm_stats {
+    gensize_t total_bytes; // Added through mm_add
+    gensize_t free_bytes; // Not covered by any pending capability
+    gensize_t allocated_bytes; // Covered by pending capabilities
+    gensize_t requested_bytes; // Requested for the pending capabilities
+    gensize_t waste_bytes; // Allocated but not requested (i.e. lost to rounding)
+    gensize_t carved_bytes; // Returned to the free lists by exact allocations so far (i.e. what rounding to powers of 2 would have wasted)
+    size_t pending_count; // Number of pending capabilities
+    size_t alloc_count; // Successful allocations so far
+    size_t carve_count; // Allocations so far which were carved out of a larger block
+};
+
 /**
  * \brief Memory manager instance data
  *
@@ -85,6 +110,7 @@ struct mm {
     // TODO: add your meta data tracking here...
     struct mm_node *pending_root; // The root of the pending tree
     struct mm_node *node_table[MM_NODE_TABLE_SIZE]; // The triangle-array storing the linked list of the free nodes
+    struct mm_stats stats; // Derived fields are filled in by mm_get_stats
 };
 
 errval_t mm_init(struct mm *mm, enum objtype objtype,
@@ -97,6 +123,8 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment,
                               struct capref *retcap);
 errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap);
 errval_t mm_free(struct mm *mm, struct capref cap);
+errval_t mm_retire(struct mm *mm, struct capref cap);
+void mm_get_stats(struct mm *mm, struct mm_stats *ret);
 void mm_destroy(struct mm *mm);
 
 __END_DECLS
@@ -8,31 +8,174 @@
 #include <errors/errno.h>
 #include <strings.h>
 #include <machine/param.h>
+#include <aos/systime.h>
 
 #define RING_BUFFER_SIZE PAGE_SIZE
 
+/// The head and the tail of the ring live in their own cacheline each
+#define RING_CONTROL_SIZE (2 * CACHE_LINE_SIZE)
+
+/// Bytes available for records
+#define RING_DATA_SIZE (RING_BUFFER_SIZE - RING_CONTROL_SIZE)
+
+/// Every record starts with a header of this size and is aligned to it
+#define RING_RECORD_HEADER_SIZE 16
+
+/// A single record never takes more than half of the ring, so that it always fits after
+/// wrapping around once the ring is drained
+#define RING_MAX_RECORD_SIZE (RING_DATA_SIZE / 2 - RING_RECORD_HEADER_SIZE)
+
+/// Largest payload that is stored contiguously in the ring. Larger messages are split
+/// into fragments and reassembled on the consumer side.
+#define RING_MAX_INPLACE_SIZE (RING_MAX_RECORD_SIZE - RING_RECORD_HEADER_SIZE)
+
+/// In RING_MODE_INDEX, the consumer publishes its tail at least every this many bytes
+#define RING_TAIL_PUBLISH_BATCH (RING_DATA_SIZE / 4)
+
+/**
+ * How the producer makes records visible to the consumer. Both ends of a ring MUST use
+ * the same mode.
+ */
+enum ring_mode {
+	/// Every record carries a ready flag that the consumer polls. The consumer publishes
+	/// its tail after every record.
+	RING_MODE_READY_FLAG,
+	/// The producer publishes its head index once per message or batch and the consumer
+	/// publishes its tail once it has drained what it has seen. Both sides cache the index
+	/// of the other side and only reload it when the cached value runs out.
+	RING_MODE_INDEX,
+};
+
+/**
+ * How one side of a ring waits for the other one (for a message, or for free space).
+ * It first yields in a loop for spin_ns, which gives the lowest latency, then sleeps
+ * between checks, starting at sleep_min_us and doubling up to sleep_max_us, which gives
+ * the CPU away at the cost of up to sleep_max_us of added latency.
+ */
+struct ring_wait_policy {
+	uint64_t spin_ns;       ///< Yield for this long before sleeping, RING_WAIT_SPIN_FOREVER to never sleep
+	uint32_t sleep_min_us;  ///< First sleep interval
+	uint32_t sleep_max_us;  ///< Longest sleep interval
+};
+
+#define RING_WAIT_SPIN_FOREVER UINT64_MAX
+
+/// Never sleep, lowest latency (the default of a ring)
+#define RING_WAIT_POLICY_POLL ((struct ring_wait_policy){ RING_WAIT_SPIN_FOREVER, 0, 0 })
+
+/// State of one wait, see ring_wait()
+struct ring_waiter {
+	systime_t start;    ///< When the wait started
+	uint32_t sleep_us;  ///< Next sleep interval, 0 while spinning
+};
+
+static inline void ring_waiter_init(struct ring_waiter *w)
+{
+	w->start = systime_now();
+	w->sleep_us = 0;
+}
+
+/**
+ * @brief Wait a little for the other side, according to the policy. Call in a loop
+ * between checks, with a waiter initialized before the first check.
+ */
+void ring_wait(const struct ring_wait_policy *policy, struct ring_waiter *w);
+
 /**
- * @brief Initializes a ringbuffer of size 63, which each element being equal to a single cacheline.
- * 
+ * @brief Initializes a ringbuffer of RING_BUFFER_SIZE bytes. Messages are stored as
+ * variable-length records in the data area.
+ *
  * @param buffer Pointer to at least one page of memory. This address MUST be pagealigned.
- * @return LIB_ERR_MALLOC_FAIL if the memory allocation failed, SYS_ERR_OK otherwise. 
+ * @return LIB_ERR_MALLOC_FAIL if the memory allocation failed, SYS_ERR_OK otherwise.
  */
 errval_t ring_init(void *buffer);
 
 struct ring_producer {
 	void *ringbuffer;
+	enum ring_mode mode;
+	size_t head;          ///< Local write position, ahead of the published one in a batch
+	size_t cached_tail;   ///< Last tail read from the consumer
+	bool batching;        ///< Defer publishing the head until ring_producer_batch_end
+	size_t pending_pad;   ///< Padding needed before the reserved record (wrap around)
+	size_t pending_size;  ///< Payload size of the reserved record
+	struct ring_wait_policy wait;  ///< How to wait for free space, RING_WAIT_POLICY_POLL by default
 };
 
-errval_t ring_producer_init(struct ring_producer *rp, void *ring_buffer);
+errval_t ring_producer_init(struct ring_producer *rp, void *ring_buffer, enum ring_mode mode);
 errval_t ring_producer_send(struct ring_producer *rp, const void *payload, size_t size);
 
+/**
+ * @brief Send the fragments of a message from *offset on, for as long as they fit
+ * without waiting for the consumer. *offset is advanced past what was sent, the message
+ * is complete when it reaches size. Call again with the same message until it does,
+ * nothing else may be sent in between.
+ */
+errval_t ring_producer_send_some(struct ring_producer *rp, const void *payload, size_t size,
+                                 size_t *offset);
+
+/**
+ * @brief Start a batch: messages sent from now on become visible to the consumer only
+ * at ring_producer_batch_end, with a single barrier (RING_MODE_INDEX only, no-op otherwise).
+ * The batch is flushed early if the producer has to wait for space.
+ */
+void ring_producer_batch_begin(struct ring_producer *rp);
+errval_t ring_producer_batch_end(struct ring_producer *rp);
+
+/**
+ * @brief Reserve a contiguous range of the ring for a message of the given size.
+ * Blocks until the consumer frees enough space. Only one reservation can be pending.
+ *
+ * @param size Size of the message, at most RING_MAX_INPLACE_SIZE.
+ * @param buf  Filled with a pointer into the ring where the message should be written.
+ */
+errval_t ring_producer_reserve(struct ring_producer *rp, size_t size, void **buf);
+
+/**
+ * @brief Check if ring_producer_reserve would return without waiting for the consumer.
+ */
+bool ring_producer_can_reserve(struct ring_producer *rp, size_t size);
+
+/**
+ * @brief Make the message written into the pending reservation visible to the consumer.
+ */
+errval_t ring_producer_publish(struct ring_producer *rp);
+
 struct ring_consumer {
 	void *ringbuffer;
+	enum ring_mode mode;
+	size_t tail;         ///< Local read position, ahead of the published one in a batch
+	size_t cached_head;  ///< Last head read from the producer
+	struct ring_wait_policy wait;  ///< How to wait in the blocking calls, RING_WAIT_POLICY_POLL by default
+};
+
+/**
+ * @brief View of a received message. Unless the message was fragmented, the payload
+ * points directly into the shared ring and stays valid until ring_consumer_commit.
+ */
+struct ring_msg_view {
+	void *payload;      ///< Message payload, writable until commit
+	size_t size;        ///< Size of the payload
+	size_t ring_bytes;  ///< Ring space to release on commit
+	bool owned;         ///< The payload is a reassembled heap buffer, freed on commit
 };
 
-errval_t ring_consumer_init(struct ring_consumer *rc, void *ring_buffer);
+errval_t ring_consumer_init(struct ring_consumer *rc, void *ring_buffer, enum ring_mode mode);
 errval_t ring_consumer_recv(struct ring_consumer *rc, void **payload, size_t *size);
 bool ring_consumer_can_recv(struct ring_consumer *rc);
 errval_t ring_consumer_recv_non_blocking(struct ring_consumer *rc, void **payload, size_t *size);
 
+/**
+ * @brief Get a view of the next message without copying it out of the ring.
+ * At most one view can be outstanding per consumer.
+ *
+ * @return LIB_ERR_RING_NO_MSG if no message is available.
+ */
+errval_t ring_consumer_peek(struct ring_consumer *rc, struct ring_msg_view *view);
+errval_t ring_consumer_peek_blocking(struct ring_consumer *rc, struct ring_msg_view *view);
+
+/**
+ * @brief Release a message obtained by ring_consumer_peek. The view is invalid after.
+ */
+errval_t ring_consumer_commit(struct ring_consumer *rc, struct ring_msg_view *view);
+
 #endif  // AOS_RINGBUFFER_H
@@ -8,13 +8,27 @@
 #include <aos/capabilities.h>
 #include <aos/aos_rpc.h>
 #include <sys/tree.h>
+#include <sys/queue.h>
+
+/// Caps a process has not claimed yet beyond this make the senders retry
+#define PROC_CAP_MAILBOX_MAX 64
+
+/// A cap transferred to a process, waiting for it to claim it with the ticket
+struct proc_cap_mail {
+    struct aos_rpc_cap_ticket ticket;
+    struct capref cap;
+    TAILQ_ENTRY(proc_cap_mail) link;
+};
 
 struct proc_node {
     domainid_t pid;
     struct capref dispatcher;
     char name[DISP_NAME_LEN];
     struct aos_chan chan;
-    int accepting_cap;
+    TAILQ_HEAD(, proc_cap_mail) cap_mailbox;  ///< Transferred caps not claimed yet
+    size_t cap_mailbox_count;
+    struct capref cap_claimed;  ///< Init's copy of the last cap claimed, deleted on the next
+    size_t ram_bytes;           ///< RAM handed out through RPC_RAM_REQUEST and not freed
     RB_ENTRY(proc_node) rb_entry;
     LIST_ENTRY(proc_node) link;
 };
@@ -87,4 +101,21 @@ errval_t proc_mgmt_get_all_pids(struct proc_mgmt *ps, domainid_t **pids,
 
 struct proc_node *proc_mgmt_get_node(struct proc_mgmt *ps, domainid_t pid);
 
+/**
+ * Queue a cap transferred to a process until it claims it.
+ * @param node  The receiving process.
+ * @return PROC_MGMT_ERR_CAP_MAILBOX_FULL if the process has PROC_CAP_MAILBOX_MAX caps
+ *         waiting already. Not retried, the process may never claim them.
+ */
+errval_t proc_mgmt_cap_mailbox_put(struct proc_node *node, const struct aos_rpc_cap_ticket *ticket,
+                                   struct capref cap);
+
+/**
+ * Claim a cap queued with proc_mgmt_cap_mailbox_put(). The cap stays owned by the mailbox
+ * until the next claim, so that it can be sent as the reply.
+ * @return MON_ERR_RETRY if the cap has not arrived yet.
+ */
+errval_t proc_mgmt_cap_mailbox_take(struct proc_node *node, const struct aos_rpc_cap_ticket *ticket,
+                                    struct capref *cap);
+
 #endif  // AOS_PROC_MGMT_H
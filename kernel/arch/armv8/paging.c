@@ -327,6 +327,74 @@ paging_set_flags(union armv8_ttable_entry *entry, uintptr_t kpi_paging_flags)
     entry->page.af = 1;
 }
 
+/**
+ * Map a frame with block descriptors in an L1 (1 GiB) or L2 (2 MiB) table.
+ */
+static errval_t
+caps_map_blocks(struct capability* dest,
+                cslot_t            slot,
+                struct capability* src,
+                uintptr_t          kpi_paging_flags,
+                uintptr_t          offset,
+                uintptr_t          pte_count,
+                size_t             block_size,
+                struct cte*        mapping_cte)
+{
+    assert(0 == (kpi_paging_flags & ~KPI_PAGING_FLAGS_MASK));
+
+    if (slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES) {
+        if (slot >= VMSAv8_64_PTABLE_NUM_ENTRIES) {
+            return SYS_ERR_VNODE_SLOT_INVALID;
+        }
+        else {
+            return SYS_ERR_VM_MAP_SIZE;
+        }
+    }
+
+    // Unlike pages, a block must not reach beyond the frame
+    if ((offset % block_size) != 0 || offset + pte_count * block_size > get_size(src)) {
+        return SYS_ERR_FRAME_OFFSET_INVALID;
+    }
+
+    lpaddr_t src_lpaddr = gen_phys_to_local_phys(get_address(src) + offset);
+    if (!aligned(src_lpaddr, block_size)) {
+        return SYS_ERR_VM_FRAME_UNALIGNED;
+    }
+
+    // Destination
+    lpaddr_t dest_lpaddr = gen_phys_to_local_phys(get_address(dest));
+    lvaddr_t dest_lvaddr = local_phys_to_mem(dest_lpaddr);
+
+    union armv8_ttable_entry *entry = (union armv8_ttable_entry *)dest_lvaddr + slot;
+    for (int i = 0; i < pte_count; i++) {
+        if (entry[i].d.valid) {
+            debug(SUBSYS_PAGING, "ARMv8 block @ 0x%lx: slot %d in use\n", dest_lpaddr, slot + i);
+            return SYS_ERR_VNODE_SLOT_INUSE;
+        }
+    }
+
+    create_mapping_cap(mapping_cte, src, cte_for_cap(dest), slot, pte_count);
+
+    for (int i = 0; i < pte_count; i++) {
+        entry->raw = 0;
+
+        // Same layout as a page, except that bit 1 is clear and the low address bits are 0
+        entry->page.valid = 1;
+        entry->page.mb1 = 0;
+        paging_set_flags(entry, kpi_paging_flags);
+        entry->page.base = (src_lpaddr + i * block_size) >> 12;
+
+        debug(SUBSYS_PAGING, "block mapping %08"PRIxLVADDR"[%"PRIuCSLOT"] @%p = %08"PRIx64"\n",
+               dest_lvaddr, slot + i, entry, entry->raw);
+
+        entry++;
+    }
+
+    sysreg_invalidate_tlb();
+
+    return SYS_ERR_OK;
+}
+
 static errval_t
 caps_map_l0(struct capability* dest,
             cslot_t            slot,
@@ -404,6 +472,11 @@ caps_map_l1(struct capability* dest,
         return SYS_ERR_VNODE_SLOT_INVALID;
     }
 
+    if (src->type == ObjType_Frame || src->type == ObjType_DevFrame) {
+        return caps_map_blocks(dest, slot, src, kpi_paging_flags, offset, pte_count,
+                               VMSAv8_64_L1_BLOCK_SIZE, mapping_cte);
+    }
+
     if (pte_count != 1) {
         debug(SUBSYS_PAGING, "pte_count = %zu\n",(size_t)pte_count);
         return SYS_ERR_VM_MAP_SIZE;
@@ -502,6 +575,10 @@ static errval_t caps_map_l2(struct capability *dest, cslot_t slot, struct capabi
               entry, entry->raw);
 
         break;
+    case ObjType_Frame:
+    case ObjType_DevFrame:
+        return caps_map_blocks(dest, slot, src, kpi_paging_flags, offset, pte_count,
+                               VMSAv8_64_L2_BLOCK_SIZE, mapping_cte);
     default:
         return SYS_ERR_WRONG_MAPPING;
     }
@@ -747,6 +824,8 @@ bool paging_is_region_valid(lvaddr_t buffer, size_t size, uint8_t type)
         for (uint16_t l1idx = first_l1idx; l1idx <= last_l1idx; l1idx++) {
             pte = (union armv8_ttable_entry *)pdpt + l1idx;
             if (!pte->d.valid) { return false; }
+            // 1 GiB block, nothing below to check
+            if (!pte->d.mb1) { continue; }
             // calculate which part of pdpt to check
             first_l2idx = l1idx == first_l1idx ? VMSAv8_64_L2_INDEX(buffer) : 0;
             last_l2idx  = l1idx == last_l1idx  ? VMSAv8_64_L2_INDEX(end)  : PTABLE_ENTRIES;
@@ -755,6 +834,8 @@ bool paging_is_region_valid(lvaddr_t buffer, size_t size, uint8_t type)
             for (uint16_t l2idx = first_l2idx; l2idx <= last_l2idx; l2idx++) {
                 pte = (union armv8_ttable_entry *)pdir + l2idx;
                 if (!pte->d.valid) { return false; }
+                // 2 MiB block
+                if (!pte->d.mb1) { continue; }
                 // calculate which part of pdpt to check
                 first_l3idx = l2idx == first_l2idx ? VMSAv8_64_L3_INDEX(buffer) : 0;
                 last_l3idx  = l2idx == last_l2idx  ? VMSAv8_64_L3_INDEX(end)  : PTABLE_ENTRIES;
@@ -822,8 +903,8 @@ void paging_dump_tables(struct dcb *dispatcher, lvaddr_t addr)
         }
 
          if (l2_e->block_l2.mb0 == 0) {
-            genpaddr_t l3_gp = (genpaddr_t)(l1_e->block_l2.base) << LARGE_PAGE_BITS;
-            printf("    l2[% 3d] -> LARGE_PAGE @ 0x%lx\n", l1_index, l3_gp);
+            genpaddr_t l3_gp = (genpaddr_t)(l2_e->block_l2.base) << LARGE_PAGE_BITS;
+            printf("    l2[% 3d] -> LARGE_PAGE @ 0x%lx\n", l2_index, l3_gp);
             return;
          }
 
@@ -51,6 +51,63 @@ errval_t aos_rpc_stress_test(struct aos_rpc *rpc, uint8_t *val, size_t len)
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_bench_echo(struct aos_rpc *rpc, struct rpc_bench_echo_msg *msg,
+                            size_t size, void **ret_buf, size_t *ret_size)
+{
+    if (size < sizeof(*msg)) {
+        return ERR_INVALID_ARGS;
+    }
+    return aos_rpc_call(rpc, RPC_BENCH_ECHO, NULL_CAP, msg, size, NULL, ret_buf, ret_size);
+}
+
+errval_t aos_rpc_get_chan_stats(struct aos_rpc *rpc, coreid_t core,
+                                struct rpc_chan_stats_entry **entries, size_t *count)
+{
+    struct rpc_chan_stats_reply *reply = NULL;
+    size_t reply_size = 0;
+    errval_t err = aos_rpc_call(rpc, RPC_CHAN_STATS, NULL_CAP, &core, sizeof(core), NULL,
+                                (void **)&reply, &reply_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (reply_size < sizeof(*reply)
+        || reply_size != sizeof(*reply) + reply->count * sizeof(reply->entries[0])) {
+        free(reply);
+        return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+
+    *count = reply->count;
+    *entries = malloc(reply->count * sizeof(reply->entries[0]));
+    if (*entries == NULL && reply->count != 0) {
+        free(reply);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    memcpy(*entries, reply->entries, reply->count * sizeof(reply->entries[0]));
+    free(reply);
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_get_mem_stats(struct aos_rpc *rpc, coreid_t core, struct mm_stats *stats)
+{
+    struct mm_stats *reply = NULL;
+    size_t reply_size = 0;
+    errval_t err = aos_rpc_call(rpc, RPC_MEM_STATS, NULL_CAP, &core, sizeof(core), NULL,
+                                (void **)&reply, &reply_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (reply_size != sizeof(*reply)) {
+        free(reply);
+        return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+
+    *stats = *reply;
+    free(reply);
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc, size_t bytes, size_t alignment,
                              struct capref *ret_cap, size_t *ret_bytes)
 {
@@ -79,6 +136,11 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc, size_t bytes, size_t alignment
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_free_ram_cap(struct aos_rpc *rpc, struct capref cap)
+{
+    return aos_rpc_call(rpc, RPC_RAM_FREE, cap, NULL, 0, NULL, NULL, NULL);
+}
+
 
 errval_t aos_rpc_serial_getchar(struct aos_rpc *rpc, char *retc)
 {
@@ -122,10 +184,11 @@ errval_t aos_rpc_serial_puts(struct aos_rpc *rpc, const char *buf, size_t len, s
 	memcpy(tmp_buf, buf, len);
 	tmp_buf[len] = 0;
 
-    for (size_t offset = 0; offset < len + 1; offset += 30) {
+    // Chunks that fit in a single LMP message
+    for (size_t offset = 0; offset < len + 1; offset += RPC_LMP_INLINE_PAYLOAD_SIZE) {
         size_t *rbuf = NULL;
         size_t rlen = 0;
-        err = aos_rpc_call(rpc, RPC_TERMINAL_PUTS, NULL_CAP, tmp_buf + offset, min(30, len + 1 - offset),
+        err = aos_rpc_call(rpc, RPC_TERMINAL_PUTS, NULL_CAP, tmp_buf + offset, min(RPC_LMP_INLINE_PAYLOAD_SIZE, len + 1 - offset),
                                     NULL, (void **)&rbuf, &rlen);
         assert(rlen >= sizeof(size_t));
         *retlen += *rbuf;
@@ -233,6 +296,26 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *rpc, domainid_t pid, char **na
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_process_get_mem(struct aos_rpc *rpc, domainid_t pid, size_t *ram_bytes)
+{
+    size_t *reply = NULL;
+    size_t reply_size = 0;
+    errval_t err = aos_rpc_call(rpc, RPC_PROCESS_GET_MEM, NULL_CAP, &pid, sizeof(pid),
+                                NULL, (void **)&reply, &reply_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (reply_size != sizeof(*reply)) {
+        free(reply);
+        return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+
+    *ram_bytes = *reply;
+    free(reply);
+    return SYS_ERR_OK;
+}
+
 
 errval_t aos_rpc_process_get_all_pids(struct aos_rpc *rpc, domainid_t **pids,
                                       size_t *pid_count)
@@ -456,6 +539,49 @@ errval_t aos_rpc_fstat(struct aos_rpc *rpc, handle_t handle, struct fs_fileinfo
     return err;
 }
 
+errval_t aos_rpc_fread_async(struct aos_rpc *rpc, handle_t handle, size_t bytes,
+                             struct aos_chan_future *future)
+{
+    uint8_t send_msg[sizeof(lvaddr_t) + sizeof(size_t)];
+    memcpy(send_msg, &handle, sizeof(lvaddr_t));
+    memcpy(send_msg + sizeof(lvaddr_t), &bytes, sizeof(size_t));
+
+    return aos_rpc_call_async(rpc, RPC_FREAD, NULL_CAP, send_msg, sizeof(send_msg), future);
+}
+
+errval_t aos_rpc_fread_wait(struct aos_rpc *rpc, struct aos_chan_future *future,
+                            void *buffer, size_t *ret_bytes)
+{
+    errval_t err = aos_rpc_wait(rpc, future);
+    if(err_is_ok(err)) {
+        *ret_bytes = *(size_t *)(future->ret_buf);
+        memcpy(buffer, future->ret_buf + sizeof(size_t), *ret_bytes);
+    }
+    free(future->ret_buf);
+    future->ret_buf = NULL;
+
+    return err;
+}
+
+errval_t aos_rpc_fstat_async(struct aos_rpc *rpc, handle_t handle,
+                             struct aos_chan_future *future)
+{
+    return aos_rpc_call_async(rpc, RPC_FSTAT, NULL_CAP, (void *)&handle, sizeof(lvaddr_t),
+                              future);
+}
+
+errval_t aos_rpc_fstat_wait(struct aos_rpc *rpc, struct aos_chan_future *future,
+                            struct fs_fileinfo *info)
+{
+    errval_t err = aos_rpc_wait(rpc, future);
+    if(err_is_ok(err)) {
+        *info = *(struct fs_fileinfo *)(future->ret_buf);
+    }
+    free(future->ret_buf);
+    future->ret_buf = NULL;
+
+    return err;
+}
 
 /**
  * \brief Returns the RPC channel to init.
@@ -694,8 +694,11 @@ errval_t frame_create(struct capref dest, size_t bytes, size_t *retbytes)
 
     bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
 
+    // Large frames get an alignment that lets paging map them with blocks
+    size_t alignment = (bytes >= LARGE_PAGE_SIZE) ? LARGE_PAGE_SIZE : BASE_PAGE_SIZE;
+
     struct capref ram;
-    err = ram_alloc(&ram, bytes);
+    err = ram_alloc_aligned(&ram, bytes, alignment);
     if (err_is_fail(err)) {
         if (err_no(err) == MM_ERR_NO_MEMORY ||
             err_no(err) == LIB_ERR_RAM_ALLOC_WRONG_SIZE) {
@@ -55,20 +55,21 @@ void deferred_event_init(struct deferred_event *event)
 }
 
 /**
- * \brief Register a deferred event
+ * \brief Register a deferred event, while disabled
  *
+ * \param event Storage for event metadata
  * \param ws Waitset
  * \param delay Delay in microseconds
  * \param closure Event closure to execute
- * \param event Storage for event metadata
+ * \param dh Current dispatcher handle
  */
-errval_t deferred_event_register(struct deferred_event *event,
-                                 struct waitset *ws, delayus_t delay,
-                                 struct event_closure closure)
+errval_t deferred_event_register_disabled(struct deferred_event *event,
+                                          struct waitset *ws, delayus_t delay,
+                                          struct event_closure closure,
+                                          dispatcher_handle_t dh)
 {
     errval_t err;
 
-    dispatcher_handle_t dh = disp_disable();
     err = waitset_chan_register_disabled(ws, &event->waitset_state, closure);
     if (err_is_ok(err)) {
         struct dispatcher_generic *dg = get_dispatcher_generic(dh);
@@ -80,7 +81,7 @@ errval_t deferred_event_register(struct deferred_event *event,
              p = e, e = e->next) {
             if (e == NULL || e->time > event->time) {
                 if (p == NULL) { // insert at head
-                    assert(e == dg->deferred_events);
+                    assert_disabled(e == dg->deferred_events);
                     event->prev = NULL;
                     event->next = e;
                     if (e != NULL) {
@@ -102,6 +103,23 @@ errval_t deferred_event_register(struct deferred_event *event,
 
     update_wakeup_disabled(dh);
 
+    return err;
+}
+
+/**
+ * \brief Register a deferred event
+ *
+ * \param ws Waitset
+ * \param delay Delay in microseconds
+ * \param closure Event closure to execute
+ * \param event Storage for event metadata
+ */
+errval_t deferred_event_register(struct deferred_event *event,
+                                 struct waitset *ws, delayus_t delay,
+                                 struct event_closure closure)
+{
+    dispatcher_handle_t dh = disp_disable();
+    errval_t err = deferred_event_register_disabled(event, ws, delay, closure, dh);
     disp_enable(dh);
 
     return err;
@@ -139,12 +157,12 @@ errval_t barrelfish_usleep(delayus_t delay)
 }
 
 /**
- * \brief Cancel a deferred event that has not yet fired
+ * \brief Cancel a deferred event that has not yet fired, while disabled
  */
-errval_t deferred_event_cancel(struct deferred_event *event)
+errval_t deferred_event_cancel_disabled(struct deferred_event *event,
+                                        dispatcher_handle_t handle)
 {
     enum ws_chanstate chanstate = event->waitset_state.state;
-    dispatcher_handle_t handle = disp_disable();
     errval_t err = waitset_chan_deregister_disabled(&event->waitset_state, handle);
     if (err_is_ok(err) && chanstate != CHAN_PENDING) {
         // remove from dispatcher queue
@@ -159,7 +177,16 @@ errval_t deferred_event_cancel(struct deferred_event *event)
         }
         update_wakeup_disabled(handle);
     }
+    return err;
+}
 
+/**
+ * \brief Cancel a deferred event that has not yet fired
+ */
+errval_t deferred_event_cancel(struct deferred_event *event)
+{
+    dispatcher_handle_t handle = disp_disable();
+    errval_t err = deferred_event_cancel_disabled(event, handle);
     disp_enable(handle);
     return err;
 }
@@ -6,11 +6,16 @@
 #define AOS_RPC_PRIV_H
 
 #include <aos/rpc.h>
+#include <aos/systime.h>
+
+struct aos_rpc_cap_ticket;
 
 enum {
-    RPC_ACK_CAP_CHANNEL = RPC_ERR + 1,  // on UMP: capability transfer channel is setup
-    RPC_PUT_CAP,          // on LMP: this message is putting a cap in the init channel
-    RPC_MSG_IN_FRAME,     // on LMP: the actual message in encode in the frame cap
+    RPC_MSG_IN_FRAME = RPC_ERR + 1,  // on LMP: the actual message in encode in the frame cap
+    RPC_BULK_MSG,         // on UMP: the actual message is in the bulk region, see descriptor
+    RPC_LMP_POOL_SETUP,   // on LMP: the cap is the frame pool of the other end
+    RPC_MSG_IN_POOL,      // on LMP: the actual message is in a slot of the frame pool
+    RPC_MSG_FRAGMENT,     // on LMP: part of a train, see rpc_lmp_serialize
     INTERNAL_RPC_IDENTIFIER_COUNT,
 
     RPC_SPECIAL_CAP_TRANSFER_FLAG = (1U << (sizeof(uint8_t) * 8 - 1))
@@ -21,6 +26,78 @@ STATIC_ASSERT(RPC_SPECIAL_CAP_TRANSFER_FLAG > RPC_IDENTIFIER_USER_END,
               "RPC_IDENTIFIER_USER_END too large");
 STATIC_ASSERT(RPC_SPECIAL_CAP_TRANSFER_FLAG == 0x80, "RPC_SPECIAL_CAP_TRANSFER_FLAG");
 
+/// Every UMP message starts with the request ID, immediately followed by the identifier
+#define RPC_UMP_HEADER_SIZE (sizeof(rpc_request_id_t) + sizeof(rpc_identifier_t))
+
+static inline void aos_chan_stats_sent(struct aos_chan *chan, size_t size,
+                                       struct capref cap)
+{
+#if AOS_CHAN_STATS
+    chan->stats.msgs_sent++;
+    chan->stats.bytes_sent += size;
+    if (!capref_is_null(cap)) {
+        chan->stats.caps_sent++;
+    }
+#endif
+}
+
+static inline void aos_chan_stats_recv(struct aos_chan *chan, size_t size,
+                                       struct capref cap)
+{
+#if AOS_CHAN_STATS
+    chan->stats.msgs_recv++;
+    chan->stats.bytes_recv += size;
+    if (!capref_is_null(cap)) {
+        chan->stats.caps_recv++;
+    }
+#endif
+}
+
+/**
+ * Account a call given to the receive handler.
+ * @param start  systime_now() before calling the handler.
+ */
+static inline void aos_chan_stats_handled(struct aos_chan *chan, systime_t start)
+{
+#if AOS_CHAN_STATS
+    uint64_t ns = systime_to_ns(systime_now() - start);
+    chan->stats.handled++;
+    chan->stats.handler_ns += ns;
+
+    size_t bucket = 0;
+    for (uint64_t us = ns / 1000; us > 0 && bucket < AOS_CHAN_STATS_HIST_BUCKETS - 1;
+         us >>= 1) {
+        bucket++;
+    }
+    chan->stats.handler_hist[bucket]++;
+#endif
+}
+
+/**
+ * Add a future to the pending list and give it a request ID that is not in flight.
+ * Called with chan->mutex held.
+ */
+void aos_chan_add_pending(struct aos_chan *chan, struct aos_chan_future *future);
+
+/**
+ * Remove the future of a request ID from the pending list. Called with chan->mutex held.
+ * @return NULL if no call with this ID is in flight.
+ */
+struct aos_chan_future *aos_chan_take_pending(struct aos_chan *chan, rpc_request_id_t id);
+
+/**
+ * Mark a future as done and call its closure. Called without holding chan->mutex.
+ */
+void aos_chan_complete(struct aos_chan_future *future);
+
+/**
+ * Receive one reply if one has arrived and complete its future.
+ * @param locked    chan->mutex is held by the caller. Otherwise, nothing is received if
+ *                  another thread is holding it.
+ * @param received  Set if a message was taken from the channel.
+ */
+errval_t aos_chan_poll_one(struct aos_chan *chan, bool locked, bool *received);
+
 errval_t lmp_try_send(struct lmp_chan *lc, uintptr_t *send_words, struct capref send_cap,
                       bool non_blocking);
 
@@ -30,63 +107,157 @@ errval_t lmp_try_recv(struct lmp_chan *lc, struct lmp_recv_msg *recv_msg,
 struct lmp_helper {
     struct capref payload_frame;
     void *mapped_frame;
+    volatile uint32_t *pool_slot;  ///< Busy flag of the pool slot to release on cleanup
+    void *reassembled;             ///< Reassembled train to free on cleanup
+    const uint8_t *train_buf;      ///< Payload of the train being sent, NULL if none
+    size_t train_size;
+    size_t train_sent;             ///< Payload bytes serialized so far
+    rpc_identifier_t train_identifier;
 };
 
-errval_t rpc_lmp_serialize(rpc_identifier_t identifier, struct capref cap, const void *buf,
-                       size_t size, uintptr_t ret_payload[LMP_MSG_LENGTH],
-                       struct capref *ret_cap, struct lmp_helper *helper);
+/**
+ * Serialize an LMP message. Medium payloads go as a train of messages, see
+ * rpc_lmp_serialize_next. Large payloads go into the frame pool of the channel, or into
+ * a fresh frame if the pool is full.
+ * @param ret_payload  The first (or only) message to send.
+ */
+errval_t rpc_lmp_serialize(struct aos_chan *chan, rpc_request_id_t request_id,
+                           rpc_identifier_t identifier, struct capref cap, const void *buf,
+                           size_t size,
+                           uintptr_t ret_payload[LMP_MSG_LENGTH], struct capref *ret_cap,
+                           struct lmp_helper *helper);
+
+/**
+ * Serialize the next message of a train. The fragments of a train must be sent in order
+ * while holding chan->lmp_train.send_mutex.
+ * @return false if there are no more messages to send.
+ */
+bool rpc_lmp_serialize_next(struct lmp_helper *helper, rpc_request_id_t request_id,
+                            uintptr_t ret_payload[LMP_MSG_LENGTH]);
 
 /**
  * Deserialize an LMP message
+ * @param chan
  * @param recv_msg
  * @param recv_cap_ptr   May get changed by the function (if the cap is a mapped frame).
+ * @param ret_request_id
  * @param ret_type
  * @param ret_buf        Points to somewhere in recv_msg or a mapped frame. Do NOT free.
  * @param ret_size
  * @param helper
- * @return
+ * @return RPC_LMP_POOL_SETUP and RPC_MSG_FRAGMENT (a train that is not complete yet) in
+ *         ret_type are internal to the channel and should be skipped, see
+ *         rpc_lmp_is_internal. The last fragment of a train gives the whole message.
  */
-errval_t rpc_lmp_deserialize(struct lmp_recv_msg *recv_msg, struct capref *recv_cap_ptr,
-                         rpc_identifier_t *ret_type, uint8_t **ret_buf, size_t *ret_size,
-                         struct lmp_helper *helper);
+errval_t rpc_lmp_deserialize(struct aos_chan *chan, struct lmp_recv_msg *recv_msg,
+                             struct capref *recv_cap_ptr,
+                             rpc_request_id_t *ret_request_id, rpc_identifier_t *ret_type,
+                             uint8_t **ret_buf, size_t *ret_size, struct lmp_helper *helper);
+
+static inline bool rpc_lmp_is_internal(rpc_identifier_t type)
+{
+    return type == RPC_LMP_POOL_SETUP || type == RPC_MSG_FRAGMENT;
+}
 
 errval_t rpc_lmp_cleanup(struct lmp_helper *helper);
 
-errval_t rpc_lmp_send(struct lmp_chan *lc, rpc_identifier_t identifier,
-                      struct capref cap, const void *buf, size_t size,
-                      bool non_blocking);
+/**
+ * Unmap and destroy the frame pools of an LMP channel, and drop a partly received train.
+ */
+void rpc_lmp_chan_destroy(struct aos_chan *chan);
 
-errval_t rpc_lmp_call(struct aos_chan *chan, rpc_identifier_t identifier,
-                      struct capref call_cap, const void *call_buf,
-                      size_t call_size, struct capref *ret_cap, void **ret_buf,
-                      size_t *ret_size, bool no_lock);
+errval_t rpc_lmp_send(struct aos_chan *chan, rpc_request_id_t request_id,
+                      rpc_identifier_t identifier, struct capref cap, const void *buf,
+                      size_t size, bool non_blocking);
+
+/**
+ * Send the call of a future, which is added to the pending list of the channel.
+ * @param locked  chan->mutex is held by the caller.
+ */
+errval_t rpc_lmp_submit(struct aos_chan *chan, struct aos_chan_future *future, bool locked);
+
+/**
+ * Receive one reply if one has arrived, see aos_chan_poll_one.
+ * @param ret_future  The future of the reply, filled but not completed yet. NULL if
+ *                    nothing was received or the reply matches no call in flight.
+ */
+errval_t rpc_lmp_poll(struct aos_chan *chan, bool locked, bool *received,
+                      struct aos_chan_future **ret_future);
 
 errval_t rpc_lmp_chan_register_recv(struct aos_chan *chan, struct waitset *ws,
                                     aos_chan_handler_t handler, void *arg);
 
 /**
- * Prefix an identifier to the buffer
+ * Prefix the request ID and the identifier to the buffer
  * @param buf         The input buffer (can be NULL if size is also 0).
  * @param size
+ * @param request_id
  * @param identifier
  * @param ret
  * @return
  */
-errval_t rpc_ump_prefix_identifier(const void *buf, size_t size, rpc_identifier_t identifier,
-                               void **ret);
+errval_t rpc_ump_prefix_header(const void *buf, size_t size, rpc_request_id_t request_id,
+                               rpc_identifier_t identifier, void **ret);
+
+errval_t rpc_ump_send(struct ump_chan *uc, rpc_request_id_t request_id,
+                      rpc_identifier_t identifier, struct capref cap, const void *buf,
+                      size_t size);
+
+errval_t rpc_ump_ack(struct ump_chan *uc, rpc_request_id_t request_id, struct capref cap,
+                     const void *buf, size_t size);
+
+errval_t rpc_ump_nack(struct ump_chan *uc, rpc_request_id_t request_id, errval_t err);
+
+/**
+ * Send the call of a future, which is added to the pending list of the channel.
+ */
+errval_t rpc_ump_submit(struct aos_chan *chan, struct aos_chan_future *future);
 
-errval_t rpc_ump_send(struct ump_chan *uc, rpc_identifier_t identifier, struct capref cap,
-                      const void *buf, size_t size);
+/**
+ * Receive one reply if one has arrived, see rpc_lmp_poll.
+ */
+errval_t rpc_ump_poll(struct aos_chan *chan, bool locked, bool *received,
+                      struct aos_chan_future **ret_future);
 
-errval_t rpc_ump_ack(struct ump_chan *uc, struct capref cap, const void *buf, size_t size);
+/**
+ * Claim a cap sent along a UMP message from init, with the ticket appended to the message.
+ * Messages with RPC_SPECIAL_CAP_TRANSFER_FLAG end with a struct aos_rpc_cap_ticket.
+ */
+errval_t rpc_ump_recv_cap(const struct aos_rpc_cap_ticket *ticket, struct capref *recv_cap);
 
-errval_t rpc_ump_nack(struct ump_chan *uc, errval_t err);
+/// A received UMP message, in place in the ring or in the bulk region, or reassembled
+struct rpc_ump_msg {
+    struct ring_msg_view view;  ///< The message in the ring
+    uint8_t *raw;               ///< Header (RPC_UMP_HEADER_SIZE) followed by the payload
+    size_t raw_size;
+    size_t bulk_end;            ///< Position to release in the bulk region, 0 if none
+    bool owned;                 ///< raw is a malloced reassembly buffer
+};
+
+/**
+ * Get the next message, resolving bulk descriptors. The message stays valid until
+ * rpc_ump_release.
+ * @param blocking  If false, return LIB_ERR_RING_NO_MSG if no message is available.
+ */
+errval_t rpc_ump_peek(struct ump_chan *uc, bool blocking, struct rpc_ump_msg *msg);
 
-errval_t rpc_ump_call(struct aos_chan *chan, rpc_identifier_t identifier,
-                      struct capref call_cap, const void *call_buf, size_t call_size,
-                      struct capref *ret_cap, void **ret_buf, size_t *ret_size);
+errval_t rpc_ump_release(struct ump_chan *uc, struct rpc_ump_msg *msg);
 
-errval_t rpc_ump_recv_cap(struct ump_chan *uc, struct capref *recv_cap);
+/**
+ * Receive a reply (RPC_ACK or RPC_ERR) and copy the payload out.
+ * @param ret_request_id  Request ID echoed by the reply.
+ * @param ret_identifier  Identifier of the reply, with RPC_SPECIAL_CAP_TRANSFER_FLAG if a
+ *                        cap comes with it, which the caller must claim with ret_ticket.
+ * @param reply_err       Error carried by the reply.
+ * @param ret_buf         Malloced by this function if not NULL.
+ * @param ret_ticket      Filled if the reply carries a cap, may be NULL if none is expected.
+ * @return Error in receiving the reply.
+ */
+errval_t rpc_ump_recv_reply(struct ump_chan *uc, bool blocking,
+                            rpc_request_id_t *ret_request_id,
+                            rpc_identifier_t *ret_identifier, errval_t *reply_err,
+                            void **ret_buf, size_t *ret_size,
+                            struct aos_rpc_cap_ticket *ret_ticket);
 
 errval_t rpc_ump_chan_register_recv(struct aos_chan *chan, struct waitset *ws,
                                     aos_chan_handler_t handler, void *arg);
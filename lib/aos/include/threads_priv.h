@@ -12,6 +12,7 @@
 
 #include <aos/dispatcher_arch.h>
 #include <aos/except.h>
+#include <aos/malloc.h>
 
 /// Maximum number of thread-local storage keys
 #define MAX_TLS         16
@@ -80,6 +81,8 @@ struct thread {
     errval_t    async_error;                ///< RPC async error
     uint32_t    outgoing_token;             ///< Token of outgoing message
     struct waitset_chanstate *local_trigger; ///< Trigger for a local thread event
+
+    struct malloc_thread_cache malloc_cache; ///< Free blocks of the size classes
 };
 
 void thread_enqueue(struct thread *thread, struct thread **queue);
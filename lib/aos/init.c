@@ -23,6 +23,7 @@
 #include <aos/dispatcher_arch.h>
 #include <barrelfish_kpi/dispatcher_shared.h>
 #include <aos/morecore.h>
+#include <aos/malloc.h>
 #include <aos/paging.h>
 #include <aos/systime.h>
 #include <barrelfish_kpi/domain_params.h>
@@ -259,6 +260,11 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
         return err_push(err, LIB_ERR_MORECORE_INIT);
     }
 
+    err = malloc_init();
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_MORECORE_INIT);
+    }
+
     lmp_endpoint_init();
 
     // HINT: Use init_domain to check if we are the init domain.
@@ -0,0 +1,269 @@
+/**
+ * \file
+ * \brief Size-class malloc with per-thread caches
+ */
+
+#include <aos/aos.h>
+#include <aos/malloc.h>
+#include <aos/slab.h>
+#include <aos/static_assert.h>
+#include <k_r_malloc.h>
+#include <string.h>
+#include "threads_priv.h"
+
+/// Alignment of every block, as for the K&R allocator
+#define MALLOC_ALIGNMENT sizeof(Header)
+
+// The blocks of a slab follow its head, at the start of the span or of a later slab
+STATIC_ASSERT(sizeof(struct slab_head) % MALLOC_ALIGNMENT == 0, "slab blocks unaligned");
+
+#define SPAN_COUNT (MALLOC_WINDOW_SIZE / MALLOC_SPAN_SIZE)
+
+typedef void *(*alt_malloc_t)(size_t bytes);
+extern alt_malloc_t alt_malloc;
+
+typedef void (*alt_free_t)(void *p);
+extern alt_free_t alt_free;
+
+typedef void *(*alt_realloc_t)(void *p, size_t bytes);
+extern alt_realloc_t alt_realloc;
+
+struct size_class {
+    struct thread_mutex mutex;     ///< Protects slabs
+    struct slab_allocator slabs;
+    size_t size;
+    uint32_t batch;                ///< Blocks moved between a thread cache and the class
+    uint32_t cache_max;            ///< Blocks a thread cache holds at most
+};
+
+static struct {
+    bool enabled;
+    lvaddr_t base;                      ///< Start of the window, 0 before malloc_init()
+    struct thread_mutex span_mutex;     ///< Protects span_count
+    size_t span_count;                  ///< Spans of the window handed out so far
+    struct size_class classes[MALLOC_CLASS_COUNT];
+    uint8_t span_class[SPAN_COUNT];     ///< Class of each span handed out
+} sc;
+
+static inline size_t size_to_class(size_t size)
+{
+    if (size <= 128) {
+        return (size == 0) ? 0 : (size - 1) >> 4;
+    }
+    uint8_t b = log2floor(size - 1);
+    return 8 + (b - 7) * 4 + ((size - 1) >> (b - 2)) - 4;
+}
+
+static inline size_t class_to_size(size_t c)
+{
+    if (c < 8) {
+        return (c + 1) * 16;
+    }
+    size_t k = c - 8;
+    return (4 + k % 4 + 1) << (7 + k / 4 - 2);
+}
+
+static inline bool in_window(void *p)
+{
+    return (lvaddr_t)p - sc.base < MALLOC_WINDOW_SIZE;
+}
+
+/**
+ * Add a span to a class. The span is populated outside of the lock of the class, as that
+ * takes page faults. Spans are aligned to their size, so the slab allocator finds the
+ * slab of a block by its address.
+ */
+static errval_t class_grow(size_t c)
+{
+    lvaddr_t span = 0;
+    THREAD_MUTEX_ENTER(&sc.span_mutex)
+    {
+        if (sc.span_count < SPAN_COUNT) {
+            sc.span_class[sc.span_count] = c;
+            span = sc.base + sc.span_count * MALLOC_SPAN_SIZE;
+            sc.span_count++;
+        }
+    }
+    THREAD_MUTEX_EXIT(&sc.span_mutex)
+    if (span == 0) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    memset((void *)span, 0, MALLOC_SPAN_SIZE);
+
+    struct size_class *cls = &sc.classes[c];
+    THREAD_MUTEX_ENTER(&cls->mutex)
+    {
+        slab_grow(&cls->slabs, (void *)span, MALLOC_SPAN_SIZE);
+    }
+    THREAD_MUTEX_EXIT(&cls->mutex)
+    return SYS_ERR_OK;
+}
+
+/**
+ * Take a block from a class, and up to a batch more into the cache bin if there is one.
+ * \return NULL if the class has no free block.
+ */
+static void *class_fetch(size_t c, struct malloc_cache_bin *bin)
+{
+    struct size_class *cls = &sc.classes[c];
+    void *block = NULL;
+    THREAD_MUTEX_ENTER(&cls->mutex)
+    {
+        block = slab_alloc(&cls->slabs);
+        if (block == NULL || bin == NULL) {
+            break;
+        }
+        for (uint32_t i = 1; i < cls->batch; i++) {
+            void *b = slab_alloc(&cls->slabs);
+            if (b == NULL) {
+                break;
+            }
+            *(void **)b = bin->head;
+            bin->head = b;
+            bin->count++;
+        }
+    }
+    THREAD_MUTEX_EXIT(&cls->mutex)
+    return block;
+}
+
+/// Give count blocks from the cache bin back to the class
+static void class_flush(size_t c, struct malloc_cache_bin *bin, uint32_t count)
+{
+    struct size_class *cls = &sc.classes[c];
+    THREAD_MUTEX_ENTER(&cls->mutex)
+    {
+        for (uint32_t i = 0; i < count && bin->head != NULL; i++) {
+            void *b = bin->head;
+            bin->head = *(void **)b;
+            bin->count--;
+            slab_free(&cls->slabs, b);
+        }
+    }
+    THREAD_MUTEX_EXIT(&cls->mutex)
+}
+
+static void *sc_malloc(size_t bytes)
+{
+    if (!sc.enabled || bytes > MALLOC_MAX_CLASS_SIZE) {
+        return __kr_malloc(bytes);
+    }
+
+    size_t c = size_to_class(bytes);
+    struct thread *me = thread_self();
+    struct malloc_cache_bin *bin = (me != NULL) ? &me->malloc_cache.bins[c] : NULL;
+
+    if (bin != NULL && bin->head != NULL) {
+        void *b = bin->head;
+        bin->head = *(void **)b;
+        bin->count--;
+        return b;
+    }
+
+    void *b = class_fetch(c, bin);
+    // A new span is populated on page faults, which cannot be taken in a fault handler
+    if (b == NULL && me != NULL && !me->in_exception && err_is_ok(class_grow(c))) {
+        b = class_fetch(c, bin);
+    }
+    if (b == NULL) {
+        return __kr_malloc(bytes);
+    }
+    return b;
+}
+
+static void sc_free(void *p)
+{
+    if (!in_window(p)) {
+        __kr_free(p);
+        return;
+    }
+
+    size_t c = sc.span_class[((lvaddr_t)p - sc.base) / MALLOC_SPAN_SIZE];
+    struct thread *me = thread_self();
+    if (me == NULL) {
+        struct size_class *cls = &sc.classes[c];
+        THREAD_MUTEX_ENTER(&cls->mutex)
+        {
+            slab_free(&cls->slabs, p);
+        }
+        THREAD_MUTEX_EXIT(&cls->mutex)
+        return;
+    }
+
+    struct malloc_cache_bin *bin = &me->malloc_cache.bins[c];
+    *(void **)p = bin->head;
+    bin->head = p;
+    bin->count++;
+    if (bin->count > sc.classes[c].cache_max) {
+        class_flush(c, bin, sc.classes[c].batch);
+    }
+}
+
+static void *sc_realloc(void *p, size_t bytes)
+{
+    if (p == NULL) {
+        return sc_malloc(bytes);
+    }
+
+    size_t old_size;
+    if (in_window(p)) {
+        old_size = sc.classes[sc.span_class[((lvaddr_t)p - sc.base) / MALLOC_SPAN_SIZE]].size;
+        if (bytes <= old_size) {
+            return p;
+        }
+    } else {
+        old_size = sizeof(Header) * (((Header *)p - 1)->s.size - 1);
+    }
+
+    void *new_p = sc_malloc(bytes);
+    if (new_p == NULL) {
+        return NULL;
+    }
+    memcpy(new_p, p, MIN(old_size, bytes));
+    sc_free(p);
+    return new_p;
+}
+
+void malloc_thread_cache_flush(struct malloc_thread_cache *cache)
+{
+    for (size_t c = 0; c < MALLOC_CLASS_COUNT; c++) {
+        if (cache->bins[c].count > 0) {
+            class_flush(c, &cache->bins[c], cache->bins[c].count);
+        }
+    }
+}
+
+void malloc_set_size_classes(bool enable)
+{
+    sc.enabled = enable && sc.base != 0;
+}
+
+errval_t malloc_init(void)
+{
+    void *base = NULL;
+    errval_t err = paging_alloc(get_current_paging_state(), &base, MALLOC_WINDOW_SIZE,
+                                MALLOC_SPAN_SIZE);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    thread_mutex_init(&sc.span_mutex);
+    sc.span_count = 0;
+    for (size_t c = 0; c < MALLOC_CLASS_COUNT; c++) {
+        struct size_class *cls = &sc.classes[c];
+        thread_mutex_init(&cls->mutex);
+        cls->size = class_to_size(c);
+        slab_init(&cls->slabs, cls->size, NULL);
+        cls->cache_max = MAX(MALLOC_CACHE_BYTES / cls->size, 2);
+        cls->batch = cls->cache_max / 2;
+    }
+    assert(class_to_size(MALLOC_CLASS_COUNT - 1) == MALLOC_MAX_CLASS_SIZE);
+
+    sc.base = (lvaddr_t)base;
+    sc.enabled = true;
+    alt_malloc = sc_malloc;
+    alt_free = sc_free;
+    alt_realloc = sc_realloc;
+    return SYS_ERR_OK;
+}
@@ -123,10 +123,25 @@ static void *morecore_alloc(size_t bytes, size_t *retbytes)
     return ret;
 }
 
+/**
+ * \brief Give back the memory of a free span of the heap
+ *
+ * Called by lesscore() for free spans of at least MORECORE_FREE_THRESHOLD bytes, without
+ * the malloc lock held. The span stays reserved for malloc, and its pages are populated
+ * again on the next page fault.
+ */
 static void morecore_free(void *base, size_t bytes)
 {
-    // TODO: unmap for large region
-    return;
+    lvaddr_t start = ROUND_UP((lvaddr_t)base, BASE_PAGE_SIZE);
+    lvaddr_t end = ROUND_DOWN((lvaddr_t)base + bytes, BASE_PAGE_SIZE);
+    if (end <= start) {
+        return;
+    }
+
+    errval_t err = paging_decommit(get_current_paging_state(), start, end - start);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "morecore_free: paging_decommit failed");
+    }
 }
 
 errval_t morecore_init(size_t alignment)
@@ -109,6 +109,18 @@ static inline void rb_mapping_remove(struct paging_state *st,
     RB_REMOVE(paging_rb_tree, &st->mapping_tree, (struct paging_rb_tree_node *)n);
 }
 
+static inline void rb_child_insert(struct paging_state *st,
+                                   struct paging_mapping_child_node *n)
+{
+    RB_INSERT(paging_rb_tree, &st->child_tree, (struct paging_rb_tree_node *)n);
+}
+
+static inline void rb_child_remove(struct paging_state *st,
+                                   struct paging_mapping_child_node *n)
+{
+    RB_REMOVE(paging_rb_tree, &st->child_tree, (struct paging_rb_tree_node *)n);
+}
+
 static inline struct paging_vnode_node *rb_vnode_find(struct paging_state *st,
                                                       size_t level, lvaddr_t addr)
 {
@@ -136,6 +148,59 @@ static inline struct paging_mapping_node *rb_mapping_find(struct paging_state *s
                                                  (struct paging_rb_tree_node *)&find);
 }
 
+/// First child mapping at or after addr
+static inline struct paging_mapping_child_node *rb_child_nfind(struct paging_state *st,
+                                                               lvaddr_t addr)
+{
+    struct paging_mapping_child_node find;
+    find.addr = addr;
+    return (struct paging_mapping_child_node *)RB_NFIND(paging_rb_tree, &st->child_tree,
+                                                        (struct paging_rb_tree_node *)&find);
+}
+
+/// Child mapping before n, or the last one if n is NULL
+static inline struct paging_mapping_child_node *
+rb_child_prev(struct paging_state *st, struct paging_mapping_child_node *n)
+{
+    if (n == NULL) {
+        return (struct paging_mapping_child_node *)RB_MAX(paging_rb_tree, &st->child_tree);
+    }
+    return (struct paging_mapping_child_node *)RB_PREV(paging_rb_tree, &st->child_tree,
+                                                       (struct paging_rb_tree_node *)n);
+}
+
+/// Slot of a page table in the vnode cache of its level
+static inline size_t vnode_cache_index(size_t level, lvaddr_t addr)
+{
+    return (addr >> __builtin_ctzl(TABLE_ADDR_MASK[level] + 1))
+           & (PAGING_VNODE_CACHE_SLOTS - 1);
+}
+
+/**
+ * Look up an installed page table without taking vnode_mutex.
+ * @return NULL if the table is not cached, whether it exists or not.
+ */
+static inline struct paging_vnode_node *vnode_cache_find(struct paging_state *st,
+                                                         size_t level, lvaddr_t addr)
+{
+    struct paging_vnode_node *n = __atomic_load_n(
+        &st->vnode_cache[level][vnode_cache_index(level, addr)], __ATOMIC_ACQUIRE);
+    if (n != NULL && n->addr == addr) {
+        return n;
+    }
+    return NULL;
+}
+
+// NOTE: this function is called in vnode_mutex, and n must have its vnode cap installed
+static inline void vnode_cache_insert(struct paging_state *st, size_t level,
+                                      struct paging_vnode_node *n)
+{
+    assert(!capref_is_null(n->vnode_cap));
+    // Publish the node only after it is filled in
+    __atomic_store_n(&st->vnode_cache[level][vnode_cache_index(level, n->addr)], n,
+                     __ATOMIC_RELEASE);
+}
+
 /**
  * \brief Helper function that allocates a slot and
  *        creates a aarch64 page table capability for a certain level
@@ -212,7 +277,7 @@ static inline errval_t apply_mapping(struct paging_state *st, struct capref dest
                                      struct capref src, capaddr_t slot, uint64_t attr,
                                      uint64_t off, uint64_t pte_count,
                                      struct paging_mapping_node_head *mappings,
-                                     bool store_frame_cap)
+                                     bool store_frame_cap, lvaddr_t vaddr, size_t bytes)
 {
     assert(!capref_is_null(dest));
     assert(!capref_is_null(src));
@@ -242,7 +307,10 @@ static inline errval_t apply_mapping(struct paging_state *st, struct capref dest
         if (store_frame_cap) {
             child->self_paging_frame_cap = src;
         }
+        child->addr = vaddr;
+        child->bytes = bytes;
         LIST_INSERT_HEAD(mappings, child, link);
+        rb_child_insert(st, child);
     }  // discard otherwise
 
     return SYS_ERR_OK;
@@ -324,7 +392,8 @@ static inline errval_t create_and_install_vnode_node(struct paging_state *st,
     // Install the page table
     err = apply_mapping(st, parent_cap, (*node_ptr)->vnode_cap,
                         get_child_index(addr, level - 1),
-                        KPI_PAGING_FLAGS_READ | KPI_PAGING_FLAGS_WRITE, 0, 1, NULL, false);
+                        KPI_PAGING_FLAGS_READ | KPI_PAGING_FLAGS_WRITE, 0, 1, NULL, false, 0,
+                        0);
     if (err_is_fail(err)) {
         DEBUG_PRINTF("failed to apply_mapping (create_and_install_vnode_node)\n");
         goto FAILURE_APPLY_MAPPING;
@@ -340,9 +409,87 @@ FAILURE_CREATE_VNODE_NODE:
     return err;
 }
 
+/**
+ * Page tables allocated for lookup_or_create_vnode_node() before taking vnode_mutex, as
+ * allocating slots may map memory, which takes mapping_mutex.
+ */
+struct pt_prealloc {
+    struct capref vnode_cap[PAGING_TABLE_LEVELS];    // NULL_CAP if none for the level
+    struct capref mapping_cap[PAGING_TABLE_LEVELS];  // slot to install it with
+};
+
+static inline void pt_prealloc_init(struct pt_prealloc *pre)
+{
+    memset(pre, 0, sizeof(*pre));  // NULL_CAP is all 0
+}
+
+static inline size_t pt_prealloc_levels(struct pt_prealloc *pre)
+{
+    size_t mask = 0;
+    for (size_t level = 1; level < PAGING_TABLE_LEVELS; level++) {
+        if (!capref_is_null(pre->vnode_cap[level])) {
+            mask |= BIT(level);
+        }
+    }
+    return mask;
+}
+
+// NOTE: this function is called without vnode_mutex
+static errval_t pt_prealloc_fill(struct paging_state *st, size_t mask,
+                                 struct pt_prealloc *pre)
+{
+    errval_t err;
+    for (size_t level = 1; level < PAGING_TABLE_LEVELS; level++) {
+        if (!(mask & BIT(level)) || !capref_is_null(pre->vnode_cap[level])) {
+            continue;
+        }
+        err = st->slot_alloc->alloc(st->slot_alloc, &pre->mapping_cap[level]);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_SLOT_ALLOC);
+        }
+        struct capref vnode_cap;
+        err = pt_alloc(st, PAGE_TABLE_TYPE[level], &vnode_cap);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        pre->vnode_cap[level] = vnode_cap;
+    }
+    return SYS_ERR_OK;
+}
+
+// NOTE: this function is called without vnode_mutex
+static void pt_prealloc_release(struct paging_state *st, struct pt_prealloc *pre)
+{
+    for (size_t level = 1; level < PAGING_TABLE_LEVELS; level++) {
+        if (!capref_is_null(pre->vnode_cap[level])) {
+            cap_destroy(pre->vnode_cap[level]);
+        }
+        if (!capref_is_null(pre->mapping_cap[level])) {
+            st->slot_alloc->free(st->slot_alloc, pre->mapping_cap[level]);
+        }
+    }
+    pt_prealloc_init(pre);
+}
+
 // NOTE: this function is called in vnode_mutex
+// Levels up from level whose page table covering addr does not exist, as a bit mask
+static size_t missing_vnode_levels(struct paging_state *st, size_t level, lvaddr_t addr)
+{
+    size_t mask = 0;
+    while (rb_vnode_find(st, level, addr) == NULL) {
+        assert(level > 0 && "L0 node not exist");
+        mask |= BIT(level);
+        level--;
+        addr &= ~TABLE_ADDR_MASK[level];
+    }
+    return mask;
+}
+
+// NOTE: this function is called in vnode_mutex, with the page tables of all levels
+// missing_vnode_levels() reports in pre. Nothing is allocated but vnode nodes.
 static errval_t lookup_or_create_vnode_node(struct paging_state *st, size_t level,
-                                            lvaddr_t addr, struct paging_vnode_node **ret)
+                                            lvaddr_t addr, struct pt_prealloc *pre,
+                                            struct paging_vnode_node **ret)
 {
     assert(level < PAGING_TABLE_LEVELS);
     assert((addr & TABLE_ADDR_MASK[level]) == 0);
@@ -362,62 +509,38 @@ static errval_t lookup_or_create_vnode_node(struct paging_state *st, size_t leve
     assert(level > 0 && "L0 node not exist");
     struct paging_vnode_node *parent = NULL;
     err = lookup_or_create_vnode_node(st, level - 1, addr & ~(TABLE_ADDR_MASK[level - 1]),
-                                      &parent);
+                                      pre, &parent);
     if (err_is_fail(err)) {
         DEBUG_PRINTF("lookup_or_create_vnode_node(%lu) failed\n", level);
         return err;  // return directly, no need to clean up
     }
     assert(!capref_is_null(parent->vnode_cap));
 
-    // The operation above may trigger refill/vnode alloc that creates the vnode node
-    /*if ((node = rb_vnode_find(st, level, addr)) != NULL) {
-        goto DONE;
-    }*/
-
-    // Create the vnode cap
-    struct capref vnode_cap;
-    err = pt_alloc(st, PAGE_TABLE_TYPE[level], &vnode_cap);
-    if (err_is_fail(err)) {
-        goto FAILURE_PT_ALLOC;
-    }
-
-    // The operation above may trigger refill/vnode alloc that creates the vnode node
-    if ((node = rb_vnode_find(st, level, addr)) != NULL) {
-        err = SYS_ERR_OK;  // fall back to the undo path, but return OK
-        goto UNDO_PT_ALLOC;
-    }
-
     // Install the page table
-    err = apply_mapping(st, parent->vnode_cap, vnode_cap, get_child_index(addr, level - 1),
-                        KPI_PAGING_FLAGS_READ | KPI_PAGING_FLAGS_WRITE, 0, 1, NULL, false);
-    /*if ((node = rb_vnode_find(st, level, addr)) != NULL) {
-        err = SYS_ERR_OK;  // fall back to the undo path, and return OK, regardless of error
-        goto UNDO_PT_ALLOC;
-    }*/
+    struct capref vnode_cap = pre->vnode_cap[level];
+    struct capref mapping_cap = pre->mapping_cap[level];
+    assert(!capref_is_null(vnode_cap) && !capref_is_null(mapping_cap));
+    err = vnode_map(parent->vnode_cap, vnode_cap, get_child_index(addr, level - 1),
+                    KPI_PAGING_FLAGS_READ | KPI_PAGING_FLAGS_WRITE, 0, 1, mapping_cap);
     if (err_is_fail(err)) {
-        DEBUG_PRINTF("failed to apply_mapping (lookup_or_create_vnode_node)\n");
-        goto FAILURE_APPLY_MAPPING;
+        DEBUG_PRINTF("failed to vnode_map (lookup_or_create_vnode_node)\n");
+        return err_push(err, LIB_ERR_VNODE_MAP);
     }
+    pre->mapping_cap[level] = NULL_CAP;  // the mapping is discarded, as by apply_mapping()
 
     // Create the vnode node, should not trigger refill
     err = create_vnode_node(st, addr, level, &node);
     if (err_is_fail(err)) {
-        goto FAILURE_CREATE_VNODE_NODE;
+        cap_destroy(mapping_cap);  // the page table itself is freed with pre
+        return err;
     }
     node->vnode_cap = vnode_cap;
+    pre->vnode_cap[level] = NULL_CAP;
 
 DONE:
     *ret = node;
     assert(!capref_is_null(node->vnode_cap));
     return SYS_ERR_OK;
-
-FAILURE_CREATE_VNODE_NODE:
-FAILURE_APPLY_MAPPING:
-UNDO_PT_ALLOC:
-    cap_destroy(vnode_cap);
-FAILURE_PT_ALLOC:
-    *ret = node;
-    return err;
 }
 
 // free is initialized to false
@@ -507,11 +630,13 @@ unmap_and_delete_mapping_child(struct paging_state *st,
         return err;
     }
     if (!capref_is_null(child->self_paging_frame_cap)) {
-        err = cap_destroy(child->self_paging_frame_cap);
+        // Populated on a page fault, the memory can go back to the memory server
+        err = ram_free(child->self_paging_frame_cap);
         if (err_is_fail(err)) {
             return err;
         }
     }
+    rb_child_remove(st, child);
     slab_free(&st->mapping_child_slabs, child);
     return SYS_ERR_OK;
 }
@@ -546,69 +671,95 @@ static inline errval_t unmap_and_delete_mapping_node(struct paging_state *st,
     return SYS_ERR_OK;
 }
 
-static inline errval_t ensure_enough_slabs(struct paging_state *st)
+/**
+ * Refill a slab allocator once it runs low. Refilling maps memory, which itself takes
+ * nodes from the allocators, so it happens ahead of time rather than when one is empty.
+ * The memory is mapped before taking the lock of the allocator, as mapping takes the
+ * other locks.
+ */
+static errval_t refill_slabs(struct paging_state *st, struct slab_allocator *slabs,
+                             struct thread_mutex *mutex, size_t threshold,
+                             const char *name)
 {
-    if (st->refilling) {
-        return SYS_ERR_OK;
-    }
+    errval_t err;
 
-    if (slab_freecount(&st->vnode_slabs) < VNODE_SLAB_REFILL_THRESHOLD) {
+    bool needed;
+    THREAD_MUTEX_ENTER_NESTED(mutex)
+    {
+        needed = slab_needs_refill(slabs, threshold);
 #if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill vnode slabs\n");
-#endif
-        st->refilling = true;
-        errval_t err = st->vnode_slabs.refill_func(&st->vnode_slabs);
-        st->refilling = false;
-        if (err_is_fail(err)) {
-            return err;
+        if (needed) {
+            struct slab_stats stats;
+            slab_get_stats(slabs, &stats);
+            DEBUG_PRINTF("paging: refill %s slabs, %lu/%lu blocks free, %lu partial, "
+                         "%lu full, %lu empty slabs\n", name, stats.free_blocks,
+                         stats.total_blocks, stats.slabs[SLAB_LIST_PARTIAL],
+                         stats.slabs[SLAB_LIST_FULL], stats.slabs[SLAB_LIST_EMPTY]);
         }
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill vnode slabs done\n");
 #endif
     }
-    if (slab_freecount(&st->region_slabs) < REGION_SLAB_REFILL_THRESHOLD) {
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill region slabs\n");
-#endif
-        st->refilling = true;
-        errval_t err = st->region_slabs.refill_func(&st->region_slabs);
-        st->refilling = false;
-        if (err_is_fail(err)) {
-            return err;
-        }
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill region slabs done\n");
-#endif
+    THREAD_MUTEX_EXIT(mutex)
+    if (!needed) {
+        return SYS_ERR_OK;
     }
-    if (slab_freecount(&st->mapping_node_slabs) < MAPPING_NODE_SLAB_REFILL_THRESHOLD) {
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill mapping node slabs\n");
-#endif
-        st->refilling = true;
-        errval_t err = st->mapping_node_slabs.refill_func(&st->mapping_node_slabs);
-        st->refilling = false;
-        if (err_is_fail(err)) {
-            return err;
-        }
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill mapping node slabs done\n");
-#endif
+
+    // Regions are aligned to their size, so the slabs are found by alignment
+    size_t bytes = SLAB_REFILL_SLABS * slabs->slab_size;
+    struct capref frame;
+    void *buf = NULL;
+    err = frame_alloc(&frame, bytes, NULL);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_FRAME_ALLOC);
+        goto RET;
     }
-    if (slab_freecount(&st->mapping_child_slabs) < MAPPING_CHILD_SLAB_REFILL_THRESHOLD) {
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill mapping child slabs\n");
-#endif
-        st->refilling = true;
-        errval_t err = st->mapping_child_slabs.refill_func(&st->mapping_child_slabs);
-        st->refilling = false;
-        if (err_is_fail(err)) {
-            return err;
-        }
-#if defined(DEBUG_REFILL)
-        DEBUG_PRINTF("paging: refill mapping child slabs done\n");
-#endif
+    err = paging_map_frame_attr(st, &buf, bytes, frame, VREGION_FLAGS_READ_WRITE);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+        goto RET;
     }
-    return SYS_ERR_OK;
+
+    THREAD_MUTEX_ENTER_NESTED(mutex)
+    {
+        slab_grow(slabs, buf, bytes);
+    }
+    THREAD_MUTEX_EXIT(mutex)
+    st->slab_refills++;
+
+RET:
+    return err;
+}
+
+/**
+ * Refill the slab allocators that run low. The mapping a refill makes comes back here,
+ * and is served from what the thresholds keep in reserve. One thread refills at a time,
+ * the others go on with the reserve too: they may hold mapping_mutex, which the refill
+ * needs, so they cannot wait for it.
+ */
+static inline errval_t ensure_enough_slabs(struct paging_state *st)
+{
+    struct thread *none = NULL;
+    if (!__atomic_compare_exchange_n(&st->refilling, &none, thread_self(), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return SYS_ERR_OK;  // refilling, either this thread further up or another one
+    }
+
+    errval_t err = refill_slabs(st, &st->vnode_slabs, &st->vnode_mutex,
+                                VNODE_SLAB_REFILL_THRESHOLD, "vnode");
+    if (err_is_ok(err)) {
+        err = refill_slabs(st, &st->region_slabs, &st->region_mutex,
+                           REGION_SLAB_REFILL_THRESHOLD, "region");
+    }
+    if (err_is_ok(err)) {
+        err = refill_slabs(st, &st->mapping_node_slabs, &st->mapping_mutex,
+                           MAPPING_NODE_SLAB_REFILL_THRESHOLD, "mapping node");
+    }
+    if (err_is_ok(err)) {
+        err = refill_slabs(st, &st->mapping_child_slabs, &st->mapping_mutex,
+                           MAPPING_CHILD_SLAB_REFILL_THRESHOLD, "mapping child");
+    }
+
+    __atomic_store_n(&st->refilling, NULL, __ATOMIC_RELEASE);
+    return err;
 }
 
 /**
@@ -665,7 +816,47 @@ static errval_t chop_down_region(struct paging_state *st,
 }
 
 /**
- * Map a frame that can cross multiple page tables.
+ * Count how many blocks of a table at the level can map the frame from vaddr on. A block
+ * must be covered by the frame in full, have a suitably aligned physical address, and not
+ * have a table installed below it already.
+ * @param st
+ * @param level  1 for 1 GiB blocks, 2 for 2 MiB blocks.
+ * @param vaddr
+ * @param end    End of the range to map.
+ * @param paddr  Physical address mapped at vaddr.
+ * @param pend   End of the frame in physical memory.
+ * @return Number of blocks, 0 if vaddr can't be mapped with a block at this level.
+ */
+static size_t count_blocks(struct paging_state *st, size_t level, lvaddr_t vaddr,
+                           lvaddr_t end, genpaddr_t paddr, genpaddr_t pend)
+{
+    const size_t BLOCK_SIZE = CHILD_BLOCK_SIZE[level];
+    if ((vaddr & (BLOCK_SIZE - 1)) != 0 || (paddr & (BLOCK_SIZE - 1)) != 0) {
+        return 0;
+    }
+
+    // Stay in the same table
+    lvaddr_t table_end = (vaddr | TABLE_ADDR_MASK[level]) + 1;
+    end = min(end, table_end);
+
+    size_t count = 0;
+    THREAD_MUTEX_ENTER_NESTED(&st->vnode_mutex)
+    {
+        while (vaddr + BLOCK_SIZE <= end && paddr + BLOCK_SIZE <= pend
+               && rb_vnode_find(st, level + 1, vaddr) == NULL) {
+            count++;
+            vaddr += BLOCK_SIZE;
+            paddr += BLOCK_SIZE;
+        }
+    }
+    THREAD_MUTEX_EXIT(&st->vnode_mutex)
+    return count;
+}
+
+/**
+ * Map a frame that can cross multiple page tables. Parts of the frame that cover whole
+ * 1 GiB or 2 MiB blocks with matching alignment are mapped with block descriptors in an
+ * L1 or L2 table, the rest with pages in L3 tables.
  * @param st
  * @param addr
  * @param frame
@@ -679,6 +870,7 @@ static errval_t chop_down_region(struct paging_state *st,
  * @return
  * @note  On error, this function guaranteed that all mappings that are already performed
  *        are inserted into the HEAD of mappings. Page table construction is not reversed.
+ * @note  Called in mapping_mutex, which protects mappings.
  */
 static errval_t map_frame(struct paging_state *st, lvaddr_t addr, struct capref frame,
                           size_t offset, size_t bytes, uint64_t attr,
@@ -697,58 +889,104 @@ static errval_t map_frame(struct paging_state *st, lvaddr_t addr, struct capref
 
     errval_t err;
 
-    lvaddr_t l3_addr_start = ROUND_DOWN(addr, VMSAv8_64_L2_BLOCK_SIZE);
-    lvaddr_t l3_addr_end = ROUND_UP(addr + bytes, VMSAv8_64_L2_BLOCK_SIZE);
+    // Blocks need the physical address, don't bother for small frames
+    bool use_blocks = false;
+    genpaddr_t paddr = 0, pend = 0;
+    if (bytes >= VMSAv8_64_L2_BLOCK_SIZE) {
+        struct frame_identity id;
+        err = frame_identify(frame, &id);
+        if (err_is_ok(err)) {
+            use_blocks = true;
+            paddr = id.base + offset;
+            pend = id.base + id.bytes;
+        }
+    }
 
-    for (lvaddr_t l3_addr = l3_addr_start; l3_addr < l3_addr_end;
-         l3_addr += VMSAv8_64_L2_BLOCK_SIZE) {
+    lvaddr_t vaddr = addr;
+    const lvaddr_t end = addr + bytes;
+    while (vaddr < end) {
         err = ensure_enough_slabs(st);
         if (err_is_fail(err)) {
             return err;
         }
 
-        lvaddr_t child_start_vaddr = max(l3_addr, addr);
-        lvaddr_t child_end_vaddr = min(l3_addr + VMSAv8_64_L2_BLOCK_SIZE, addr + bytes);
-        size_t child_mapping_size = child_end_vaddr - child_start_vaddr;
-
-        // Get the L3 page table node
-        struct paging_vnode_node *l3_node = NULL;
-        THREAD_MUTEX_ENTER_NESTED(&st->vnode_mutex)
-        {
-            err = lookup_or_create_vnode_node(st, 3, l3_addr, &l3_node);
-        }
-        THREAD_MUTEX_EXIT(&st->vnode_mutex)
-        if (err_is_fail(err)) {
-            return err;
+        size_t level = 3;
+        size_t count = 0;
+        if (use_blocks) {
+            for (level = 1; level < 3; level++) {
+                count = count_blocks(st, level, vaddr, end, paddr, pend);
+                if (count > 0) {
+                    break;
+                }
+            }
         }
-        assert(l3_node != NULL);
 
-        // Apply mapping all at once
-        size_t child_start, child_end, child_count;
-        decode_indices(3, child_start_vaddr - l3_addr, child_mapping_size, &child_start,
-                       &child_end, &child_count);
+        lvaddr_t table_addr = vaddr & ~TABLE_ADDR_MASK[level];
+        size_t child_mapping_size;
+        size_t child_start;
+        if (level < 3) {
+            child_mapping_size = count * CHILD_BLOCK_SIZE[level];
+            child_start = get_child_index(vaddr, level);
+        } else {
+            // Pages up to the end of the L3 table
+            lvaddr_t child_end_vaddr = min(table_addr + VMSAv8_64_L2_BLOCK_SIZE, end);
+            child_mapping_size = child_end_vaddr - vaddr;
+            size_t child_end;
+            decode_indices(3, vaddr - table_addr, child_mapping_size, &child_start,
+                           &child_end, &count);
+        }
 #if 0
-        debug_printf("child_start = %lu, end = %lu, count = %lu; offset = %lu\n", child_start, child_end, child_count, offset);
+        debug_printf("level = %lu, child_start = %lu, count = %lu; offset = %lu\n", level, child_start, count, offset);
 #endif
 
-        // Allocate the mapping capability slot
-        /*struct capref mapping_cap;
-        err = st->slot_alloc->alloc(st->slot_alloc, &mapping_cap);
-        if (err_is_fail(err)) {
-            return err;
-        }*/
+        // Get the page table node, without a lock if it is in use already
+        struct paging_vnode_node *table_node = vnode_cache_find(st, level, table_addr);
+        if (table_node == NULL) {
+            // The page tables are allocated with vnode_mutex dropped, and only what is
+            // still missing when it is taken again is installed
+            struct pt_prealloc pre;
+            pt_prealloc_init(&pre);
+            err = SYS_ERR_OK;
+            while (table_node == NULL && err_is_ok(err)) {
+                size_t missing = 0;
+                THREAD_MUTEX_ENTER_NESTED(&st->vnode_mutex)
+                {
+                    missing = missing_vnode_levels(st, level, table_addr)
+                              & ~pt_prealloc_levels(&pre);
+                    if (missing != 0) {
+                        break;
+                    }
+                    err = lookup_or_create_vnode_node(st, level, table_addr, &pre,
+                                                      &table_node);
+                    if (err_is_ok(err)) {
+                        vnode_cache_insert(st, level, table_node);
+                    }
+                }
+                THREAD_MUTEX_EXIT(&st->vnode_mutex)
+                if (missing != 0) {
+                    err = pt_prealloc_fill(st, missing, &pre);
+                }
+            }
+            pt_prealloc_release(st, &pre);  // tables another thread installed meanwhile
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+        assert(table_node != NULL);
 
-        assert(!capref_is_null(l3_node->vnode_cap));
-        err = apply_mapping(st, l3_node->vnode_cap, frame, child_start, attr, offset,
-                            child_count, mappings, store_frame_cap);
+        // Apply mapping all at once
+        assert(!capref_is_null(table_node->vnode_cap));
+        err = apply_mapping(st, table_node->vnode_cap, frame, child_start, attr, offset,
+                            count, mappings, store_frame_cap, vaddr, child_mapping_size);
         store_frame_cap = false;  // no longer store the frame
         if (err_is_fail(err)) {
-            DEBUG_PRINTF("failed to apply_mapping (map_frame, child_count = %lu)\n",
-                         child_count);
-            /*st->slot_alloc->free(st->slot_alloc, mapping_cap);*/
+            DEBUG_PRINTF("failed to apply_mapping (map_frame, level = %lu, count = %lu)\n",
+                         level, count);
             return err;
         }
+        vaddr += child_mapping_size;
         offset += child_mapping_size;
+        paddr += child_mapping_size;
     }
 
     return SYS_ERR_OK;
@@ -815,7 +1053,7 @@ static errval_t map_naturally_aligned_fixed(struct paging_state *st, lvaddr_t va
                 // Continue to next order
             } else {
                 // Other error, no need to clean up
-                return err;
+                goto EXIT_FIND_BLOCK;
             }
         }
     EXIT_FIND_BLOCK:
@@ -823,44 +1061,39 @@ static errval_t map_naturally_aligned_fixed(struct paging_state *st, lvaddr_t va
     }
     THREAD_MUTEX_EXIT(&st->free_list_mutex)
     if (err_is_fail(err)) {
-        goto FAILURE_CHOP_DOWN_REGION;
+        return err;  // nothing to do on failure of chop_down_region, see its comment
     }
 
-    if (node != NULL) {
+    if (node == NULL) {
+        // DEBUG_PRINTF("paging: fixed mapping to already used region\n");
+        return LIB_ERR_PAGING_FIXED_MAP_OCCUPIED;
+    }
+
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
         // Create the mapping record
         err = create_mapping_node(st, node, &mapping);
         if (err_is_fail(err)) {
             DEBUG_PRINTF("Failed to create_mapping_node\n");
-            goto FAILURE_CREATE_MAPPING_NODE;
+            THREAD_MUTEX_BREAK;  // nothing to do, see the comment of chop_down_region
         }
 
         // Actually map the frame, which may span multiple tables
         err = map_frame(st, vaddr, frame, offset, bytes, attr, &mapping->mappings, false);
         if (err_is_fail(err)) {
             DEBUG_PRINTF("failed to map_frame (map_naturally_aligned_fixed)\n");
-            goto FAILURE_MAP_FRAME;
+            err2 = unmap_and_delete_mapping_node(st, mapping);
+            if (err_is_fail(err2)) {
+                DEBUG_PRINTF("unmap_and_delete_mapping_node failed on the way handling "
+                             "failure\n");
+                err = err_push(err, err2);
+            }
+            THREAD_MUTEX_BREAK;
         }
 
         assert(!node->free);
-
-        return SYS_ERR_OK;
-    } else {
-        // DEBUG_PRINTF("paging: fixed mapping to already used region\n");
-        return LIB_ERR_PAGING_FIXED_MAP_OCCUPIED;
-    }
-
-FAILURE_MAP_FRAME:
-    // Continue to unmap_and_delete
-
-    err2 = unmap_and_delete_mapping_node(st, mapping);
-    if (err_is_fail(err2)) {
-        DEBUG_PRINTF("unmap_and_delete_mapping_node failed on the way handling "
-                     "failure\n");
-        err = err_push(err, err2);
     }
-FAILURE_CREATE_MAPPING_NODE:
-    // Nothing to do on failure of chop_down_region, see its comment
-FAILURE_CHOP_DOWN_REGION:
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
     return err;
 }
 
@@ -919,6 +1152,7 @@ static errval_t map_fixed(struct paging_state *st, lvaddr_t vaddr, struct capref
  * @param attr
  * @return
  * @note  On error, mapping is undone in this function.
+ * @note  Called in mapping_mutex.
  */
 static errval_t map_dynamic_using_node(struct paging_state *st, void **buf, uint8_t bits,
                                        struct paging_region_node *node,
@@ -1050,13 +1284,52 @@ static errval_t map_dynamic(struct paging_state *st, void **buf, size_t bytes,
     }
 
     if (node != NULL) {
-        return map_dynamic_using_node(st, buf, bits, node, frame, bytes, attr);
+        THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+        {
+            err = map_dynamic_using_node(st, buf, bits, node, frame, bytes, attr);
+        }
+        THREAD_MUTEX_EXIT(&st->mapping_mutex)
+        return err;
     } else {
         // No available region
         return LIB_ERR_PAGING_NO_MEMORY;
     }
 }
 
+/**
+ * Find the placeholder region that contains [vaddr, vaddr + bytes).
+ * @param st
+ * @param vaddr
+ * @param bytes
+ * @return The mapping node of the region, or NULL if there is none.
+ * @note  Called in mapping_mutex.
+ */
+static struct paging_mapping_node *find_placeholder(struct paging_state *st,
+                                                    lvaddr_t vaddr, size_t bytes)
+{
+    // Find the mapping by gradually marking out the address
+    for (uint8_t b = log2ceil(bytes); b <= PAGING_ADDR_BITS; b++) {
+        struct paging_mapping_node *mapping = rb_mapping_find(st, vaddr & ~MASK(b));
+
+#if 0
+        if (mapping == NULL) {
+            DEBUG_PRINTF("b = %u, mapping = NULL\n", b);
+        } else {
+            DEBUG_PRINTF("b = %u, mapping = 0x%lx/%u bits\n", b, mapping->addr,
+                         mapping->region->bits);
+        }
+#endif
+
+        if (mapping != NULL && mapping->region->bits == b
+            && mapping->addr + BIT(mapping->region->bits) >= vaddr + bytes) {
+            return mapping;
+        } else {
+            // Continue to next order
+        }
+    }
+    return NULL;
+}
+
 /**
  * Map a frame into a placeholder region.
  * @param st
@@ -1068,6 +1341,7 @@ static errval_t map_dynamic(struct paging_state *st, void **buf, size_t bytes,
  * @param store_frame_cap
  * @return
  * @note  On error, mapping is undone in this function.
+ * @note  Called in mapping_mutex.
  */
 static errval_t map_into_placeholder(struct paging_state *st, lvaddr_t vaddr,
                                      struct capref frame, size_t bytes, size_t offset,
@@ -1081,45 +1355,24 @@ static errval_t map_into_placeholder(struct paging_state *st, lvaddr_t vaddr,
 
     errval_t err, err2;
 
-    struct paging_mapping_node *mapping = NULL;
-
-    // Temporary storage for undo on failure
-    struct paging_mapping_child_node *old_mapping_head;
-
-    // Find the mapping by gradually marking out the address
-    for (uint8_t b = log2ceil(bytes); b <= PAGING_ADDR_BITS; b++) {
-        mapping = rb_mapping_find(st, vaddr & ~MASK(b));
-
-#if 0
-        if (mapping == NULL) {
-            DEBUG_PRINTF("b = %u, mapping = NULL\n", b);
-        } else {
-            DEBUG_PRINTF("b = %u, mapping = 0x%lx/%u bits\n", b, mapping->addr,
-                         mapping->region->bits);
-        }
-#endif
-
-        if (mapping != NULL && mapping->region->bits == b
-            && mapping->addr + BIT(mapping->region->bits) >= vaddr + bytes) {
-            // Record the old mapping head for undo the operation
-            old_mapping_head = LIST_FIRST(&mapping->mappings);
-
-            // Actually map the frame, which may span multiple tables
-            // map_frame ensures that new mapping are inserted to the head
-            err = map_frame(st, vaddr, frame, offset, bytes, attr, &mapping->mappings,
-                            store_frame_cap);
-            if (err_is_fail(err)) {
-                DEBUG_PRINTF("failed to map_frame (map_into_placeholder)\n");
-                goto FAILURE_MAP_FRAME;
-            }
+    struct paging_mapping_node *mapping = find_placeholder(st, vaddr, bytes);
+    if (mapping == NULL) {
+        return LIB_ERR_PAGING_PLACEHOLDER_NOT_FOUND;
+    }
 
-            return SYS_ERR_OK;
+    // Record the old mapping head for undo the operation
+    struct paging_mapping_child_node *old_mapping_head = LIST_FIRST(&mapping->mappings);
 
-        } else {
-            // Continue to next order
-        }
+    // Actually map the frame, which may span multiple tables
+    // map_frame ensures that new mapping are inserted to the head
+    err = map_frame(st, vaddr, frame, offset, bytes, attr, &mapping->mappings,
+                    store_frame_cap);
+    if (err_is_fail(err)) {
+        DEBUG_PRINTF("failed to map_frame (map_into_placeholder)\n");
+        goto FAILURE_MAP_FRAME;
     }
-    return LIB_ERR_PAGING_PLACEHOLDER_NOT_FOUND;
+
+    return SYS_ERR_OK;
 
 FAILURE_MAP_FRAME:
     // Undo the mapping only in this function
@@ -1159,20 +1412,28 @@ static errval_t unmap(struct paging_state *st, lvaddr_t vaddr)
     DEBUG_PRINTF("unmap 0x%lx\n", vaddr);
 #endif
 
-    errval_t err;
+    errval_t err = SYS_ERR_OK;
 
-    struct paging_mapping_node *mapping = rb_mapping_find(st, vaddr);
-    if (mapping == NULL) {
-        return LIB_ERR_PAGING_UNMAP_NOT_FOUND;
-    }
+    struct paging_region_node *node = NULL;
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        struct paging_mapping_node *mapping = rb_mapping_find(st, vaddr);
+        if (mapping == NULL) {
+            err = LIB_ERR_PAGING_UNMAP_NOT_FOUND;
+            THREAD_MUTEX_BREAK;
+        }
 
-    struct paging_region_node *node = mapping->region;
-    assert(node->addr == mapping->addr);
-    assert(!node->free);
+        node = mapping->region;
+        assert(node->addr == mapping->addr);
+        assert(!node->free);
 
-    // Destroy the mapping caps
-    unmap_and_delete_mapping_node(st, mapping);
-    mapping = NULL;
+        // Destroy the mapping caps
+        unmap_and_delete_mapping_node(st, mapping);
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
+    if (err_is_fail(err)) {
+        return err;
+    }
 
     // Merge node iteratively
     THREAD_MUTEX_ENTER_NESTED(&st->free_list_mutex)
@@ -1269,10 +1530,11 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
 
     assert(ca != NULL);
 
-    thread_mutex_init(&st->frame_alloc_mutex);
+    thread_mutex_init(&st->mapping_mutex);
     thread_mutex_init(&st->free_list_mutex);
-    thread_mutex_init(&st->vnode_mutex);
     thread_mutex_init(&st->region_mutex);
+    thread_mutex_init(&st->vnode_mutex);
+    memset(st->vnode_cache, 0, sizeof(st->vnode_cache));
     st->slot_alloc = ca;
     st->start_addr = start_vaddr;
 
@@ -1297,12 +1559,19 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
     }
     RB_INIT(&st->region_tree);
     RB_INIT(&st->mapping_tree);
+    RB_INIT(&st->child_tree);
 
     for (int i = 0; i < PAGING_ADDR_BITS - BASE_PAGE_BITS + 1; i++) {
         LIST_INIT(&st->free_list[i]);
     }
 
-    st->refilling = false;
+    st->refilling = NULL;
+    st->slab_refills = 0;
+    st->fault_min_pages = PAGING_FAULT_AROUND_MIN_PAGES;
+    st->fault_max_pages = PAGING_FAULT_AROUND_MAX_PAGES;
+    st->fault_window = 0;
+    st->fault_next = 0;
+    memset(st->fault_claims, 0, sizeof(st->fault_claims));
 
     errval_t err;
     struct paging_vnode_node *l0 = NULL;
@@ -1410,19 +1679,10 @@ errval_t paging_init_onthread(struct thread *t)
 
     struct capref frame = NULL_CAP;
 
-
-    THREAD_MUTEX_ENTER_NESTED(&get_current_paging_state()->frame_alloc_mutex)
-    {
-        err = frame_alloc(&frame, EXCEPTION_STACK_SIZE, NULL);
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "paging_init_onthread: frame_alloc failed\n");
-            err = err_push(err, LIB_ERR_FRAME_ALLOC);
-            break;
-        }
-    }
-    THREAD_MUTEX_EXIT(&get_current_paging_state()->frame_alloc_mutex)
+    err = frame_alloc(&frame, EXCEPTION_STACK_SIZE, NULL);
     if (err_is_fail(err)) {
-        return err;
+        DEBUG_ERR(err, "paging_init_onthread: frame_alloc failed\n");
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
     }
 
     err = paging_map_frame(get_current_paging_state(), &t->exception_stack,
@@ -1509,7 +1769,11 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
     }
 
     // Try placeholder
-    err = map_into_placeholder(st, vaddr, frame, bytes, 0, flags_to_attr(flags), false);
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        err = map_into_placeholder(st, vaddr, frame, bytes, 0, flags_to_attr(flags), false);
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
     if (err_is_ok(err)) {
         return SYS_ERR_OK;
     } else if (err != LIB_ERR_PAGING_PLACEHOLDER_NOT_FOUND) {
@@ -1557,6 +1821,174 @@ handle_real_page_fault(enum exception_type type, int subtype, void *addr,
     exit(EXIT_FAILURE);
 }
 
+/**
+ * Populate the placeholder region around a faulting page. The window starts at the page
+ * and is clipped to the region, to the next page that is already mapped and to windows
+ * other faults are populating. It doubles as long as faults hit right after the previous
+ * window, and falls back to the minimum on any other fault.
+ *
+ * The window is claimed in mapping_mutex, but the frame is allocated without holding it,
+ * so that faults elsewhere proceed in the meantime. A fault inside the window of another
+ * thread waits for that thread and faults again.
+ * @param st
+ * @param vaddr  Page-aligned faulting address.
+ * @return
+ */
+static errval_t fault_around(struct paging_state *st, lvaddr_t vaddr)
+{
+    errval_t err = SYS_ERR_OK;
+    struct thread *me = thread_self();
+    struct paging_fault_claim *claim = NULL;
+    bool wait = false;
+    lvaddr_t end = 0;
+
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        struct paging_mapping_node *mapping = find_placeholder(st, vaddr, BASE_PAGE_SIZE);
+        if (mapping == NULL) {
+            err = LIB_ERR_PAGING_PLACEHOLDER_NOT_FOUND;
+            THREAD_MUTEX_BREAK;
+        }
+
+        size_t window = st->fault_min_pages;
+        if (vaddr == st->fault_next) {
+            window = min(st->fault_window * 2, st->fault_max_pages);
+        }
+
+        // Within one L3 table, so that the window is a single child holding its frame,
+        // which paging_decommit() can give back as a whole if the range is aligned
+        end = min(vaddr + window * BASE_PAGE_SIZE,
+                  mapping->addr + BIT(mapping->region->bits));
+        end = min(end, ROUND_UP(vaddr + 1, PAGING_FAULT_AROUND_ALIGN));
+        // Only the children around the page can overlap the window
+        struct paging_mapping_child_node *next = rb_child_nfind(st, vaddr);
+        struct paging_mapping_child_node *prev = rb_child_prev(st, next);
+        if ((next != NULL && next->addr == vaddr)
+            || (prev != NULL && vaddr < prev->addr + prev->bytes)) {
+            THREAD_MUTEX_BREAK;  // mapped by another thread in the meantime
+        }
+        if (next != NULL && next->addr < end) {
+            end = next->addr;
+        }
+
+        struct paging_fault_claim *unused = NULL;
+        for (size_t i = 0; i < PAGING_FAULT_MAX_CLAIMS; i++) {
+            struct paging_fault_claim *c = &st->fault_claims[i];
+            if (c->owner == NULL) {
+                unused = c;
+            } else if (c->start <= vaddr && vaddr < c->end) {
+                if (c->owner == me) {
+                    // Touched while allocating the frame of the window, which keeps the
+                    // part before the page
+                    c->end = vaddr;
+                } else {
+                    wait = true;
+                    break;
+                }
+            } else if (c->start > vaddr && c->start < end) {
+                end = c->start;
+            }
+        }
+        if (wait || unused == NULL) {
+            wait = true;
+            THREAD_MUTEX_BREAK;
+        }
+
+        claim = unused;
+        claim->start = vaddr;
+        claim->end = end;
+        claim->owner = me;
+        st->fault_window = (end - vaddr) / BASE_PAGE_SIZE;
+        st->fault_next = end;
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
+    if (claim == NULL) {
+        if (wait) {
+            // Let the other thread populate the page, and fault again if it has not yet
+            thread_yield();
+        }
+        return err;
+    }
+
+    size_t bytes = end - vaddr;
+    struct capref frame = NULL_CAP;
+    err = frame_alloc(&frame, bytes, NULL);
+    if (err_is_fail(err) && bytes > BASE_PAGE_SIZE) {
+        // Memory is tight, just the faulting page then
+        bytes = BASE_PAGE_SIZE;
+        err = frame_alloc(&frame, bytes, NULL);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging: fault_around: frame_alloc failed\n");
+    }
+
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        if (err_is_ok(err)) {
+            // A nested fault may have cut the window short
+            bytes = min(bytes, claim->end - claim->start);
+            if (bytes > 0) {
+                err = map_into_placeholder(st, vaddr, frame, bytes, 0,
+                                           flags_to_attr(VREGION_FLAGS_READ_WRITE), true);
+            }
+            if (bytes == 0 || err_is_fail(err)) {
+                cap_destroy(frame);
+            }
+        }
+        claim->owner = NULL;
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
+    return err;
+}
+
+errval_t paging_decommit(struct paging_state *st, lvaddr_t vaddr, size_t bytes)
+{
+    errval_t err = SYS_ERR_OK;
+    const lvaddr_t end = vaddr + bytes;
+
+    // Serializes against fault_around(), which populates the same children
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        // Only windows populated on page faults own their frame, they are children of
+        // placeholders, and are given back if they fit entirely
+        struct paging_mapping_child_node *child, *next;
+        for (child = rb_child_nfind(st, vaddr); child != NULL && child->addr < end;
+             child = next) {
+            next = (struct paging_mapping_child_node *)RB_NEXT(
+                paging_rb_tree, &st->child_tree, (struct paging_rb_tree_node *)child);
+            if (capref_is_null(child->self_paging_frame_cap)
+                || child->addr + child->bytes > end) {
+                continue;
+            }
+            LIST_REMOVE(child, link);
+            err = unmap_and_delete_mapping_child(st, child);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+
+        if (vaddr <= st->fault_next && st->fault_next < end) {
+            st->fault_next = 0;
+        }
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
+    return err;
+}
+
+void paging_set_fault_around(struct paging_state *st, size_t min_pages, size_t max_pages)
+{
+    assert(min_pages > 0 && min_pages <= max_pages);
+    assert(max_pages <= PAGING_FAULT_AROUND_MAX_PAGES);
+    THREAD_MUTEX_ENTER_NESTED(&st->mapping_mutex)
+    {
+        st->fault_min_pages = min_pages;
+        st->fault_max_pages = max_pages;
+        st->fault_window = 0;
+        st->fault_next = 0;
+    }
+    THREAD_MUTEX_EXIT(&st->mapping_mutex)
+}
+
 static void page_fault_handler(enum exception_type type, int subtype, void *addr,
                                arch_registers_state_t *regs)
 {
@@ -1569,21 +2001,8 @@ static void page_fault_handler(enum exception_type type, int subtype, void *addr
             handle_real_page_fault(type, subtype, addr, regs);
         }
 
-        errval_t err;
-        struct capref frame = NULL_CAP;
-
-        THREAD_MUTEX_ENTER_NESTED(&get_current_paging_state()->frame_alloc_mutex)
-        {
-            err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
-            if (err_is_fail(err)) {
-                USER_PANIC_ERR(err, "paging_page_fault_handler: frame_alloc failed\n");
-            }
-        }
-        THREAD_MUTEX_EXIT(&get_current_paging_state()->frame_alloc_mutex)
-
-        err = map_into_placeholder(
-            get_current_paging_state(), ROUND_DOWN((lvaddr_t)addr, BASE_PAGE_SIZE), frame,
-            BASE_PAGE_SIZE, 0, flags_to_attr(VREGION_FLAGS_READ_WRITE), true);
+        errval_t err = fault_around(get_current_paging_state(),
+                                    ROUND_DOWN((lvaddr_t)addr, BASE_PAGE_SIZE));
         if (err_is_fail(err)) {
             // XXX: the frame capability may or may not be stored yet, ignore it for now
             handle_real_page_fault(type, subtype, addr, regs);
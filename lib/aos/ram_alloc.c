@@ -16,9 +16,241 @@
 #include <aos/aos_rpc.h>
 #include <aos/core_state.h>
 
+/// Requests up to this size and alignment are carved out of the pool
+#define RAM_POOL_MAX_REQUEST (64 * 1024)
+
+/// Size of the chunks the pool requests from the memory server
+#define RAM_POOL_CHUNK_SIZE (4 * 1024 * 1024)
+
+/// The next chunk is requested once less than this is left in the current one
+#define RAM_POOL_LOW_WATERMARK (RAM_POOL_CHUNK_SIZE / 4)
+
+#define RAM_POOL_CHUNK_PAGES (RAM_POOL_CHUNK_SIZE / BASE_PAGE_SIZE)
+
+/**
+ * Replaced chunks waiting for their memory to be freed. If all are taken, the oldest one
+ * is given up: the caps retyped from it stay valid, but the rest of it is leaked, and it
+ * never goes back to the server.
+ */
+#define RAM_POOL_OLD_CHUNKS 8
+
+/// A chunk of the pool, with the pages handed out of it that are not freed yet
+struct ram_pool_chunk {
+    struct capref cap;              ///< NULL_CAP if unused
+    genpaddr_t base;
+    size_t used_pages;
+    uint64_t used[RAM_POOL_CHUNK_PAGES / 64];
+};
+
+/**
+ * Pool of RAM in front of the memory server, so that small allocations (single pages for
+ * the page fault handler, for example) are retyped locally instead of costing a round
+ * trip each. The next chunk is requested asynchronously before the current one runs out.
+ * A replaced chunk goes back to the server, with its unused rest, once all memory carved
+ * out of it is freed with ram_free().
+ */
+static struct ram_pool {
+    struct thread_mutex mutex;
+    struct ram_pool_chunk chunk;    ///< Current chunk, NULL_CAP until the first arrives
+    size_t offset;                  ///< Bytes of the chunk handed out so far
+    struct ram_pool_chunk old[RAM_POOL_OLD_CHUNKS];
+    size_t old_next;                ///< Slot of old the next replaced chunk goes to
+    bool refilling;                 ///< The next chunk is requested with refill
+    struct aos_chan_future refill;
+} ram_pool;
+
+/// Mark the pages of [base, base + bytes) in chunk as handed out or freed
+static void ram_pool_chunk_mark(struct ram_pool_chunk *chunk, genpaddr_t base,
+                                gensize_t bytes, bool used)
+{
+    size_t first = (base - chunk->base) / BASE_PAGE_SIZE;
+    size_t last = MIN((base + bytes - chunk->base) / BASE_PAGE_SIZE, RAM_POOL_CHUNK_PAGES);
+    for (size_t i = first; i < last; i++) {
+        uint64_t bit = 1ULL << (i % 64);
+        if (!!(chunk->used[i / 64] & bit) != used) {
+            chunk->used[i / 64] ^= bit;
+            chunk->used_pages += used ? 1 : -1;
+        }
+    }
+}
+
+static struct ram_pool_chunk *ram_pool_find(genpaddr_t base)
+{
+    if (!capref_is_null(ram_pool.chunk.cap) && base >= ram_pool.chunk.base
+        && base < ram_pool.chunk.base + RAM_POOL_CHUNK_SIZE) {
+        return &ram_pool.chunk;
+    }
+    for (size_t i = 0; i < RAM_POOL_OLD_CHUNKS; i++) {
+        struct ram_pool_chunk *old = &ram_pool.old[i];
+        if (!capref_is_null(old->cap) && base >= old->base
+            && base < old->base + RAM_POOL_CHUNK_SIZE) {
+            return old;
+        }
+    }
+    return NULL;
+}
+
+/// Give a chunk back to the memory server, which revokes everything retyped from it
+static void ram_pool_return_chunk(struct capref cap)
+{
+    errval_t err = aos_rpc_free_ram_cap(aos_rpc_get_memory_channel(), cap);
+    if (err_is_ok(err)) {
+        slot_free(cap);
+    } else {
+        DEBUG_ERR(err, "ram_pool: failed to return a chunk\n");
+        cap_destroy(cap);
+    }
+}
+
+static errval_t ram_pool_request_chunk(void)
+{
+    struct aos_rpc_msg_ram msg = { .size = RAM_POOL_CHUNK_SIZE,
+                                   .alignment = RAM_POOL_MAX_REQUEST };
+    aos_chan_future_init(&ram_pool.refill, NOP_CLOSURE);
+    errval_t err = aos_rpc_call_async(aos_rpc_get_memory_channel(), RPC_RAM_REQUEST,
+                                      NULL_CAP, &msg, sizeof(msg), &ram_pool.refill);
+    ram_pool.refilling = err_is_ok(err);  // otherwise requested again later
+    return err;
+}
+
+static errval_t ram_pool_next_chunk(void)
+{
+    errval_t err;
+    if (!ram_pool.refilling) {
+        err = ram_pool_request_chunk();
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    err = aos_rpc_wait(aos_rpc_get_memory_channel(), &ram_pool.refill);
+    ram_pool.refilling = false;
+    free(ram_pool.refill.ret_buf);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    assert(!capref_is_null(ram_pool.refill.ret_cap));
+
+    struct capability c;
+    err = cap_direct_identify(ram_pool.refill.ret_cap, &c);
+    if (err_is_fail(err)) {
+        cap_destroy(ram_pool.refill.ret_cap);
+        return err_push(err, LIB_ERR_CAP_IDENTIFY);
+    }
+
+    // The old chunk waits for the memory carved out of it, unless nothing is left
+    struct ram_pool_chunk *old = &ram_pool.chunk;
+    if (!capref_is_null(old->cap)) {
+        if (old->used_pages == 0) {
+            ram_pool_return_chunk(old->cap);
+        } else {
+            // Slots are taken in turn, so one still taken holds the oldest chunk
+            struct ram_pool_chunk *slot = &ram_pool.old[ram_pool.old_next];
+            if (!capref_is_null(slot->cap)) {
+                cap_destroy(slot->cap);  // leaks the rest of it, see RAM_POOL_OLD_CHUNKS
+            }
+            *slot = *old;
+            ram_pool.old_next = (ram_pool.old_next + 1) % RAM_POOL_OLD_CHUNKS;
+        }
+    }
+
+    memset(&ram_pool.chunk, 0, sizeof(ram_pool.chunk));
+    ram_pool.chunk.cap = ram_pool.refill.ret_cap;
+    ram_pool.chunk.base = get_address(&c);
+    ram_pool.offset = 0;
+    return SYS_ERR_OK;
+}
+
+static errval_t ram_pool_alloc(struct capref *ret, size_t size, size_t alignment)
+{
+    errval_t err;
+    size = ROUND_UP(MAX(size, BASE_PAGE_SIZE), BASE_PAGE_SIZE);
+    alignment = MAX(alignment, BASE_PAGE_SIZE);
+
+    // Before taking the lock, as refilling the slot allocator may allocate RAM
+    err = slot_alloc(ret);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+
+    // Nested in a refill of the pool (or contended), let the caller go to the server
+    if (!thread_mutex_trylock(&ram_pool.mutex)) {
+        slot_free(*ret);
+        return LIB_ERR_RAM_ALLOC;
+    }
+
+    size_t offset = ROUND_UP(ram_pool.offset, alignment);
+    if (capref_is_null(ram_pool.chunk.cap) || offset + size > RAM_POOL_CHUNK_SIZE) {
+        err = ram_pool_next_chunk();
+        if (err_is_fail(err)) {
+            goto unlock;
+        }
+        offset = 0;
+    }
+
+    err = cap_retype(*ret, ram_pool.chunk.cap, offset, ObjType_RAM, size, 1);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_CAP_RETYPE);
+        goto unlock;
+    }
+    ram_pool.offset = offset + size;
+    ram_pool_chunk_mark(&ram_pool.chunk, ram_pool.chunk.base + offset, size, true);
+
+    if (!ram_pool.refilling && RAM_POOL_CHUNK_SIZE - ram_pool.offset < RAM_POOL_LOW_WATERMARK) {
+        ram_pool_request_chunk();
+    }
+
+unlock:
+    thread_mutex_unlock(&ram_pool.mutex);
+    if (err_is_fail(err)) {
+        slot_free(*ret);
+    }
+    return err;
+}
+
+/**
+ * Free memory carved out of the pool. cap is deleted, and its chunk goes back to the
+ * server if it was the last memory handed out of a replaced one.
+ * \return false, leaving cap alone, if the memory is not from the pool
+ */
+static bool ram_pool_free(struct capref cap, genpaddr_t base, gensize_t bytes,
+                          errval_t *ret_err)
+{
+    struct capref chunk_cap = NULL_CAP;
+    bool found = false;
+    THREAD_MUTEX_ENTER(&ram_pool.mutex)
+    {
+        struct ram_pool_chunk *chunk = ram_pool_find(base);
+        if (chunk == NULL) {
+            break;
+        }
+        found = true;
+
+        // Before the chunk can be returned, which revokes what is left of it
+        *ret_err = cap_destroy(cap);
+        ram_pool_chunk_mark(chunk, base, bytes, false);
+        if (chunk != &ram_pool.chunk && chunk->used_pages == 0) {
+            chunk_cap = chunk->cap;
+            chunk->cap = NULL_CAP;
+        }
+    }
+    THREAD_MUTEX_EXIT(&ram_pool.mutex)
+
+    if (!capref_is_null(chunk_cap)) {
+        ram_pool_return_chunk(chunk_cap);
+    }
+    return found;
+}
+
 /* remote (indirect through a channel) version of ram_alloc, for most domains */
 static errval_t ram_alloc_remote(struct capref *ret, size_t size, size_t alignment)
 {
+    if (size <= RAM_POOL_MAX_REQUEST && alignment <= RAM_POOL_MAX_REQUEST) {
+        errval_t err = ram_pool_alloc(ret, size, alignment);
+        if (err_is_ok(err)) {
+            return SYS_ERR_OK;
+        }
+    }
     return aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(), size, alignment, ret, NULL);
 }
 
@@ -96,6 +328,37 @@ errval_t ram_alloc(struct capref *ret, size_t size)
     return ram_alloc_aligned(ret, size, BASE_PAGE_SIZE);
 }
 
+/**
+ * \brief Free RAM allocated with ram_alloc(), or a Frame retyped from it
+ *
+ * The memory goes back to the memory server if it was handed out as a whole. Memory
+ * carved out of the pool goes back with its chunk, once all of the chunk is freed.
+ * Memory allocated by a local allocator is only given up.
+ *
+ * \param cap RAM or Frame cap, deleted and its slot freed
+ */
+errval_t ram_free(struct capref cap)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    if (ram_alloc_state->ram_alloc_func == ram_alloc_remote) {
+        struct capability c;
+        errval_t err = cap_direct_identify(cap, &c);
+        if (err_is_ok(err) && ram_pool_free(cap, get_address(&c), get_size(&c), &err)) {
+            return err;
+        }
+        if (err_is_ok(err)) {
+            // The server revokes the memory, which deletes our copy as well
+            err = aos_rpc_free_ram_cap(aos_rpc_get_memory_channel(), cap);
+            if (err_is_ok(err)) {
+                slot_free(cap);
+                return SYS_ERR_OK;
+            }
+        }
+    }
+
+    return cap_destroy(cap);
+}
+
 errval_t ram_available(genpaddr_t *available, genpaddr_t *total)
 {
     // TODO: Implement protocol to check amount of ram available with memserv
@@ -116,6 +379,13 @@ void ram_alloc_init(void)
     ram_alloc_state->default_minbase  = 0;
     ram_alloc_state->default_maxlimit = 0;
     ram_alloc_state->base_capnum      = 0;
+
+    thread_mutex_init(&ram_pool.mutex);
+    memset(&ram_pool.chunk, 0, sizeof(ram_pool.chunk));  // NULL_CAP is all 0
+    memset(ram_pool.old, 0, sizeof(ram_pool.old));
+    ram_pool.old_next = 0;
+    ram_pool.offset = 0;
+    ram_pool.refilling = false;
 }
 
 /**
@@ -21,6 +21,31 @@ static void aos_chan_generic_init(struct aos_chan *chan) {
     chan->handler = NULL;
     chan->arg = NULL;
     thread_mutex_init(&chan->mutex);
+    chan->pending = NULL;
+    chan->pending_count = 0;
+    chan->next_request_id = RPC_REQUEST_ID_NONE + 1;
+    chan->async_ws = NULL;
+    chan->ump_large_sender = NULL;
+
+    thread_mutex_init(&chan->lmp_pool.mutex);
+    chan->lmp_pool.tx_frame = NULL_CAP;
+    chan->lmp_pool.tx = NULL;
+    chan->lmp_pool.tx_ready = false;
+    chan->lmp_pool.tx_setting_up = false;
+    chan->lmp_pool.tx_next = 0;
+    chan->lmp_pool.rx_frame = NULL_CAP;
+    chan->lmp_pool.rx = NULL;
+
+    thread_mutex_init(&chan->lmp_train.send_mutex);
+    chan->lmp_train.recv_buf = NULL;
+    chan->lmp_train.recv_size = 0;
+    chan->lmp_train.recv_received = 0;
+    chan->lmp_train.recv_request_id = RPC_REQUEST_ID_NONE;
+    chan->lmp_train.recv_cap = NULL_CAP;
+
+#if AOS_CHAN_STATS
+    memset(&chan->stats, 0, sizeof(chan->stats));
+#endif
 }
 
 void aos_chan_lmp_init(struct aos_chan *chan)
@@ -43,7 +68,7 @@ errval_t aos_chan_lmp_accept(struct aos_chan *chan, size_t buflen_words,
     assert(chan->lc.connstate == LMP_CONNECTED);
 
     // Send the local endpoint to the other side to finish binding
-    err = rpc_lmp_call(chan, RPC_ACK, chan->lc.local_cap, NULL, 0, NULL, NULL, NULL, false);
+    err = aos_chan_call(chan, RPC_ACK, chan->lc.local_cap, NULL, 0, NULL, NULL, NULL);
     return err;
 }
 
@@ -75,6 +100,7 @@ void aos_chan_destroy(struct aos_chan *chan)
 {
     switch (chan->type) {
     case AOS_CHAN_TYPE_LMP:
+        rpc_lmp_chan_destroy(chan);
         lmp_chan_destroy(&chan->lc);
         break;
     case AOS_CHAN_TYPE_UMP:
@@ -131,22 +157,319 @@ bool aos_chan_can_recv(struct aos_chan *chan) {
     }
 }
 
-errval_t aos_chan_call(struct aos_chan *chan, rpc_identifier_t identifier,
-                      struct capref call_cap, const void *call_buf, size_t call_size,
-                      struct capref *ret_cap, void **ret_buf, size_t *ret_size)
+void aos_chan_add_pending(struct aos_chan *chan, struct aos_chan_future *future)
+{
+    // Pick the next ID that is not in flight, skipping RPC_REQUEST_ID_NONE
+    bool in_use;
+    do {
+        future->id = chan->next_request_id++;
+        if (chan->next_request_id == RPC_REQUEST_ID_NONE) {
+            chan->next_request_id++;
+        }
+        in_use = false;
+        for (struct aos_chan_future *f = chan->pending; f != NULL; f = f->next) {
+            if (f->id == future->id) {
+                in_use = true;
+                break;
+            }
+        }
+    } while (in_use);
+
+    future->done = false;
+    future->next = NULL;
+    struct aos_chan_future **tail = &chan->pending;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = future;
+    chan->pending_count++;
+}
+
+struct aos_chan_future *aos_chan_take_pending(struct aos_chan *chan, rpc_request_id_t id)
+{
+    for (struct aos_chan_future **f = &chan->pending; *f != NULL; f = &(*f)->next) {
+        if ((*f)->id == id) {
+            struct aos_chan_future *future = *f;
+            *f = future->next;
+            future->next = NULL;
+            chan->pending_count--;
+            return future;
+        }
+    }
+    return NULL;
+}
+
+void aos_chan_complete(struct aos_chan_future *future)
+{
+    // The future may be gone as soon as it is done
+    struct event_closure closure = future->closure;
+    future->done = true;
+    if (closure.handler != NULL) {
+        closure.handler(closure.arg);
+    }
+}
+
+void aos_chan_future_init(struct aos_chan_future *future, struct event_closure closure)
+{
+    memset(future, 0, sizeof(*future));
+    future->ret_cap = NULL_CAP;
+    future->call_cap = NULL_CAP;
+    future->closure = closure;
+}
+
+void aos_chan_future_destroy(struct aos_chan_future *future)
+{
+    if (future->owns_call_buf) {
+        free(future->call_buf);
+        future->call_buf = NULL;
+        future->owns_call_buf = false;
+    }
+}
+
+static errval_t aos_chan_submit(struct aos_chan *chan, struct aos_chan_future *future,
+                                bool locked)
+{
+    switch (chan->type) {
+    case AOS_CHAN_TYPE_LMP:
+        return rpc_lmp_submit(chan, future, locked);
+    case AOS_CHAN_TYPE_UMP:
+        assert(!locked);
+        return rpc_ump_submit(chan, future);
+    case AOS_CHAN_TYPE_ECHO:
+        return LIB_ERR_NOT_IMPLEMENTED;
+    default:
+        assert(!"unknown aos_chan type");
+    }
+}
+
+errval_t aos_chan_poll_one(struct aos_chan *chan, bool locked, bool *received)
 {
+    errval_t err;
+    struct aos_chan_future *future = NULL;
+
     switch (chan->type) {
     case AOS_CHAN_TYPE_LMP:
-        return rpc_lmp_call(chan, identifier, call_cap, call_buf, call_size, ret_cap,
-                            ret_buf, ret_size, false);
+        err = rpc_lmp_poll(chan, locked, received, &future);
+        break;
     case AOS_CHAN_TYPE_UMP:
-        return rpc_ump_call(chan, identifier, call_cap, call_buf, call_size, ret_cap,
-                            ret_buf, ret_size);
+        err = rpc_ump_poll(chan, locked, received, &future);
+        break;
     case AOS_CHAN_TYPE_ECHO:
         return LIB_ERR_NOT_IMPLEMENTED;
     default:
         assert(!"unknown aos_chan type");
     }
+
+    if (future != NULL) {
+        aos_chan_complete(future);
+    }
+    return err;
+}
+
+static void aos_chan_async_handler(void *arg);
+
+static errval_t aos_chan_async_register_recv(struct aos_chan *chan)
+{
+    errval_t err;
+    switch (chan->type) {
+    case AOS_CHAN_TYPE_LMP:
+        err = lmp_chan_register_recv(&chan->lc, chan->async_ws,
+                                     MKCLOSURE(aos_chan_async_handler, chan));
+        break;
+    case AOS_CHAN_TYPE_UMP:
+        err = ump_chan_register_recv(&chan->uc, chan->async_ws,
+                                     MKCLOSURE(aos_chan_async_handler, chan));
+        break;
+    default:
+        return LIB_ERR_NOT_IMPLEMENTED;
+    }
+    if (err == LIB_ERR_CHAN_ALREADY_REGISTERED) {
+        return SYS_ERR_OK;
+    }
+    return err;
+}
+
+static void aos_chan_async_handler(void *arg)
+{
+    struct aos_chan *chan = arg;
+
+    errval_t err = aos_chan_poll(chan);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "%s: aos_chan_poll failed\n", __func__);
+    }
+
+    if (chan->pending_count != 0) {
+        err = aos_chan_async_register_recv(chan);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "%s: error re-registering handler\n", __func__);
+        }
+    }
+}
+
+errval_t aos_chan_register_async(struct aos_chan *chan, struct waitset *ws)
+{
+    assert(chan->handler == NULL);
+    chan->async_ws = ws;
+    if (chan->pending_count == 0) {
+        return SYS_ERR_OK;  // registered by the next call
+    }
+    return aos_chan_async_register_recv(chan);
+}
+
+errval_t aos_chan_call_async(struct aos_chan *chan, rpc_identifier_t identifier,
+                             struct capref call_cap, const void *call_buf,
+                             size_t call_size, struct aos_chan_future *future)
+{
+    errval_t err;
+
+    future->identifier = identifier;
+    future->call_cap = call_cap;
+    future->call_size = call_size;
+    future->call_buf = NULL;
+    future->owns_call_buf = false;
+    if (call_size != 0) {
+        future->call_buf = malloc(call_size);
+        if (future->call_buf == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        memcpy(future->call_buf, call_buf, call_size);
+        future->owns_call_buf = true;
+    }
+
+    // Bound the calls in flight, so that their replies never block the other end
+    while (chan->pending_count >= AOS_CHAN_MAX_PENDING) {
+        bool received = false;
+        err = aos_chan_poll_one(chan, false, &received);
+        if (err_is_fail(err)) {
+            aos_chan_future_destroy(future);
+            return err;
+        }
+        if (!received) {
+            thread_yield();
+        }
+    }
+
+    return aos_chan_resubmit(chan, future);
+}
+
+errval_t aos_chan_resubmit(struct aos_chan *chan, struct aos_chan_future *future)
+{
+    future->err = SYS_ERR_OK;
+    future->ret_buf = NULL;
+    future->ret_size = 0;
+    future->ret_cap = NULL_CAP;
+
+    errval_t err = aos_chan_submit(chan, future, false);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (chan->async_ws != NULL) {
+        err = aos_chan_async_register_recv(chan);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "aos_chan_resubmit: failed to register async handler\n");
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t aos_chan_poll(struct aos_chan *chan)
+{
+    errval_t err;
+    bool received;
+    do {
+        err = aos_chan_poll_one(chan, false, &received);
+    } while (err_is_ok(err) && received);
+    return err;
+}
+
+static errval_t aos_chan_wait_impl(struct aos_chan *chan, struct aos_chan_future *future,
+                                   bool locked)
+{
+    struct ring_waiter waiter;
+    ring_waiter_init(&waiter);
+    while (!future->done) {
+        bool received = false;
+        errval_t err = aos_chan_poll_one(chan, locked, &received);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (future->done || received) {
+            ring_waiter_init(&waiter);
+        } else if (chan->type == AOS_CHAN_TYPE_UMP) {
+            // spin, then sleep, as the channel is configured to
+            ring_wait(&chan->uc.wait.policy, &waiter);
+        } else {
+            thread_yield();
+        }
+    }
+    return future->err;
+}
+
+errval_t aos_chan_wait(struct aos_chan *chan, struct aos_chan_future *future)
+{
+    return aos_chan_wait_impl(chan, future, false);
+}
+
+static errval_t aos_chan_call_impl(struct aos_chan *chan, rpc_identifier_t identifier,
+                                   struct capref call_cap, const void *call_buf,
+                                   size_t call_size, struct capref *ret_cap,
+                                   void **ret_buf, size_t *ret_size, bool locked)
+{
+    errval_t err;
+
+    // A synchronous call is an asynchronous one waited for right away, so that it can be
+    // made while other calls are in flight. The call buffer is not copied.
+    struct aos_chan_future future;
+    aos_chan_future_init(&future, NOP_CLOSURE);
+    future.identifier = identifier;
+    future.call_cap = call_cap;
+    future.call_buf = (void *)call_buf;
+    future.call_size = call_size;
+
+    err = aos_chan_submit(chan, &future, locked);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = aos_chan_wait_impl(chan, &future, locked);
+    if (!future.done) {
+        // Failed to receive, the future must not outlive this frame
+        THREAD_MUTEX_ENTER_IF(&chan->mutex, !locked)
+        {
+            aos_chan_take_pending(chan, future.id);
+        }
+        THREAD_MUTEX_EXIT_IF(&chan->mutex, !locked)
+        return err;
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (ret_buf) {
+        *ret_buf = future.ret_buf;
+    } else {
+        free(future.ret_buf);
+    }
+    if (ret_size) {
+        *ret_size = future.ret_size;
+    }
+    if (!capref_is_null(future.ret_cap)) {
+        if (ret_cap) {
+            *ret_cap = future.ret_cap;
+        } else {
+            DEBUG_PRINTF("aos_chan_call: received a cap but is given up!\n");
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t aos_chan_call(struct aos_chan *chan, rpc_identifier_t identifier,
+                      struct capref call_cap, const void *call_buf, size_t call_size,
+                      struct capref *ret_cap, void **ret_buf, size_t *ret_size)
+{
+    return aos_chan_call_impl(chan, identifier, call_cap, call_buf, call_size, ret_cap,
+                              ret_buf, ret_size, false);
 }
 
 errval_t aos_chan_send(struct aos_chan *chan, rpc_identifier_t identifier,
@@ -154,9 +477,16 @@ errval_t aos_chan_send(struct aos_chan *chan, rpc_identifier_t identifier,
 {
     switch (chan->type) {
     case AOS_CHAN_TYPE_LMP:
-        return rpc_lmp_send(&chan->lc, identifier, cap, buf, size, non_blocking);
-    case AOS_CHAN_TYPE_UMP:
-        return rpc_ump_send(&chan->uc, identifier, cap, buf, size);
+        return rpc_lmp_send(chan, RPC_REQUEST_ID_NONE, identifier, cap, buf, size,
+                            non_blocking);
+    case AOS_CHAN_TYPE_UMP: {
+        errval_t err = rpc_ump_send(&chan->uc, RPC_REQUEST_ID_NONE, identifier, cap, buf,
+                                    size);
+        if (err_is_ok(err)) {
+            aos_chan_stats_sent(chan, size, cap);
+        }
+        return err;
+    }
     case AOS_CHAN_TYPE_ECHO:
         return LIB_ERR_NOT_IMPLEMENTED;
     default:
@@ -164,6 +494,25 @@ errval_t aos_chan_send(struct aos_chan *chan, rpc_identifier_t identifier,
     }
 }
 
+errval_t aos_chan_ump_try_recv_reply(struct aos_chan *chan, void **ret_buf,
+                                     size_t *ret_size)
+{
+    assert(chan->type == AOS_CHAN_TYPE_UMP);
+
+    rpc_request_id_t request_id;
+    rpc_identifier_t identifier;
+    errval_t reply_err;
+    errval_t err = rpc_ump_recv_reply(&chan->uc, false, &request_id, &identifier, &reply_err,
+                                      ret_buf, ret_size, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    assert(!(identifier & RPC_SPECIAL_CAP_TRANSFER_FLAG));
+    aos_chan_stats_recv(chan, (err_is_ok(reply_err) && ret_buf != NULL) ? *ret_size : 0,
+                        NULL_CAP);
+    return reply_err;
+}
+
 errval_t aos_chan_ack(struct aos_chan *chan, struct capref cap, const void *buf,
                       size_t size)
 {
@@ -175,6 +524,15 @@ errval_t aos_chan_nack(struct aos_chan *chan, errval_t err)
     return aos_chan_send(chan, RPC_ERR, NULL_CAP, &err, sizeof(errval_t), false);
 }
 
+void aos_chan_get_stats(struct aos_chan *chan, struct aos_chan_stats *ret)
+{
+#if AOS_CHAN_STATS
+    *ret = chan->stats;
+#else
+    memset(ret, 0, sizeof(*ret));
+#endif
+}
+
 bool aos_chan_is_connected(struct aos_chan *chan) {
     switch (chan->type) {
     case AOS_CHAN_TYPE_UNKNOWN:
@@ -7,19 +7,221 @@
 #include <aos/domain.h>
 #include <string.h>
 
+// A single message is [size][request ID][identifier][payload], a message in frame carries
+// [size_t size][identifier][payload] in the frame and keeps the request ID in the words.
+// A fragment of a train is [used size | first flag][request ID][RPC_MSG_FRAGMENT][data], and
+// the data of the first fragment starts with [uint16_t total size][identifier].
 typedef uint8_t lmp_single_msg_size_t;
 
-#define LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE                                                  \
-    (LMP_MSG_LENGTH * sizeof(uintptr_t) - sizeof(lmp_single_msg_size_t)                  \
-     - sizeof(rpc_identifier_t))
+#define LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE RPC_LMP_INLINE_PAYLOAD_SIZE
 
+#define LMP_SINGLE_MSG_HEADER_SIZE                                                       \
+    (sizeof(lmp_single_msg_size_t) + sizeof(rpc_request_id_t) + sizeof(rpc_identifier_t))
+
+STATIC_ASSERT(LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE + LMP_SINGLE_MSG_HEADER_SIZE
+                  == LMP_MSG_LENGTH * sizeof(uintptr_t),
+              "RPC_LMP_INLINE_PAYLOAD_SIZE mismatch");
 STATIC_ASSERT(LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE
                   <= (1 << (sizeof(lmp_single_msg_size_t) * 8)),
               "lmp_single_msg_size_t too small");
 
-errval_t rpc_lmp_serialize(rpc_identifier_t identifier, struct capref cap, const void *buf,
-                       size_t size, uintptr_t ret_payload[LMP_MSG_LENGTH],
-                       struct capref *ret_cap, struct lmp_helper *helper)
+#define LMP_REQUEST_ID(words)                                                            \
+    CAST_DEREF(rpc_request_id_t, words, sizeof(lmp_single_msg_size_t))
+
+#define LMP_IDENTIFIER(words)                                                            \
+    CAST_DEREF(rpc_identifier_t, words,                                                  \
+               sizeof(lmp_single_msg_size_t) + sizeof(rpc_request_id_t))
+
+#define LMP_FRAG_FIRST_FLAG 0x80
+#define LMP_FRAG_SIZE_MASK 0x7F
+#define LMP_FRAG_FIRST_HEADER_SIZE (sizeof(uint16_t) + sizeof(rpc_identifier_t))
+
+STATIC_ASSERT(LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE <= LMP_FRAG_SIZE_MASK,
+              "fragment size overlaps LMP_FRAG_FIRST_FLAG");
+STATIC_ASSERT(RPC_LMP_TRAIN_MAX_PAYLOAD_SIZE <= UINT16_MAX, "train size too large");
+
+/// Header of a slot in the frame pool, the identifier is right before the payload
+struct rpc_lmp_pool_slot {
+    volatile uint32_t busy;  ///< Set by the sender, cleared by the receiver once handled
+    uint32_t size;
+    uint8_t reserved[7];
+    rpc_identifier_t identifier;
+    uint8_t payload[];
+};
+
+#define RPC_LMP_POOL_SIZE (RPC_LMP_POOL_SLOTS * RPC_LMP_POOL_SLOT_SIZE)
+
+#define RPC_LMP_POOL_SLOT_MAX_PAYLOAD_SIZE                                               \
+    (RPC_LMP_POOL_SLOT_SIZE - sizeof(struct rpc_lmp_pool_slot))
+
+STATIC_ASSERT(sizeof(struct rpc_lmp_pool_slot) == 16, "rpc_lmp_pool_slot layout");
+
+// A message in the pool carries the slot index in the second word
+#define LMP_POOL_SLOT_INDEX(words) CAST_DEREF(uint32_t, words, sizeof(uintptr_t))
+
+static inline struct rpc_lmp_pool_slot *pool_slot(uint8_t *pool, size_t index)
+{
+    return (struct rpc_lmp_pool_slot *)OFFSET(pool, index * RPC_LMP_POOL_SLOT_SIZE);
+}
+
+/**
+ * Allocate the tx pool of the channel and announce it to the other end. Failing is not
+ * fatal, the message then goes through a fresh frame.
+ */
+static errval_t pool_setup(struct aos_chan *chan)
+{
+    struct rpc_lmp_pool *pool = &chan->lmp_pool;
+    errval_t err = SYS_ERR_OK;
+
+    bool setup = false;
+    THREAD_MUTEX_ENTER(&pool->mutex)
+    {
+        if (!pool->tx_ready && !pool->tx_setting_up) {
+            pool->tx_setting_up = true;
+            setup = true;
+        }
+    }
+    THREAD_MUTEX_EXIT(&pool->mutex)
+    if (!setup) {
+        return SYS_ERR_OK;  // ready or being set up by another thread
+    }
+
+    // Allocation may trigger RPC calls on this channel, so don't hold the mutex
+    if (pool->tx == NULL) {
+        struct capref frame;
+        err = frame_alloc(&frame, RPC_LMP_POOL_SIZE, NULL);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_FRAME_ALLOC);
+            goto DONE;
+        }
+
+        uint8_t *addr;
+        err = paging_map_frame(get_current_paging_state(), (void **)&addr,
+                               RPC_LMP_POOL_SIZE, frame);
+        if (err_is_fail(err)) {
+            cap_destroy(frame);
+            err = err_push(err, LIB_ERR_PAGING_MAP);
+            goto DONE;
+        }
+        memset(addr, 0, RPC_LMP_POOL_SIZE);
+
+        pool->tx_frame = frame;
+        pool->tx = addr;
+        pool->tx_next = 0;
+    }
+
+    // Never wait here, the other end may be blocked on sending to us. Retry next time.
+    uintptr_t words[LMP_MSG_LENGTH] = { 0 };
+    LMP_REQUEST_ID(words) = RPC_REQUEST_ID_NONE;
+    LMP_IDENTIFIER(words) = RPC_LMP_POOL_SETUP;
+    err = lmp_try_send(&chan->lc, words, pool->tx_frame, true);
+
+DONE:
+    THREAD_MUTEX_ENTER(&pool->mutex)
+    {
+        pool->tx_ready = err_is_ok(err);
+        pool->tx_setting_up = false;
+    }
+    THREAD_MUTEX_EXIT(&pool->mutex)
+    return err;
+}
+
+/**
+ * Take a free slot of the tx pool.
+ * @return NULL if the pool is not ready or all slots are in use.
+ */
+static struct rpc_lmp_pool_slot *pool_take_slot(struct aos_chan *chan, uint32_t *ret_index)
+{
+    struct rpc_lmp_pool *pool = &chan->lmp_pool;
+    struct rpc_lmp_pool_slot *slot = NULL;
+
+    THREAD_MUTEX_ENTER(&pool->mutex)
+    {
+        if (pool->tx_ready) {
+            for (size_t i = 0; i < RPC_LMP_POOL_SLOTS; i++) {
+                size_t index = (pool->tx_next + i) % RPC_LMP_POOL_SLOTS;
+                struct rpc_lmp_pool_slot *s = pool_slot(pool->tx, index);
+                if (s->busy == 0) {
+                    s->busy = 1;
+                    pool->tx_next = (index + 1) % RPC_LMP_POOL_SLOTS;
+                    *ret_index = index;
+                    slot = s;
+                    break;
+                }
+            }
+        }
+    }
+    THREAD_MUTEX_EXIT(&pool->mutex)
+    return slot;
+}
+
+static void pool_destroy(struct aos_chan *chan)
+{
+    struct rpc_lmp_pool *pool = &chan->lmp_pool;
+    errval_t err;
+
+    if (pool->tx != NULL) {
+        err = paging_unmap(get_current_paging_state(), pool->tx);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "rpc_lmp_chan_destroy: failed to unmap tx pool\n");
+        }
+        cap_destroy(pool->tx_frame);
+        pool->tx = NULL;
+        pool->tx_frame = NULL_CAP;
+    }
+    if (pool->rx != NULL) {
+        err = paging_unmap(get_current_paging_state(), pool->rx);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "rpc_lmp_chan_destroy: failed to unmap rx pool\n");
+        }
+        cap_destroy(pool->rx_frame);
+        pool->rx = NULL;
+        pool->rx_frame = NULL_CAP;
+    }
+    pool->tx_ready = false;
+}
+
+static void serialize_fragment(struct lmp_helper *helper, rpc_request_id_t request_id,
+                               uintptr_t ret_payload[LMP_MSG_LENGTH])
+{
+    uint8_t *data = OFFSET(ret_payload, LMP_SINGLE_MSG_HEADER_SIZE);
+    size_t space = LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE;
+    lmp_single_msg_size_t flag = 0;
+
+    if (helper->train_sent == 0) {
+        uint16_t total = helper->train_size;
+        memcpy(data, &total, sizeof(total));
+        data[sizeof(total)] = helper->train_identifier;
+        data += LMP_FRAG_FIRST_HEADER_SIZE;
+        space -= LMP_FRAG_FIRST_HEADER_SIZE;
+        flag = LMP_FRAG_FIRST_FLAG;
+    }
+
+    size_t n = MIN(space, helper->train_size - helper->train_sent);
+    memcpy(data, helper->train_buf + helper->train_sent, n);
+    helper->train_sent += n;
+
+    CAST_DEREF(lmp_single_msg_size_t, ret_payload, 0)
+        = flag | (lmp_single_msg_size_t)(LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE - space + n);
+    LMP_REQUEST_ID(ret_payload) = request_id;
+    LMP_IDENTIFIER(ret_payload) = RPC_MSG_FRAGMENT;
+}
+
+bool rpc_lmp_serialize_next(struct lmp_helper *helper, rpc_request_id_t request_id,
+                            uintptr_t ret_payload[LMP_MSG_LENGTH])
+{
+    if (helper->train_buf == NULL || helper->train_sent == helper->train_size) {
+        return false;
+    }
+    serialize_fragment(helper, request_id, ret_payload);
+    return true;
+}
+
+errval_t rpc_lmp_serialize(struct aos_chan *chan, rpc_request_id_t request_id,
+                           rpc_identifier_t identifier, struct capref cap, const void *buf,
+                           size_t size,
+                           uintptr_t ret_payload[LMP_MSG_LENGTH], struct capref *ret_cap,
+                           struct lmp_helper *helper)
 {
     if (buf == NULL && size != 0) {
         return ERR_INVALID_ARGS;
@@ -27,67 +229,199 @@ errval_t rpc_lmp_serialize(rpc_identifier_t identifier, struct capref cap, const
     errval_t err;
     helper->payload_frame = NULL_CAP;
     helper->mapped_frame = NULL;
+    helper->pool_slot = NULL;
+    helper->reassembled = NULL;
+    helper->train_buf = NULL;
 
     if (size <= LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE) {  // buffer fits in the remaining space
         CAST_DEREF(lmp_single_msg_size_t, ret_payload, 0) = (lmp_single_msg_size_t)size;
-        CAST_DEREF(rpc_identifier_t, ret_payload, sizeof(lmp_single_msg_size_t))
-            = identifier;
-        memcpy(
-            OFFSET(ret_payload, sizeof(lmp_single_msg_size_t) + sizeof(rpc_identifier_t)),
-            buf, size);
+        LMP_REQUEST_ID(ret_payload) = request_id;
+        LMP_IDENTIFIER(ret_payload) = identifier;
+        memcpy(OFFSET(ret_payload, LMP_SINGLE_MSG_HEADER_SIZE), buf, size);
         *ret_cap = cap;
+        return SYS_ERR_OK;
+    }
 
-    } else {
-        // Buffer doesn't fit, make and map frame cap
+    if (size <= RPC_LMP_TRAIN_MAX_PAYLOAD_SIZE) {
+        helper->train_buf = buf;
+        helper->train_size = size;
+        helper->train_sent = 0;
+        helper->train_identifier = identifier;
+        serialize_fragment(helper, request_id, ret_payload);
+        *ret_cap = cap;  // goes with the first fragment
+        return SYS_ERR_OK;
+    }
+
+    if (size <= RPC_LMP_POOL_SLOT_MAX_PAYLOAD_SIZE
+        && chan->lc.connstate == LMP_CONNECTED) {
+        if (!chan->lmp_pool.tx_ready) {
+            err = pool_setup(chan);
+            if (err_is_fail(err) && !lmp_err_is_transient(err)) {
+                DEBUG_ERR(err, "rpc_lmp_serialize: failed to set up the frame pool\n");
+            }
+        }
+
+        uint32_t index;
+        struct rpc_lmp_pool_slot *slot = pool_take_slot(chan, &index);
+        if (slot != NULL) {
+            slot->size = size;
+            // Put identifier before actual payload, consistent with single message
+            slot->identifier = identifier;
+            memcpy(slot->payload, buf, size);
+
+            CAST_DEREF(lmp_single_msg_size_t, ret_payload, 0) = 0;
+            LMP_REQUEST_ID(ret_payload) = request_id;
+            LMP_IDENTIFIER(ret_payload) = RPC_MSG_IN_POOL;
+            LMP_POOL_SLOT_INDEX(ret_payload) = index;
+
+            *ret_cap = cap;  // the cap slot is still free
+            helper->pool_slot = &slot->busy;  // released by cleanup if never sent
+            return SYS_ERR_OK;
+        }
+        // Otherwise all slots are in flight, fall back to a fresh frame
+    }
+
+    // Buffer doesn't fit, make and map frame cap
 #if 0
-        DEBUG_PRINTF("rpc_lmp_serialize: alloc frame\n");
+    DEBUG_PRINTF("rpc_lmp_serialize: alloc frame\n");
 #endif
 
-        size_t rounded_size = ROUND_UP(size + sizeof(size_t) + sizeof(rpc_identifier_t),
-                                       BASE_PAGE_SIZE);
+    size_t rounded_size = ROUND_UP(size + sizeof(size_t) + sizeof(rpc_identifier_t),
+                                   BASE_PAGE_SIZE);
 
-        struct capref frame_cap;
-        err = frame_alloc(&frame_cap, rounded_size, NULL);
-        if (err_is_fail(err)) {
-            err_push(err, LIB_ERR_FRAME_ALLOC);
-        }
+    struct capref frame_cap;
+    err = frame_alloc(&frame_cap, rounded_size, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
 
-        uint8_t *addr;
-        err = paging_map_frame(get_current_paging_state(), (void **)&addr, rounded_size,
-                               frame_cap);
-        if (err_is_fail(err)) {
-            err_push(err, LIB_ERR_PAGING_MAP);
-        }
+    uint8_t *addr;
+    err = paging_map_frame(get_current_paging_state(), (void **)&addr, rounded_size,
+                           frame_cap);
+    if (err_is_fail(err)) {
+        cap_destroy(frame_cap);
+        return err_push(err, LIB_ERR_PAGING_MAP);
+    }
+
+    CAST_DEREF(size_t, addr, 0) = size;
+    // Put identifier before actual payload, consistent with single message
+    CAST_DEREF(rpc_identifier_t, addr, sizeof(size_t)) = identifier;
+    memcpy(OFFSET(addr, sizeof(size_t) + sizeof(rpc_identifier_t)), buf, size);
+
+    // Replace the size and the identifier
+    CAST_DEREF(lmp_single_msg_size_t, ret_payload, 0) = 0;
+    LMP_REQUEST_ID(ret_payload) = request_id;
+    LMP_IDENTIFIER(ret_payload) = RPC_MSG_IN_FRAME;
+
+    if (!capref_is_null(cap)) {
+        DEBUG_PRINTF("rpc_lmp_serialize: the cap is dropped as the payload is in a frame\n");
+    }
+    *ret_cap = frame_cap;
+
+    helper->payload_frame = frame_cap;
+    helper->mapped_frame = addr;
+
+    return SYS_ERR_OK;
+}
+
+static void train_reset(struct rpc_lmp_train *train)
+{
+    free(train->recv_buf);
+    train->recv_buf = NULL;
+    if (!capref_is_null(train->recv_cap)) {
+        cap_destroy(train->recv_cap);
+        train->recv_cap = NULL_CAP;
+    }
+}
+
+static errval_t deserialize_fragment(struct aos_chan *chan, struct lmp_recv_msg *recv_msg,
+                                     struct capref *recv_cap_ptr, rpc_identifier_t *ret_type,
+                                     uint8_t **ret_buf, size_t *ret_size,
+                                     struct lmp_helper *helper)
+{
+    struct rpc_lmp_train *train = &chan->lmp_train;
+    lmp_single_msg_size_t header = CAST_DEREF(lmp_single_msg_size_t, recv_msg->words, 0);
+    rpc_request_id_t request_id = LMP_REQUEST_ID(recv_msg->words);
+    uint8_t *data = OFFSET(recv_msg->words, LMP_SINGLE_MSG_HEADER_SIZE);
+    size_t n = header & LMP_FRAG_SIZE_MASK;
+
+    if (n > LMP_SINGLE_MSG_MAX_PAYLOAD_SIZE) {
+        train_reset(train);
+        return LIB_ERR_RPC_INVALID_MSG;
+    }
 
-        CAST_DEREF(size_t, addr, 0) = size;
-        // Put identifier before actual payload, consistent with single message
-        CAST_DEREF(rpc_identifier_t, addr, sizeof(size_t)) = identifier;
-        memcpy(OFFSET(addr, sizeof(size_t) + sizeof(rpc_identifier_t)), buf, size);
+    if (header & LMP_FRAG_FIRST_FLAG) {
+        if (train->recv_buf != NULL) {
+            DEBUG_PRINTF("rpc_lmp_deserialize: drop incomplete train of request %u\n",
+                         train->recv_request_id);
+            train_reset(train);
+        }
 
-        // Replace the size and the identifier
-        CAST_DEREF(lmp_single_msg_size_t, ret_payload, 0) = 0;
-        CAST_DEREF(rpc_identifier_t, ret_payload, sizeof(lmp_single_msg_size_t))
-            = RPC_MSG_IN_FRAME;
+        uint16_t total;
+        memcpy(&total, data, sizeof(total));
+        if (n < LMP_FRAG_FIRST_HEADER_SIZE || total > RPC_LMP_TRAIN_MAX_PAYLOAD_SIZE) {
+            return LIB_ERR_RPC_INVALID_MSG;
+        }
 
-        *ret_cap = frame_cap;
+        // Keep the identifier right before the payload, consistent with single message
+        train->recv_buf = malloc(sizeof(rpc_identifier_t) + total);
+        if (train->recv_buf == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        train->recv_buf[0] = data[sizeof(total)];
+        train->recv_size = total;
+        train->recv_received = 0;
+        train->recv_request_id = request_id;
+        train->recv_cap = *recv_cap_ptr;
+        *recv_cap_ptr = NULL_CAP;  // handed out with the last fragment
+
+        data += LMP_FRAG_FIRST_HEADER_SIZE;
+        n -= LMP_FRAG_FIRST_HEADER_SIZE;
+
+    } else if (train->recv_buf == NULL || train->recv_request_id != request_id) {
+        DEBUG_PRINTF("rpc_lmp_deserialize: unexpected fragment of request %u\n", request_id);
+        train_reset(train);
+        return LIB_ERR_RPC_INVALID_MSG;
+    }
 
-        helper->payload_frame = frame_cap;
-        helper->mapped_frame = addr;
+    if (train->recv_received + n > train->recv_size) {
+        train_reset(train);
+        return LIB_ERR_RPC_INVALID_MSG;
+    }
+    memcpy(train->recv_buf + sizeof(rpc_identifier_t) + train->recv_received, data, n);
+    train->recv_received += n;
+
+    if (train->recv_received < train->recv_size) {
+        *ret_type = RPC_MSG_FRAGMENT;  // more to come
+        *ret_buf = NULL;
+        *ret_size = 0;
+        return SYS_ERR_OK;
     }
 
+    *ret_type = train->recv_buf[0];
+    *ret_buf = train->recv_buf + sizeof(rpc_identifier_t);
+    *ret_size = train->recv_size;
+    *recv_cap_ptr = train->recv_cap;
+
+    helper->reassembled = train->recv_buf;
+    train->recv_buf = NULL;
+    train->recv_cap = NULL_CAP;
     return SYS_ERR_OK;
 }
 
-errval_t rpc_lmp_deserialize(struct lmp_recv_msg *recv_msg, struct capref *recv_cap_ptr,
-                         rpc_identifier_t *ret_type, uint8_t **ret_buf, size_t *ret_size,
-                         struct lmp_helper *helper)
+errval_t rpc_lmp_deserialize(struct aos_chan *chan, struct lmp_recv_msg *recv_msg,
+                             struct capref *recv_cap_ptr,
+                             rpc_request_id_t *ret_request_id, rpc_identifier_t *ret_type,
+                             uint8_t **ret_buf, size_t *ret_size, struct lmp_helper *helper)
 {
     errval_t err;
     helper->payload_frame = NULL_CAP;
     helper->mapped_frame = NULL;
+    helper->pool_slot = NULL;
+    helper->reassembled = NULL;
+    helper->train_buf = NULL;
 
-    rpc_identifier_t type = CAST_DEREF(rpc_identifier_t, recv_msg->words,
-                                       sizeof(lmp_single_msg_size_t));
+    rpc_identifier_t type = LMP_IDENTIFIER(recv_msg->words);
     uint8_t *buf;
     size_t size;
 
@@ -120,13 +454,59 @@ errval_t rpc_lmp_deserialize(struct lmp_recv_msg *recv_msg, struct capref *recv_
         helper->mapped_frame = frame_payload;
 
         *recv_cap_ptr = NULL_CAP;  // no cap is actually received
+
+    } else if (type == RPC_MSG_IN_POOL) {
+        uint32_t index = LMP_POOL_SLOT_INDEX(recv_msg->words);
+        if (chan->lmp_pool.rx == NULL || index >= RPC_LMP_POOL_SLOTS) {
+            return LIB_ERR_RPC_INVALID_MSG;
+        }
+
+        // The slot is written by the other end, read the size once and check it
+        struct rpc_lmp_pool_slot *slot = pool_slot(chan->lmp_pool.rx, index);
+        if (!slot->busy) {
+            return LIB_ERR_RPC_INVALID_MSG;
+        }
+        size = slot->size;
+        if (size > RPC_LMP_POOL_SLOT_MAX_PAYLOAD_SIZE) {
+            slot->busy = 0;  // give the slot back to the sender, it is not handled
+            return LIB_ERR_RPC_INVALID_MSG;
+        }
+        type = slot->identifier;  // replace
+        buf = slot->payload;
+
+        helper->pool_slot = &slot->busy;
+
+    } else if (type == RPC_MSG_FRAGMENT) {
+        err = deserialize_fragment(chan, recv_msg, recv_cap_ptr, &type, &buf, &size, helper);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+    } else if (type == RPC_LMP_POOL_SETUP) {
+        assert(!capref_is_null(*recv_cap_ptr));
+        if (chan->lmp_pool.rx != NULL) {
+            return LIB_ERR_RPC_INVALID_MSG;  // announced only once
+        }
+
+        err = paging_map_frame(get_current_paging_state(), (void **)&chan->lmp_pool.rx,
+                               RPC_LMP_POOL_SIZE, *recv_cap_ptr);
+        if (err_is_fail(err)) {
+            chan->lmp_pool.rx = NULL;
+            return err_push(err, LIB_ERR_PAGING_MAP);
+        }
+        chan->lmp_pool.rx_frame = *recv_cap_ptr;
+
+        *recv_cap_ptr = NULL_CAP;  // owned by the pool
+        buf = NULL;
+        size = 0;
+
     } else {
         size = (size_t)CAST_DEREF(lmp_single_msg_size_t, recv_msg->words, 0);
         // type is already decoded
-        buf = OFFSET(recv_msg->words,
-                     sizeof(lmp_single_msg_size_t) + sizeof(rpc_identifier_t));
+        buf = OFFSET(recv_msg->words, LMP_SINGLE_MSG_HEADER_SIZE);
     }
 
+    *ret_request_id = LMP_REQUEST_ID(recv_msg->words);
     *ret_type = type;
     *ret_buf = buf;
     *ret_size = size;
@@ -135,6 +515,14 @@ errval_t rpc_lmp_deserialize(struct lmp_recv_msg *recv_msg, struct capref *recv_
 
 errval_t rpc_lmp_cleanup(struct lmp_helper *helper)
 {
+    free(helper->reassembled);
+    helper->reassembled = NULL;
+
+    if (helper->pool_slot != NULL) {
+        *helper->pool_slot = 0;  // give the slot back to the sender
+        helper->pool_slot = NULL;
+    }
+
     if (helper->mapped_frame != NULL) {
         assert(!capref_is_null(helper->payload_frame));
 
@@ -154,6 +542,12 @@ errval_t rpc_lmp_cleanup(struct lmp_helper *helper)
     return SYS_ERR_OK;
 }
 
+void rpc_lmp_chan_destroy(struct aos_chan *chan)
+{
+    pool_destroy(chan);
+    train_reset(&chan->lmp_train);
+}
+
 errval_t lmp_try_send(struct lmp_chan *lc, uintptr_t *send_words, struct capref send_cap,
                       bool non_blocking)
 {
@@ -195,39 +589,57 @@ errval_t lmp_try_recv(struct lmp_chan *lc, struct lmp_recv_msg *recv_msg,
     }
 }
 
-errval_t rpc_lmp_send(struct lmp_chan *lc, rpc_identifier_t identifier, struct capref cap,
-                      const void *buf, size_t size, bool non_blocking)
+errval_t rpc_lmp_send(struct aos_chan *chan, rpc_request_id_t request_id,
+                      rpc_identifier_t identifier, struct capref cap, const void *buf,
+                      size_t size, bool non_blocking)
 {
+    assert(chan->type == AOS_CHAN_TYPE_LMP);
     errval_t err;
     uintptr_t send_words[LMP_MSG_LENGTH];
     struct capref send_cap;
     struct lmp_helper send_helper;
 
-    err = rpc_lmp_serialize(identifier, cap, buf, size, send_words, &send_cap,
-                            &send_helper);
+    err = rpc_lmp_serialize(chan, request_id, identifier, cap, buf, size, send_words,
+                            &send_cap, &send_helper);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_LMP_SERIALIZE);
     }
 
-    // Send
-    err = lmp_try_send(lc, send_words, send_cap, non_blocking);
-    if (err_is_fail(err)) {
-        return err;  // expose transient error directly
+    // Send, the rest of a train can't be given up once the first fragment is out
+    if (send_helper.train_buf != NULL) {
+        thread_mutex_lock(&chan->lmp_train.send_mutex);
+    }
+    err = lmp_try_send(&chan->lc, send_words, send_cap, non_blocking);
+    if (err_is_ok(err)) {
+        send_helper.pool_slot = NULL;  // released by the receiver from now on
+        while (rpc_lmp_serialize_next(&send_helper, request_id, send_words)) {
+            err = lmp_try_send(&chan->lc, send_words, NULL_CAP, false);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+    }
+    if (send_helper.train_buf != NULL) {
+        thread_mutex_unlock(&chan->lmp_train.send_mutex);
+    }
+
+    if (err_is_ok(err)) {
+        aos_chan_stats_sent(chan, size, cap);
     }
 
     // Clean up
-    err = rpc_lmp_cleanup(&send_helper);
+    errval_t err2 = rpc_lmp_cleanup(&send_helper);
     if (err_is_fail(err)) {
-        return err_push(err, LIB_ERR_LMP_CLEANUP);
+        return err;  // expose transient error directly
+    }
+    if (err_is_fail(err2)) {
+        return err_push(err2, LIB_ERR_LMP_CLEANUP);
     }
 
     return SYS_ERR_OK;
 }
 
-errval_t rpc_lmp_call(struct aos_chan *chan, rpc_identifier_t identifier,
-                      struct capref call_cap, const void *call_buf, size_t call_size,
-                      struct capref *ret_cap, void **ret_buf, size_t *ret_size,
-                      bool no_lock)
+errval_t rpc_lmp_submit(struct aos_chan *chan, struct aos_chan_future *future, bool locked)
 {
     assert(chan->type == AOS_CHAN_TYPE_LMP);
     struct lmp_chan *lc = &chan->lc;
@@ -240,7 +652,7 @@ errval_t rpc_lmp_call(struct aos_chan *chan, rpc_identifier_t identifier,
         // refill flag is set
         err = lmp_chan_alloc_recv_slot(lc);
         if (err_is_fail(err)) {
-            DEBUG_PRINTF("rpc_lmp_call: lmp_chan_alloc_recv_slot failed (case 2)\n");
+            DEBUG_PRINTF("rpc_lmp_submit: lmp_chan_alloc_recv_slot failed (case 2)\n");
             return err_push(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
         }
     }
@@ -249,112 +661,218 @@ errval_t rpc_lmp_call(struct aos_chan *chan, rpc_identifier_t identifier,
     struct capref send_cap;
     struct lmp_helper send_helper;
 
-    // Serialization
-    // We do not use mutex to protect send since it may trigger recursive RPC
-    err = rpc_lmp_serialize(identifier, call_cap, call_buf, call_size, send_words,
-                            &send_cap, &send_helper);
+    // Serialization, the request ID is filled in once allocated
+    // We do not use mutex to protect serialization since it may trigger recursive RPC
+    err = rpc_lmp_serialize(chan, RPC_REQUEST_ID_NONE, future->identifier,
+                            future->call_cap, future->call_buf, future->call_size,
+                            send_words, &send_cap, &send_helper);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_LMP_SERIALIZE);
     }
 
+    // Only one train at a time, while single messages may still go in between
+    bool train = send_helper.train_buf != NULL;
+    if (train) {
+        thread_mutex_lock(&chan->lmp_train.send_mutex);
+    }
+
+    bool added = false;
+    bool first = true;
+    while (true) {
+        if (first) {
+            THREAD_MUTEX_ENTER_IF(&chan->mutex, !locked)
+            {
+                if (!added) {
+                    aos_chan_add_pending(chan, future);
+                    LMP_REQUEST_ID(send_words) = future->id;
+                    added = true;
+                }
+
+                // Send
+                err = lmp_try_send(lc, send_words, send_cap, true);
+                if (err_is_fail(err) && !lmp_err_is_transient(err)) {
+                    aos_chan_take_pending(chan, future->id);
+                }
+            }
+            THREAD_MUTEX_EXIT_IF(&chan->mutex, !locked)
+        } else {
+            // The request ID is reserved already, the rest of the train needs no mutex
+            err = lmp_try_send(lc, send_words, NULL_CAP, true);
+            if (err_is_fail(err) && !lmp_err_is_transient(err)) {
+                THREAD_MUTEX_ENTER_IF(&chan->mutex, !locked)
+                {
+                    aos_chan_take_pending(chan, future->id);
+                }
+                THREAD_MUTEX_EXIT_IF(&chan->mutex, !locked)
+            }
+        }
+
+        if (err_is_ok(err)) {
+            first = false;
+            if (rpc_lmp_serialize_next(&send_helper, future->id, send_words)) {
+                continue;
+            }
+            break;
+        }
+        if (!lmp_err_is_transient(err)) {
+            break;
+        }
+
+        // The other end may be blocked on replying to us before it takes more calls
+        bool received = false;
+        errval_t err2 = aos_chan_poll_one(chan, locked, &received);
+        if (err_is_fail(err2)) {
+            DEBUG_ERR(err2, "rpc_lmp_submit: failed to receive\n");
+        }
+        if (!received) {
+            thread_yield();
+        }
+    }
+
+    if (train) {
+        thread_mutex_unlock(&chan->lmp_train.send_mutex);
+    }
+
+    // Clean up (don't touch err), the other end has its own copy of the frame
+    if (err_is_ok(err)) {
+        send_helper.pool_slot = NULL;  // released by the receiver from now on
+        aos_chan_stats_sent(chan, future->call_size, future->call_cap);
+    }
+    errval_t err2 = rpc_lmp_cleanup(&send_helper);
+    if (err_is_fail(err2)) {
+        DEBUG_ERR(err2, "rpc_lmp_submit: failed to clean up\n");
+    }
+
+    return err;
+}
+
+errval_t rpc_lmp_poll(struct aos_chan *chan, bool locked, bool *received,
+                      struct aos_chan_future **ret_future)
+{
+    assert(chan->type == AOS_CHAN_TYPE_LMP);
+    struct lmp_chan *lc = &chan->lc;
+
+    errval_t err;
+    *received = false;
+    *ret_future = NULL;
+
+    if (!locked && !thread_mutex_trylock(&chan->mutex)) {
+        return SYS_ERR_OK;  // the thread holding the mutex receives the replies
+    }
+
     struct lmp_recv_msg recv_msg = LMP_RECV_MSG_INIT;
     struct capref recv_cap = NULL_CAP;
+    struct aos_chan_future *future = NULL;
 
-    THREAD_MUTEX_ENTER_IF(&chan->mutex, !no_lock)
-    {
-        // Send
-        err = lmp_try_send(lc, send_words, send_cap, false);
-        if (err_is_fail(err)) {
-            THREAD_MUTEX_BREAK;
+    rpc_request_id_t recv_request_id;
+    rpc_identifier_t recv_type;
+    uint8_t *recv_buf;
+    size_t recv_size;
+    struct lmp_helper recv_helper;
+    bool deserialized = false;
+    errval_t deserialize_err = SYS_ERR_OK;
+
+    err = lmp_chan_recv(lc, &recv_msg, &recv_cap);
+    bool slot_used = !capref_is_null(recv_cap);
+    if (err_is_ok(err)) {
+        if (LMP_IDENTIFIER(recv_msg.words) == RPC_MSG_FRAGMENT) {
+            // Fragments must be reassembled in receiving order, and only the last one
+            // completes the call
+            deserialized = true;
+            deserialize_err = rpc_lmp_deserialize(chan, &recv_msg, &recv_cap,
+                                                  &recv_request_id, &recv_type, &recv_buf,
+                                                  &recv_size, &recv_helper);
+            if (err_is_fail(deserialize_err) || !rpc_lmp_is_internal(recv_type)) {
+                future = aos_chan_take_pending(chan, LMP_REQUEST_ID(recv_msg.words));
+            }
+        } else {
+            future = aos_chan_take_pending(chan, LMP_REQUEST_ID(recv_msg.words));
         }
+    }
 
-        // Receive acknowledgement and/or return message
-        err = lmp_try_recv(lc, &recv_msg, &recv_cap);
-        if (err_is_fail(err)) {
-            THREAD_MUTEX_BREAK;
-        }
+    if (!locked) {
+        thread_mutex_unlock(&chan->mutex);
     }
-    THREAD_MUTEX_EXIT_IF(&chan->mutex, !no_lock)
-    if (err_is_fail(err)) {
-        return err;
+    if (err == LIB_ERR_NO_LMP_MSG) {
+        return SYS_ERR_OK;
+    } else if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_LMP_CHAN_RECV);
     }
+    *received = true;
 
     // Refill recv cap if the slot is consumed
-    if (!capref_is_null(recv_cap)) {
+    if (slot_used) {
         lc->endpoint->recv_slot = NULL_CAP;  // clear it to trigger the force refill above
         err = lmp_chan_alloc_recv_slot(lc);  // this may trigger another RPC call
         if (err_is_fail(err)) {
-            DEBUG_PRINTF("rpc_lmp_call: lmp_chan_alloc_recv_slot failed (case 1)\n");
+            DEBUG_PRINTF("rpc_lmp_poll: lmp_chan_alloc_recv_slot failed (case 1)\n");
             return err_push(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
         }
     }
 
-    rpc_identifier_t recv_type;
-    uint8_t *recv_buf;
-    size_t recv_size;
-    struct lmp_helper recv_helper;
+    if (!deserialized) {
+        deserialize_err = rpc_lmp_deserialize(chan, &recv_msg, &recv_cap, &recv_request_id,
+                                              &recv_type, &recv_buf, &recv_size,
+                                              &recv_helper);
+    }
+    if (err_is_fail(deserialize_err)) {
+        err = err_push(deserialize_err, LIB_ERR_LMP_DESERIALIZE);
+        if (future != NULL) {
+            future->err = err;
+            *ret_future = future;
+        }
+        return err;
+    }
 
-    err = rpc_lmp_deserialize(&recv_msg, &recv_cap, &recv_type, &recv_buf, &recv_size,
-                              &recv_helper);
-    if (err_is_fail(err)) {
-        return err_push(err, LIB_ERR_LMP_DESERIALIZE);
+    if (!rpc_lmp_is_internal(recv_type)) {
+        aos_chan_stats_recv(chan, recv_size, recv_cap);
     }
 
-    if (recv_type == RPC_ACK) {
-        if (ret_buf) {
-            *ret_buf = malloc(recv_size);
-            memcpy(*ret_buf, recv_buf, recv_size);
-        }
+    if (rpc_lmp_is_internal(recv_type)) {
+        // Internal to the channel, not a reply
 
-        if (ret_size) {
-            *ret_size = recv_size;
-        }
+    } else if (future == NULL) {
+        DEBUG_PRINTF("rpc_lmp_poll: reply to unknown request %u\n", recv_request_id);
 
-        if (!capref_is_null(recv_cap)) {
-            if (ret_cap) {
-                *ret_cap = recv_cap;
-            } else {
-                DEBUG_PRINTF("rpc_lmp_call: received a cap but is given up!\n");
-            }
+    } else if (recv_type == RPC_ACK) {
+        future->ret_buf = malloc(recv_size);
+        if (future->ret_buf == NULL && recv_size != 0) {
+            future->err = LIB_ERR_MALLOC_FAIL;
+        } else {
+            memcpy(future->ret_buf, recv_buf, recv_size);
+            future->ret_size = recv_size;
+            future->ret_cap = recv_cap;
+            future->err = SYS_ERR_OK;
         }
-        err = SYS_ERR_OK;
 
     } else if (recv_type == RPC_ERR) {
-        err = *((errval_t *)recv_buf);
+        future->err = *((errval_t *)recv_buf);
 
     } else {
-        DEBUG_PRINTF("rpc_lmp_call: unknown recv_type %u\n", recv_type);
-        err = LIB_ERR_RPC_INVALID_MSG;
+        DEBUG_PRINTF("rpc_lmp_poll: unknown recv_type %u\n", recv_type);
+        future->err = LIB_ERR_RPC_INVALID_MSG;
     }
 
-
-    // Clean up (don't touch err)
-    errval_t err2 = rpc_lmp_cleanup(&send_helper);
-    if (err_is_fail(err2)) {
-        DEBUG_ERR(err2, "rpc_lmp_call: failed to clean up\n");
-    }
-    err2 = rpc_lmp_cleanup(&recv_helper);
-    if (err_is_fail(err2)) {
-        DEBUG_ERR(err2, "rpc_lmp_call: failed to clean up\n");
+    // Clean up
+    err = rpc_lmp_cleanup(&recv_helper);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rpc_lmp_poll: failed to clean up\n");
     }
 
-    return err;
-}
-
-errval_t rpc_lmp_put_cap(struct lmp_chan *lc, struct capref cap)
-{
-    assert(!capref_is_null(cap));
-    return rpc_lmp_send(lc, RPC_PUT_CAP, cap, NULL, 0, true);
+    *ret_future = future;
+    return SYS_ERR_OK;
 }
 
-static errval_t rpc_lmp_ack(struct lmp_chan *lc, struct capref cap, const void *buf, size_t size)
+static errval_t rpc_lmp_ack(struct aos_chan *chan, rpc_request_id_t request_id,
+                            struct capref cap, const void *buf, size_t size)
 {
-    return rpc_lmp_send(lc, RPC_ACK, cap, buf, size, false);
+    return rpc_lmp_send(chan, request_id, RPC_ACK, cap, buf, size, false);
 }
 
-static errval_t rpc_lmp_nack(struct lmp_chan *lc, errval_t err)
+static errval_t rpc_lmp_nack(struct aos_chan *chan, rpc_request_id_t request_id,
+                             errval_t err)
 {
-    return rpc_lmp_send(lc, RPC_ERR, NULL_CAP, &err, sizeof(errval_t), false);
+    return rpc_lmp_send(chan, request_id, RPC_ERR, NULL_CAP, &err, sizeof(errval_t), false);
 }
 
 static void rpc_lmp_generic_handler(void *arg)
@@ -391,17 +909,22 @@ static void rpc_lmp_generic_handler(void *arg)
     }
 
     /* Deserialize */
+    rpc_request_id_t recv_request_id;
     rpc_identifier_t recv_identifier;
     uint8_t *recv_buf;
     size_t recv_size;
     struct lmp_helper helper;
-    err = rpc_lmp_deserialize(&recv_raw_msg, &recv_cap, &recv_identifier, &recv_buf,
-                              &recv_size, &helper);
+    err = rpc_lmp_deserialize(chan, &recv_raw_msg, &recv_cap, &recv_request_id,
+                              &recv_identifier, &recv_buf, &recv_size, &helper);
     if (err_is_fail(err)) {
         err = err_push(err, LIB_ERR_LMP_SERIALIZE);
         DEBUG_ERR(err, "%s: fail to deserialize\n", __func__);
         goto FAILURE;
     }
+    if (rpc_lmp_is_internal(recv_identifier)) {
+        goto RE_REGISTER;  // a new frame pool, or a train not complete yet, nothing to reply
+    }
+    aos_chan_stats_recv(chan, recv_size, recv_cap);
 
     /// If the channel is not setup yet, set it up
 
@@ -427,7 +950,7 @@ static void rpc_lmp_generic_handler(void *arg)
         lc->connstate = LMP_CONNECTED;
 
         /* Ack */
-        err = rpc_lmp_ack(lc, NULL_CAP, NULL, 0);
+        err = rpc_lmp_ack(chan, recv_request_id, NULL_CAP, NULL, 0);
         if (err_is_fail(err)) {
             DEBUG_ERR(err, "rpc_lmp_handler (binding): aos_chan_ack failed\n");
             goto FAILURE;
@@ -443,17 +966,19 @@ static void rpc_lmp_generic_handler(void *arg)
         size_t reply_size = 0;
         struct capref reply_cap = NULL_CAP;
         bool free_out_payload = true;
+        systime_t start = systime_now();
         err = chan->handler(chan->arg, recv_identifier, recv_buf, recv_size, recv_cap,
                             &reply_buf, &reply_size, &reply_cap, &free_out_payload, &re_register);
+        aos_chan_stats_handled(chan, start);
 
         if (reply_size != -1) {  // -1 means no reply
             if (err_is_ok(err)) {
-                err = rpc_lmp_ack(lc, reply_cap, reply_buf, reply_size);
+                err = rpc_lmp_ack(chan, recv_request_id, reply_cap, reply_buf, reply_size);
                 if (err_is_fail(err)) {
                     DEBUG_ERR(err, "%s: aos_chan_ack failed\n", __func__);
                 }
             } else {
-                err = rpc_lmp_nack(lc, err);
+                err = rpc_lmp_nack(chan, recv_request_id, err);
                 if (err_is_fail(err)) {
                     DEBUG_ERR(err, "%s: aos_chan_nack failed\n", __func__);
                 }
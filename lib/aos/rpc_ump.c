@@ -8,16 +8,20 @@
 #include <aos/domain.h>
 #include <string.h>
 
-errval_t rpc_ump_prefix_identifier(const void *buf, size_t size,
-                                   rpc_identifier_t identifier, void **ret)
+#define UMP_REQUEST_ID(raw) CAST_DEREF(rpc_request_id_t, raw, 0)
+#define UMP_IDENTIFIER(raw) CAST_DEREF(rpc_identifier_t, raw, sizeof(rpc_request_id_t))
+
+errval_t rpc_ump_prefix_header(const void *buf, size_t size, rpc_request_id_t request_id,
+                               rpc_identifier_t identifier, void **ret)
 {
-    uint8_t *new_buf = malloc(sizeof(rpc_identifier_t) + size);
+    uint8_t *new_buf = malloc(RPC_UMP_HEADER_SIZE + size);
     if (new_buf == NULL) {
         return LIB_ERR_MALLOC_FAIL;
     }
-    CAST_DEREF(rpc_identifier_t, new_buf, 0) = identifier;
+    UMP_REQUEST_ID(new_buf) = request_id;
+    UMP_IDENTIFIER(new_buf) = identifier;
     if (size != 0) {
-        memcpy(OFFSET(new_buf, sizeof(rpc_identifier_t)), buf, size);
+        memcpy(OFFSET(new_buf, RPC_UMP_HEADER_SIZE), buf, size);
     }
     *ret = new_buf;
     return SYS_ERR_OK;
@@ -42,272 +46,538 @@ static errval_t ump_chan_recv_blocking_dispatch(struct ump_chan *uc, void **payl
     }
 }
 
-static errval_t ump_send_cap(struct ump_chan *uc, struct capref call_cap)
+/// Sequence numbers of the caps this domain hands to init, see struct aos_rpc_cap_ticket
+static uint32_t cap_transfer_seq = 0;
+
+/**
+ * Hand a cap to init for the other end of the channel, to be claimed with the returned
+ * ticket. Init queues it in the mailbox of the receiver, so no handshake with the receiver
+ * is needed, and the call runs in parallel with any other call on the init channel.
+ */
+static errval_t ump_send_cap(struct ump_chan *uc, struct capref call_cap,
+                             struct aos_rpc_cap_ticket *ticket)
 {
     if (uc->pid == 0) {
         return LIB_ERR_UMP_CHAN_SEND_CAP_NO_PID;
     }
 
+    ticket->from = disp_get_domain_id();
+    ticket->to = uc->pid;
+    ticket->seq = __atomic_fetch_add(&cap_transfer_seq, 1, __ATOMIC_RELAXED);
+
+    // Fails with PROC_MGMT_ERR_CAP_MAILBOX_FULL if the receiver does not claim its caps
+    return aos_rpc_call(get_init_rpc(), RPC_TRANSFER_CAP, call_cap, ticket, sizeof(*ticket),
+                        NULL, NULL, NULL);
+}
+
+errval_t rpc_ump_recv_cap(const struct aos_rpc_cap_ticket *ticket, struct capref *recv_cap)
+{
+    // Retries until the cap, handed to init before the message was sent, has arrived
+    // on our core
+    return aos_rpc_call(get_init_rpc(), RPC_ACCEPT_CAP, NULL_CAP, ticket, sizeof(*ticket),
+                        recv_cap, NULL, NULL);
+}
+
+/**
+ * Strip the ticket appended to a message that carries a cap.
+ */
+static errval_t rpc_ump_take_ticket(uint8_t *buf, size_t *size,
+                                    struct aos_rpc_cap_ticket *ticket)
+{
+    if (*size < sizeof(*ticket)) {
+        return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+    *size -= sizeof(*ticket);
+    memcpy(ticket, buf + *size, sizeof(*ticket));
+    return SYS_ERR_OK;
+}
+
+/// Descriptor of a chunk of a message placed in the bulk region, sent through the ring
+struct rpc_ump_bulk_desc {
+    size_t pos;    ///< Position of the chunk in the bulk region of the sender
+    size_t size;   ///< Size of the chunk
+    size_t total;  ///< Size of the whole message, including the header
+};
+
+/**
+ * Wait for the other end to free space for a large message of chan. The mutex of the
+ * channel is dropped meanwhile and replies are drained, as the other end may be blocked
+ * on replying to us before it takes more of the message.
+ */
+static void rpc_ump_wait_room(struct aos_chan *chan)
+{
+    thread_mutex_unlock(&chan->mutex);
+    bool received = false;
+    errval_t err = aos_chan_poll_one(chan, false, &received);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rpc_ump_wait_room: failed to receive\n");
+    }
+    if (!received) {
+        thread_yield();
+    }
+    thread_mutex_lock(&chan->mutex);
+}
+
+/**
+ * Send the header and the payload through the bulk region of the channel, in chunks
+ * of at most half of the region so that the receiver can copy one while the next is written.
+ * Only the descriptors go through the ring. With chan, waits for space with rpc_ump_wait_room().
+ */
+static errval_t rpc_ump_send_bulk(struct ump_chan *uc, struct aos_chan *chan,
+                                  rpc_request_id_t request_id,
+                                  rpc_identifier_t identifier, const void *buf, size_t size)
+{
     errval_t err;
 
-    uint8_t *recv_payload = NULL;
-    size_t recv_size = 0;
+    struct rpc_ump_bulk_desc desc = { .total = size + RPC_UMP_HEADER_SIZE };
+    size_t offset = 0;  // in the header followed by the payload
+    while (offset < desc.total) {
+        desc.size = MIN(desc.total - offset, uc->bulk.size / 2);
+        if (chan != NULL) {
+            while (!ump_chan_bulk_can_alloc(uc, desc.size)
+                   || !ump_chan_can_reserve(uc, RPC_UMP_HEADER_SIZE + sizeof(desc))) {
+                rpc_ump_wait_room(chan);
+            }
+        }
 
-    // Grab init rpc for capability transfer
-    THREAD_MUTEX_ENTER(&get_init_rpc()->chan.mutex)
-    {
-        // Step 1: wait for ACK from UMP channel
-        err = ump_chan_recv_blocking(uc, (void **)&recv_payload, &recv_size);
+        uint8_t *chunk = NULL;
+        err = ump_chan_bulk_alloc(uc, desc.size, (void **)&chunk, &desc.pos);
         if (err_is_fail(err)) {
-            DEBUG_ERR(err, "ump_send_cap: cap transfer step 1 fail\n");
-            THREAD_MUTEX_BREAK;
+            return err;
         }
-
-        // Step 2: decode the reply and make sure it's RPC_ACK_CAP_CHANNEL
-        assert(recv_size >= sizeof(rpc_identifier_t));
-        rpc_identifier_t recv_identifier = CAST_DEREF(rpc_identifier_t, recv_payload, 0);
-        if (recv_identifier == RPC_ACK_CAP_CHANNEL) {
-            // pass
-            assert(recv_size == sizeof(rpc_identifier_t));
-        } else if (recv_identifier == RPC_ERR) {
-            assert(recv_size == sizeof(rpc_identifier_t) + sizeof(errval_t));
-            err = CAST_DEREF(errval_t, recv_payload, sizeof(rpc_identifier_t));
-            DEBUG_ERR(err, "ump_send_cap: cap transfer step 2 fail\n");
-            THREAD_MUTEX_BREAK;
+        if (offset == 0) {
+            UMP_REQUEST_ID(chunk) = request_id;
+            UMP_IDENTIFIER(chunk) = identifier;
+            memcpy(chunk + RPC_UMP_HEADER_SIZE, buf, desc.size - RPC_UMP_HEADER_SIZE);
         } else {
-            DEBUG_PRINTF("ump_send_cap: unknown identifier %u (size = %lu) in step 2\n",
-                         recv_identifier, recv_size);
-            err = LIB_ERR_UMP_CHAN_SEND_CAP_NO_ACK;
-            THREAD_MUTEX_BREAK;
+            memcpy(chunk, (const uint8_t *)buf + offset - RPC_UMP_HEADER_SIZE, desc.size);
         }
-        free(recv_payload);
+        offset += desc.size;
 
-        // Step 3: send the cap through init
-        // There must be no way to trigger recursive init RPC call inside
-        do {
-            err = rpc_lmp_call(&get_init_rpc()->chan, RPC_TRANSFER_CAP, call_cap,
-                               &uc->pid, sizeof(uc->pid), NULL, NULL, NULL, true);
-            if (err == MON_ERR_RETRY) {
-                thread_yield();
-            } else {
-                break;
-            }
-        } while (1);
+        // The ring publication orders the chunk before the descriptor
+        uint8_t *send_payload = NULL;
+        err = ump_chan_reserve(uc, RPC_UMP_HEADER_SIZE + sizeof(desc),
+                               (void **)&send_payload);
         if (err_is_fail(err)) {
-            DEBUG_ERR(err, "ump_send_cap: cap transfer step 3 fail\n");
-            THREAD_MUTEX_BREAK;
+            return err;
+        }
+        UMP_REQUEST_ID(send_payload) = request_id;
+        UMP_IDENTIFIER(send_payload) = RPC_BULK_MSG;
+        memcpy(send_payload + RPC_UMP_HEADER_SIZE, &desc, sizeof(desc));
+        err = ump_chan_publish(uc);
+        if (err_is_fail(err)) {
+            return err;
         }
     }
-    THREAD_MUTEX_EXIT(&get_init_rpc()->chan.mutex)
 
-    return err;
+    return SYS_ERR_OK;
 }
 
-errval_t rpc_ump_recv_cap(struct ump_chan *uc, struct capref *recv_cap)
+/**
+ * Send a message. Without chan, blocks while the other end has no space for it. With
+ * chan, whose mutex the caller holds, a large message waits with rpc_ump_wait_room().
+ */
+static errval_t rpc_ump_send_impl(struct ump_chan *uc, struct aos_chan *chan,
+                                  rpc_request_id_t request_id, rpc_identifier_t identifier,
+                                  struct capref cap, const void *buf, size_t size)
 {
     errval_t err;
 
-    err = aos_rpc_call(get_init_rpc(), RPC_ACCEPT_CAP, NULL_CAP, NULL, 0, NULL, NULL, NULL);
-    if (err_is_fail(err)) {
-        return err;
-    }
+    // The cap goes to init first, the message carries the ticket to claim it
+    uint8_t *with_ticket = NULL;
+    if (!capref_is_null(cap)) {
+        struct aos_rpc_cap_ticket ticket;
+        err = ump_send_cap(uc, cap, &ticket);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_UMP_CHAN_SEND_CAP);
+        }
 
-    // Prepare the refill slot, do so outside the mutex since it may trigger recursive rpc
-    struct capref refill_slot = NULL_CAP;
-    err = slot_alloc(&refill_slot);
-    if (err_is_fail(err)) {
-        return err_push(err, LIB_ERR_SLOT_ALLOC);
+        with_ticket = malloc(size + sizeof(ticket));
+        if (with_ticket == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        if (size != 0) {
+            memcpy(with_ticket, buf, size);
+        }
+        memcpy(with_ticket + size, &ticket, sizeof(ticket));
+        buf = with_ticket;
+        size += sizeof(ticket);
+        identifier |= RPC_SPECIAL_CAP_TRANSFER_FLAG;
     }
 
-    // Grab init rpc for capability transfer
-    THREAD_MUTEX_ENTER(&get_init_rpc()->chan.mutex)
-    {
-        // Step 1: send RPC_ACK_CAP_CHANNEL in UMP channel
-        rpc_identifier_t ack = RPC_ACK_CAP_CHANNEL;
-        err = ump_chan_send(uc, &ack, sizeof(ack));
+    if (size + RPC_UMP_HEADER_SIZE <= RING_MAX_INPLACE_SIZE) {
+        // Build the message directly in the ring, no intermediate buffer
+        uint8_t *send_payload = NULL;
+        err = ump_chan_reserve(uc, size + RPC_UMP_HEADER_SIZE, (void **)&send_payload);
         if (err_is_fail(err)) {
-            DEBUG_ERR(err, "rpc_ump_recv_cap: cap transfer step 1 fail\n");
-            THREAD_MUTEX_BREAK;
+            err = err_push(err, LIB_ERR_UMP_CHAN_SEND);
+            goto DONE;
         }
-
-        // Step 2: receive the cap on init channel
-        // Work on raw LMP channel to bypass mutex
-        struct lmp_recv_msg recv_msg = LMP_RECV_MSG_INIT;
-        err = lmp_try_recv(&get_init_rpc()->chan.lc, &recv_msg, recv_cap);
+        UMP_REQUEST_ID(send_payload) = request_id;
+        UMP_IDENTIFIER(send_payload) = identifier;
+        if (size != 0) {
+            memcpy(send_payload + RPC_UMP_HEADER_SIZE, buf, size);
+        }
+        err = ump_chan_publish(uc);
         if (err_is_fail(err)) {
-            DEBUG_ERR(err, "rpc_ump_recv_cap: cap transfer step 2 fail\n");
-            THREAD_MUTEX_BREAK;
+            err = err_push(err, LIB_ERR_UMP_CHAN_SEND);
+        }
+    } else if (ump_chan_has_bulk(uc) && size + RPC_UMP_HEADER_SIZE > UMP_CHAN_BULK_THRESHOLD) {
+        // Large payload, only pass descriptors through the ring
+        err = rpc_ump_send_bulk(uc, chan, request_id, identifier, buf, size);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_UMP_CHAN_SEND);
+        }
+    } else {
+        // Too large to be placed contiguously, let the ring fragment it
+        void *send_payload = NULL;
+        err = rpc_ump_prefix_header(buf, size, request_id, identifier, &send_payload);
+        if (err_is_fail(err)) {
+            goto DONE;
         }
 
-        // Refill the slot with refill_slot, without calling init RPC
-        if (!capref_is_null(*recv_cap)) {
-            lmp_chan_set_recv_slot(&get_init_rpc()->chan.lc, refill_slot);
+        if (chan == NULL) {
+            err = ump_chan_send(uc, send_payload, size + RPC_UMP_HEADER_SIZE);
         } else {
-            err = slot_free(refill_slot);
-            if (err_is_fail(err)) {
-                DEBUG_ERR(err, "rpc_ump_recv_cap: refill_slot fail\n");
+            size_t offset = 0;
+            while (true) {
+                err = ump_chan_send_some(uc, send_payload, size + RPC_UMP_HEADER_SIZE,
+                                         &offset);
+                if (err_is_fail(err) || offset == size + RPC_UMP_HEADER_SIZE) {
+                    break;
+                }
+                rpc_ump_wait_room(chan);
             }
         }
+        free(send_payload);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_UMP_CHAN_SEND);
+        }
+    }
 
-        // Step 3: decode the message
-        rpc_identifier_t recv_type;
-        uint8_t *recv_buf;
-        size_t recv_size;
-        struct lmp_helper recv_helper;
+DONE:
+    free(with_ticket);
+    return err;
+}
 
-        err = rpc_lmp_deserialize(&recv_msg, recv_cap, &recv_type, &recv_buf, &recv_size,
-                                  &recv_helper);
+errval_t rpc_ump_send(struct ump_chan *uc, rpc_request_id_t request_id,
+                      rpc_identifier_t identifier, struct capref cap, const void *buf,
+                      size_t size)
+{
+    return rpc_ump_send_impl(uc, NULL, request_id, identifier, cap, buf, size);
+}
+
+/**
+ * Copy a message sent in several bulk chunks into a malloced buffer, releasing each chunk
+ * as soon as it is copied.
+ */
+static errval_t rpc_ump_reassemble_bulk(struct ump_chan *uc, struct rpc_ump_bulk_desc *desc,
+                                        struct rpc_ump_msg *msg)
+{
+    errval_t err;
+
+    uint8_t *raw = malloc(desc->total);
+    if (raw == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    size_t total = desc->total;
+    size_t offset = 0;
+    while (true) {
+        void *chunk = ump_chan_bulk_rx_buf(uc, desc->pos, desc->size);
+        if (chunk == NULL || desc->total != total || offset + desc->size > total) {
+            err = LIB_ERR_UMP_BULK_INVALID;
+            goto FAILURE;
+        }
+        memcpy(raw + offset, chunk, desc->size);
+        offset += desc->size;
+        ump_chan_bulk_release(uc, desc->pos + desc->size);
+
+        err = ump_chan_commit(uc, &msg->view);
         if (err_is_fail(err)) {
-            err = err_push(err, LIB_ERR_LMP_DESERIALIZE);
-            THREAD_MUTEX_BREAK;
+            goto FAILURE;
         }
-        if (recv_type == RPC_PUT_CAP) {
-            // pass
-            assert(recv_size == 0);
-            assert(!capref_is_null(*recv_cap));
-        } else if (recv_type == RPC_ERR) {
-            assert(recv_size == sizeof(errval_t));
-            err = CAST_DEREF(errval_t, recv_buf, 0);
-            DEBUG_ERR(err, "rpc_ump_recv_cap: cap transfer step 3 fail\n");
-        } else {
-            DEBUG_PRINTF("rpc_ump_recv_cap: unknown identifier %u in step 3\n", recv_type);
-            err = LIB_ERR_UMP_CHAN_RECV_CAP_UNKNOWN;
+        if (offset == total) {
+            break;
         }
 
-        errval_t err2 = rpc_lmp_cleanup(&recv_helper);
-        if (err_is_fail(err2)) {
-            DEBUG_ERR(err2, "rpc_ump_recv_cap: failed to clean up\n");
+        // The sender keeps writing chunks as we release them
+        err = ump_chan_peek_blocking(uc, &msg->view);
+        if (err_is_fail(err)) {
+            goto FAILURE;
+        }
+        uint8_t *payload = msg->view.payload;
+        if (msg->view.size != RPC_UMP_HEADER_SIZE + sizeof(*desc)
+            || UMP_IDENTIFIER(payload) != RPC_BULK_MSG) {
+            err = LIB_ERR_UMP_BULK_INVALID;
+            goto FAILURE;
         }
+        memcpy(desc, payload + RPC_UMP_HEADER_SIZE, sizeof(*desc));
     }
-    THREAD_MUTEX_EXIT(&get_init_rpc()->chan.mutex)
 
+    msg->raw = raw;
+    msg->raw_size = total;
+    msg->owned = true;
+    return SYS_ERR_OK;
+
+FAILURE:
+    free(raw);
     return err;
 }
 
-errval_t rpc_ump_send(struct ump_chan *uc, rpc_identifier_t identifier, struct capref cap,
-                      const void *buf, size_t size)
+errval_t rpc_ump_peek(struct ump_chan *uc, bool blocking, struct rpc_ump_msg *msg)
 {
     errval_t err;
 
-    if (!capref_is_null(cap)) {
-        identifier |= RPC_SPECIAL_CAP_TRANSFER_FLAG;
-    }
-
-    void *send_payload = NULL;
-    err = rpc_ump_prefix_identifier(buf, size, identifier, &send_payload);
+    err = blocking ? ump_chan_peek_blocking(uc, &msg->view) : ump_chan_peek(uc, &msg->view);
     if (err_is_fail(err)) {
         return err;
     }
 
-    err = ump_chan_send(uc, send_payload, size + sizeof(rpc_identifier_t));
+    msg->raw = msg->view.payload;
+    msg->raw_size = msg->view.size;
+    msg->bulk_end = 0;
+    msg->owned = false;
+    assert(msg->raw_size >= RPC_UMP_HEADER_SIZE);
+
+    if (UMP_IDENTIFIER(msg->raw) != RPC_BULK_MSG) {
+        return SYS_ERR_OK;
+    }
+
+    struct rpc_ump_bulk_desc desc;
+    if (msg->raw_size != RPC_UMP_HEADER_SIZE + sizeof(desc)) {
+        err = LIB_ERR_UMP_BULK_INVALID;
+        goto FAILURE;
+    }
+    memcpy(&desc, msg->raw + RPC_UMP_HEADER_SIZE, sizeof(desc));
+
+    if (desc.size != desc.total) {
+        err = rpc_ump_reassemble_bulk(uc, &desc, msg);
+        if (err_is_fail(err)) {
+            goto FAILURE;
+        }
+        return SYS_ERR_OK;
+    }
+
+    // Single chunk: work on it in place and drop the descriptor
+    msg->raw = ump_chan_bulk_rx_buf(uc, desc.pos, desc.size);
+    if (msg->raw == NULL || desc.size < RPC_UMP_HEADER_SIZE) {
+        err = LIB_ERR_UMP_BULK_INVALID;
+        goto FAILURE;
+    }
+    msg->raw_size = desc.size;
+    msg->bulk_end = desc.pos + desc.size;
+    return ump_chan_commit(uc, &msg->view);
+
+FAILURE:
+    ump_chan_commit(uc, &msg->view);
+    return err;
+}
+
+errval_t rpc_ump_release(struct ump_chan *uc, struct rpc_ump_msg *msg)
+{
+    errval_t err = ump_chan_commit(uc, &msg->view);  // no-op if already released
+    if (msg->bulk_end != 0) {
+        ump_chan_bulk_release(uc, msg->bulk_end);
+        msg->bulk_end = 0;
+    }
+    if (msg->owned) {
+        free(msg->raw);
+        msg->owned = false;
+    }
+    msg->raw = NULL;
+    msg->raw_size = 0;
+    return err;
+}
+
+errval_t rpc_ump_recv_reply(struct ump_chan *uc, bool blocking,
+                            rpc_request_id_t *ret_request_id,
+                            rpc_identifier_t *ret_identifier, errval_t *reply_err,
+                            void **ret_buf, size_t *ret_size,
+                            struct aos_rpc_cap_ticket *ret_ticket)
+{
+    struct rpc_ump_msg msg;
+    errval_t err = rpc_ump_peek(uc, blocking, &msg);
     if (err_is_fail(err)) {
-        free(send_payload);
-        return err_push(err, LIB_ERR_UMP_CHAN_SEND);
+        return err;
     }
 
-    if (!capref_is_null(cap)) {
-        err = ump_send_cap(uc, cap);
+    *ret_request_id = UMP_REQUEST_ID(msg.raw);
+    *ret_identifier = UMP_IDENTIFIER(msg.raw);
+    uint8_t *recv_buf = msg.raw + RPC_UMP_HEADER_SIZE;
+    size_t recv_size = msg.raw_size - RPC_UMP_HEADER_SIZE;
+
+    if (*ret_identifier & RPC_SPECIAL_CAP_TRANSFER_FLAG) {
+        assert(ret_ticket != NULL);
+        err = rpc_ump_take_ticket(recv_buf, &recv_size, ret_ticket);
         if (err_is_fail(err)) {
-            free(send_payload);
-            return err_push(err, LIB_ERR_UMP_CHAN_SEND_CAP);
+            rpc_ump_release(uc, &msg);
+            return err;
         }
     }
 
-    free(send_payload);
-    return SYS_ERR_OK;
+    // Decode the reply, copying the payload out only once
+    if ((*ret_identifier & ~RPC_SPECIAL_CAP_TRANSFER_FLAG) == RPC_ACK) {
+        *reply_err = SYS_ERR_OK;
+        if (ret_buf != NULL) {
+            *ret_size = recv_size;
+            *ret_buf = malloc(recv_size);
+            if (*ret_buf == NULL) {
+                *reply_err = LIB_ERR_MALLOC_FAIL;
+            } else {
+                memcpy(*ret_buf, recv_buf, recv_size);
+            }
+        }
+    } else {
+        assert(recv_size == sizeof(errval_t));
+        *reply_err = CAST_DEREF(errval_t, recv_buf, 0);
+    }
+
+    return rpc_ump_release(uc, &msg);
 }
 
-errval_t rpc_ump_ack(struct ump_chan *uc, struct capref cap, const void *buf, size_t size)
+errval_t rpc_ump_ack(struct ump_chan *uc, rpc_request_id_t request_id, struct capref cap,
+                     const void *buf, size_t size)
 {
-    return rpc_ump_send(uc, RPC_ACK, cap, buf, size);
+    return rpc_ump_send(uc, request_id, RPC_ACK, cap, buf, size);
 }
 
-errval_t rpc_ump_nack(struct ump_chan *uc, errval_t err)
+errval_t rpc_ump_nack(struct ump_chan *uc, rpc_request_id_t request_id, errval_t err)
 {
-    return rpc_ump_send(uc, RPC_ERR, NULL_CAP, &err, sizeof(errval_t));
+    return rpc_ump_send(uc, request_id, RPC_ERR, NULL_CAP, &err, sizeof(errval_t));
 }
 
-errval_t rpc_ump_call(struct aos_chan *chan, rpc_identifier_t identifier,
-                      struct capref call_cap, const void *call_buf, size_t call_size,
-                      struct capref *ret_cap, void **ret_buf, size_t *ret_size)
+errval_t rpc_ump_submit(struct aos_chan *chan, struct aos_chan_future *future)
 {
     assert(chan->type == AOS_CHAN_TYPE_UMP);
     struct ump_chan *uc = &chan->uc;
 
     errval_t err;
 
-    uint8_t *recv_payload = NULL;
-    size_t recv_size = 0;
-    struct capref recv_cap = NULL_CAP;
+    size_t raw_size = future->call_size + RPC_UMP_HEADER_SIZE;
+    if (!capref_is_null(future->call_cap)) {
+        raw_size += sizeof(struct aos_rpc_cap_ticket);
+    }
+    while (true) {
+        thread_mutex_lock(&chan->mutex);
+
+        // Don't wait for ring space with the mutex held, the other end may be blocked on
+        // replying to us before it takes more calls. A large message waits for space
+        // piece by piece, dropping the mutex in between, so nothing else may be sent
+        // until it is complete.
+        if (chan->ump_large_sender == NULL
+            && (raw_size > RING_MAX_INPLACE_SIZE || ump_chan_can_reserve(uc, raw_size))) {
+            break;
+        }
+        thread_mutex_unlock(&chan->mutex);
 
-    THREAD_MUTEX_ENTER(&chan->mutex)
+        bool received = false;
+        err = aos_chan_poll_one(chan, false, &received);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "rpc_ump_submit: failed to receive\n");
+        }
+        if (!received) {
+            thread_yield();
+        }
+    }
+    do
     {
         // Make the call and transfer cap if needed
-        err = rpc_ump_send(uc, identifier, call_cap, call_buf, call_size);
+        aos_chan_add_pending(chan, future);
+        if (raw_size > RING_MAX_INPLACE_SIZE) {
+            chan->ump_large_sender = thread_self();
+        }
+        err = rpc_ump_send_impl(uc, chan, future->id, future->identifier, future->call_cap,
+                                future->call_buf, future->call_size);
+        chan->ump_large_sender = NULL;
         if (err_is_fail(err)) {
-            DEBUG_ERR(err, "rpc_ump_call: failed to send\n");
-            THREAD_MUTEX_BREAK;
+            aos_chan_take_pending(chan, future->id);
+            DEBUG_ERR(err, "rpc_ump_submit: failed to send\n");
+        } else {
+            aos_chan_stats_sent(chan, future->call_size, future->call_cap);
         }
+    }
+    while (0); thread_mutex_unlock(&chan->mutex);
 
+    return err;
+}
+
+errval_t rpc_ump_poll(struct aos_chan *chan, bool locked, bool *received,
+                      struct aos_chan_future **ret_future)
+{
+    assert(chan->type == AOS_CHAN_TYPE_UMP);
+    struct ump_chan *uc = &chan->uc;
+
+    errval_t err;
+    *received = false;
+    *ret_future = NULL;
+
+    if (!locked && !thread_mutex_trylock(&chan->mutex)) {
+        return SYS_ERR_OK;  // the thread holding the mutex receives the replies
+    }
+
+    rpc_request_id_t recv_request_id = RPC_REQUEST_ID_NONE;
+    rpc_identifier_t recv_identifier = RPC_ERR;
+    errval_t reply_err = SYS_ERR_OK;
+    void *recv_buf = NULL;
+    size_t recv_size = 0;
+    struct capref recv_cap = NULL_CAP;
+    struct aos_rpc_cap_ticket ticket;
+    struct aos_chan_future *future = NULL;
+    do
+    {
         // Receive acknowledgement and/or return message
-        err = ump_chan_recv_blocking(uc, (void **)&recv_payload, &recv_size);
+        err = rpc_ump_recv_reply(uc, false, &recv_request_id, &recv_identifier, &reply_err,
+                                 &recv_buf, &recv_size, &ticket);
+        if (err == LIB_ERR_RING_NO_MSG) {
+            err = SYS_ERR_OK;
+            THREAD_MUTEX_BREAK;
+        }
         if (err_is_fail(err)) {
             err = err_push(err, LIB_ERR_UMP_CHAN_RECV);
-            DEBUG_ERR(err, "rpc_ump_call: failed to recv\n");
             THREAD_MUTEX_BREAK;
         }
-
-        // Receive cap if needed
-        assert(recv_size >= sizeof(rpc_identifier_t));
-        if (CAST_DEREF(rpc_identifier_t, recv_payload, 0) & RPC_SPECIAL_CAP_TRANSFER_FLAG) {
-            err = rpc_ump_recv_cap(uc, &recv_cap);
-            if (err_is_fail(err)) {
-                err = err_push(err, LIB_ERR_UMP_CHAN_RECV_CAP);
-                DEBUG_ERR(err, "rpc_ump_call: rpc_ump_recv_cap failed\n");
-                THREAD_MUTEX_BREAK;
-            }
-
-            // Clear the flag
-            CAST_DEREF(rpc_identifier_t, recv_payload, 0) ^= RPC_SPECIAL_CAP_TRANSFER_FLAG;
-        }
+        *received = true;
+        future = aos_chan_take_pending(chan, recv_request_id);
     }
-    THREAD_MUTEX_EXIT(&chan->mutex)
-    // Handle error happened in the critical section
-    if (err_is_fail(err)) {
-        goto RET;
+    while (0);
+    if (!locked) {
+        thread_mutex_unlock(&chan->mutex);
+    }
+    if (err_is_fail(err) || !*received) {
+        return err;
     }
 
-    if (CAST_DEREF(rpc_identifier_t, recv_payload, 0) == RPC_ACK) {
-        if (ret_buf != NULL) {
-            // XXX: it is annoying to malloc a new buf and make the copy just to remove
-            //      the identifier. Consider moving it into ring buffer.
-            *ret_size = recv_size - sizeof(rpc_identifier_t);
-            *ret_buf = malloc(*ret_size);
-            if (*ret_buf == NULL) {
-                err = LIB_ERR_MALLOC_FAIL;
-                goto RET;
-            }
-            memcpy(*ret_buf, recv_payload + sizeof(rpc_identifier_t), *ret_size);
+    // Claim the cap from init, without holding up other replies on the channel
+    if (recv_identifier & RPC_SPECIAL_CAP_TRANSFER_FLAG) {
+        errval_t err2 = rpc_ump_recv_cap(&ticket, &recv_cap);
+        if (err_is_fail(err2)) {
+            reply_err = err_push(err2, LIB_ERR_UMP_CHAN_RECV_CAP);
+            DEBUG_ERR(reply_err, "rpc_ump_poll: rpc_ump_recv_cap failed\n");
         }
+    }
+
+    aos_chan_stats_recv(chan, recv_size, recv_cap);
 
+    if (future == NULL) {
+        DEBUG_PRINTF("rpc_ump_poll: reply to unknown request %u\n", recv_request_id);
+        free(recv_buf);
         if (!capref_is_null(recv_cap)) {
-            if (ret_cap == NULL) {
-                DEBUG_PRINTF("rpc_ump_call: received a cap but is given up!\n");
-            } else {
-                *ret_cap = recv_cap;
-            }
+            cap_destroy(recv_cap);
         }
-        err = SYS_ERR_OK;
-        goto RET;
-    } else {
-        assert(recv_size == sizeof(rpc_identifier_t) + sizeof(errval_t));
-        err = *((errval_t *)(recv_payload + sizeof(rpc_identifier_t)));
-        goto RET;
+        return SYS_ERR_OK;
     }
 
-RET:
-    free(recv_payload);
-    return err;
+    future->err = reply_err;
+    if (err_is_ok(reply_err)) {
+        future->ret_buf = recv_buf;
+        future->ret_size = recv_size;
+        future->ret_cap = recv_cap;
+    } else {
+        free(recv_buf);
+    }
+    *ret_future = future;
+    return SYS_ERR_OK;
 }
 
 static void rpc_ump_generic_handler(void *arg)
@@ -320,25 +590,29 @@ static void rpc_ump_generic_handler(void *arg)
 
     errval_t err;
 
-    uint8_t *recv_raw_buf = NULL;
-    size_t recv_raw_size = 0;
-
-    err = ump_chan_recv(uc, (void **)&recv_raw_buf, &recv_raw_size);
+    // The handler works on the message in place in the ring or the bulk region
+    struct rpc_ump_msg recv_msg;
+    err = rpc_ump_peek(uc, false, &recv_msg);
     if (err == LIB_ERR_RING_NO_MSG) {
         goto RE_REGISTER;
     }
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "%s: ring_consumer_recv failed\n", __func__);
+        DEBUG_ERR(err, "%s: rpc_ump_peek failed\n", __func__);
         goto RE_REGISTER;
     }
 
-    rpc_identifier_t recv_identifier = *((rpc_identifier_t *)recv_raw_buf);
-    uint8_t *recv_buf = recv_raw_buf + sizeof(rpc_identifier_t);
-    size_t recv_size = recv_raw_size - sizeof(rpc_identifier_t);
+    rpc_request_id_t recv_request_id = UMP_REQUEST_ID(recv_msg.raw);
+    rpc_identifier_t recv_identifier = UMP_IDENTIFIER(recv_msg.raw);
+    uint8_t *recv_buf = recv_msg.raw + RPC_UMP_HEADER_SIZE;
+    size_t recv_size = recv_msg.raw_size - RPC_UMP_HEADER_SIZE;
 
     struct capref recv_cap = NULL_CAP;
     if (recv_identifier & RPC_SPECIAL_CAP_TRANSFER_FLAG) {
-        err = rpc_ump_recv_cap(uc, &recv_cap);
+        struct aos_rpc_cap_ticket ticket;
+        err = rpc_ump_take_ticket(recv_buf, &recv_size, &ticket);
+        if (err_is_ok(err)) {
+            err = rpc_ump_recv_cap(&ticket, &recv_cap);
+        }
         if (err_is_fail(err)) {
             err = err_push(err, LIB_ERR_UMP_CHAN_RECV_CAP);
             DEBUG_ERR(err, "%s: rpc_ump_recv_cap failed\n", __func__);
@@ -348,6 +622,7 @@ static void rpc_ump_generic_handler(void *arg)
         /* Clear the flag */
         recv_identifier ^= RPC_SPECIAL_CAP_TRANSFER_FLAG;
     }
+    aos_chan_stats_recv(chan, recv_size, recv_cap);
 
     /* Call the handler */
     if (chan->handler) {
@@ -355,20 +630,32 @@ static void rpc_ump_generic_handler(void *arg)
         size_t reply_size = 0;
         struct capref reply_cap = NULL_CAP;
         bool free_out_payload = true;
+        systime_t start = systime_now();
         err = chan->handler(chan->arg, recv_identifier, recv_buf, recv_size, recv_cap,
                             &reply_buf, &reply_size, &reply_cap, &free_out_payload,
                             &re_register);
+        aos_chan_stats_handled(chan, start);
+
+        // Release the request before replying, the reply may need the ring space
+        errval_t err2 = rpc_ump_release(uc, &recv_msg);
+        if (err_is_fail(err2)) {
+            DEBUG_ERR(err2, "%s: rpc_ump_release failed\n", __func__);
+        }
 
         if (reply_size != -1) {  // -1 means no reply
             if (err_is_fail(err)) {
-                err = rpc_ump_nack(uc, err);
+                err = rpc_ump_nack(uc, recv_request_id, err);
                 if (err_is_fail(err)) {
                     DEBUG_ERR(err, "%s: aos_chan_nack failed\n", __func__);
+                } else {
+                    aos_chan_stats_sent(chan, sizeof(errval_t), NULL_CAP);
                 }
             } else {
-                err = rpc_ump_ack(uc, reply_cap, reply_buf, reply_size);
+                err = rpc_ump_ack(uc, recv_request_id, reply_cap, reply_buf, reply_size);
                 if (err_is_fail(err)) {
                     DEBUG_ERR(err, "%s: aos_chan_ack failed\n", __func__);
+                } else {
+                    aos_chan_stats_sent(chan, reply_size, reply_cap);
                 }
             }
         }
@@ -379,7 +666,10 @@ static void rpc_ump_generic_handler(void *arg)
     }
 
 CLEANUP:
-    free(recv_raw_buf);
+    err = rpc_ump_release(uc, &recv_msg);  // no-op if already released
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "%s: rpc_ump_release failed\n", __func__);
+    }
 RE_REGISTER:
     if (re_register) {
         err = ump_chan_register_recv(uc, get_default_waitset(),
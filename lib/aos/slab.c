@@ -24,6 +24,38 @@ struct block_head {
 };
 
 STATIC_ASSERT_SIZEOF(struct block_head, SLAB_BLOCK_HDRSIZE);
+STATIC_ASSERT(sizeof(struct slab_head) % 16 == 0, "slab_head must keep blocks aligned");
+
+static inline void list_insert(struct slab_allocator *slabs, struct slab_head *sh,
+                               enum slab_list list)
+{
+    sh->list = list;
+    sh->prev = NULL;
+    sh->next = slabs->lists[list];
+    if (sh->next != NULL) {
+        sh->next->prev = sh;
+    }
+    slabs->lists[list] = sh;
+}
+
+static inline void list_remove(struct slab_allocator *slabs, struct slab_head *sh)
+{
+    if (sh->prev != NULL) {
+        sh->prev->next = sh->next;
+    } else {
+        slabs->lists[sh->list] = sh->next;
+    }
+    if (sh->next != NULL) {
+        sh->next->prev = sh->prev;
+    }
+}
+
+static inline void list_move(struct slab_allocator *slabs, struct slab_head *sh,
+                             enum slab_list list)
+{
+    list_remove(slabs, sh);
+    list_insert(slabs, sh, list);
+}
 
 /**
  * \brief Initialise a new slab allocator
@@ -35,14 +67,61 @@ STATIC_ASSERT_SIZEOF(struct block_head, SLAB_BLOCK_HDRSIZE);
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func)
 {
-    slabs->slabs = NULL;
+    for (size_t i = 0; i < SLAB_LIST_COUNT; i++) {
+        slabs->lists[i] = NULL;
+    }
+    slabs->unaligned = NULL;
     slabs->blocksize = SLAB_REAL_BLOCKSIZE(blocksize);
+    slabs->slab_size = MAX(BASE_PAGE_SIZE, 1UL << log2ceil(sizeof(struct slab_head)
+                                                            + SLAB_MIN_BLOCKS
+                                                                  * slabs->blocksize));
+    slabs->total_blocks = 0;
+    slabs->free_blocks = 0;
     slabs->refill_func = refill_func;
 }
 
+/// Set up a slab in [start, end), which must hold at least one block
+static void add_slab(struct slab_allocator *slabs, uintptr_t start, uintptr_t end)
+{
+    struct slab_head *head = (struct slab_head *)start;
+    size_t blocksize = slabs->blocksize;
+    uintptr_t buf = start + sizeof(struct slab_head);
+    assert((end - buf) / blocksize <= UINT32_MAX);
+    head->free = head->total = (end - buf) / blocksize;
+    assert(head->total > 0);
+    head->owner = slabs;
+    head->limit = buf + head->total * blocksize;
+
+    /* enqueue blocks in freelist */
+    struct block_head *bh = head->blocks = (struct block_head *)buf;
+    for (uint32_t i = head->total; i > 1; i--) {
+        buf += blocksize;
+        bh->next = (struct block_head *)buf;
+        bh = bh->next;
+    }
+    bh->next = NULL;
+
+    /* slabs not starting at a boundary are searched for on free */
+    if (start % slabs->slab_size != 0) {
+        head->next_unaligned = slabs->unaligned;
+        slabs->unaligned = head;
+    } else {
+        head->next_unaligned = NULL;
+    }
+
+    list_insert(slabs, head, SLAB_LIST_EMPTY);
+    slabs->total_blocks += head->total;
+    slabs->free_blocks += head->total;
+}
 
 /**
- * \brief Add memory (a new slab) to a slab allocator
+ * \brief Add memory to a slab allocator
+ *
+ * The memory is cut into slabs at multiples of slabs->slab_size, so that slab_free()
+ * finds the slab of a block by rounding its address down. A buffer that does not start
+ * at such a multiple begins with a slab that slab_free() has to search for; a buffer
+ * smaller than a slab is a single slab, holding as many blocks as SLAB_STATIC_SIZE()
+ * promises.
  *
  * \param slabs Pointer to slab allocator instance
  * \param buf Pointer to start of memory region
@@ -50,30 +129,30 @@ void slab_init(struct slab_allocator *slabs, size_t blocksize,
  */
 void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
 {
-    /* setup slab_head structure at top of buffer */
     assert(buflen > sizeof(struct slab_head));
-    struct slab_head *head = buf;
-    buflen -= sizeof(struct slab_head);
-    buf = (char *)buf + sizeof(struct slab_head);
-
-    /* calculate number of blocks in buffer */
-    size_t blocksize = slabs->blocksize;
-    assert(buflen / blocksize <= UINT32_MAX);
-    head->free = head->total = buflen / blocksize;
-    assert(head->total > 0);
-
-    /* enqueue blocks in freelist */
-    struct block_head *bh = head->blocks = buf;
-    for (uint32_t i = head->total; i > 1; i--) {
-        buf = (char *)buf + blocksize;
-        bh->next = buf;
-        bh = buf;
+    const size_t slab_size = slabs->slab_size;
+    const size_t min_len = sizeof(struct slab_head) + slabs->blocksize;
+    uintptr_t start = (uintptr_t)buf;
+    const uintptr_t end = start + buflen;
+
+    if (start % slab_size != 0) {
+        uintptr_t boundary = ROUND_UP(start, slab_size);
+        if (boundary >= end || end - boundary < slab_size) {
+            // Not even one whole aligned slab after the boundary, keep it in one piece
+            add_slab(slabs, start, end);
+            return;
+        }
+        if (boundary - start >= min_len) {
+            add_slab(slabs, start, boundary);
+        }
+        start = boundary;
     }
-    bh->next = NULL;
 
-    /* enqueue slab in list of slabs */
-    head->next = slabs->slabs;
-    slabs->slabs = head;
+    while (start < end && end - start >= min_len) {
+        uintptr_t slab_end = MIN(start + slab_size, end);
+        add_slab(slabs, start, slab_end);
+        start = slab_end;
+    }
 }
 
 /**
@@ -86,9 +165,11 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
 void *slab_alloc(struct slab_allocator *slabs)
 {
     errval_t err;
-    /* find a slab with free blocks */
-    struct slab_head *sh;
-    for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+    /* partially used slabs first, to keep the empty ones empty */
+    struct slab_head *sh = slabs->lists[SLAB_LIST_PARTIAL];
+    if (sh == NULL) {
+        sh = slabs->lists[SLAB_LIST_EMPTY];
+    }
 
     if (sh == NULL) {
         /* out of memory. try refill function if we have one */
@@ -100,7 +181,10 @@ void *slab_alloc(struct slab_allocator *slabs)
                 DEBUG_ERR(err, "slab refill_func failed");
                 return NULL;
             }
-            for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+            sh = slabs->lists[SLAB_LIST_PARTIAL];
+            if (sh == NULL) {
+                sh = slabs->lists[SLAB_LIST_EMPTY];
+            }
             if (sh == NULL) {
                 return NULL;
             }
@@ -113,10 +197,28 @@ void *slab_alloc(struct slab_allocator *slabs)
     assert(bh != NULL);
     sh->blocks = bh->next;
     sh->free--;
+    slabs->free_blocks--;
+
+    if (sh->free == 0) {
+        list_move(slabs, sh, SLAB_LIST_FULL);
+    } else if (sh->list == SLAB_LIST_EMPTY) {
+        list_move(slabs, sh, SLAB_LIST_PARTIAL);
+    }
 
     return bh;
 }
 
+/// Find the slab a block belongs to
+static inline struct slab_head *find_slab(struct slab_allocator *slabs, void *block)
+{
+    for (struct slab_head *sh = slabs->unaligned; sh != NULL; sh = sh->next_unaligned) {
+        if ((uintptr_t)block > (uintptr_t)sh && (uintptr_t)block < sh->limit) {
+            return sh;
+        }
+    }
+    return (struct slab_head *)ROUND_DOWN((uintptr_t)block, slabs->slab_size);
+}
+
 /**
  * \brief Free a block to the slab allocator
  *
@@ -131,24 +233,22 @@ void slab_free(struct slab_allocator *slabs, void *block)
 
     struct block_head *bh = (struct block_head *)block;
 
-    /* find matching slab */
-    struct slab_head *sh;
-    size_t blocksize = slabs->blocksize;
-    for (sh = slabs->slabs; sh != NULL; sh = sh->next) {
-        /* check if block falls inside this slab */
-        uintptr_t slab_limit = (uintptr_t)sh + sizeof(struct slab_head)
-                               + blocksize * sh->total;
-        if ((uintptr_t)bh > (uintptr_t)sh && (uintptr_t)bh < slab_limit) {
-            break;
-        }
-    }
-    assert(sh != NULL);
+    struct slab_head *sh = find_slab(slabs, block);
+    assert(sh->owner == slabs);
+    assert((uintptr_t)bh < sh->limit);
 
     /* re-enqueue in slab's free list */
     bh->next = sh->blocks;
     sh->blocks = bh;
     sh->free++;
+    slabs->free_blocks++;
     assert(sh->free <= sh->total);
+
+    if (sh->free == sh->total) {
+        list_move(slabs, sh, SLAB_LIST_EMPTY);
+    } else if (sh->list == SLAB_LIST_FULL) {
+        list_move(slabs, sh, SLAB_LIST_PARTIAL);
+    }
 }
 
 /**
@@ -160,13 +260,29 @@ void slab_free(struct slab_allocator *slabs, void *block)
  */
 size_t slab_freecount(struct slab_allocator *slabs)
 {
-    size_t ret = 0;
+    return slabs->free_blocks;
+}
 
-    for (struct slab_head *sh = slabs->slabs; sh != NULL; sh = sh->next) {
-        ret += sh->free;
+/**
+ * \brief Report the occupancy of a slab allocator
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param stats Filled with the number of slabs on each list and the block counts
+ */
+void slab_get_stats(struct slab_allocator *slabs, struct slab_stats *stats)
+{
+    for (size_t i = 0; i < SLAB_LIST_COUNT; i++) {
+        stats->slabs[i] = 0;
+        for (struct slab_head *sh = slabs->lists[i]; sh != NULL; sh = sh->next) {
+            stats->slabs[i]++;
+        }
     }
-
-    return ret;
+    stats->unaligned_slabs = 0;
+    for (struct slab_head *sh = slabs->unaligned; sh != NULL; sh = sh->next_unaligned) {
+        stats->unaligned_slabs++;
+    }
+    stats->total_blocks = slabs->total_blocks;
+    stats->free_blocks = slabs->free_blocks;
 }
 
 /**
@@ -222,9 +338,18 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref fr
         return err;
     }
 
-    // Map the frame
+    // Map the frame, at a slab boundary so that all the slabs are found by alignment
+    struct paging_state *st = get_current_paging_state();
     void *buf;
-    err = paging_map_frame_attr(get_current_paging_state(), &buf, size, frame, VREGION_FLAGS_READ_WRITE);
+    if (slabs->slab_size > BASE_PAGE_SIZE && size >= slabs->slab_size) {
+        err = paging_alloc(st, &buf, size, slabs->slab_size);
+        if (err_is_ok(err)) {
+            err = paging_map_fixed_attr(st, (lvaddr_t)buf, frame, size,
+                                        VREGION_FLAGS_READ_WRITE);
+        }
+    } else {
+        err = paging_map_frame_attr(st, &buf, size, frame, VREGION_FLAGS_READ_WRITE);
+    }
     if (err_is_fail(err)) {
         return err;
     }
@@ -238,12 +363,11 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref fr
 /**
  * \brief General-purpose implementation of a slab allocate/refill function
  *
- * Allocates and maps a single page (FIXME: make configurable) and adds it
- * to the allocator.
+ * Allocates and maps SLAB_REFILL_SLABS slabs at once and adds them to the allocator.
  *
  * \param slabs Pointer to slab allocator instance
  */
 errval_t slab_default_refill(struct slab_allocator *slabs)
 {
-    return slab_refill_pages(slabs, BASE_PAGE_SIZE);
+    return slab_refill_pages(slabs, SLAB_REFILL_SLABS * slabs->slab_size);
 }
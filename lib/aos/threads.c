@@ -222,6 +222,7 @@ static void thread_init(dispatcher_handle_t disp, struct thread *newthread)
     newthread->coreid = get_dispatcher_generic(disp)->core_id;
     newthread->userptr = NULL;
     memset(newthread->userptrs, 0, sizeof(newthread->userptrs));
+    memset(&newthread->malloc_cache, 0, sizeof(newthread->malloc_cache));
     newthread->yield_epoch = 0;
     newthread->wakeup_reason = NULL;
     newthread->return_value = 0;
@@ -317,6 +318,7 @@ static void free_thread(struct thread *thread)
     ldt_free_segment(thread->thread_seg_selector);
 #endif
 
+    malloc_thread_cache_flush(&thread->malloc_cache);
     free(thread->stack);
     if (thread->tls_dtv != NULL) {
         free(thread->tls_dtv);
@@ -771,6 +773,8 @@ static int cleanup_thread(void *arg)
     if (thread != NULL) {
         free_thread(thread);
     }
+    // This thread is initialized again next time, without its cache
+    malloc_thread_cache_flush(&thread_self()->malloc_cache);
 
     // disable and release static thread
     dispatcher_handle_t handle = disp_disable();
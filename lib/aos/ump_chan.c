@@ -5,7 +5,9 @@
 #include <aos/ump_chan.h>
 #include <aos/paging.h>
 #include <aos/domain.h>
+#include <aos/dispatch.h>
 #include <string.h>
+#include "waitset_chan_priv.h"
 
 /**
  * \brief Initialise a new UMP channel
@@ -57,18 +59,31 @@ errval_t ump_chan_init_from_buf(struct ump_chan *uc, void *zeroed_buf, enum UMP_
 
     uint8_t *b = zeroed_buf;
 
-    err = ring_consumer_init(&uc->recv, role == UMP_CHAN_CLIENT ? b : b + RING_BUFFER_SIZE);
+    err = ring_consumer_init(&uc->recv, role == UMP_CHAN_CLIENT ? b : b + RING_BUFFER_SIZE,
+                             UMP_CHAN_RING_MODE);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_RING_CONSUMER_INIT);
     }
 
-    err = ring_producer_init(&uc->send, role == UMP_CHAN_CLIENT ? b + RING_BUFFER_SIZE : b);
+    err = ring_producer_init(&uc->send, role == UMP_CHAN_CLIENT ? b + RING_BUFFER_SIZE : b,
+                             UMP_CHAN_RING_MODE);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_RING_PRODUCER_INIT);
     }
 
     waitset_chanstate_init(&uc->recv_waitset, CHANTYPE_UMP_IN);
 
+    uc->bulk.tx = NULL;
+    uc->bulk.rx = NULL;
+    uc->bulk.size = 0;
+    uc->bulk.tx_head = 0;
+
+    uc->wait.last_active = 0;
+    uc->wait.parked = false;
+    uc->wait.park_us = 0;
+    deferred_event_init(&uc->wait.wake_event);
+    ump_chan_set_wait_policy(uc, UMP_CHAN_WAIT_POLICY_DEFAULT);
+
     uc->pid = pid;
 
     return SYS_ERR_OK;
@@ -81,5 +96,192 @@ errval_t ump_chan_init_from_buf(struct ump_chan *uc, void *zeroed_buf, enum UMP_
  */
 void ump_chan_destroy(struct ump_chan *uc)
 {
-    waitset_chanstate_destroy(&uc->recv_waitset);  // will deregister inside
-}
\ No newline at end of file
+    if (uc->recv_waitset.waitset != NULL) {
+        errval_t err = ump_chan_deregister_recv(uc);
+        assert(err_is_ok(err));  // can't fail if registered
+    }
+}
+
+void ump_chan_set_wait_policy(struct ump_chan *uc, struct ring_wait_policy policy)
+{
+    assert(uc != NULL);
+    uc->wait.policy = policy;
+    uc->send.wait = policy;
+    uc->recv.wait = policy;
+}
+
+errval_t ump_chan_register_recv(struct ump_chan *uc, struct waitset *ws,
+                                struct event_closure closure)
+{
+    uc->wait.last_active = systime_now();  // spin again before parking
+    return waitset_chan_register_polled(ws, &uc->recv_waitset, closure);
+}
+
+errval_t ump_chan_deregister_recv(struct ump_chan *uc)
+{
+    dispatcher_handle_t handle = disp_disable();
+    if (uc->wait.parked) {
+        uc->wait.parked = false;
+        // fails if the recheck has fired but not been dispatched, which cancels it as well
+        deferred_event_cancel_disabled(&uc->wait.wake_event, handle);
+    }
+    errval_t err = waitset_chan_deregister_disabled(&uc->recv_waitset, handle);
+    disp_enable(handle);
+    return err;
+}
+
+/**
+ * \brief Record the result of polling the channel, returns true if it should be parked
+ */
+bool ump_chan_poll_idle_disabled(struct ump_chan *uc, bool ready, systime_t now)
+{
+    if (ready) {
+        uc->wait.last_active = now;
+        return false;
+    }
+    return uc->wait.policy.spin_ns != RING_WAIT_SPIN_FOREVER
+           && systime_to_ns(now - uc->wait.last_active) >= uc->wait.policy.spin_ns;
+}
+
+static void ump_chan_wake_handler(void *arg);
+
+static void ump_chan_arm_wake_disabled(struct ump_chan *uc, dispatcher_handle_t handle)
+{
+    errval_t err = deferred_event_register_disabled(&uc->wait.wake_event,
+                                                    uc->recv_waitset.waitset,
+                                                    uc->wait.park_us,
+                                                    MKCLOSURE(ump_chan_wake_handler, uc),
+                                                    handle);
+    assert_disabled(err_is_ok(err));
+}
+
+/**
+ * \brief Recheck a parked channel, trigger it if a message has arrived
+ */
+static void ump_chan_wake_handler(void *arg)
+{
+    struct ump_chan *uc = arg;
+
+    dispatcher_handle_t handle = disp_disable();
+    if (uc->wait.parked) {  // not deregistered meanwhile
+        if (ring_consumer_can_recv(&uc->recv)) {
+            uc->wait.parked = false;
+            uc->wait.last_active = systime_now();
+            errval_t err = waitset_chan_trigger_disabled(&uc->recv_waitset, handle);
+            assert_disabled(err_is_ok(err));
+        } else {
+            uc->wait.park_us = MIN(uc->wait.park_us * 2,
+                                   MAX(uc->wait.policy.sleep_max_us, uc->wait.park_us));
+            ump_chan_arm_wake_disabled(uc, handle);
+        }
+    }
+    disp_enable(handle);
+}
+
+/**
+ * \brief Park a channel the waitset has just stopped polling
+ */
+void ump_chan_park_disabled(struct ump_chan *uc, dispatcher_handle_t handle)
+{
+    assert_disabled(!uc->wait.parked);
+    uc->wait.parked = true;
+    uc->wait.park_us = MAX(uc->wait.policy.sleep_min_us, 1);
+    ump_chan_arm_wake_disabled(uc, handle);
+}
+
+void ump_chan_attach_bulk(struct ump_chan *uc, void *zeroed_tx, void *zeroed_rx,
+                          size_t region_size)
+{
+    assert(uc != NULL);
+    assert(region_size > UMP_BULK_CONTROL_SIZE);
+    uc->bulk.tx = zeroed_tx;
+    uc->bulk.rx = zeroed_rx;
+    uc->bulk.size = ROUND_DOWN(region_size - UMP_BULK_CONTROL_SIZE, UMP_BULK_ALIGNMENT);
+    uc->bulk.tx_head = 0;
+}
+
+/// Position up to which the receiver has released a region
+static inline volatile size_t *ump_bulk_consumed(uint8_t *region)
+{
+    return (volatile size_t *)region;
+}
+
+/// Range a buffer of size would take next, it never wraps around inside the region
+static inline size_t ump_bulk_next(struct ump_bulk *bulk, size_t size, size_t *end)
+{
+    // Skip to the start of the region instead of wrapping
+    size_t start = bulk->tx_head;
+    if (start % bulk->size + size > bulk->size) {
+        start = ROUND_UP(start, bulk->size);
+    }
+    *end = ROUND_UP(start + size, UMP_BULK_ALIGNMENT);
+    return start;
+}
+
+/**
+ * \brief Check if ump_chan_bulk_alloc() would return without waiting for the other end
+ */
+bool ump_chan_bulk_can_alloc(struct ump_chan *uc, size_t size)
+{
+    struct ump_bulk *bulk = &uc->bulk;
+    assert(bulk->tx != NULL && size <= bulk->size / 2);
+    size_t end;
+    ump_bulk_next(bulk, size, &end);
+    return end - *ump_bulk_consumed(bulk->tx) <= bulk->size;
+}
+
+/**
+ * \brief Allocate a contiguous buffer in the bulk region written by us
+ *
+ * Blocks until the other end has released enough space. Allocations are released in the
+ * order they are made.
+ *
+ * \param uc UMP channel with bulk regions
+ * \param size Size of the buffer, at most half of the region
+ * \param buf Filled with the buffer to write into
+ * \param pos Filled with the position to pass to the other end
+ */
+errval_t ump_chan_bulk_alloc(struct ump_chan *uc, size_t size, void **buf, size_t *pos)
+{
+    struct ump_bulk *bulk = &uc->bulk;
+    if (bulk->tx == NULL) {
+        return LIB_ERR_UMP_BULK_INVALID;
+    }
+    if (size == 0 || size > bulk->size / 2) {
+        return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+
+    size_t end;
+    size_t start = ump_bulk_next(bulk, size, &end);
+
+    while (end - *ump_bulk_consumed(bulk->tx) > bulk->size) {
+        thread_yield();
+    }
+    dmb();  // the other end is done reading before we overwrite
+
+    bulk->tx_head = end;
+    *buf = bulk->tx + UMP_BULK_CONTROL_SIZE + start % bulk->size;
+    *pos = start;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Locate a buffer written by the other end, NULL if the position is invalid
+ */
+void *ump_chan_bulk_rx_buf(struct ump_chan *uc, size_t pos, size_t size)
+{
+    struct ump_bulk *bulk = &uc->bulk;
+    if (bulk->rx == NULL || size > bulk->size || pos % bulk->size + size > bulk->size) {
+        return NULL;
+    }
+    return bulk->rx + UMP_BULK_CONTROL_SIZE + pos % bulk->size;
+}
+
+/**
+ * \brief Release the bulk buffers written by the other end up to end_pos
+ */
+void ump_chan_bulk_release(struct ump_chan *uc, size_t end_pos)
+{
+    dmb();  // finish reading before the other end can reuse the space
+    *ump_bulk_consumed(uc->bulk.rx) = ROUND_UP(end_pos, UMP_BULK_ALIGNMENT);
+}
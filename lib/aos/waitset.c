@@ -213,9 +213,11 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
 
     if (!dp->polled_channels)
         return;
+    systime_t now = systime_now();
     chan = dp->polled_channels;
     do {
         bool chan_ready = false;
+        bool chan_park = false;
         switch (chan->chantype) {
             case CHANTYPE_UMP_IN:
                 // DONE: To add UMP channel support to waitsets,
@@ -223,6 +225,7 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
                 {
                     struct ump_chan *uc = (struct ump_chan *) chan;
                     chan_ready = ring_consumer_can_recv(&uc->recv);
+                    chan_park = ump_chan_poll_idle_disabled(uc, chan_ready, now);
                 }
                 break;
             default:
@@ -240,6 +243,12 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
             errval_t err = waitset_chan_trigger_disabled(chan->polled_prev, handle);
             /* Shouldn't fail */
             assert_disabled(err_is_ok(err));
+        } else if (chan_park) {
+            /* Idle for too long, stop polling it so that the dispatcher can sleep.
+             * The channel stays registered and is rechecked by a deferred event. */
+            struct ump_chan *uc = (struct ump_chan *) chan->polled_prev;
+            dequeue_polled(&dp->polled_channels, &uc->recv_waitset);
+            ump_chan_park_disabled(uc, handle);
         }
         /* Circular queue, stop if we arrived at the start again
          * If channel was dequeued there are 3 situations:
@@ -747,7 +756,9 @@ errval_t waitset_chan_deregister_disabled(struct waitset_chanstate *chan,
 
     case CHAN_POLLED:
         dequeue(&ws->polled, chan);
-        dequeue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+        if (chan->polled_next != NULL) {  // not parked
+            dequeue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+        }
         break;
 
     case CHAN_PENDING:
@@ -857,7 +868,9 @@ errval_t waitset_chan_trigger_disabled(struct waitset_chanstate *chan,
     } else {
         assert_disabled(chan->state == CHAN_POLLED);
         dequeue(&ws->polled, chan);
-        dequeue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+        if (chan->polled_next != NULL) {  // not parked
+            dequeue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+        }
     }
 
     // else mark channel pending and move to end of pending event queue
@@ -0,0 +1,316 @@
+/**
+ * \file
+ * \brief Write-back buffer cache of block device sectors
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <fs/bcache.h>
+
+/// Longest run of dirty sectors written back with a single request
+#define BCACHE_SYNC_RUN 64
+
+struct bcache_buf {
+    size_t sector;
+    bool dirty;
+    struct bcache_buf *prev, *next;     ///< LRU list, or free list through next
+    struct bcache_buf *hash_next;
+    uint8_t data[BLOCKDEV_SECTOR_SIZE];
+};
+
+static inline struct bcache_buf **bucket(struct bcache *c, size_t sector)
+{
+    return &c->buckets[sector & c->bucket_mask];
+}
+
+static struct bcache_buf *lookup(struct bcache *c, size_t sector)
+{
+    for (struct bcache_buf *b = *bucket(c, sector); b != NULL; b = b->hash_next) {
+        if (b->sector == sector) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void hash_insert(struct bcache *c, struct bcache_buf *b)
+{
+    struct bcache_buf **head = bucket(c, b->sector);
+    b->hash_next = *head;
+    *head = b;
+}
+
+static void hash_remove(struct bcache *c, struct bcache_buf *b)
+{
+    struct bcache_buf **p = bucket(c, b->sector);
+    while (*p != b) {
+        p = &(*p)->hash_next;
+    }
+    *p = b->hash_next;
+}
+
+static void lru_remove(struct bcache *c, struct bcache_buf *b)
+{
+    if (b->prev != NULL) {
+        b->prev->next = b->next;
+    } else {
+        c->lru_head = b->next;
+    }
+    if (b->next != NULL) {
+        b->next->prev = b->prev;
+    } else {
+        c->lru_tail = b->prev;
+    }
+}
+
+static void lru_push_front(struct bcache *c, struct bcache_buf *b)
+{
+    b->prev = NULL;
+    b->next = c->lru_head;
+    if (c->lru_head != NULL) {
+        c->lru_head->prev = b;
+    } else {
+        c->lru_tail = b;
+    }
+    c->lru_head = b;
+}
+
+static void touch(struct bcache *c, struct bcache_buf *b)
+{
+    if (c->lru_head != b) {
+        lru_remove(c, b);
+        lru_push_front(c, b);
+    }
+}
+
+/// Take a buffer for a sector the cache does not hold, evicting the least recently used
+static errval_t get_buf(struct bcache *c, size_t sector, struct bcache_buf **retbuf)
+{
+    struct bcache_buf *b = c->free;
+    if (b != NULL) {
+        c->free = b->next;
+    } else {
+        b = c->lru_tail;
+        assert(b != NULL);
+        if (b->dirty) {
+            errval_t err = blockdev_write(c->dev, b->sector, 1, b->data);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            c->stats.writebacks++;
+        }
+        lru_remove(c, b);
+        hash_remove(c, b);
+    }
+
+    b->sector = sector;
+    b->dirty = false;
+    hash_insert(c, b);
+    lru_push_front(c, b);
+    *retbuf = b;
+    return SYS_ERR_OK;
+}
+
+/// Give back a buffer taken by get_buf() that could not be filled
+static void put_buf(struct bcache *c, struct bcache_buf *b)
+{
+    lru_remove(c, b);
+    hash_remove(c, b);
+    b->next = c->free;
+    c->free = b;
+}
+
+errval_t bcache_init(struct bcache *c, struct blockdev *dev, size_t budget)
+{
+    memset(c, 0, sizeof(*c));
+    c->dev = dev;
+    thread_mutex_init(&c->mutex);
+
+    c->buf_count = MAX(budget / sizeof(struct bcache_buf), 1);
+    size_t bucket_count = 1;
+    while (bucket_count < c->buf_count) {
+        bucket_count *= 2;
+    }
+    c->bucket_mask = bucket_count - 1;
+
+    c->bufs = malloc(c->buf_count * sizeof(struct bcache_buf));
+    c->buckets = calloc(bucket_count, sizeof(struct bcache_buf *));
+    if (c->bufs == NULL || c->buckets == NULL) {
+        free(c->bufs);
+        free(c->buckets);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < c->buf_count; i++) {
+        c->bufs[i].next = c->free;
+        c->free = &c->bufs[i];
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t bcache_read(struct bcache *c, size_t sector, void *buf)
+{
+    errval_t err = SYS_ERR_OK;
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        struct bcache_buf *b = lookup(c, sector);
+        if (b != NULL) {
+            c->stats.hits++;
+            touch(c, b);
+            memcpy(buf, b->data, BLOCKDEV_SECTOR_SIZE);
+            break;
+        }
+
+        c->stats.misses++;
+        err = get_buf(c, sector, &b);
+        if (err_is_fail(err)) {
+            break;
+        }
+        err = blockdev_read(c->dev, sector, 1, b->data);
+        if (err_is_fail(err)) {
+            put_buf(c, b);
+            break;
+        }
+        memcpy(buf, b->data, BLOCKDEV_SECTOR_SIZE);
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+    return err;
+}
+
+errval_t bcache_write(struct bcache *c, size_t sector, const void *buf)
+{
+    errval_t err = SYS_ERR_OK;
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        struct bcache_buf *b = lookup(c, sector);
+        if (b != NULL) {
+            c->stats.hits++;
+            touch(c, b);
+        } else {
+            // The whole sector is overwritten, it need not be read first
+            c->stats.misses++;
+            err = get_buf(c, sector, &b);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+        memcpy(b->data, buf, BLOCKDEV_SECTOR_SIZE);
+        b->dirty = true;
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+    return err;
+}
+
+errval_t bcache_read_run(struct bcache *c, size_t sector, size_t count, void *buf)
+{
+    errval_t err = SYS_ERR_OK;
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        err = blockdev_read(c->dev, sector, count, buf);
+        if (err_is_fail(err)) {
+            break;
+        }
+        // Dirty sectors are newer than the device, clean ones are the same
+        for (size_t i = 0; i < count; i++) {
+            struct bcache_buf *b = lookup(c, sector + i);
+            if (b != NULL && b->dirty) {
+                memcpy((uint8_t *)buf + i * BLOCKDEV_SECTOR_SIZE, b->data,
+                       BLOCKDEV_SECTOR_SIZE);
+            }
+        }
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+    return err;
+}
+
+errval_t bcache_write_run(struct bcache *c, size_t sector, size_t count,
+                          const void *buf)
+{
+    errval_t err = SYS_ERR_OK;
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        err = blockdev_write(c->dev, sector, count, buf);
+        if (err_is_fail(err)) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            struct bcache_buf *b = lookup(c, sector + i);
+            if (b != NULL) {
+                memcpy(b->data, (const uint8_t *)buf + i * BLOCKDEV_SECTOR_SIZE,
+                       BLOCKDEV_SECTOR_SIZE);
+                b->dirty = false;
+            }
+        }
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+    return err;
+}
+
+static int compare_sector(const void *a, const void *b)
+{
+    size_t sa = (*(struct bcache_buf *const *)a)->sector;
+    size_t sb = (*(struct bcache_buf *const *)b)->sector;
+    return (sa > sb) - (sa < sb);
+}
+
+errval_t bcache_sync(struct bcache *c)
+{
+    errval_t err = SYS_ERR_OK;
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        struct bcache_buf **dirty = malloc(c->buf_count * sizeof(*dirty));
+        uint8_t *run = malloc(BCACHE_SYNC_RUN * BLOCKDEV_SECTOR_SIZE);
+        if (dirty == NULL || run == NULL) {
+            free(dirty);
+            free(run);
+            err = LIB_ERR_MALLOC_FAIL;
+            break;
+        }
+
+        size_t n = 0;
+        for (struct bcache_buf *b = c->lru_head; b != NULL; b = b->next) {
+            if (b->dirty) {
+                dirty[n++] = b;
+            }
+        }
+        qsort(dirty, n, sizeof(*dirty), compare_sector);
+
+        // Sectors that follow each other go to the device together
+        for (size_t i = 0; i < n;) {
+            size_t len = 1;
+            while (i + len < n && len < BCACHE_SYNC_RUN
+                   && dirty[i + len]->sector == dirty[i]->sector + len) {
+                len++;
+            }
+            for (size_t j = 0; j < len; j++) {
+                memcpy(run + j * BLOCKDEV_SECTOR_SIZE, dirty[i + j]->data,
+                       BLOCKDEV_SECTOR_SIZE);
+            }
+            err = blockdev_write(c->dev, dirty[i]->sector, len, run);
+            if (err_is_fail(err)) {
+                break;
+            }
+            for (size_t j = 0; j < len; j++) {
+                dirty[i + j]->dirty = false;
+            }
+            c->stats.writebacks += len;
+            i += len;
+        }
+
+        free(dirty);
+        free(run);
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+    return err;
+}
+
+void bcache_get_stats(struct bcache *c, struct bcache_stats *stats)
+{
+    THREAD_MUTEX_ENTER(&c->mutex)
+    {
+        *stats = c->stats;
+    }
+    THREAD_MUTEX_EXIT(&c->mutex)
+}
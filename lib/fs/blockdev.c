@@ -0,0 +1,181 @@
+/**
+ * \file
+ * \brief Block device requests, common to all backends
+ */
+
+#include <aos/aos.h>
+#include <fs/blockdev.h>
+
+void blockdev_init(struct blockdev *dev, const char *name, const struct blockdev_ops *ops,
+                   void *st, size_t sector_count, size_t queue_depth)
+{
+    assert(queue_depth > 0);
+    dev->name = name;
+    dev->ops = ops;
+    dev->st = st;
+    dev->sector_count = sector_count;
+    dev->queue_depth = queue_depth;
+    thread_mutex_init(&dev->mutex);
+    dev->in_flight = 0;
+    dev->queue_head = dev->queue_tail = NULL;
+    dev->starters = NULL;
+}
+
+/// Start req, and the requests handed its slot if the backend completes it right away
+static void start(struct blockdev *dev, struct blockdev_request *req)
+{
+    struct blockdev_starter me = { .thread = thread_self() };
+    THREAD_MUTEX_ENTER(&dev->mutex)
+    {
+        me.next = dev->starters;
+        dev->starters = &me;
+    }
+    THREAD_MUTEX_EXIT(&dev->mutex)
+
+    while (req != NULL) {
+        errval_t err = dev->ops->submit(dev, req);
+        if (err_is_fail(err)) {
+            blockdev_complete(dev, req, err);
+        }
+
+        THREAD_MUTEX_ENTER(&dev->mutex)
+        {
+            req = me.head;
+            if (req != NULL) {
+                me.head = req->next;
+                if (me.head == NULL) {
+                    me.tail = NULL;
+                }
+                break;
+            }
+            struct blockdev_starter **s = &dev->starters;
+            while (*s != &me) {
+                s = &(*s)->next;
+            }
+            *s = me.next;
+        }
+        THREAD_MUTEX_EXIT(&dev->mutex)
+    }
+}
+
+errval_t blockdev_submit(struct blockdev *dev, struct blockdev_request *req)
+{
+    if (req->count == 0 || req->sector + req->count > dev->sector_count) {
+        return FAT_ERR_BLOCK_BOUNDS;
+    }
+
+    req->err = SYS_ERR_OK;
+    req->completed = false;
+    req->next = NULL;
+
+    bool started = false;
+    THREAD_MUTEX_ENTER(&dev->mutex)
+    {
+        if (dev->in_flight < dev->queue_depth) {
+            dev->in_flight++;
+            started = true;
+        } else if (dev->queue_tail == NULL) {
+            dev->queue_head = dev->queue_tail = req;
+        } else {
+            dev->queue_tail->next = req;
+            dev->queue_tail = req;
+        }
+    }
+    THREAD_MUTEX_EXIT(&dev->mutex)
+
+    if (started) {
+        start(dev, req);
+    }
+    return SYS_ERR_OK;
+}
+
+void blockdev_complete(struct blockdev *dev, struct blockdev_request *req, errval_t err)
+{
+    // The slot of the request goes to the next one in the queue
+    struct blockdev_request *next = NULL;
+    THREAD_MUTEX_ENTER(&dev->mutex)
+    {
+        next = dev->queue_head;
+        if (next != NULL) {
+            dev->queue_head = next->next;
+            if (dev->queue_head == NULL) {
+                dev->queue_tail = NULL;
+            }
+
+            // Completed within a submit of this thread, its loop starts the next one
+            struct blockdev_starter *s = dev->starters;
+            while (s != NULL && s->thread != thread_self()) {
+                s = s->next;
+            }
+            if (s != NULL) {
+                next->next = NULL;
+                if (s->tail == NULL) {
+                    s->head = s->tail = next;
+                } else {
+                    s->tail->next = next;
+                    s->tail = next;
+                }
+                next = NULL;
+            }
+        } else {
+            assert(dev->in_flight > 0);
+            dev->in_flight--;
+        }
+    }
+    THREAD_MUTEX_EXIT(&dev->mutex)
+
+    // The waiter may free the request as soon as it is completed, don't touch it after
+    blockdev_done_fn done = req->done;
+    void *arg = req->arg;
+    req->err = err;
+    __atomic_store_n(&req->completed, true, __ATOMIC_RELEASE);
+    if (done != NULL) {
+        done(req, arg);
+    }
+
+    if (next != NULL) {
+        start(dev, next);
+    }
+}
+
+errval_t blockdev_wait(struct blockdev *dev, struct blockdev_request *req)
+{
+    while (!__atomic_load_n(&req->completed, __ATOMIC_ACQUIRE)) {
+        if (dev->ops->poll != NULL) {
+            errval_t err = dev->ops->poll(dev);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        } else {
+            thread_yield();
+        }
+    }
+    return req->err;
+}
+
+static errval_t transfer(struct blockdev *dev, enum blockdev_op op, size_t sector,
+                         size_t count, void *buf)
+{
+    struct blockdev_request req = {
+        .op = op,
+        .sector = sector,
+        .count = count,
+        .buf = buf,
+    };
+    errval_t err = blockdev_submit(dev, &req);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return blockdev_wait(dev, &req);
+}
+
+errval_t blockdev_read(struct blockdev *dev, size_t sector, size_t count, void *buf)
+{
+    return transfer(dev, BLOCKDEV_READ, sector, count, buf);
+}
+
+errval_t blockdev_write(struct blockdev *dev, size_t sector, size_t count,
+                        const void *buf)
+{
+    return transfer(dev, BLOCKDEV_WRITE, sector, count, (void *)buf);
+}
@@ -0,0 +1,58 @@
+/**
+ * \file
+ * \brief Block device in memory
+ *
+ * The disk is a frame mapped into our address space, on QEMU usually a FAT32 image
+ * loaded as multiboot module. Requests are copies and complete when submit returns.
+ */
+
+#include <string.h>
+
+#include <aos/aos.h>
+#include <fs/blockdev.h>
+
+/// Copies of different threads run in parallel
+#define RAMDISK_QUEUE_DEPTH 8
+
+static errval_t ramdisk_submit(struct blockdev *dev, struct blockdev_request *req)
+{
+    uint8_t *data = (uint8_t *)dev->st + req->sector * BLOCKDEV_SECTOR_SIZE;
+    size_t bytes = req->count * BLOCKDEV_SECTOR_SIZE;
+
+    if (req->op == BLOCKDEV_READ) {
+        memcpy(req->buf, data, bytes);
+    } else {
+        memcpy(data, req->buf, bytes);
+    }
+
+    blockdev_complete(dev, req, SYS_ERR_OK);
+    return SYS_ERR_OK;
+}
+
+static const struct blockdev_ops ramdisk_ops = {
+    .submit = ramdisk_submit,
+    .poll = NULL,
+};
+
+errval_t blockdev_ramdisk_create(struct capref frame, size_t bytes,
+                                 struct blockdev **retdev)
+{
+    errval_t err;
+
+    struct blockdev *dev = malloc(sizeof(*dev));
+    if (dev == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    void *base;
+    err = paging_map_frame(get_current_paging_state(), &base, bytes, frame);
+    if (err_is_fail(err)) {
+        free(dev);
+        return err_push(err, LIB_ERR_PAGING_MAP);
+    }
+
+    blockdev_init(dev, "ramdisk", &ramdisk_ops, base, bytes / BLOCKDEV_SECTOR_SIZE,
+                  RAMDISK_QUEUE_DEPTH);
+    *retdev = dev;
+    return SYS_ERR_OK;
+}
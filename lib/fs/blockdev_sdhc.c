@@ -0,0 +1,183 @@
+/**
+ * \file
+ * \brief Block device on the SD card
+ *
+ * The driver transfers a run of blocks by DMA and waits for it, so requests are
+ * started one at a time and are complete when submit returns. The data goes through
+ * bounce buffers the device keeps mapped for its whole lifetime.
+ */
+
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/static_assert.h>
+#include <fs/blockdev.h>
+#include <drivers/sdhc.h>
+
+STATIC_ASSERT(SDHC_BLOCK_SIZE == BLOCKDEV_SECTOR_SIZE, "SD blocks are not sectors");
+
+/// Requests the controller works on at a time, it runs a single command
+#define SDHC_QUEUE_DEPTH 1
+
+/// Size of a bounce buffer, larger requests are transferred in parts
+#define SDHC_BOUNCE_SIZE (64 * 1024)
+STATIC_ASSERT(SDHC_BOUNCE_SIZE / SDHC_BLOCK_SIZE <= SDHC_MAX_BLOCKS, "bounce buffer too large");
+
+struct sdhc_blockdev {
+    struct sdhc_s *sd;
+
+    // Bounce buffers the controller can DMA to and from, one per request in flight.
+    // They are mapped once, uncached, when the device is created.
+    struct capref bounce_frame;
+    lvaddr_t bounce_vbase;
+    lpaddr_t bounce_pbase;
+    struct thread_mutex bounce_mutex;   ///< Protects bounce_free
+    bool bounce_free[SDHC_QUEUE_DEPTH];
+};
+
+static size_t bounce_get(struct sdhc_blockdev *st)
+{
+    size_t i = SDHC_QUEUE_DEPTH;
+    THREAD_MUTEX_ENTER(&st->bounce_mutex)
+    {
+        for (i = 0; i < SDHC_QUEUE_DEPTH; i++) {
+            if (st->bounce_free[i]) {
+                st->bounce_free[i] = false;
+                break;
+            }
+        }
+    }
+    THREAD_MUTEX_EXIT(&st->bounce_mutex)
+    // There is a buffer for every request the device starts
+    assert(i < SDHC_QUEUE_DEPTH);
+    return i;
+}
+
+static void bounce_put(struct sdhc_blockdev *st, size_t i)
+{
+    THREAD_MUTEX_ENTER(&st->bounce_mutex)
+    {
+        st->bounce_free[i] = true;
+    }
+    THREAD_MUTEX_EXIT(&st->bounce_mutex)
+}
+
+static errval_t bounce_init(struct sdhc_blockdev *st)
+{
+    errval_t err;
+
+    size_t bytes = SDHC_QUEUE_DEPTH * SDHC_BOUNCE_SIZE;
+    err = frame_alloc(&st->bounce_frame, bytes, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+
+    struct frame_identity f_id;
+    err = cap_identify_mappable(st->bounce_frame, &f_id);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_CAP_IDENTIFY);
+        goto FAILURE_IDENTIFY;
+    }
+    st->bounce_pbase = f_id.base;
+
+    err = paging_map_frame_attr(get_current_paging_state(), (void **)&st->bounce_vbase,
+                                bytes, st->bounce_frame, VREGION_FLAGS_READ_WRITE_NOCACHE);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_PAGING_MAP);
+        goto FAILURE_MAP;
+    }
+
+    thread_mutex_init(&st->bounce_mutex);
+    for (size_t i = 0; i < SDHC_QUEUE_DEPTH; i++) {
+        st->bounce_free[i] = true;
+    }
+    return SYS_ERR_OK;
+
+FAILURE_MAP:
+FAILURE_IDENTIFY:
+    cap_destroy(st->bounce_frame);
+    st->bounce_frame = NULL_CAP;
+    return err;
+}
+
+/// Transfer count blocks starting at sector through the bounce buffer, in one command
+static errval_t transfer(struct sdhc_s *sd, enum blockdev_op op, size_t sector,
+                         size_t count, lpaddr_t paddr)
+{
+    errval_t err;
+    if (op == BLOCKDEV_READ) {
+        err = sdhc_read_blocks(sd, sector, count, paddr);
+        if (err_is_fail(err)) {
+            return err_push(err, FS_ERR_BLOCK_READ);
+        }
+    } else {
+        err = sdhc_write_blocks(sd, sector, count, paddr);
+        if (err_is_fail(err)) {
+            return err_push(err, FS_ERR_BLOCK_WRITE);
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t sdhc_submit(struct blockdev *dev, struct blockdev_request *req)
+{
+    errval_t err = SYS_ERR_OK;
+    struct sdhc_blockdev *st = dev->st;
+
+    size_t b = bounce_get(st);
+    void *vaddr = (void *)(st->bounce_vbase + b * SDHC_BOUNCE_SIZE);
+    lpaddr_t paddr = st->bounce_pbase + b * SDHC_BOUNCE_SIZE;
+
+    const size_t part_blocks = SDHC_BOUNCE_SIZE / SDHC_BLOCK_SIZE;
+    for (size_t done = 0; done < req->count; done += part_blocks) {
+        size_t count = MIN(req->count - done, part_blocks);
+        uint8_t *buf = (uint8_t *)req->buf + done * SDHC_BLOCK_SIZE;
+
+        if (req->op == BLOCKDEV_WRITE) {
+            memcpy(vaddr, buf, count * SDHC_BLOCK_SIZE);
+        }
+        err = transfer(st->sd, req->op, req->sector + done, count, paddr);
+        if (err_is_fail(err)) {
+            break;
+        }
+        if (req->op == BLOCKDEV_READ) {
+            memcpy(buf, vaddr, count * SDHC_BLOCK_SIZE);
+        }
+    }
+
+    bounce_put(st, b);
+    blockdev_complete(dev, req, err);
+    return SYS_ERR_OK;
+}
+
+static const struct blockdev_ops sdhc_ops = {
+    .submit = sdhc_submit,
+    .poll = NULL,
+};
+
+errval_t blockdev_sdhc_create(struct sdhc_s *sd, struct blockdev **retdev)
+{
+    errval_t err;
+
+    struct blockdev *dev = malloc(sizeof(*dev));
+    struct sdhc_blockdev *st = malloc(sizeof(*st));
+    if (dev == NULL || st == NULL) {
+        free(dev);
+        free(st);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    st->sd = sd;
+    err = bounce_init(st);
+    if (err_is_fail(err)) {
+        free(dev);
+        free(st);
+        return err;
+    }
+
+    // The driver does not report the size of the card
+    blockdev_init(dev, "sdhc", &sdhc_ops, st, SIZE_MAX / SDHC_BLOCK_SIZE,
+                  SDHC_QUEUE_DEPTH);
+    *retdev = dev;
+    return SYS_ERR_OK;
+}
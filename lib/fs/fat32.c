@@ -38,9 +38,9 @@
             }\
 })
 
-void set_sd(struct sdhc_s *sdh) {
+void set_blockdev(struct blockdev *dev) {
     if(manager)
-        manager->sd = sdh;
+        manager->dev = dev;
 }
 
 static void shortname_to_name(char *shortname, char **retname) {
@@ -113,73 +113,38 @@ static bool valid_shortname(char *name) {
     return true;
 }
 
-static errval_t get_no_cache_frame(int size, lpaddr_t *paddr, lpaddr_t *vaddr, struct capref *retframe) {
+//Read count logical sectors starting at <sector> into data
+static errval_t sd_read_sectors(int sector, int count, void *data) {
     errval_t err;
 
-    struct capref frame;
+    CHECK_ERR_PUSH(bcache_read_run(&manager->cache, sector, count, data), FS_ERR_BLOCK_READ);
 
-    err = frame_alloc(&frame, size, NULL);
-    if(err_is_fail(err))
-        return err;
-    
-    struct frame_identity f_id;
-    err = cap_identify_mappable(frame, &f_id);
-    if(err_is_fail(err))
-        return err;
-    *paddr = f_id.base;
-
-    err = paging_map_frame_attr(get_current_paging_state(), (void **)vaddr, SDHC_BLOCK_SIZE, frame, VREGION_FLAGS_READ_WRITE_NOCACHE);
-    if(err_is_fail(err))
-        return err;
-    
-    *retframe = frame;
     return SYS_ERR_OK;
 }
 
-// //Read logical sector <sector> and return a pointer to the info
-// static errval_t sd_read_sector(int sector, void *data)__attribute__((optimize ("Os")));
-
-static errval_t sd_read_sector(int sector, void *data) {
+//Write count logical sectors starting at <sector> from data
+static errval_t sd_write_sectors(int sector, int count, const void *data) {
     errval_t err;
 
-    lpaddr_t paddr, vaddr;
-    struct capref frame;
-
-    CHECK_ERR(get_no_cache_frame(SDHC_BLOCK_SIZE, &paddr, &vaddr, &frame), "");
-    
-    CHECK_ERR_PUSH(sdhc_read_block(manager->sd, sector, paddr), FS_ERR_BLOCK_READ);
+    CHECK_ERR_PUSH(bcache_write_run(&manager->cache, sector, count, data), FS_ERR_BLOCK_WRITE);
 
-    // DEBUG_PRINTF("DATA OF SECTOR %d\n", sector);
-    //I DO NOT KNOW WHY, BUT WITHOUT THESE LINES THE CODE BREAKS!!!!!
-    //DEBUG_PRINTF("%d", *(uint8_t *)vaddr);
-    //DEBUG_PRINTF("");
-    // print_block((uint8_t *) vaddr);
-	barrelfish_usleep(25000);
+    return SYS_ERR_OK;
+}
 
-    memcpy(data, (void *)vaddr, SDHC_BLOCK_SIZE);
-    
-    CHECK_ERR(cap_destroy(frame), "");
+//Read logical sector <sector> into data, through the buffer cache
+static errval_t sd_read_sector(int sector, void *data) {
+    errval_t err;
 
-    // DEBUG_PRINTF("READING WORKS\n");
+    CHECK_ERR_PUSH(bcache_read(&manager->cache, sector, data), FS_ERR_BLOCK_READ);
 
     return SYS_ERR_OK;
 }
 
-//Write data to logical sector
+//Write data to logical sector, the buffer cache writes it back later
 static errval_t sd_write_sector(int sector, void *data) {
     errval_t err;
 
-    lpaddr_t paddr, vaddr;
-    struct capref frame;
-    CHECK_ERR(get_no_cache_frame(SDHC_BLOCK_SIZE, &paddr, &vaddr, &frame), "");
-
-    memcpy((void *)vaddr, data, SDHC_BLOCK_SIZE);
-
-    CHECK_ERR_PUSH(sdhc_write_block(manager->sd, sector, paddr), FS_ERR_BLOCK_WRITE);
-
-	barrelfish_usleep(25000);
-
-    CHECK_ERR(cap_destroy(frame), "");
+    CHECK_ERR_PUSH(bcache_write(&manager->cache, sector, data), FS_ERR_BLOCK_WRITE);
 
     return SYS_ERR_OK;
 }
@@ -314,22 +279,57 @@ static errval_t allocate_cluster(int *retclus) {
     return SYS_ERR_OK;
 }
 
-static errval_t sector_from_cluster_offset(int cluster, int offset, int *retsector, int *retoffset) {
-    if((cluster == CLUSTER_FREE) || (cluster == CLUSTER_EOC))
-        return FS_ERR_INDEX_BOUNDS;
-    
+//finds the cluster of the chain starting at <cluster> that holds byte <offset>, and the offset into that cluster
+static errval_t cluster_from_offset(int cluster, int offset, int *retcluster, int *retoffset) {
     errval_t err;
-    
-    if(offset > manager->BytsPerSec * manager->SecPerClus) {
-        offset -= manager->BytsPerSec * manager->SecPerClus;
-        int next_cluster;
-        CHECK_ERR(get_next_cluster(cluster, &next_cluster), "");
-        return sector_from_cluster_offset(next_cluster, offset, retsector, retoffset);
+    int cluster_bytes = manager->BytsPerSec * manager->SecPerClus;
+
+    while(offset >= cluster_bytes) {
+        if((cluster == CLUSTER_FREE) || (cluster == CLUSTER_EOC))
+            return FS_ERR_INDEX_BOUNDS;
+        offset -= cluster_bytes;
+        CHECK_ERR(get_next_cluster(cluster, &cluster), "");
     }
+    if((cluster == CLUSTER_FREE) || (cluster == CLUSTER_EOC))
+        return FS_ERR_INDEX_BOUNDS;
+
+    *retcluster = cluster;
+    *retoffset = offset;
+    return SYS_ERR_OK;
+}
+
+static errval_t sector_from_cluster_offset(int cluster, int offset, int *retsector, int *retoffset) {
+    errval_t err = cluster_from_offset(cluster, offset, &cluster, &offset);
+    if(err_is_fail(err))
+        return err;
+
+    *retsector = FIRST_SECTOR_OF_CLUSTER(cluster) + (offset/manager->BytsPerSec);
+    *retoffset = offset % manager->BytsPerSec;
+
+    return SYS_ERR_OK;
+}
+
+//like sector_from_cluster_offset, and also counts the sectors from there on, up to max_sectors, that follow each other on disk
+static errval_t sector_run_from_cluster_offset(int cluster, int offset, int max_sectors, int *retsector, int *retoffset, int *retcount) {
+    errval_t err = cluster_from_offset(cluster, offset, &cluster, &offset);
+    if(err_is_fail(err))
+        return err;
 
     *retsector = FIRST_SECTOR_OF_CLUSTER(cluster) + (offset/manager->BytsPerSec);
     *retoffset = offset % manager->BytsPerSec;
 
+    //the rest of this cluster, then the clusters of the chain that are next to it
+    int count = MIN(max_sectors, manager->SecPerClus - offset/manager->BytsPerSec);
+    while(count < max_sectors) {
+        int next_cluster;
+        CHECK_ERR(get_next_cluster(cluster, &next_cluster), "");
+        if(next_cluster != cluster + 1)
+            break;
+        cluster = next_cluster;
+        count = MIN(max_sectors, count + manager->SecPerClus);
+    }
+    *retcount = count;
+
     return SYS_ERR_OK;
 }
 
@@ -776,6 +776,8 @@ errval_t fat32_init(char *mnt) {
 
     manager->mount = mnt; 
 
+    CHECK_ERR(bcache_init(&manager->cache, manager->dev, FAT32_CACHE_BYTES), "failed to create buffer cache");
+
     uint8_t bpb[SDHC_BLOCK_SIZE];
 
     CHECK_ERR(sd_read_sector(BPB_SECTOR, bpb), "bad read");
@@ -895,10 +897,12 @@ static void close_handle(struct fat32_handle *handle) {
 }
 
 errval_t fat32_close(fat32_handle_t inhandle) {
+    errval_t err;
     struct fat32_handle *handle = inhandle;
     if(handle->isdir)
         return FS_ERR_NOTFILE;
     close_handle(handle);
+    CHECK_ERR(fat32_sync(), "");
     return SYS_ERR_OK;
 }
 
@@ -910,12 +914,18 @@ errval_t fat32_closedir(fat32_handle_t inhandle) {
     return SYS_ERR_OK;
 }
 
+// Write the sectors dirty in the buffer cache to the disk
+errval_t fat32_sync(void) {
+    return bcache_sync(&manager->cache);
+}
+
 errval_t fat32_mkdir(const char *path) {
     errval_t err;
 
     struct fat32_dirent *h;
 
     CHECK_ERR(find_dirent(manager->mount, path, true, ATTR_DIRECTORY, &h), "mkdir failed");
+    CHECK_ERR(fat32_sync(), "");
 
     return SYS_ERR_OK;
 }
@@ -929,13 +939,23 @@ errval_t fat32_read(fat32_handle_t handle, void *buffer, size_t bytes, size_t *b
 
     size_t start_bytes = bytes;
     while(bytes != 0 && fhandle->pos != fhandle->dirent->size) {
-        //we read every iteration, because we either read a new sector, or we terminate
-        int sector, offset;
-        CHECK_ERR(sector_from_cluster_offset(fhandle->dirent->FstCluster, fhandle->pos, &sector, &offset), "");
-        CHECK_ERR(sd_read_sector(sector, data), "bad read");
+        size_t left = MIN(fhandle->dirent->size - fhandle->pos, bytes);
+        //whole sectors are read straight into the buffer, as many per request as follow each other on disk
+        int max_sectors = (fhandle->pos % SDHC_BLOCK_SIZE == 0) ? MAX(left / SDHC_BLOCK_SIZE, 1) : 1;
+
+        int sector, offset, count;
+        CHECK_ERR(sector_run_from_cluster_offset(fhandle->dirent->FstCluster, fhandle->pos, max_sectors, &sector, &offset, &count), "");
 
-        size_t cpy_bytes = MIN(fhandle->dirent->size - fhandle->pos, MIN(SDHC_BLOCK_SIZE - offset, bytes));
-        memcpy(buffer, data + offset, cpy_bytes);
+        size_t cpy_bytes;
+        if(offset == 0 && left >= SDHC_BLOCK_SIZE) {
+            CHECK_ERR(sd_read_sectors(sector, count, buffer), "bad read");
+            cpy_bytes = count * SDHC_BLOCK_SIZE;
+        }
+        else {
+            CHECK_ERR(sd_read_sector(sector, data), "bad read");
+            cpy_bytes = MIN(SDHC_BLOCK_SIZE - offset, left);
+            memcpy(buffer, data + offset, cpy_bytes);
+        }
         buffer += cpy_bytes;
         fhandle->pos += cpy_bytes;
         bytes -= cpy_bytes;
@@ -957,10 +977,11 @@ errval_t fat32_write(fat32_handle_t handle, const void *buffer, size_t bytes, si
     uint8_t data[SDHC_BLOCK_SIZE];
     size_t start_bytes = bytes;
     while(bytes != 0) {
-        //we read every iteration, because we either read a new sector, or we terminate
-        int sector, offset;
+        //whole sectors are written straight from the buffer, as many per request as follow each other on disk
+        int max_sectors = (fhandle->pos % SDHC_BLOCK_SIZE == 0) ? MAX(bytes / SDHC_BLOCK_SIZE, 1) : 1;
+        int sector, offset, count;
         
-        err = sector_from_cluster_offset(fhandle->dirent->FstCluster, fhandle->pos, &sector, &offset);
+        err = sector_run_from_cluster_offset(fhandle->dirent->FstCluster, fhandle->pos, max_sectors, &sector, &offset, &count);
         if(err_is_fail(err)) {
             if(err == FS_ERR_INDEX_BOUNDS) {
                 //out of space, extend the file, write to bytes in case we throw an error
@@ -972,24 +993,30 @@ errval_t fat32_write(fat32_handle_t handle, const void *buffer, size_t bytes, si
                 CHECK_ERR(extend_dirent_by_one_cluster(fhandle->dirent, last_cluster, &last_cluster), "");
                 sector = FIRST_SECTOR_OF_CLUSTER(last_cluster);
                 offset = 0;
+                count = MIN(max_sectors, manager->SecPerClus);
             }
             else
                 return err;
         }
 
-        size_t cpy_bytes = MIN(SDHC_BLOCK_SIZE - offset, bytes);
-        if(cpy_bytes != SDHC_BLOCK_SIZE)
+        size_t cpy_bytes;
+        if(offset == 0 && bytes >= SDHC_BLOCK_SIZE) {
+            CHECK_ERR(sd_write_sectors(sector, count, buffer), "bad write");
+            cpy_bytes = count * SDHC_BLOCK_SIZE;
+        }
+        else {
+            cpy_bytes = MIN(SDHC_BLOCK_SIZE - offset, bytes);
             CHECK_ERR(sd_read_sector(sector, data), "bad read");
-
-        memcpy(data + offset, buffer, cpy_bytes);
-        CHECK_ERR(sd_write_sector(sector, data), "bad write");
+            memcpy(data + offset, buffer, cpy_bytes);
+            CHECK_ERR(sd_write_sector(sector, data), "bad write");
+        }
         buffer += cpy_bytes;
         fhandle->pos += cpy_bytes;
         bytes -= cpy_bytes;
     }
 
-    //write new size back to dirent
-    if(start_bytes - bytes > 0) {
+    //write new size back to dirent, if the file grew (overwriting inside it must not truncate it)
+    if(fhandle->pos > fhandle->dirent->size) {
         fhandle->dirent->size = fhandle->pos;
         CHECK_ERR(sd_read_sector(fhandle->dirent->sector, data), "");
         marshall_directory_entry(fhandle->dirent, data + fhandle->dirent->sector_offset);
@@ -1011,6 +1038,7 @@ errval_t fat32_rmdir(const char *path) {
     CHECK_ERR(find_dirent(manager->mount, path, false, ATTR_DIRECTORY, &dir), "");
 
     CHECK_ERR_PUSH(delete_dirent(dir), FS_ERR_DELETE_DIR);
+    CHECK_ERR(fat32_sync(), "");
 
     return SYS_ERR_OK;
 }
@@ -1021,6 +1049,7 @@ errval_t fat32_remove(const char *path) {
     CHECK_ERR(find_dirent(manager->mount, path, false, ATTR_ARCHIVE, &dir), "");
 
     CHECK_ERR_PUSH(delete_dirent(dir), FS_ERR_DELETE_DIR);
+    CHECK_ERR(fat32_sync(), "");
 
     return SYS_ERR_OK;
 }
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <aos/aos.h>
 #include <aos/capabilities.h>
@@ -6,9 +7,31 @@
 #include <aos/aos_rpc.h>
 #include <grading.h>
 #include <spawn/spawn.h>
+#include <spawn/multiboot.h>
 #include "test_paging.h"
 
-void grading_setup_bsp_init(int argc, char **argv) { }
+static struct bootinfo *bsp_bi = NULL;
+
+void grading_setup_bsp_init(int argc, char **argv)
+{
+    if (argc >= 2) {
+        bsp_bi = (struct bootinfo *)strtol(argv[1], NULL, 10);
+    }
+}
+
+/// Whether the init line of the menu.lst has the option, such as "bench=paging"
+static bool init_has_option(const char *option)
+{
+    if (bsp_bi == NULL) {
+        return false;
+    }
+    struct mem_region *module = multiboot_find_module(bsp_bi, "init");
+    if (module == NULL) {
+        return false;
+    }
+    const char *opts = multiboot_module_opts(module);
+    return opts != NULL && strstr(opts, option) != NULL;
+}
 
 void grading_setup_app_init(struct bootinfo *bi) { }
 
@@ -125,6 +148,9 @@ void grading_test_early(void)
                                   // something causes a pagefault*/
 
     //grading_test_paging(&aos_mm, get_current_paging_state());
+    if (init_has_option("bench=paging")) {
+        grading_bench_paging(&aos_mm, get_current_paging_state());
+    }
     //    grading_test_fixed_map_more_time(&aos_mm, get_current_paging_state(), 10000);
     //    grading_test_dynamic_map_more_time(&aos_mm, get_current_paging_state(), 10000);
 
@@ -6,6 +6,8 @@
 #include <aos/aos.h>
 #include <aos/capabilities.h>
 #include <aos/ram_alloc.h>
+#include <aos/slab.h>
+#include <aos/systime.h>
 
 #define QUITE_TEST true
 #define MUTE_TEST_TITLE true
@@ -411,3 +413,257 @@ void grading_test_dynamic_map_more_time(struct mm *mm, struct paging_state *st,
     }
     DEBUG_PRINTF("  %d times done\n", count);
 }
+
+/*
+ * Performance suite. Every measurement is printed as one line:
+ *
+ *   pagingbench,<test>,<bytes>,<threads>,<ops>,<ns total>,<ns/op>,<max ns>,<slab refills>
+ *
+ * and the occupancy of the slab allocators of the paging state at the end as:
+ *
+ *   pagingslab,<allocator>,<slab size>,<partial>,<full>,<empty>,<total blocks>,<free blocks>
+ */
+
+#define BENCH_MAX_THREADS 4
+#define BENCH_MAP_OPS 256
+#define BENCH_FAULT_PAGES 1024
+#define BENCH_FRAG_REGIONS 512
+#define BENCH_ALLOC_OPS 256
+#define BENCH_MAX_SIZE (BASE_PAGE_SIZE * 1024)
+
+static const size_t bench_sizes[] = { BASE_PAGE_SIZE, BASE_PAGE_SIZE * 4,
+                                      BASE_PAGE_SIZE * 16, BASE_PAGE_SIZE * 64,
+                                      BASE_PAGE_SIZE * 256, BASE_PAGE_SIZE * 512,
+                                      BASE_PAGE_SIZE * 1024 };
+
+struct bench_result {
+    uint64_t ns;
+    uint64_t max_ns;
+};
+
+struct bench_thread {
+    struct paging_state *st;
+    struct capref frame;
+    size_t bytes;
+    size_t ops;
+    void *region;
+    struct bench_result map;
+    struct bench_result unmap;
+};
+
+static inline void bench_add(struct bench_result *r, systime_t start, systime_t end)
+{
+    uint64_t ns = systime_to_ns(end - start);
+    r->ns += ns;
+    if (ns > r->max_ns) {
+        r->max_ns = ns;
+    }
+}
+
+static void bench_print(const char *test, size_t bytes, size_t threads, size_t ops,
+                        struct bench_result *r, size_t refills)
+{
+    printf("pagingbench,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", test, bytes, threads, ops, r->ns,
+           ops > 0 ? r->ns / ops : 0, r->max_ns, refills);
+}
+
+static int bench_map_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    for (size_t i = 0; i < t->ops; i++) {
+        void *vaddr = NULL;
+        systime_t start = systime_now();
+        errval_t err = paging_map_frame_attr(t->st, &vaddr, t->bytes, t->frame,
+                                             VREGION_FLAGS_READ_WRITE);
+        systime_t mapped = systime_now();
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "paging_map_frame_attr failed\n");
+        }
+        err = paging_unmap(t->st, vaddr);
+        systime_t unmapped = systime_now();
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "paging_unmap failed\n");
+        }
+        bench_add(&t->map, start, mapped);
+        bench_add(&t->unmap, mapped, unmapped);
+    }
+    return 0;
+}
+
+static int bench_fault_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    for (size_t i = 0; i < t->ops; i++) {
+        volatile uint8_t *page = (uint8_t *)t->region + i * BASE_PAGE_SIZE;
+        systime_t start = systime_now();
+        *page = (uint8_t)i;
+        bench_add(&t->map, start, systime_now());
+    }
+    return 0;
+}
+
+/// Run fn on every thread and sum up the results, the max is the largest of all threads
+static void bench_run_threads(thread_func_t fn, struct bench_thread *args, size_t count,
+                              struct bench_result *map, struct bench_result *unmap)
+{
+    struct thread *threads[BENCH_MAX_THREADS];
+    for (size_t i = 0; i < count; i++) {
+        threads[i] = thread_create(fn, &args[i]);
+        if (threads[i] == NULL) {
+            USER_PANIC("thread_create failed\n");
+        }
+    }
+    *map = (struct bench_result) { 0 };
+    *unmap = (struct bench_result) { 0 };
+    for (size_t i = 0; i < count; i++) {
+        thread_join(threads[i], NULL);
+        map->ns += args[i].map.ns;
+        map->max_ns = MAX(map->max_ns, args[i].map.max_ns);
+        unmap->ns += args[i].unmap.ns;
+        unmap->max_ns = MAX(unmap->max_ns, args[i].unmap.max_ns);
+    }
+}
+
+/// paging_map_frame_attr() and paging_unmap() of a frame over sizes and threads
+static void bench_map_unmap(struct mm *mm, struct paging_state *st)
+{
+    struct capref frame = test_alloc_frame_success(mm, BENCH_MAX_SIZE, true);
+    struct bench_thread args[BENCH_MAX_THREADS];
+
+    for (size_t s = 0; s < ARRAY_LENGTH(bench_sizes); s++) {
+        for (size_t threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+            for (size_t i = 0; i < threads; i++) {
+                args[i] = (struct bench_thread) { .st = st, .frame = frame,
+                                                  .bytes = bench_sizes[s],
+                                                  .ops = BENCH_MAP_OPS / threads };
+            }
+            size_t refills = st->slab_refills;
+            struct bench_result map, unmap;
+            bench_run_threads(bench_map_thread, args, threads, &map, &unmap);
+            refills = st->slab_refills - refills;
+            bench_print("map", bench_sizes[s], threads, BENCH_MAP_OPS, &map, refills);
+            bench_print("unmap", bench_sizes[s], threads, BENCH_MAP_OPS, &unmap, refills);
+        }
+    }
+
+    cap_destroy(frame);
+}
+
+/// Latency of page faults in regions of their own, populating one page or a window each
+static void bench_faults(struct paging_state *st)
+{
+    struct bench_thread args[BENCH_MAX_THREADS];
+
+    for (size_t around = 0; around < 2; around++) {
+        if (around) {
+            paging_set_fault_around(st, PAGING_FAULT_AROUND_MIN_PAGES,
+                                    PAGING_FAULT_AROUND_MAX_PAGES);
+        } else {
+            paging_set_fault_around(st, 1, 1);
+        }
+
+        for (size_t threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+            for (size_t i = 0; i < threads; i++) {
+                args[i] = (struct bench_thread) { .st = st, .ops = BENCH_FAULT_PAGES };
+                test_mapping_alloc_success(NULL, st, BENCH_FAULT_PAGES * BASE_PAGE_SIZE,
+                                           &args[i].region, true, false);
+            }
+            size_t refills = st->slab_refills;
+            struct bench_result touch, unused;
+            bench_run_threads(bench_fault_thread, args, threads, &touch, &unused);
+            refills = st->slab_refills - refills;
+            bench_print(around ? "fault_around" : "fault", BASE_PAGE_SIZE, threads,
+                        threads * BENCH_FAULT_PAGES, &touch, refills);
+
+            for (size_t i = 0; i < threads; i++) {
+                errval_t err = paging_unmap(st, args[i].region);
+                if (err_is_fail(err)) {
+                    USER_PANIC_ERR(err, "paging_unmap failed\n");
+                }
+            }
+        }
+    }
+}
+
+/// paging_alloc() and paging_unmap() of a region while half of the regions around are free
+static void bench_alloc_fragmented(struct paging_state *st)
+{
+    static void *regions[BENCH_FRAG_REGIONS];
+    errval_t err;
+
+    // Sizes of 1 to 16 pages from a fixed sequence, so that runs are comparable
+    uint32_t seed = 42;
+    for (size_t i = 0; i < BENCH_FRAG_REGIONS; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t pages = (seed >> 16) % 16 + 1;
+        test_mapping_alloc_success(NULL, st, pages * BASE_PAGE_SIZE, &regions[i], true,
+                                   false);
+    }
+    for (size_t i = 0; i < BENCH_FRAG_REGIONS; i += 2) {
+        err = paging_unmap(st, regions[i]);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "paging_unmap failed\n");
+        }
+    }
+
+    for (size_t s = 0; s < ARRAY_LENGTH(bench_sizes); s++) {
+        struct bench_result alloc = { 0 }, unmap = { 0 };
+        size_t refills = st->slab_refills;
+        for (size_t i = 0; i < BENCH_ALLOC_OPS; i++) {
+            void *vaddr = NULL;
+            systime_t start = systime_now();
+            err = paging_alloc(st, &vaddr, bench_sizes[s], BASE_PAGE_SIZE);
+            systime_t allocated = systime_now();
+            if (err_is_fail(err)) {
+                USER_PANIC_ERR(err, "paging_alloc failed\n");
+            }
+            err = paging_unmap(st, vaddr);
+            systime_t unmapped = systime_now();
+            if (err_is_fail(err)) {
+                USER_PANIC_ERR(err, "paging_unmap failed\n");
+            }
+            bench_add(&alloc, start, allocated);
+            bench_add(&unmap, allocated, unmapped);
+        }
+        refills = st->slab_refills - refills;
+        bench_print("alloc_fragmented", bench_sizes[s], 1, BENCH_ALLOC_OPS, &alloc, refills);
+        bench_print("unmap_fragmented", bench_sizes[s], 1, BENCH_ALLOC_OPS, &unmap, refills);
+    }
+
+    for (size_t i = 1; i < BENCH_FRAG_REGIONS; i += 2) {
+        err = paging_unmap(st, regions[i]);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "paging_unmap failed\n");
+        }
+    }
+}
+
+static void bench_print_slabs(const char *name, struct slab_allocator *slabs)
+{
+    struct slab_stats stats;
+    slab_get_stats(slabs, &stats);
+    printf("pagingslab,%s,%lu,%lu,%lu,%lu,%lu,%lu\n", name, slabs->slab_size,
+           stats.slabs[SLAB_LIST_PARTIAL], stats.slabs[SLAB_LIST_FULL],
+           stats.slabs[SLAB_LIST_EMPTY], stats.total_blocks, stats.free_blocks);
+}
+
+void grading_bench_paging(struct mm *mm, struct paging_state *st)
+{
+    // Numbers of a broken implementation are worthless
+    grading_test_paging(mm, st);
+
+    printf("pagingbench,test,bytes,threads,ops,total_ns,ns_per_op,max_ns,slab_refills\n");
+    bench_map_unmap(mm, st);
+    bench_faults(st);
+    bench_alloc_fragmented(st);
+
+    printf("pagingslab,allocator,slab_size,partial,full,empty,total_blocks,free_blocks\n");
+    bench_print_slabs("region", &st->region_slabs);
+    bench_print_slabs("vnode", &st->vnode_slabs);
+    bench_print_slabs("mapping_node", &st->mapping_node_slabs);
+    bench_print_slabs("mapping_child", &st->mapping_child_slabs);
+
+    paging_set_fault_around(st, PAGING_FAULT_AROUND_MIN_PAGES,
+                            PAGING_FAULT_AROUND_MAX_PAGES);
+    DEBUG_PRINTF("Paging benchmark done\n");
+}
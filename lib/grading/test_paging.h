@@ -12,4 +12,7 @@ void grading_test_paging(struct mm *mm, struct paging_state *st);
 void grading_test_fixed_map_more_time(struct mm *mm, struct paging_state *st, int count);
 void grading_test_dynamic_map_more_time(struct mm *mm, struct paging_state *st, int count);
 
+/// Run grading_test_paging(), then print a machine-readable performance report
+void grading_bench_paging(struct mm *mm, struct paging_state *st);
+
 #endif  // AOS_TEST_PAGING_H
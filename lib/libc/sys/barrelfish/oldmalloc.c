@@ -41,7 +41,15 @@ malloc(size_t nbytes)
     if (alt_malloc != NULL) {
         return alt_malloc(nbytes);
     }
+    return __kr_malloc(nbytes);
+}
 
+/*
+ * __kr_malloc: first-fit allocation from the free list, for alt_malloc to fall back to
+ */
+void *
+__kr_malloc(size_t nbytes)
+{
     struct morecore_state *state = get_morecore_state();
 	Header *p, *prevp;
 	unsigned nunits;
@@ -154,7 +162,14 @@ void free(void *ap)
     if (alt_free != NULL) {
         return alt_free(ap);
     }
+    __kr_free(ap);
+}
 
+/*
+ * __kr_free: free a block allocated by __kr_malloc()
+ */
+void __kr_free(void *ap)
+{
     struct morecore_state *state = get_morecore_state();
 
 #ifdef __x86_64__
@@ -17,6 +17,8 @@
 #include <stddef.h>
 #include <aos/aos.h>
 #include <aos/core_state.h>
+#include <aos/morecore.h>
+#include <aos/static_assert.h>
 
 Header *get_malloc_freep(void);
 
@@ -26,6 +28,9 @@ typedef void (*morecore_free_func_t)(void *base, size_t bytes);
 morecore_alloc_func_t sys_morecore_alloc;
 morecore_free_func_t sys_morecore_free;
 
+STATIC_ASSERT(MORECORE_FREE_KEEP + 2 * MORECORE_FREE_ALIGN <= MORECORE_FREE_THRESHOLD,
+              "nothing to give back");
+
 /**
  * \brief sbrk() equivalent.
  *
@@ -67,7 +72,41 @@ Header *morecore(unsigned nu)
 void lesscore(void)
 {
 #if defined(__arm__) || defined(__aarch64__)
-    // Not implemented
+    // The heap is not a contiguous segment, give back the memory of a large free block
+    // where it is instead. Only the block just freed (merged into the one at header_freep
+    // or following it) can have become large. Its memory given back before is given back
+    // again, which finds nothing mapped there and is cheap.
+    struct morecore_state *state = get_morecore_state();
+
+    assert(sys_morecore_free);
+
+    Header *prevp = state->header_freep, *p = prevp->s.ptr;
+    if (prevp->s.size * sizeof(Header) >= MORECORE_FREE_THRESHOLD) {
+        // Find the predecessor to unlink header_freep itself
+        for (p = prevp; p->s.ptr != state->header_freep; p = p->s.ptr)
+            ;
+        prevp = p;
+        p = p->s.ptr;
+    } else if (p->s.size * sizeof(Header) < MORECORE_FREE_THRESHOLD) {
+        return;
+    }
+
+    // Unlink the block, so that it is not handed out while the memory is given back
+    // without the malloc lock, which the memory server RPC may need
+    prevp->s.ptr = p->s.ptr;
+    state->header_freep = prevp;
+    thread_mutex_unlock(&state->mutex);
+
+    // Pages populated on page faults are only given back in whole windows, which never
+    // cross a multiple of MORECORE_FREE_ALIGN. The tail stays committed as hysteresis,
+    // malloc() carves blocks from there first, and the header stays where it is.
+    lvaddr_t start = ROUND_UP((lvaddr_t)(p + 1), MORECORE_FREE_ALIGN);
+    lvaddr_t end = ROUND_DOWN((lvaddr_t)(p + p->s.size) - MORECORE_FREE_KEEP,
+                              MORECORE_FREE_ALIGN);
+    sys_morecore_free((void *)start, end - start);
+
+    thread_mutex_lock(&state->mutex);
+    __free_locked((void *)(p + 1));
 
 #else
     struct morecore_state *state = get_morecore_state();
@@ -43,6 +43,7 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     mm->objtype = objtype;
 
     mm->pending_root = NULL;
+    mm->stats = (struct mm_stats) { 0 };
 
     slab_init(&mm->slabs, sizeof(struct mm_node), slab_refill_func);
     for (int i = 0; i < MM_NODE_TABLE_SIZE; i++) mm->node_table[i] = NULL; // Setup linked-list table
@@ -151,7 +152,7 @@ static errval_t __mm_create_node(struct mm *mm, struct mm_node **node, struct ca
     errval_t err;
 
     // Refill if required
-    if (!is_refilling && slab_freecount(&mm->slabs) <= MM_SLAB_RESERVE) {
+    if (!is_refilling && slab_needs_refill(&mm->slabs, MM_SLAB_RESERVE + 1)) {
 		is_refilling = true;
         err = slab_default_refill(&mm->slabs);
         is_refilling = false;
@@ -167,6 +168,8 @@ static errval_t __mm_create_node(struct mm *mm, struct mm_node **node, struct ca
     (*node)->is_pending = false;
     (*node)->is_leaf = true;
     (*node)->key = 0;
+    (*node)->carve_next = NULL;
+    (*node)->requested_size = 0;
 
     (*node)->parent = parent;
 
@@ -190,6 +193,7 @@ static void __mm_destroy_node(struct mm *mm, struct mm_node *node) {
     assert(node->is_pending == false);
     assert(node->is_leaf == true);
     assert(node->key == 0);
+    assert(node->carve_next == NULL);
     assert(node->parent != NULL); // Right now a root node should never be deleted! (might change if we implement deinitialization)
 
     slab_free(&mm->slabs, node);
@@ -285,6 +289,96 @@ static void __mm_collapsing_add_node_list(struct mm *mm, struct mm_node *node) {
     __mm_add_node_list(mm, node);
 }
 
+/**
+ * @brief Split a block (neither free nor pending) such that its first size bytes are covered by as few blocks as possible and the rest is free again
+ * 
+ * The blocks covering the prefix are marked as pending and chained through carve_next, the first one is returned. The caller adds it to the pending tree.
+ * On failure the block is added back to the free-list.
+ * 
+ * @param mm The mm instance
+ * @param node The block to split, removed from the free-list
+ * @param size The size of the prefix, a multiple of BASE_PAGE_SIZE smaller than the block
+ * @param head Where to store the first block of the prefix
+ * @return errval_t 
+ */
+static errval_t __mm_carve_node(struct mm *mm, struct mm_node *node, gensize_t size, struct mm_node **head) {
+    assert(node->is_leaf && !node->is_pending);
+    assert(size > 0 && size < __bits_to_gensize(node->block.size_bits) && size % BASE_PAGE_SIZE == 0);
+
+    errval_t err;
+    struct mm_node **chain = head; // Where to link the next block of the prefix
+    *head = NULL;
+
+    // Walk down the buddy tree: a left half entirely inside the prefix is taken, a right half entirely outside of it is free
+    while (size > 0) {
+        if (size == __bits_to_gensize(node->block.size_bits)) {
+            node->is_pending = true;
+            *chain = node;
+            break;
+        }
+
+        gensize_t half = __bits_to_gensize(node->block.size_bits - 1);
+        node->is_leaf = false;
+
+        err = __mm_create_node(mm, &node->left, node->block.root_cap, node->block.root_offset, node->block.size_bits - 1, node->block.alignment_bits, node);
+        if (err_is_fail(err)) {
+            node->is_leaf = true;
+            goto undo;
+        }
+        // The right half is aligned exactly by its size, as the parent is aligned by at least its own size
+        err = __mm_create_node(mm, &node->right, node->block.root_cap, node->block.root_offset + half, node->block.size_bits - 1, node->block.size_bits - 1, node);
+        if (err_is_fail(err)) {
+            __mm_destroy_node(mm, node->left);
+            node->left = NULL;
+            node->is_leaf = true;
+            goto undo;
+        }
+
+        if (size >= half) {
+            node->left->is_pending = true;
+            *chain = node->left;
+            chain = &node->left->carve_next;
+            size -= half;
+            if (size == 0) __mm_add_node_list(mm, node->right);
+            node = node->right;
+        } else {
+            __mm_add_node_list(mm, node->right);
+            node = node->left;
+        }
+    }
+
+    return SYS_ERR_OK;
+
+undo:
+    // Merge everything back, starting with the block we failed to split
+    __mm_collapsing_add_node_list(mm, node);
+    while (*head != NULL) {
+        node = *head;
+        *head = node->carve_next;
+        node->carve_next = NULL;
+        node->is_pending = false;
+        __mm_collapsing_add_node_list(mm, node);
+    }
+    return err_push(err, MM_ERR_NODE_CREATE);
+}
+
+/**
+ * @brief Add all blocks covered by a capability back to the free-list (collapsing them)
+ * 
+ * @param mm The mm instance
+ * @param node The first block, not in the pending tree
+ */
+static void __mm_release_node(struct mm *mm, struct mm_node *node) {
+    while (node != NULL) {
+        struct mm_node *next = node->carve_next;
+        node->carve_next = NULL;
+        node->requested_size = 0;
+        node->is_pending = false;
+        __mm_collapsing_add_node_list(mm, node);
+        node = next;
+    }
+}
+
 /**
  * @brief Search the slot where the given key should be inserted (or the slot pointing to the key if it already exists)
  * 
@@ -312,11 +406,10 @@ static void __mm_add_node_tree(struct mm *mm, struct mm_node *node, struct capre
     // Ensure that we are not currently in either data_structure
     assert(node->left == NULL);
     assert(node->right == NULL);
-    assert(node->is_pending == false);
     assert(node->is_leaf == true);
     assert(node->key == 0);
 
-    // Set key and is_pending as we are adding the node to the tree
+    // Set key and is_pending as we are adding the node to the tree (the first block of an exact allocation is already marked)
     node->is_pending = true;
     node->key = __mm_capref_to_key(cap);
 
@@ -442,6 +535,7 @@ errval_t mm_add(struct mm *mm, struct capref cap)
     }
 
     for (int i = 0; i < nodes_cnt; i++) __mm_add_node_list(mm, nodes[i]);
+    mm->stats.total_bytes += bytes;
 
     return SYS_ERR_OK;
 }
@@ -458,6 +552,7 @@ errval_t mm_add(struct mm *mm, struct capref cap)
 errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct capref *retcap)
 {
     errval_t err;
+    const size_t requested_size = size;
     size = MAX(size, BASE_PAGE_SIZE);
     assert(alignment > 0);
 
@@ -506,7 +601,7 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
         assert(node->left != NULL);
         assert(node->left->is_leaf);
 
-        err = __mm_create_node(mm, &node->right, node->block.root_cap, node->block.root_offset + search_block_size / 2, search_block_size_bits - 1, search_alignment_bits - 1, node);
+        err = __mm_create_node(mm, &node->right, node->block.root_cap, node->block.root_offset + search_block_size / 2, search_block_size_bits - 1, search_block_size_bits - 1, node);
         if (err_is_fail(err)) {
             assert(node->right == NULL);
             __mm_destroy_node(mm, node->left);
@@ -540,15 +635,40 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
     // Remove the node from the list before allocating the capability as another block could be requested during the call (for more capabilities) and we do not want the same block to be found again!
     __mm_remove_node_list(mm, node);
 
+    // Only hand out the page-rounded size, the remainder of the block stays free
+    gensize_t alloc_size = search_block_size;
+#if MM_EXACT_ALLOC
+    if (ROUND_UP(size, BASE_PAGE_SIZE) < search_block_size) {
+        alloc_size = ROUND_UP(size, BASE_PAGE_SIZE);
+        err = __mm_carve_node(mm, node, alloc_size, &node);
+        if (err_is_fail(err)) return err;
+        mm->stats.carved_bytes += search_block_size - alloc_size;
+        mm->stats.carve_count++;
+    }
+#endif
+
     err = mm->slot_alloc(mm->slot_alloc_inst, 1, retcap);
-    if (err_is_fail(err)) return err_push(err, MM_ERR_SLOT_EMPTY);
+    if (err_is_fail(err)) {
+        __mm_release_node(mm, node);
+        return err_push(err, MM_ERR_SLOT_EMPTY);
+    }
     
-    err = cap_retype(*retcap, node->block.root_cap, node->block.root_offset, ObjType_RAM, search_block_size, 1);
-    if (err_is_fail(err)) return err_push(err, MM_ERR_CANNOT_SPLIT_CAP);
+    // The blocks of an exact allocation are consecutive, so a single retype covers them
+    err = cap_retype(*retcap, node->block.root_cap, node->block.root_offset, ObjType_RAM, alloc_size, 1);
+    if (err_is_fail(err)) {
+        __mm_release_node(mm, node);
+        return err_push(err, MM_ERR_CANNOT_SPLIT_CAP);
+    }
 
     // Add the node to the pending tree
+    node->requested_size = requested_size;
     __mm_add_node_tree(mm, node, *retcap);
 
+    mm->stats.allocated_bytes += alloc_size;
+    mm->stats.requested_bytes += requested_size;
+    mm->stats.pending_count++;
+    mm->stats.alloc_count++;
+
     return SYS_ERR_OK;
 }
 
@@ -582,8 +702,14 @@ errval_t mm_free(struct mm *mm, struct capref cap)
     assert(node->is_pending == false);
     assert(node->is_leaf == true);
 
-    // Add the node back to the list, but collapse it as long as our siblings are not pending
-    __mm_collapsing_add_node_list(mm, node);
+    gensize_t alloc_size = 0;
+    for (struct mm_node *n = node; n != NULL; n = n->carve_next) alloc_size += __bits_to_gensize(n->block.size_bits);
+    mm->stats.allocated_bytes -= alloc_size;
+    mm->stats.requested_bytes -= node->requested_size;
+    mm->stats.pending_count--;
+
+    // Add the blocks back to the list, but collapse them as long as our siblings are not pending
+    __mm_release_node(mm, node);
     
     // Lastly, destroy the pending capability
     err = cap_destroy(cap);
@@ -591,3 +717,49 @@ errval_t mm_free(struct mm *mm, struct capref cap)
 
     return SYS_ERR_OK;
 }
+
+/**
+ * @brief Take a previously allocated RAM capability out of mm for good (and destroy it), e.g. once its memory was given to someone else
+ * 
+ * The blocks stay in the buddy tree marked as pending, so they are never merged or handed out again, but they no longer count as memory of mm.
+ * 
+ * @param mm The mm instance
+ * @param cap The RAM capability to retire
+ * @return errval_t 
+ */
+errval_t mm_retire(struct mm *mm, struct capref cap)
+{
+    errval_t err;
+
+    struct mm_node *node = __mm_remove_node_tree(mm, cap);
+    if (node == NULL) return MM_ERR_NO_PENDING_CAP;
+
+    gensize_t alloc_size = 0;
+    for (struct mm_node *n = node; n != NULL; n = n->carve_next) {
+        n->is_pending = true; // Not in the pending tree, but never collapsed either
+        alloc_size += __bits_to_gensize(n->block.size_bits);
+    }
+    mm->stats.total_bytes -= alloc_size;
+    mm->stats.allocated_bytes -= alloc_size;
+    mm->stats.requested_bytes -= node->requested_size;
+    mm->stats.pending_count--;
+    node->requested_size = 0;
+
+    err = cap_destroy(cap);
+    if (err_is_fail(err)) return err_push(err, MM_ERR_CANNOT_DESTROY_CAP);
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * @brief Get the allocation statistics, including how much memory is lost to rounding
+ * 
+ * @param mm The mm instance
+ * @param ret Where to store the statistics
+ */
+void mm_get_stats(struct mm *mm, struct mm_stats *ret)
+{
+    *ret = mm->stats;
+    ret->free_bytes = ret->total_bytes - ret->allocated_bytes;
+    ret->waste_bytes = ret->allocated_bytes - ret->requested_bytes;
+}
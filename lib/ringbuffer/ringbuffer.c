@@ -1,30 +1,93 @@
 #include <ringbuffer/ringbuffer.h>
 
 #include <aos/threads.h>
+#include <aos/deferred.h>
 #include <string.h>
 #include <stdlib.h>
 #include <aos/debug.h>
 #include <arch/aarch64/aos/cache.h>
 
-#define RINGBUFFER_CAPACITY ((RING_BUFFER_SIZE / CACHE_LINE_SIZE) - 1)
-#define ENTRY_DATA_CAPACITY (CACHE_LINE_SIZE - sizeof(size_t))
+/*
+ * Protocol for transferring data:
+ *
+ * The data area is a sequence of records. Each record is a header followed by the
+ * payload, rounded up to RING_RECORD_HEADER_SIZE.
+ *
+ * In RING_MODE_READY_FLAG, the producer writes the payload, then clears the flags of the
+ * header right after the record (so that the consumer stops there), and finally sets
+ * RING_RECORD_READY in the header of the record. Only one barrier is needed per record,
+ * no matter how large it is, but the consumer polls the record headers.
+ *
+ * In RING_MODE_INDEX, the producer publishes its head after the records are written,
+ * once per message or once per batch of messages. The consumer reads the shared head
+ * only when it has consumed everything up to its cached copy, and publishes its tail
+ * when it has drained what it has seen (or every RING_TAIL_PUBLISH_BATCH bytes). Each
+ * side thus touches the cacheline of the other side once per batch instead of once per
+ * record.
+ *
+ * A record never wraps around the end of the data area. If it doesn't fit, the rest of
+ * the data area is covered by a padding record and the message is placed at the start.
+ * Messages larger than RING_MAX_INPLACE_SIZE are split into fragments, all but the last
+ * of which carry RING_RECORD_FRAGMENT.
+ *
+ * head and tail are byte counters that only grow. The producer owns head, the consumer
+ * owns tail and advances it when a record is released, which frees the space. Both sides
+ * keep their position locally and the shared copies are the published ones.
+ */
 
-#define INDEX(x) (x)
-#define INCR(x) do { x = (x + 1) % RINGBUFFER_CAPACITY; } while(0)
+#define RING_RECORD_READY    (1U << 0)  // the record can be read
+#define RING_RECORD_PAD      (1U << 1)  // skip the record, the next one is at the start
+#define RING_RECORD_FRAGMENT (1U << 2)  // more fragments of the message follow
 
-struct ringbuffer_entry { // one cacheline (on our machine 64 bytes)
-	uint8_t data[CACHE_LINE_SIZE - sizeof(size_t)]; // the data contained in this block
-	volatile size_t ready: 1; // whether this block is ready to be read
+struct ring_record_header {
+	volatile uint32_t flags;  // written last by the producer
+	uint32_t size;            // payload bytes in this record
+	size_t msg_size;          // size of the whole message (sum of all fragments)
 };
-STATIC_ASSERT(sizeof(struct ringbuffer_entry) == CACHE_LINE_SIZE, "sizeof(struct ringbuffer_entry)");
+STATIC_ASSERT(sizeof(struct ring_record_header) == RING_RECORD_HEADER_SIZE, "sizeof(struct ring_record_header)");
 
-struct ringbuffer { // head, tail, size, list of cachelines
-	struct ringbuffer_entry entries[RINGBUFFER_CAPACITY]; // make sure that the cachelines are pagealigned
-	size_t head;
-	size_t tail;
-    uint8_t padding[RING_BUFFER_SIZE - RINGBUFFER_CAPACITY * CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+struct ringbuffer { // head, tail, list of records
+	volatile size_t head;  // written by the producer only
+	uint8_t head_padding[CACHE_LINE_SIZE - sizeof(size_t)];
+	volatile size_t tail;  // written by the consumer only
+	uint8_t tail_padding[CACHE_LINE_SIZE - sizeof(size_t)];
+	uint8_t data[RING_DATA_SIZE];
 };
 STATIC_ASSERT(sizeof(struct ringbuffer) == RING_BUFFER_SIZE, "sizeof(struct ringbuffer)");
+STATIC_ASSERT(RING_DATA_SIZE % RING_RECORD_HEADER_SIZE == 0, "RING_DATA_SIZE alignment");
+
+static inline size_t ring_record_size(size_t payload_size)
+{
+	return ROUND_UP(RING_RECORD_HEADER_SIZE + payload_size, RING_RECORD_HEADER_SIZE);
+}
+
+static inline struct ring_record_header *ring_record_at(struct ringbuffer *rbuf, size_t pos)
+{
+	return (struct ring_record_header *)&rbuf->data[pos % RING_DATA_SIZE];
+}
+
+static inline size_t ring_producer_free_bytes(struct ring_producer *rp)
+{
+	return RING_DATA_SIZE - (rp->head - rp->cached_tail);
+}
+
+void ring_wait(const struct ring_wait_policy *policy, struct ring_waiter *w)
+{
+	if (w->sleep_us == 0) {
+		if (policy->spin_ns == RING_WAIT_SPIN_FOREVER
+		    || systime_to_ns(systime_now() - w->start) < policy->spin_ns) {
+			thread_yield();
+			return;
+		}
+		w->sleep_us = MAX(policy->sleep_min_us, 1);
+	}
+
+	errval_t err = barrelfish_usleep(w->sleep_us);
+	if (err_is_fail(err)) {
+		thread_yield();  // keep waiting, just without the CPU savings
+	}
+	w->sleep_us = MIN(w->sleep_us * 2, MAX(policy->sleep_max_us, w->sleep_us));
+}
 
 errval_t ring_init(void *buffer)
 {
@@ -33,147 +96,206 @@ errval_t ring_init(void *buffer)
 		DEBUG_PRINTF("Could not initialze ringbuffer: recieved null pointer.\n");
 		return ERR_INVALID_ARGS;
 	}
-	
+
 	// make sure that the address is page aligned
 	assert(((uint64_t)buffer) % PAGE_SIZE == 0);
-	
+
 	// zero the memory to clear all flags
 	memset(buffer, 0, PAGE_SIZE);
-	
+
 	return SYS_ERR_OK;
 }
 
-/* 
- * TODO: define protocol
- * Protocol for transferring data:
- * 
- * 8 bytes: size
- * ${size} bytes: message
- * 
- * This is very simple and enough for a unidirectional channel from one endpoint to another.
- * This is implemented in the producer and consumer functions.
- * 
- * 
- */
-
-/**
- * @brief Inserts a block of exactly CACHE_LINE_SIZE - sizeof(size_t) bytes into the ringbuffer (on our machine that is 56 bytes).
- * 
- * @param rb A non null ringbuffer.
- * @param payload exactly 56 bytes of memory to be inserted into the buffer.
- * @return An error code indicating a failure, or SYS_ERR_OK.
- */
-static errval_t ring_insert(void *rb, void *payload) {
-	
+errval_t ring_producer_init(struct ring_producer *rp, void *ring_buffer, enum ring_mode mode)
+{
 	// check for null-pointer
-	if (rb == NULL) {
-		DEBUG_PRINTF("Cannot insert into ringbuffer: buffer is null pointer.\n");
+	if (rp == NULL) {
+		DEBUG_PRINTF("Cannot initialize ringbuffer producer: producer is null-ptr.\n");
+		return ERR_INVALID_ARGS;
+	}
+	if (ring_buffer == NULL) {
+		DEBUG_PRINTF("Cannot initialize ringbuffer producer: ring_buffer is null-ptr.\n");
 		return ERR_INVALID_ARGS;
 	}
-	
-	struct ringbuffer *rbuf = rb;
-	int head = INDEX(rbuf->head);
-	
-	// wait for the buffer entry to be free
-	while (rbuf->entries[head].ready) thread_yield();
-	dmb();
-	
-	// insert data into entry
-	memcpy(&(rbuf->entries[head]), payload, ENTRY_DATA_CAPACITY);
-	INCR(rbuf->head); // increment head pointer
-	
-	dmb(); // wait for the write to complete
-	rbuf->entries[head].ready = 1;
-	// TODO: does the writebuffer need flushing here?
-	
+
+	struct ringbuffer *rbuf = ring_buffer;
+	rp->ringbuffer = ring_buffer;
+	rp->mode = mode;
+	rp->head = rbuf->head;
+	rp->cached_tail = rbuf->tail;
+	rp->batching = false;
+	rp->pending_pad = 0;
+	rp->pending_size = 0;
+	rp->wait = RING_WAIT_POLICY_POLL;
+
 	return SYS_ERR_OK;
 }
 
 /**
- * @brief Consumes a block of exactly 64 bytes from the ringbuffer
- * This function blocks until an element can be read from the buffer.
- * 
- * @param rb A non null ringbuffer
- * @param payload exactly ENTRY_DATA_CAPACITY bytes of space to write the data (on our machine this is 56 bytes)
- * @return An error code indicating a failure, or SYS_ERR_OK. 
+ * @brief Make everything written so far visible to the consumer.
  */
-static errval_t ring_consume(void *rb, void *payload)
+static void ring_producer_flush(struct ring_producer *rp)
 {
-	// check for null-pointer
-	if (rb == NULL) {
-		DEBUG_PRINTF("Cannot consume from ringbuffer: buffer is null pointer.\n");
-		return ERR_INVALID_ARGS;
+	struct ringbuffer *rbuf = rp->ringbuffer;
+	if (rbuf->head == rp->head) {
+		return;
 	}
-	
-	struct ringbuffer *rbuf = rb;
-	int tail = INDEX(rbuf->tail);
-	
-	// wait for the data to be ready
-	while (! rbuf->entries[tail].ready) thread_yield();
-	dmb();
-	
-	// read value from buffer
-	memcpy(payload, &(rbuf->entries[tail]), ENTRY_DATA_CAPACITY);
-	INCR(rbuf->tail); // increment the tail pointer
-
-	dmb();
-	rbuf->entries[tail].ready = 0;
-
-	// TODO: does the writebuffer need flushing?
-	
-	return SYS_ERR_OK;
+	if (rp->mode == RING_MODE_INDEX) {
+		dmb();  // release: all records are written before the head moves past them
+	}
+	rbuf->head = rp->head;  // only informational in RING_MODE_READY_FLAG
 }
 
-
 /**
- * @brief Consumes a block of exactly 64 bytes from the ringbuffer.
- * This function will not block, but return RING_NO_MSG when buffer is empty
- * 
- * @param rb A non null ringbuffer
- * @param payload exactly ENTRY_DATA_CAPACITY bytes of space to write the data (on our machine this is 56 bytes)
- * @return An error code indicating a failure, LIB_ERR_RING_NO_MSG if buffer is empty, or SYS_ERR_OK. 
+ * @brief Ring space needed to reserve a record of the given size at the current head,
+ * including the padding up to the end of the data area and the header after the record.
  */
-errval_t ring_consumer_recv_non_blocking(struct ring_consumer *rc, void **payload, size_t *size)
+static size_t ring_producer_needed_bytes(struct ring_producer *rp, size_t size, size_t *pad)
 {
-    if (!ring_consumer_can_recv(rc)) return LIB_ERR_RING_NO_MSG;
-	return ring_consumer_recv(rc, payload, size);
+	size_t offset = rp->head % RING_DATA_SIZE;
+	size_t record_size = ring_record_size(size);
+
+	// pad up to the end of the data area if the record doesn't fit contiguously
+	*pad = (record_size > RING_DATA_SIZE - offset) ? RING_DATA_SIZE - offset : 0;
+
+	return *pad + record_size + RING_RECORD_HEADER_SIZE;
 }
 
-bool ring_consumer_can_recv(struct ring_consumer *rc)
+bool ring_producer_can_reserve(struct ring_producer *rp, size_t size)
 {
-	if (rc == NULL) {
-		DEBUG_PRINTF("Cannot check if ringbuffer consumer can receive: consumer is null-ptr!\n");
-		return ERR_INVALID_ARGS;
+	assert(rp != NULL && rp->ringbuffer != NULL);
+	assert(size <= RING_MAX_INPLACE_SIZE);
+
+	struct ringbuffer *rbuf = rp->ringbuffer;
+	size_t pad;
+	size_t needed = ring_producer_needed_bytes(rp, size, &pad);
+	if (ring_producer_free_bytes(rp) >= needed) {
+		return true;
 	}
-	
-	struct ringbuffer *rbuf = rc->ringbuffer;
-	int tail = INDEX(rbuf->tail);
-	return rbuf->entries[tail].ready;
+
+	ring_producer_flush(rp);  // the consumer can't free anything it hasn't seen
+	rp->cached_tail = rbuf->tail;
+	if (ring_producer_free_bytes(rp) < needed) {
+		return false;
+	}
+	dmb();  // the consumer is done reading the space before we overwrite it
+	return true;
 }
 
-errval_t ring_producer_init(struct ring_producer *rp, void *ring_buffer)
+errval_t ring_producer_reserve(struct ring_producer *rp, size_t size, void **buf)
 {
 	// check for null-pointer
-	if (rp == NULL) {
-		DEBUG_PRINTF("Cannot initialize ringbuffer producer: producer is null-ptr.\n");
+	if (rp == NULL || rp->ringbuffer == NULL) {
+		DEBUG_PRINTF("Ringbuffer producer cannot reserve: producer or ringbuffer is null-ptr.\n");
 		return ERR_INVALID_ARGS;
 	}
-	if (ring_buffer == NULL) {
-		DEBUG_PRINTF("Cannot initialize ringbuffer producer: ring_buffer is null-ptr.\n");
+	if (size > RING_MAX_INPLACE_SIZE) {
+		DEBUG_PRINTF("Ringbuffer producer cannot reserve %lu bytes in place.\n", size);
+		return LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+	}
+
+	struct ringbuffer *rbuf = rp->ringbuffer;
+
+	// wait for the padding, the record and the header after it to be free
+	size_t pad;
+	size_t needed = ring_producer_needed_bytes(rp, size, &pad);
+	if (ring_producer_free_bytes(rp) < needed) {
+		ring_producer_flush(rp);  // the consumer can't free anything it hasn't seen
+		struct ring_waiter waiter;
+		ring_waiter_init(&waiter);
+		while (rp->cached_tail = rbuf->tail, ring_producer_free_bytes(rp) < needed) {
+			ring_wait(&rp->wait, &waiter);
+		}
+		dmb();  // the consumer is done reading the space before we overwrite it
+	}
+
+	rp->pending_pad = pad;
+	rp->pending_size = size;
+	*buf = ring_record_at(rbuf, rp->head + pad) + 1;
+
+	return SYS_ERR_OK;
+}
+
+static errval_t ring_producer_publish_record(struct ring_producer *rp, uint32_t flags, size_t msg_size)
+{
+	struct ringbuffer *rbuf = rp->ringbuffer;
+	size_t pad = rp->pending_pad;
+	size_t record_pos = rp->head + pad;
+	size_t next_pos = record_pos + ring_record_size(rp->pending_size);
+
+	struct ring_record_header *record = ring_record_at(rbuf, record_pos);
+	record->size = rp->pending_size;
+	record->msg_size = msg_size;
+
+	struct ring_record_header *padding = NULL;
+	if (pad != 0) {
+		padding = ring_record_at(rbuf, rp->head);
+		padding->size = pad - RING_RECORD_HEADER_SIZE;
+		padding->msg_size = 0;
+	}
+
+	if (rp->mode == RING_MODE_READY_FLAG) {
+		ring_record_at(rbuf, next_pos)->flags = 0;  // stop the consumer after this record
+		dmb();  // payload and headers are written before the record becomes visible
+		record->flags = RING_RECORD_READY | flags;
+		if (padding != NULL) {
+			// the padding is published last, so the record after it is already visible
+			dmb();
+			padding->flags = RING_RECORD_READY | RING_RECORD_PAD;
+		}
+	} else {
+		// the head index publishes the record, no ordering needed among the headers
+		record->flags = RING_RECORD_READY | flags;
+		if (padding != NULL) {
+			padding->flags = RING_RECORD_READY | RING_RECORD_PAD;
+		}
+	}
+
+	rp->head = next_pos;
+	rp->pending_pad = 0;
+	rp->pending_size = 0;
+
+	if (!rp->batching) {
+		ring_producer_flush(rp);
+	}
+
+	return SYS_ERR_OK;
+}
+
+void ring_producer_batch_begin(struct ring_producer *rp)
+{
+	assert(rp != NULL);
+	rp->batching = true;
+}
+
+errval_t ring_producer_batch_end(struct ring_producer *rp)
+{
+	// check for null-pointer
+	if (rp == NULL || rp->ringbuffer == NULL) {
+		DEBUG_PRINTF("Ringbuffer producer cannot end batch: producer or ringbuffer is null-ptr.\n");
 		return ERR_INVALID_ARGS;
 	}
-	
-	rp->ringbuffer = ring_buffer;
-	// TODO: do necessary setup
-	
+
+	rp->batching = false;
+	ring_producer_flush(rp);
 	return SYS_ERR_OK;
 }
 
+errval_t ring_producer_publish(struct ring_producer *rp)
+{
+	// check for null-pointer
+	if (rp == NULL || rp->ringbuffer == NULL) {
+		DEBUG_PRINTF("Ringbuffer producer cannot publish: producer or ringbuffer is null-ptr.\n");
+		return ERR_INVALID_ARGS;
+	}
+
+	return ring_producer_publish_record(rp, 0, rp->pending_size);
+}
 
 errval_t ring_producer_send(struct ring_producer *rp, const void *payload, size_t size)
 {
 	errval_t err;
-	
+
 	// check for null-pointer
 	if (rp == NULL) {
 		DEBUG_PRINTF("Ringbuffer producer cannot transmit: producer is null-ptr.\n");
@@ -183,33 +305,41 @@ errval_t ring_producer_send(struct ring_producer *rp, const void *payload, size_
 		DEBUG_PRINTF("Ringbuffer producer cannot transmit: ringbuffer is null-ptr.\n");
 		return  ERR_INVALID_ARGS;
 	}
-	
+
 	// insert into buffer (this part should block until complete, or irrecoverable error happens)
-	uint8_t tmp[ENTRY_DATA_CAPACITY];
+	// the fragments of a message are published together, unless the ring runs full
+	bool batching = rp->batching;
+	rp->batching = true;
 	size_t offset = 0;
-	size_t start = sizeof(size_t);
-	size_t cap = ENTRY_DATA_CAPACITY - start;
-	
-	while (offset < size) {
-		// clear the temporary storage
-		memset(tmp, 0, ENTRY_DATA_CAPACITY);
-		*((size_t*)tmp) = size;
-		memcpy(tmp + start, (void*)((size_t)payload + offset), MIN(size - offset, cap)); // copy the first part of this message into the buffer
-		
-		offset += cap;
-		start = 0;
-		cap = ENTRY_DATA_CAPACITY - start;
-		
-		err = ring_insert(rp->ringbuffer, tmp); // this error can only be SYS_ERR_OK
-		assert(err == SYS_ERR_OK);
-	
-	}
-	
+	do {
+		size_t chunk = MIN(size - offset, RING_MAX_INPLACE_SIZE);
+
+		void *buf;
+		err = ring_producer_reserve(rp, chunk, &buf);
+		if (err_is_fail(err)) {
+			rp->batching = batching;
+			return err_push(err, LIB_ERR_RING_PRODUCER_SEND);
+		}
+		memcpy(buf, (uint8_t *)payload + offset, chunk);
+		offset += chunk;
+
+		err = ring_producer_publish_record(rp, offset < size ? RING_RECORD_FRAGMENT : 0, size);
+		if (err_is_fail(err)) {
+			rp->batching = batching;
+			return err_push(err, LIB_ERR_RING_PRODUCER_SEND);
+		}
+	} while (offset < size);
+
+	rp->batching = batching;
+	if (!batching) {
+		ring_producer_flush(rp);
+	}
+
 	// if no errors happened, return OK
 	return SYS_ERR_OK;
 }
 
-errval_t ring_consumer_init(struct ring_consumer *rc, void *ring_buffer)
+errval_t ring_consumer_init(struct ring_consumer *rc, void *ring_buffer, enum ring_mode mode)
 {
 		// check for null-pointer
 	if (rc == NULL) {
@@ -220,49 +350,262 @@ errval_t ring_consumer_init(struct ring_consumer *rc, void *ring_buffer)
 		DEBUG_PRINTF("Cannot initialize ringbuffer consumer: ringbuffer is null-ptr.\n");
 		return ERR_INVALID_ARGS;
 	}
-	
+
+	struct ringbuffer *rbuf = ring_buffer;
 	rc->ringbuffer = ring_buffer;
-	// TODO: do necessary setup
-	
+	rc->mode = mode;
+	rc->tail = rbuf->tail;
+	rc->cached_head = rbuf->head;
+	rc->wait = RING_WAIT_POLICY_POLL;
+
 	return SYS_ERR_OK;
 }
 
-errval_t ring_consumer_recv(struct ring_consumer *rc, void **payload, size_t *size)
+static inline void ring_consumer_release(struct ring_consumer *rc, size_t bytes)
+{
+	struct ringbuffer *rbuf = rc->ringbuffer;
+	rc->tail += bytes;
+
+	// in RING_MODE_INDEX, publish once everything seen is drained or enough has piled up
+	if (rc->mode == RING_MODE_READY_FLAG || rc->tail == rc->cached_head
+	    || rc->tail - rbuf->tail >= RING_TAIL_PUBLISH_BATCH) {
+		dmb();  // finish reading the records before the producer can reuse the space
+		rbuf->tail = rc->tail;
+	}
+}
+
+/**
+ * @brief Returns the header of the next ready record, skipping padding, or NULL.
+ */
+static struct ring_record_header *ring_consumer_next_record(struct ring_consumer *rc)
+{
+	struct ringbuffer *rbuf = rc->ringbuffer;
+	while (true) {
+		struct ring_record_header *record = ring_record_at(rbuf, rc->tail);
+		uint32_t flags;
+		if (rc->mode == RING_MODE_READY_FLAG) {
+			flags = record->flags;
+			if (!(flags & RING_RECORD_READY)) {
+				return NULL;
+			}
+			dmb();  // read the flags before the rest of the record
+		} else {
+			if (rc->tail == rc->cached_head) {
+				rc->cached_head = rbuf->head;
+				if (rc->tail == rc->cached_head) {
+					return NULL;
+				}
+				dmb();  // acquire: read the head before the records it covers
+			}
+			flags = record->flags;
+		}
+
+		if (!(flags & RING_RECORD_PAD)) {
+			return record;
+		}
+		ring_consumer_release(rc, RING_RECORD_HEADER_SIZE + record->size);
+	}
+}
+
+bool ring_consumer_can_recv(struct ring_consumer *rc)
 {
-	errval_t err;
-	
-	// check for null-pointer
 	if (rc == NULL) {
-		DEBUG_PRINTF("Ringbuffer consumer cannot consume: consumer is null-ptr.\n");
+		DEBUG_PRINTF("Cannot check if ringbuffer consumer can receive: consumer is null-ptr!\n");
 		return ERR_INVALID_ARGS;
 	}
-	if (rc->ringbuffer == NULL) {
-		DEBUG_PRINTF("Ringbuffer consumer cannot consume: ring_buffer is null-ptr.\n");
+
+	struct ringbuffer *rbuf = rc->ringbuffer;
+	if (rc->mode == RING_MODE_READY_FLAG) {
+		// a ready padding record implies that the record after it is ready as well
+		return ring_record_at(rbuf, rc->tail)->flags & RING_RECORD_READY;
+	} else {
+		// may be called from the waitset poll, so leave the cached head alone
+		return rc->tail != rbuf->head;
+	}
+}
+
+/**
+ * @brief Copy a fragmented message out of the ring, releasing the fragments on the way
+ * since the message may be larger than the ring itself.
+ */
+static errval_t ring_consumer_reassemble(struct ring_consumer *rc, struct ring_record_header *record,
+                                         struct ring_msg_view *view)
+{
+	uint8_t *buf = malloc(record->msg_size);
+	if (buf == NULL) {
+		return LIB_ERR_MALLOC_FAIL;
+	}
+
+	size_t msg_size = record->msg_size;
+	size_t offset = 0;
+	while (true) {
+		assert(offset + record->size <= msg_size);
+		memcpy(buf + offset, record + 1, record->size);
+		offset += record->size;
+
+		bool last = !(record->flags & RING_RECORD_FRAGMENT);
+		ring_consumer_release(rc, ring_record_size(record->size));
+		if (last) {
+			break;
+		}
+
+		// the producer keeps sending the following fragments as we free space
+		struct ring_waiter waiter;
+		ring_waiter_init(&waiter);
+		while ((record = ring_consumer_next_record(rc)) == NULL) ring_wait(&rc->wait, &waiter);
+	}
+	assert(offset == msg_size);
+
+	view->payload = buf;
+	view->size = msg_size;
+	view->ring_bytes = 0;
+	view->owned = true;
+	return SYS_ERR_OK;
+}
+
+errval_t ring_consumer_peek(struct ring_consumer *rc, struct ring_msg_view *view)
+{
+	// check for null-pointer
+	if (rc == NULL || rc->ringbuffer == NULL) {
+		DEBUG_PRINTF("Ringbuffer consumer cannot peek: consumer or ring_buffer is null-ptr.\n");
+		return ERR_INVALID_ARGS;
+	}
+
+	struct ring_record_header *record = ring_consumer_next_record(rc);
+	if (record == NULL) {
+		return LIB_ERR_RING_NO_MSG;
+	}
+
+	if (record->flags & RING_RECORD_FRAGMENT) {
+		return ring_consumer_reassemble(rc, record, view);
+	}
+
+	view->payload = record + 1;
+	view->size = record->size;
+	view->ring_bytes = ring_record_size(record->size);
+	view->owned = false;
+	return SYS_ERR_OK;
+}
+
+errval_t ring_consumer_peek_blocking(struct ring_consumer *rc, struct ring_msg_view *view)
+{
+	errval_t err;
+	struct ring_waiter waiter;
+	ring_waiter_init(&waiter);
+	while ((err = ring_consumer_peek(rc, view)) == LIB_ERR_RING_NO_MSG) ring_wait(&rc->wait, &waiter);
+	return err;
+}
+
+errval_t ring_consumer_commit(struct ring_consumer *rc, struct ring_msg_view *view)
+{
+	// check for null-pointer
+	if (rc == NULL || rc->ringbuffer == NULL) {
+		DEBUG_PRINTF("Ringbuffer consumer cannot commit: consumer or ring_buffer is null-ptr.\n");
 		return ERR_INVALID_ARGS;
 	}
-	
+
+	if (view->ring_bytes != 0) {
+		ring_consumer_release(rc, view->ring_bytes);
+	}
+	if (view->owned) {
+		free(view->payload);
+	}
+
+	view->payload = NULL;
+	view->size = 0;
+	view->ring_bytes = 0;
+	view->owned = false;
+	return SYS_ERR_OK;
+}
+
+/**
+ * @brief Hands out a malloced copy of the message, copying only if it is still in the ring.
+ */
+static errval_t ring_consumer_copy_out(struct ring_consumer *rc, struct ring_msg_view *view,
+                                       void **payload, size_t *size)
+{
+	*size = view->size;
+	if (view->owned) {
+		// already reassembled on the heap, hand the buffer over
+		*payload = view->payload;
+		view->owned = false;
+	} else {
+		*payload = malloc(view->size);
+		if (*payload == NULL) {
+			return LIB_ERR_MALLOC_FAIL;  // leave the message in the ring
+		}
+		memcpy(*payload, view->payload, view->size);
+	}
+
+	return ring_consumer_commit(rc, view);
+}
+
+/**
+ * @brief Consumes a message from the ringbuffer.
+ * This function will not block, but return RING_NO_MSG when buffer is empty
+ *
+ * @param payload malloced by this function and should be freed outside
+ * @return An error code indicating a failure, LIB_ERR_RING_NO_MSG if buffer is empty, or SYS_ERR_OK.
+ */
+errval_t ring_consumer_recv_non_blocking(struct ring_consumer *rc, void **payload, size_t *size)
+{
+	struct ring_msg_view view;
+	errval_t err = ring_consumer_peek(rc, &view);
+	if (err_is_fail(err)) {
+		return err;
+	}
+	return ring_consumer_copy_out(rc, &view, payload, size);
+}
+
+errval_t ring_consumer_recv(struct ring_consumer *rc, void **payload, size_t *size)
+{
 	// consume from buffer (this part should block until complete, or irrecoverable error happens)
-	uint8_t tmp[ENTRY_DATA_CAPACITY];
-	
-	err = ring_consume(rc->ringbuffer, tmp); // this error can only be SYS_ERR_OK
-	assert(err == SYS_ERR_OK);
-	
-	*size = *((size_t*)tmp);
-	*payload = malloc(*size);
-	
-	memcpy(*payload, (void*)((size_t)tmp + sizeof(size_t)), MIN(ENTRY_DATA_CAPACITY - sizeof(size_t), *size));
-	
-	size_t offset = ENTRY_DATA_CAPACITY - sizeof(size_t);
-	
-	while (offset < *size) {
-		err = ring_consume(rc->ringbuffer, tmp); // this error can only be SYS_ERR_OK
-		assert(err == SYS_ERR_OK);
-		
-		memcpy((void*)((size_t)*payload + offset), tmp, MIN(*size - offset, ENTRY_DATA_CAPACITY));
-		
-		offset += ENTRY_DATA_CAPACITY;
-	}
-	
-	// if no errors happened, return OK
+	struct ring_msg_view view;
+	errval_t err = ring_consumer_peek_blocking(rc, &view);
+	if (err_is_fail(err)) {
+		return err;
+	}
+	return ring_consumer_copy_out(rc, &view, payload, size);
+}
+
+errval_t ring_producer_send_some(struct ring_producer *rp, const void *payload, size_t size,
+                                 size_t *offset)
+{
+	errval_t err;
+
+	// check for null-pointer
+	if (rp == NULL || rp->ringbuffer == NULL || offset == NULL) {
+		DEBUG_PRINTF("Ringbuffer producer cannot transmit: producer or ringbuffer is null-ptr.\n");
+		return ERR_INVALID_ARGS;
+	}
+
+	bool batching = rp->batching;
+	rp->batching = true;
+	while (*offset < size) {
+		size_t chunk = MIN(size - *offset, RING_MAX_INPLACE_SIZE);
+		if (!ring_producer_can_reserve(rp, chunk)) {
+			break;
+		}
+
+		void *buf;
+		err = ring_producer_reserve(rp, chunk, &buf);
+		if (err_is_fail(err)) {
+			rp->batching = batching;
+			return err_push(err, LIB_ERR_RING_PRODUCER_SEND);
+		}
+		memcpy(buf, (uint8_t *)payload + *offset, chunk);
+		*offset += chunk;
+
+		err = ring_producer_publish_record(rp, *offset < size ? RING_RECORD_FRAGMENT : 0, size);
+		if (err_is_fail(err)) {
+			rp->batching = batching;
+			return err_push(err, LIB_ERR_RING_PRODUCER_SEND);
+		}
+	}
+
+	rp->batching = batching;
+	if (!batching) {
+		ring_producer_flush(rp);  // also when stopping early, the consumer must see it to free space
+	}
 	return SYS_ERR_OK;
-}
\ No newline at end of file
+}
@@ -51,13 +51,16 @@ errval_t proc_mgmt_alloc(struct proc_mgmt *ps, struct proc_node **ret)
         }
         node->pid = ps->pid_upper + (disp_get_core_id() * PID_CORE_ID_FACTOR);
         ps->pid_upper++;
-        node->accepting_cap = 0;
     } else {
         node = LIST_FIRST(&ps->free_list);
         LIST_REMOVE(node, link);
         // Reuse node->pid
     }
     assert(node != NULL);
+    TAILQ_INIT(&node->cap_mailbox);
+    node->cap_mailbox_count = 0;
+    node->cap_claimed = NULL_CAP;
+    node->ram_bytes = 0;
 
     RB_INSERT(proc_rb_tree, &ps->running, node);
     ps->running_count++;
@@ -89,6 +92,19 @@ errval_t proc_mgmt_delete(struct proc_mgmt *ps, domainid_t pid)
     node->name[0] = '\0';
     node->dispatcher = NULL_CAP;
 
+    // Drop the caps the process will never claim
+    struct proc_cap_mail *mail;
+    while ((mail = TAILQ_FIRST(&node->cap_mailbox)) != NULL) {
+        TAILQ_REMOVE(&node->cap_mailbox, mail, link);
+        cap_destroy(mail->cap);
+        free(mail);
+    }
+    node->cap_mailbox_count = 0;
+    if (!capref_is_null(node->cap_claimed)) {
+        cap_destroy(node->cap_claimed);
+        node->cap_claimed = NULL_CAP;
+    }
+
     LIST_INSERT_HEAD(&ps->free_list, node, link);
     return SYS_ERR_OK;
 }
@@ -141,3 +157,47 @@ errval_t proc_mgmt_get_all_pids(struct proc_mgmt *ps, domainid_t **pids, size_t
     *pid_count = ps->running_count;
     return SYS_ERR_OK;
 }
+
+errval_t proc_mgmt_cap_mailbox_put(struct proc_node *node, const struct aos_rpc_cap_ticket *ticket,
+                                   struct capref cap)
+{
+    if (node->cap_mailbox_count >= PROC_CAP_MAILBOX_MAX) {
+        return PROC_MGMT_ERR_CAP_MAILBOX_FULL;
+    }
+
+    struct proc_cap_mail *mail = malloc(sizeof(*mail));
+    if (mail == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    mail->ticket = *ticket;
+    mail->cap = cap;
+    TAILQ_INSERT_TAIL(&node->cap_mailbox, mail, link);
+    node->cap_mailbox_count++;
+    return SYS_ERR_OK;
+}
+
+errval_t proc_mgmt_cap_mailbox_take(struct proc_node *node, const struct aos_rpc_cap_ticket *ticket,
+                                    struct capref *cap)
+{
+    // The reply carrying the previous claim has been sent by now
+    if (!capref_is_null(node->cap_claimed)) {
+        errval_t err = cap_destroy(node->cap_claimed);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "proc_mgmt_cap_mailbox_take: failed to destroy claimed cap\n");
+        }
+        node->cap_claimed = NULL_CAP;
+    }
+
+    // Caps from one sender are mostly claimed in order, so the match is near the front
+    struct proc_cap_mail *mail;
+    TAILQ_FOREACH(mail, &node->cap_mailbox, link) {
+        if (mail->ticket.from == ticket->from && mail->ticket.seq == ticket->seq) {
+            TAILQ_REMOVE(&node->cap_mailbox, mail, link);
+            node->cap_mailbox_count--;
+            *cap = node->cap_claimed = mail->cap;
+            free(mail);
+            return SYS_ERR_OK;
+        }
+    }
+    return MON_ERR_RETRY;
+}
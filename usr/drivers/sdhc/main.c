@@ -30,6 +30,8 @@
 #include <aos/aos.h>
 #include <drivers/sdhc.h>
 #include <aos/deferred.h>
+#include <aos/systime.h>
+#include <aos/static_assert.h>
 #include <dev/imx8x/sdhc_dev.h>
 
 //#define DEBUG_ON
@@ -97,6 +99,24 @@
 #define MMC_RSP_R6  (MMC_RSP_PRESENT|MMC_RSP_CRC|MMC_RSP_OPCODE)
 #define MMC_RSP_R7  (MMC_RSP_PRESENT|MMC_RSP_CRC|MMC_RSP_OPCODE)
 
+// Upper bounds for polling the interrupt status, the inhibit flags and line resets
+#define SDHC_CMD_TIMEOUT_US  100000
+#define SDHC_DATA_TIMEOUT_US 1000000
+
+// ADMA2 descriptors, each moves up to SDHC_ADMA_MAX_LEN bytes
+#define SDHC_ADMA_VALID     (1 << 0)
+#define SDHC_ADMA_END       (1 << 1)
+#define SDHC_ADMA_ACT_TRAN  (2 << 4)
+#define SDHC_ADMA_MAX_LEN   (32 * 1024)
+#define SDHC_ADMA_TABLE_SIZE BASE_PAGE_SIZE
+#define SDHC_ADMA_MAX_DESC  (SDHC_ADMA_TABLE_SIZE / sizeof(uint64_t))
+STATIC_ASSERT(SDHC_MAX_BLOCKS * SDHC_BLOCK_SIZE / SDHC_ADMA_MAX_LEN <= SDHC_ADMA_MAX_DESC,
+              "ADMA table too small");
+
+// prot_ctrl.dmasel
+#define SDHC_DMASEL_SIMPLE  0
+#define SDHC_DMASEL_ADMA2   2
+
 #define OCR_BUSY        0x80000000
 #define OCR_HCS         0x40000000
 #define OCR_S18R        0x1000000
@@ -115,6 +135,11 @@ struct sdhc_s {
     uint64_t read_bl_len;
     uint64_t write_bl_len ;
     uint64_t capacity_user;
+
+    // ADMA2 descriptor table of multi-block transfers, mapped uncached
+    struct capref adma_frame;
+    uint64_t *adma_table;
+    lpaddr_t adma_table_p;
 };
 
 
@@ -125,8 +150,24 @@ struct cmd {
     unsigned int response[4]; // The response of the command
     genpaddr_t   dma_base;    // If a data transfer is necessary, use this
                               // physical base address for read/write.
+    size_t       blkcnt;      // Blocks of a multi-block transfer
 };
 
+static bool cmd_is_read(struct cmd *cmd) {
+    return cmd->cmdidx == MMC_CMD_READ_SINGLE_BLOCK ||
+           cmd->cmdidx == MMC_CMD_READ_MULTIPLE_BLOCK;
+}
+
+static bool cmd_is_write(struct cmd *cmd) {
+    return cmd->cmdidx == MMC_CMD_WRITE_SINGLE_BLOCK ||
+           cmd->cmdidx == MMC_CMD_WRITE_MULTIPLE_BLOCK;
+}
+
+static bool cmd_is_multi(struct cmd *cmd) {
+    return cmd->cmdidx == MMC_CMD_READ_MULTIPLE_BLOCK ||
+           cmd->cmdidx == MMC_CMD_WRITE_MULTIPLE_BLOCK;
+}
+
 #define dump(sd) do {\
         char buf[1024];\
         sdhc_int_status_pr(buf, 1024, &sd->dev);\
@@ -184,8 +225,7 @@ static errval_t software_reset(struct sdhc_s *sd){
 static sdhc_cmd_xfr_typ_t xfr_typ_for_cmd(struct cmd *cmd){
     sdhc_cmd_xfr_typ_t c = 0;
 
-    if(cmd->cmdidx == MMC_CMD_READ_SINGLE_BLOCK ||
-       cmd->cmdidx == MMC_CMD_WRITE_SINGLE_BLOCK)
+    if(cmd_is_read(cmd) || cmd_is_write(cmd))
     {
         c = sdhc_cmd_xfr_typ_dpsel_insert(c, 1);
     }
@@ -212,8 +252,87 @@ static sdhc_cmd_xfr_typ_t xfr_typ_for_cmd(struct cmd *cmd){
     return c;
 }
 
+// Wait for the command complete flag, or a command error
+static errval_t wait_cmd_complete(struct sdhc_s *sd) {
+    systime_t start = systime_now();
+    while(true) {
+        uint32_t ctoe = sdhc_int_status_ctoe_rdf(&sd->dev);
+        uint32_t cce = sdhc_int_status_cce_rdf(&sd->dev);
+
+        if (ctoe == 0x1 && cce == 0x1) {
+            DEBUG("%s:%d: ctoe = 1 ccrc = 1: Conflict on cmd line.\n",
+                    __FUNCTION__, __LINE__);
+            dump(sd);
+            return SDHC_ERR_CMD_CONFLICT;
+        }
+        if (ctoe == 0x1 && cce == 0x0) {
+            DEBUG("%s:%d: cto = 1 ccrc = 0: Abort.\n", __FUNCTION__, __LINE__);
+            dump(sd);
+            return SDHC_ERR_CMD_TIMEOUT;
+        }
+
+        if(sdhc_int_status_cc_rdf(&sd->dev) || sdhc_int_status_tc_rdf(&sd->dev))
+            return SYS_ERR_OK;
+
+        // The caller resets the lines, as for a timeout the controller reports
+        if (systime_to_us(systime_now() - start) > SDHC_CMD_TIMEOUT_US) {
+            DEBUG("%s:%d: Command not Ackd.\n", __FUNCTION__, __LINE__);
+            dump(sd);
+            return SDHC_ERR_CMD_TIMEOUT;
+        }
+        thread_yield();
+    }
+}
+
+// Wait for the transfer complete flag of a data command, or a data or DMA error
+static errval_t wait_transfer_complete(struct sdhc_s *sd) {
+    systime_t start = systime_now();
+    while(true) {
+        if(sdhc_int_status_dtoe_rdf(&sd->dev)) {
+            dump(sd);
+            return SDHC_ERR_DATA_TIMEOUT;
+        }
+        if(sdhc_int_status_dce_rdf(&sd->dev) || sdhc_int_status_debe_rdf(&sd->dev) ||
+           sdhc_int_status_dmae_rdf(&sd->dev) || sdhc_int_status_ac12e_rdf(&sd->dev)) {
+            dump(sd);
+            return SDHC_ERR_DATA_ERROR;
+        }
+
+        if(sdhc_int_status_tc_rdf(&sd->dev))
+            return SYS_ERR_OK;
+
+        // The controller times out on its own (sys_ctrl.dtocv), this is a last resort
+        if (systime_to_us(systime_now() - start) > SDHC_DATA_TIMEOUT_US) {
+            dump(sd);
+            return SDHC_ERR_DATA_TIMEOUT;
+        }
+        thread_yield();
+    }
+}
+
+// Reset the data line, and the command line with it, after an error. Clears the
+// inhibit flags an aborted command leaves set.
+static errval_t reset_lines(struct sdhc_s *sd, bool cmd_line) {
+    sdhc_sys_ctrl_t s = sdhc_sys_ctrl_rd(&sd->dev);
+    s = sdhc_sys_ctrl_rstd_insert(s, 1);
+    if (cmd_line)
+        s = sdhc_sys_ctrl_rstc_insert(s, 1);
+    sdhc_sys_ctrl_wr(&sd->dev, s);
+
+    systime_t start = systime_now();
+    while(sdhc_sys_ctrl_rstd_rdf(&sd->dev) || sdhc_sys_ctrl_rstc_rdf(&sd->dev)) {
+        if (systime_to_us(systime_now() - start) > SDHC_CMD_TIMEOUT_US) {
+            DEBUG("Line reset TIMEOUT!\n");
+            return SDHC_ERR_RESET_TIMEOUT;
+        }
+        thread_yield();
+    }
+    return SYS_ERR_OK;
+}
+
 static errval_t sdhc_send_cmd(struct sdhc_s * sd, struct cmd * cmd) {
     DEBUG("sdhc_send_cmd: cmdidx=%d,cmdarg=%d\n", cmd->cmdidx, cmd->cmdarg);
+    errval_t err;
 
     uint32_t mask; // TODO: in some cases we don't need to wait for all
     if(cmd->cmdidx == MMC_CMD_STOP_TRANSMISSION) {
@@ -221,11 +340,18 @@ static errval_t sdhc_send_cmd(struct sdhc_s * sd, struct cmd * cmd) {
     } else {
        mask = 3;
     }
+    // The card holds the data line while it programs written blocks
+    systime_t start = systime_now();
     while(sdhc_pres_state_rawrd(&sd->dev) & mask){
-        DEBUG("Card busy!\n");
+        if (systime_to_us(systime_now() - start) > SDHC_DATA_TIMEOUT_US) {
+            DEBUG("Card busy, giving up!\n");
+            dump(sd);
+            reset_lines(sd, true);
+            return SDHC_ERR_CMD_TIMEOUT;
+        }
+        thread_yield();
     }
     DEBUG("Card ready (data & cmd inhibit are clear)!\n");
-    barrelfish_usleep(10000);
 
     // Clear interrupts
     sdhc_int_status_rawwr(&sd->dev, ~0x0);
@@ -237,8 +363,9 @@ static errval_t sdhc_send_cmd(struct sdhc_s * sd, struct cmd * cmd) {
     sdhc_cmd_arg_wr(&sd->dev, cmd->cmdarg);
 
     // Mixer controler
-    int is_read = cmd->cmdidx == MMC_CMD_READ_SINGLE_BLOCK;
-    int is_write = cmd->cmdidx == MMC_CMD_WRITE_SINGLE_BLOCK;
+    int is_read = cmd_is_read(cmd);
+    int is_write = cmd_is_write(cmd);
+    int is_multi = cmd_is_multi(cmd);
     sdhc_mix_ctrl_wr(&sd->dev, 0); 
     sdhc_mix_ctrl_dmaen_wrf(&sd->dev, is_read || is_write);
     sdhc_mix_ctrl_dtdsel_wrf(&sd->dev, is_read);
@@ -247,46 +374,62 @@ static errval_t sdhc_send_cmd(struct sdhc_s * sd, struct cmd * cmd) {
         // DMA address setup
         assert((cmd->dma_base >> 32) == 0);
         sdhc_vend_spec2_acmd23_argu2_en_wrf(&sd->dev, 0);
-        sdhc_ds_addr_wr(&sd->dev, cmd->dma_base);
+        if(is_multi){
+            // Count the blocks, and stop the card with an automatic CMD12 after them
+            sdhc_mix_ctrl_bcen_wrf(&sd->dev, 1);
+            sdhc_mix_ctrl_msbsel_wrf(&sd->dev, 1);
+            sdhc_mix_ctrl_ac12en_wrf(&sd->dev, 1);
+            sdhc_blk_att_blkcnt_wrf(&sd->dev, cmd->blkcnt);
+            sdhc_prot_ctrl_dmasel_wrf(&sd->dev, SDHC_DMASEL_ADMA2);
+            sdhc_adma_sys_addr_wr(&sd->dev, sd->adma_table_p);
+        } else {
+            sdhc_blk_att_blkcnt_wrf(&sd->dev, 1);
+            sdhc_prot_ctrl_dmasel_wrf(&sd->dev, SDHC_DMASEL_SIMPLE);
+            sdhc_ds_addr_wr(&sd->dev, cmd->dma_base);
+        }
+        sdhc_blk_att_blksize_wrf(&sd->dev, SDHC_BLOCK_SIZE);
 
         //Set watermark
         sdhc_wtmk_lvl_rd_wml_wrf(&sd->dev, 16);
         sdhc_wtmk_lvl_wr_wml_wrf(&sd->dev, 16);
     }
 
+    // The buffers are mapped uncached, the barrier orders their writes before the DMA
+    dmb();
+
     sdhc_cmd_xfr_typ_t c = xfr_typ_for_cmd(cmd);
     sdhc_cmd_xfr_typ_wr(&sd->dev, c);
 
-    //DEBUG("%s:%d: Wait until irq_stat.tc || irq_stat.cc \n", __FUNCTION__, __LINE__);
-    uint32_t tc = 0;
-    uint32_t cc = 0;
-    size_t i = 0;
-    do {
-        uint32_t ctoe = sdhc_int_status_ctoe_rdf(&sd->dev);
-        uint32_t cce = sdhc_int_status_cce_rdf(&sd->dev);
-        tc = sdhc_int_status_tc_rdf(&sd->dev);
-        cc = sdhc_int_status_cc_rdf(&sd->dev);
+    err = wait_cmd_complete(sd);
+    if(err_is_fail(err)) {
+        reset_lines(sd, true);
+        return err;
+    }
+    DEBUG("Command complete!\n");
 
-        if (ctoe == 0x1 && cce == 0x1) {
-            DEBUG("%s:%d: ctoe = 1 ccrc = 1: Conflict on cmd line.\n",
-                    __FUNCTION__, __LINE__);
-            dump(sd);
-            return SDHC_ERR_CMD_CONFLICT;
-        }
-        if (ctoe == 0x1 && cce == 0x0) {
-            DEBUG("%s:%d: cto = 1 ccrc = 0: Abort.\n", __FUNCTION__, __LINE__);
-            dump(sd);
-            return SDHC_ERR_CMD_TIMEOUT;
+    if(is_read || is_write){
+        err = wait_transfer_complete(sd);
+        if(err_is_fail(err)) {
+            // The controller does not stop the card on errors, auto CMD12 only follows
+            // the last block
+            reset_lines(sd, false);
+            if(is_multi) {
+                struct cmd stop = {
+                    .cmdidx = MMC_CMD_STOP_TRANSMISSION,
+                    .cmdarg = 0,
+                    .resp_type = MMC_RSP_R1b
+                };
+                errval_t stop_err = sdhc_send_cmd(sd, &stop);
+                if(err_is_fail(stop_err))
+                    DEBUG_ERR(stop_err, "failed to stop the transmission");
+            }
+            return err;
         }
+        // Reads of the buffer must not be done before the DMA is
+        dmb();
+        DEBUG("Transfer complete!\n");
+    }
 
-        if (i++ > 1000) {
-            dump(sd);
-            USER_PANIC("Command not Ackd?");
-        }
-        barrelfish_usleep(100);
-        if(tc || cc) break;
-    } while (true);
-    DEBUG("Command complete!\n");
 
     if(cmd->resp_type & MMC_RSP_136){
         uint32_t r0 = sdhc_cmd_rsp0_rd(&sd->dev);
@@ -464,13 +607,7 @@ static errval_t sdhc_card_init(struct sdhc_s* sd){
         return err;
     }      
 
-    return SYS_ERR_OK;
-}
-
-errval_t sdhc_read_block(struct sdhc_s* sd, int index, lpaddr_t dest)
-{
-    errval_t err;
-/*
+    // The block length stays set for all later transfers
     struct cmd set_blocklen = {
         .cmdidx = MMC_CMD_SET_BLOCKLEN,
         .cmdarg = SDHC_BLOCK_SIZE,
@@ -480,52 +617,102 @@ errval_t sdhc_read_block(struct sdhc_s* sd, int index, lpaddr_t dest)
     if(err_is_fail(err)){
         DEBUG_ERR(err, "set_blocklen");
         return err;
-    }*/
+    }
+
+    return SYS_ERR_OK;
+}
+
+// Describe count blocks at base in the ADMA2 descriptor table
+static void adma_setup(struct sdhc_s *sd, lpaddr_t base, size_t count) {
+    size_t bytes = count * SDHC_BLOCK_SIZE;
+    size_t i = 0;
+    for(size_t done = 0; done < bytes; done += SDHC_ADMA_MAX_LEN, i++) {
+        size_t len = MIN(bytes - done, SDHC_ADMA_MAX_LEN);
+        uint64_t attr = SDHC_ADMA_VALID | SDHC_ADMA_ACT_TRAN;
+        if(done + len == bytes)
+            attr |= SDHC_ADMA_END;
+        sd->adma_table[i] = ((uint64_t)(base + done) << 32) | ((uint64_t)len << 16) | attr;
+    }
+}
+
+static errval_t transfer_blocks(struct sdhc_s *sd, int index, size_t count, lpaddr_t base,
+                                bool write) {
+    errval_t err;
+    assert(count > 0 && count <= SDHC_MAX_BLOCKS);
 
-    struct cmd read_block = {
-        .cmdidx = MMC_CMD_READ_SINGLE_BLOCK,
+    struct cmd cmd = {
         .cmdarg = index,
         .resp_type = MMC_RSP_R1,
-        .dma_base = dest
-
+        .dma_base = base,
+        .blkcnt = count
     };
-    err = sdhc_send_cmd(sd, &read_block);
+    if(count == 1) {
+        cmd.cmdidx = write ? MMC_CMD_WRITE_SINGLE_BLOCK : MMC_CMD_READ_SINGLE_BLOCK;
+    } else {
+        cmd.cmdidx = write ? MMC_CMD_WRITE_MULTIPLE_BLOCK : MMC_CMD_READ_MULTIPLE_BLOCK;
+        adma_setup(sd, base, count);
+    }
+
+    err = sdhc_send_cmd(sd, &cmd);
     if(err_is_fail(err)){
-        DEBUG_ERR(err, "read_block");
+        DEBUG_ERR(err, write ? "write_blocks" : "read_blocks");
         return err;
     }
 
     return SYS_ERR_OK;
 }
 
+errval_t sdhc_read_block(struct sdhc_s* sd, int index, lpaddr_t dest)
+{
+    return transfer_blocks(sd, index, 1, dest, false);
+}
+
 errval_t sdhc_write_block(struct sdhc_s* sd, int index, lpaddr_t source){
+    return transfer_blocks(sd, index, 1, source, true);
+}
+
+errval_t sdhc_read_blocks(struct sdhc_s* sd, int index, size_t count, lpaddr_t dest)
+{
+    return transfer_blocks(sd, index, count, dest, false);
+}
+
+errval_t sdhc_write_blocks(struct sdhc_s* sd, int index, size_t count, lpaddr_t source)
+{
+    return transfer_blocks(sd, index, count, source, true);
+}
+
+// Allocate the ADMA2 descriptor table, the controller reads it like the data
+static errval_t adma_init(struct sdhc_s *sd) {
     errval_t err;
 
-    struct cmd set_blocklen = {
-        .cmdidx = MMC_CMD_SET_BLOCKLEN,
-        .cmdarg = SDHC_BLOCK_SIZE,
-        .resp_type = MMC_RSP_R1
-    };
-    err = sdhc_send_cmd(sd, &set_blocklen);
-    if(err_is_fail(err)){
-        DEBUG_ERR(err, "set_blocklen");
-        return err;
-    }
+    err = frame_alloc(&sd->adma_frame, SDHC_ADMA_TABLE_SIZE, NULL);
+    if(err_is_fail(err))
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
 
-    struct cmd write_block = {
-        .cmdidx = MMC_CMD_WRITE_SINGLE_BLOCK,
-        .cmdarg = index,
-        .resp_type = MMC_RSP_R1,
-        .dma_base = source 
+    struct frame_identity f_id;
+    err = cap_identify_mappable(sd->adma_frame, &f_id);
+    if(err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_CAP_IDENTIFY);
+        goto FAILURE_IDENTIFY;
+    }
+    assert((f_id.base >> 32) == 0);
+    sd->adma_table_p = f_id.base;
 
-    };
-    err = sdhc_send_cmd(sd, &write_block);
-    if(err_is_fail(err)){
-        DEBUG_ERR(err, "read_block");
-        return err;
+    err = paging_map_frame_attr(get_current_paging_state(), (void **)&sd->adma_table,
+                                SDHC_ADMA_TABLE_SIZE, sd->adma_frame,
+                                VREGION_FLAGS_READ_WRITE_NOCACHE);
+    if(err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_PAGING_MAP);
+        goto FAILURE_MAP;
     }
 
     return SYS_ERR_OK;
+
+FAILURE_MAP:
+FAILURE_IDENTIFY:
+    cap_destroy(sd->adma_frame);
+    sd->adma_frame = NULL_CAP;
+    return err;
 }
 
 static errval_t card_init(struct sdhc_s * sd){
@@ -609,6 +796,12 @@ errval_t sdhc_init(struct sdhc_s** sd_ret, void *base)
        return err;
     }
 
+    err = adma_init(sd);
+    if (err_is_fail(err)) {
+       DEBUG_ERR(err, "failed to allocate ADMA descriptors");
+       return err;
+    }
+
     return SYS_ERR_OK;
 }
 
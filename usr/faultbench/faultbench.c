@@ -0,0 +1,158 @@
+/**
+ * \file
+ * \brief Page-fault storm over several threads, after memtest
+ *
+ * Every thread writes a pattern to each page of lazily mapped memory and then checks it,
+ * like the threads of memtest do. The memory is laid out in two ways:
+ *
+ *   private  every thread touches a region of its own
+ *   shared   the threads touch interleaved pages of a single region
+ *
+ * Either runs with every fault populating a single page ("page"), which makes every
+ * page a fault, and with the default fault-around window ("around"). Every result is
+ * printed as one line:
+ *
+ *   faultbench,<layout>,<window>,<threads>,<pages>,<ns total>,<ns/page>
+ *
+ * Run "faultbench <layout>" to measure a single layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/paging.h>
+#include <aos/systime.h>
+
+#define PAGES_PER_THREAD 1024
+#define MAX_THREADS 4
+
+struct bench_thread {
+    uint8_t *base;   ///< First page of the thread
+    size_t stride;   ///< Bytes between pages of the thread
+    size_t pages;
+    uint32_t data;
+};
+
+static int fault_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    int errors = 0;
+
+    for (size_t i = 0; i < t->pages; i++) {
+        *(volatile uint32_t *)(t->base + i * t->stride) = t->data + i;
+    }
+    for (size_t i = 0; i < t->pages; i++) {
+        if (*(volatile uint32_t *)(t->base + i * t->stride) != t->data + i) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static errval_t run(bool shared, size_t thread_count, uint64_t *ns, int *errors)
+{
+    errval_t err = SYS_ERR_OK;
+    struct paging_state *st = get_current_paging_state();
+    struct bench_thread args[MAX_THREADS];
+    void *regions[MAX_THREADS] = { NULL };
+    size_t region_count = shared ? 1 : thread_count;
+    size_t region_size = (shared ? thread_count : 1) * PAGES_PER_THREAD * BASE_PAGE_SIZE;
+
+    for (size_t i = 0; i < region_count; i++) {
+        err = paging_alloc(st, &regions[i], region_size, BASE_PAGE_SIZE);
+        if (err_is_fail(err)) {
+            goto UNMAP;
+        }
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        if (shared) {
+            args[i].base = (uint8_t *)regions[0] + i * BASE_PAGE_SIZE;
+            args[i].stride = thread_count * BASE_PAGE_SIZE;
+        } else {
+            args[i].base = regions[i];
+            args[i].stride = BASE_PAGE_SIZE;
+        }
+        args[i].pages = PAGES_PER_THREAD;
+        args[i].data = 0xdeafbeef + i;
+    }
+
+    struct thread *threads[MAX_THREADS];
+    *errors = 0;
+    systime_t start = systime_now();
+    for (size_t i = 0; i < thread_count; i++) {
+        threads[i] = thread_create(fault_thread, &args[i]);
+        if (threads[i] == NULL) {
+            err = LIB_ERR_THREAD_CREATE;
+            thread_count = i;
+            break;
+        }
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        int thread_errors = 0;
+        errval_t join_err = thread_join(threads[i], &thread_errors);
+        if (err_is_fail(join_err)) {
+            err = join_err;
+        }
+        *errors += thread_errors;
+    }
+    *ns = systime_to_ns(systime_now() - start);
+
+UNMAP:
+    for (size_t i = 0; i < region_count; i++) {
+        if (regions[i] != NULL) {
+            errval_t unmap_err = paging_unmap(st, regions[i]);
+            if (err_is_fail(unmap_err)) {
+                DEBUG_ERR(unmap_err, "faultbench: paging_unmap failed");
+            }
+        }
+    }
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = (argc >= 2) ? argv[1] : NULL;
+    static const char *layouts[] = { "private", "shared" };
+    static const char *windows[] = { "page", "around" };
+    struct paging_state *st = get_current_paging_state();
+
+    printf("faultbench,layout,window,threads,pages,total_ns,ns_per_page\n");
+    for (size_t l = 0; l < ARRAY_LENGTH(layouts); l++) {
+        if (only != NULL && strcmp(only, layouts[l]) != 0) {
+            continue;
+        }
+        for (size_t w = 0; w < ARRAY_LENGTH(windows); w++) {
+            if (w == 0) {
+                paging_set_fault_around(st, 1, 1);
+            } else {
+                paging_set_fault_around(st, PAGING_FAULT_AROUND_MIN_PAGES,
+                                        PAGING_FAULT_AROUND_MAX_PAGES);
+            }
+
+            for (size_t t = 1; t <= MAX_THREADS; t *= 2) {
+                uint64_t ns = 0;
+                int errors = 0;
+                errval_t err = run(l == 1, t, &ns, &errors);
+                if (err_is_fail(err)) {
+                    printf("faultbench: %s/%s with %lu threads failed: %s\n", layouts[l],
+                           windows[w], t, err_getstring(err));
+                    return EXIT_FAILURE;
+                }
+                if (errors != 0) {
+                    printf("faultbench: %s/%s with %lu threads found %d memory corruption "
+                           "errors\n", layouts[l], windows[w], t, errors);
+                    return EXIT_FAILURE;
+                }
+                size_t pages = t * PAGES_PER_THREAD;
+                printf("faultbench,%s,%s,%lu,%lu,%lu,%lu\n", layouts[l], windows[w], t,
+                       pages, ns, ns / pages);
+            }
+        }
+    }
+
+    paging_set_fault_around(st, PAGING_FAULT_AROUND_MIN_PAGES,
+                            PAGING_FAULT_AROUND_MAX_PAGES);
+    return EXIT_SUCCESS;
+}
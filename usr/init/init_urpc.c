@@ -8,6 +8,24 @@
 struct aos_chan *urpc_listen_from[MAX_COREID];
 struct aos_rpc *urpc[MAX_COREID];
 
+/**
+ * Attach the bulk regions of the index-th channel in the URPC frame. The server of the
+ * channel writes into the first one.
+ */
+static void attach_bulk(struct aos_chan *chan, uint8_t *urpc_buffer, int index,
+                        enum UMP_CHAN_ROLE role)
+{
+    uint8_t *bulk = urpc_buffer + UMP_CHAN_SHARED_FRAME_SIZE * 2
+                    + index * INIT_URPC_BULK_REGION_SIZE * 2;
+    uint8_t *server_tx = bulk;
+    uint8_t *client_tx = bulk + INIT_URPC_BULK_REGION_SIZE;
+    if (role == UMP_CHAN_SERVER) {
+        ump_chan_attach_bulk(&chan->uc, server_tx, client_tx, INIT_URPC_BULK_REGION_SIZE);
+    } else {
+        ump_chan_attach_bulk(&chan->uc, client_tx, server_tx, INIT_URPC_BULK_REGION_SIZE);
+    }
+}
+
 errval_t setup_urpc(coreid_t core, struct capref urpc_frame, bool listener_first)
 {
     assert(urpc[core] == NULL);
@@ -35,6 +53,9 @@ errval_t setup_urpc(coreid_t core, struct capref urpc_frame, bool listener_first
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_UMP_CHAN_INIT);
     }
+    attach_bulk(urpc_listen_from[core], urpc_buffer, listener_first ? 0 : 1, UMP_CHAN_SERVER);
+    // Every process on the core depends on init, never trade its latency for CPU time
+    ump_chan_set_wait_policy(&urpc_listen_from[core]->uc, RING_WAIT_POLICY_POLL);
 
     // Init UPRC calling point
     urpc[core] = malloc(sizeof(**urpc));
@@ -48,6 +69,8 @@ errval_t setup_urpc(coreid_t core, struct capref urpc_frame, bool listener_first
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_UMP_CHAN_INIT);
     }
+    attach_bulk(&urpc[core]->chan, urpc_buffer, listener_first ? 1 : 0, UMP_CHAN_CLIENT);
+    ump_chan_set_wait_policy(&urpc[core]->chan.uc, RING_WAIT_POLICY_POLL);
 
     return SYS_ERR_OK;
 }
@@ -73,9 +96,6 @@ errval_t urpc_call_to_core(coreid_t core, rpc_identifier_t identifier, void *in_
 
     errval_t err;
 
-    uint8_t *recv_payload = NULL;
-    size_t recv_size = 0;
-
     if (!thread_mutex_trylock(&chan->mutex)) {
         return MON_ERR_RETRY;
     }
@@ -100,42 +120,10 @@ errval_t urpc_call_to_core(coreid_t core, rpc_identifier_t identifier, void *in_
             THREAD_MUTEX_BREAK;
         }
 
-        // Receive acknowledgement and/or return message
-        err = ump_chan_recv(uc, (void **)&recv_payload, &recv_size);
-        if (err_is_fail(err)) {
-            err = err_push(err, LIB_ERR_UMP_CHAN_RECV);
-            DEBUG_ERR(err, "rpc_ump_call: failed to recv\n");
-            THREAD_MUTEX_BREAK;
-        }
-
-        assert(recv_payload != NULL);
-        assert(recv_size >= sizeof(rpc_identifier_t));
+        // Receive acknowledgement and/or return message, err may be carried by the reply
+        err = aos_chan_ump_try_recv_reply(chan, out_payload, out_size);
     }
     while(0); thread_mutex_unlock(&chan->mutex);
 
-    // Handle error happened in the critical section
-    if (err_is_fail(err)) {
-        goto RET;
-    }
-
-    assert(recv_payload != NULL);
-    if (CAST_DEREF(rpc_identifier_t, recv_payload, 0) == RPC_ACK) {
-        if (out_payload != NULL) {
-            // XXX: it is annoying to malloc a new buf and make the copy just to remove
-            //      the identifier. Consider moving it into ring buffer.
-            MALLOC_OUT_MSG_WITH_SIZE(ret_buf, uint8_t,
-                                     recv_size - sizeof(rpc_identifier_t));
-            memcpy(ret_buf, recv_payload + sizeof(rpc_identifier_t), *out_size);
-        }
-        err = SYS_ERR_OK;
-        goto RET;
-    } else {
-        assert(recv_size == sizeof(rpc_identifier_t) + sizeof(errval_t));
-        err = *((errval_t *)(recv_payload + sizeof(rpc_identifier_t)));
-        goto RET;
-    }
-
-RET:
-    free(recv_payload);
     return err;
 }
\ No newline at end of file
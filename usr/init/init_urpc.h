@@ -7,7 +7,12 @@
 
 #include <aos/aos_rpc.h>
 
-#define INIT_BIDIRECTIONAL_URPC_FRAME_SIZE (UMP_CHAN_SHARED_FRAME_SIZE * 2)
+/// Each direction of each URPC channel has a bulk region for large payloads (file data)
+#define INIT_URPC_BULK_REGION_SIZE (256 * 1024)
+
+/// Two UMP channels, followed by their bulk regions
+#define INIT_BIDIRECTIONAL_URPC_FRAME_SIZE                                               \
+    (UMP_CHAN_SHARED_FRAME_SIZE * 2 + INIT_URPC_BULK_REGION_SIZE * 4)
 extern struct aos_chan *urpc_listen_from[MAX_COREID];  // the current init should listen on them
 extern struct aos_rpc *urpc[MAX_COREID];               // the current init make calls on them
 
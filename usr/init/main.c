@@ -31,11 +31,14 @@
 #include <ringbuffer/ringbuffer.h>
 #include <drivers/sdhc.h>
 #include <fs/fat32.h>
+#include <fs/blockdev.h>
+#include <spawn/multiboot.h>
 
 #include <maps/imx8x_map.h>
 #include <maps/qemu_map.h>
 
 #include "mem_alloc.h"
+#include "ram_cache.h"
 #include <barrelfish_kpi/platform.h>
 #include <spawn/spawn.h>
 #include "init_urpc.h"
@@ -51,6 +54,9 @@
             }\
 })
 
+/// FAT32 image used as disk where there is no SD card
+#define RAMDISK_MODULE "/armv8/fat32.img"
+
 struct bootinfo *bi;
 
 coreid_t my_core_id;
@@ -294,14 +300,14 @@ static errval_t start_nameserver(void)
 }
 
 // initialize sd card: map sd devframe capability, and initialize the driver
-static errval_t init_sd(void) {
+static errval_t init_sd(struct blockdev **retdev) {
     errval_t err;
 
     struct capability sdhc_c;
     err = cap_direct_identify(dev_cap_sdhc2, &sdhc_c);
-    assert(sdhc_c.type == ObjType_DevFrame);
     if(err_is_fail(err))
         return err;
+    assert(sdhc_c.type == ObjType_DevFrame);
 
     //map capability to sd card
     void *sdhc_base;
@@ -314,31 +320,41 @@ static errval_t init_sd(void) {
     if(err_is_fail(err))
         return err;
 
+    return blockdev_sdhc_create(sd, retdev);
+}
+
+// initialize a RAM disk on the disk image loaded as module, if there is one
+static errval_t init_ramdisk(struct blockdev **retdev) {
+    struct mem_region *module = multiboot_find_module(bi, RAMDISK_MODULE);
+    if(module == NULL)
+        return SPAWN_ERR_FIND_MODULE;
+
+    struct capref frame = {
+        .cnode = cnode_module,
+        .slot = module->mrmod_slot,
+    };
+    return blockdev_ramdisk_create(frame, module->mrmod_size, retdev);
+}
+
+// initialize the disk of the platform and mount the FAT32 filesystem on it
+static errval_t init_disk(void) {
+    errval_t err;
+
+    struct blockdev *dev;
+    if(platform_info.platform == PI_PLATFORM_IMX8X)
+        err = init_sd(&dev);
+    else
+        err = init_ramdisk(&dev);
+    if(err_is_fail(err))
+        return err;
+
     fat32_preinit();
-    set_sd(sd);
+    set_blockdev(dev);
     err = filesystem_init();
 
     if(err_is_fail(err))
         DEBUG_ERR(err, "FAT INIT FAILED");
 
-    //I DO NOT KNOW WHY, BUT WITHOUT THESE LINES THE CODE BREAKS!!!!!
-    // fat32_handle_t handle;
-    // err = fat32_opendir("/sdcard/DIR1", &handle);
-    // if(err_is_fail(err))
-    //     DEBUG_ERR(err, "DIR1 open fail");
-    // err = fat32_closedir(handle);
-    // if(err_is_fail(err))
-    //     DEBUG_ERR(err, "DIR1 close fail");
-    // char *name;
-    // err = fat32_dir_read_next(handle, &name, NULL);
-    // if(err_is_fail(err))
-    //     DEBUG_ERR(err, "DIR1 read_next fail");
-    // fat32_handle_t handle;
-    // err = fat32_create("/sdcard/myfile2.txt", &handle);
-    // char *msg = "hellow orld!";
-    // err = fat32_write(handle, msg, 11, NULL);
-
-
     return SYS_ERR_OK;
 }
 
@@ -401,13 +417,13 @@ static int bsp_main(int argc, char *argv[])
         break;
     }
 
-    //Initialize sd card
-    err = init_sd();
+    //Initialize sd card, or the RAM disk on QEMU
+    err = init_disk();
     if(err_is_fail(err)) {
-        DEBUG_ERR(err, "failed to initialize SD card\n");
+        DEBUG_ERR(err, "failed to initialize disk\n");
+    } else {
+        debug_printf("Initialized disk\n");
     }
-
-    debug_printf("Initialized SD card\n");
     
     // Booting other cores
     for (int i = 1; i < 4; i++) {
@@ -612,6 +628,13 @@ static int app_main(int argc, char *argv[])
         abort();
     }
 
+    // Keep the local RAM allocator filled from core 0
+    err = ram_cache_init();
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "ram_cache_init failed");
+        abort();
+    }
+
     struct waitset *default_ws = get_default_waitset();
     while (true) {
         err = event_dispatch(default_ws);
@@ -4,6 +4,7 @@
  */
 
 #include "mem_alloc.h"
+#include "ram_cache.h"
 #include <mm/mm.h>
 #include <aos/paging.h>
 #include <grading.h>
@@ -14,7 +15,7 @@ char buf[64000];
 
 errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment)
 {
-    return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    return ram_cache_alloc(ret, size, alignment);
 }
 
 errval_t aos_ram_free(struct capref cap)
@@ -22,6 +23,145 @@ errval_t aos_ram_free(struct capref cap)
     return mm_free(&aos_mm, cap);
 }
 
+/// RAM handed out to a domain, hashed by base address to find it again
+struct ram_handout {
+    struct capref cap;  ///< Pending cap in aos_mm
+    genpaddr_t base;
+    gensize_t bytes;
+    domainid_t pid;
+    struct ram_handout *next;
+};
+
+#define RAM_HANDOUT_BUCKETS 256
+
+static struct ram_handout *handouts[RAM_HANDOUT_BUCKETS];
+
+static inline struct ram_handout **handout_bucket(genpaddr_t base)
+{
+    return &handouts[(base >> BASE_PAGE_BITS) % RAM_HANDOUT_BUCKETS];
+}
+
+errval_t aos_ram_hand_out(struct capref *ret, size_t size, size_t alignment,
+                          domainid_t pid, gensize_t *ret_bytes)
+{
+    errval_t err;
+
+    struct ram_handout *h = malloc(sizeof(*h));
+    if (h == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    err = aos_ram_alloc_aligned(&h->cap, size, alignment);
+    if (err_is_fail(err)) {
+        free(h);
+        return err;
+    }
+
+    struct capability c;
+    err = cap_direct_identify(h->cap, &c);
+    if (err_is_fail(err)) {
+        aos_ram_free(h->cap);
+        free(h);
+        return err_push(err, LIB_ERR_CAP_IDENTIFY);
+    }
+    assert(c.type == ObjType_RAM);
+
+    h->base = c.u.ram.base;
+    h->bytes = c.u.ram.bytes;
+    h->pid = pid;
+    struct ram_handout **bucket = handout_bucket(h->base);
+    h->next = *bucket;
+    *bucket = h;
+
+    *ret = h->cap;
+    if (ret_bytes != NULL) {
+        *ret_bytes = h->bytes;
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t aos_ram_take_back(struct capref cap, domainid_t pid, size_t *charged)
+{
+    errval_t err;
+
+    struct capability c;
+    err = cap_direct_identify(cap, &c);
+    if (err_is_fail(err)) {
+        cap_destroy(cap);
+        return err_push(err, LIB_ERR_CAP_IDENTIFY);
+    }
+
+    genpaddr_t base;
+    gensize_t bytes;
+    if (c.type == ObjType_RAM) {
+        base = c.u.ram.base;
+        bytes = c.u.ram.bytes;
+    } else if (c.type == ObjType_Frame) {
+        base = c.u.frame.base;
+        bytes = c.u.frame.bytes;
+    } else {
+        cap_destroy(cap);
+        return MM_ERR_NO_PENDING_CAP;
+    }
+
+    struct ram_handout **h = handout_bucket(base);
+    while (*h != NULL && ((*h)->base != base || (*h)->bytes != bytes)) {
+        h = &(*h)->next;
+    }
+    // Only the domain the RAM was handed out to can give it back
+    if (*h == NULL || (*h)->pid != pid
+        || (charged != NULL && *charged < (*h)->bytes)) {
+        cap_destroy(cap);
+        return MM_ERR_NO_PENDING_CAP;
+    }
+    struct ram_handout *handout = *h;
+
+    // Also deletes cap and the copies the domain still has
+    err = cap_revoke(handout->cap);
+    if (err_is_fail(err)) {
+        cap_destroy(cap);
+        return err;
+    }
+    slot_free(cap);
+
+    err = aos_ram_free(handout->cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *h = handout->next;
+    if (charged != NULL) {
+        *charged -= handout->bytes;
+    }
+    free(handout);
+    return SYS_ERR_OK;
+}
+
+void aos_ram_take_back_all(domainid_t pid)
+{
+    for (size_t i = 0; i < RAM_HANDOUT_BUCKETS; i++) {
+        struct ram_handout **h = &handouts[i];
+        while (*h != NULL) {
+            struct ram_handout *handout = *h;
+            if (handout->pid != pid) {
+                h = &handout->next;
+                continue;
+            }
+
+            // Dropped even if freeing fails, a later domain with this pid must not see it
+            *h = handout->next;
+            errval_t err = cap_revoke(handout->cap);
+            if (err_is_ok(err)) {
+                err = aos_ram_free(handout->cap);
+            }
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "failed to take back RAM of domain %u\n", pid);
+            }
+            free(handout);
+        }
+    }
+}
+
 static inline errval_t initialize_ram_allocator(void)
 {
     errval_t err;
@@ -25,4 +25,29 @@ errval_t initialize_ram_alloc(void);
 errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment);
 errval_t aos_ram_free(struct capref cap);
 
+/**
+ * \brief Allocate RAM for a domain, remembering it so that the domain can give it back.
+ */
+errval_t aos_ram_hand_out(struct capref *ret, size_t size, size_t alignment,
+                          domainid_t pid, gensize_t *ret_bytes);
+
+/**
+ * \brief Take back RAM handed out by aos_ram_hand_out() and free it.
+ *
+ * The RAM is revoked first, so that no copy of it or mapping of a frame retyped from it
+ * is left anywhere. Consumes cap, the copy of the RAM or Frame cap the domain sent.
+ *
+ * \param pid      Domain giving the RAM back, the one it was handed out to
+ * \param charged  RAM charged to the domain, reduced by the RAM taken back, or NULL
+ *
+ * \return MM_ERR_NO_PENDING_CAP if cap does not cover exactly a RAM cap handed out to
+ *         pid, or more RAM than charged.
+ */
+errval_t aos_ram_take_back(struct capref cap, domainid_t pid, size_t *charged);
+
+/**
+ * \brief Take back and free all RAM handed out to a domain that is gone.
+ */
+void aos_ram_take_back_all(domainid_t pid);
+
 #endif /* _INIT_MEM_ALLOC_H_ */
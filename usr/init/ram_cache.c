@@ -0,0 +1,313 @@
+/**
+ * \file
+ * \brief Per-core cache of RAM in front of the local allocator of init
+ */
+
+#include "ram_cache.h"
+#include "mem_alloc.h"
+#include "init_urpc.h"
+#include "rpc_handlers.h"
+#include <mm/mm.h>
+#include <aos/deferred.h>
+#include <aos/kernel_cap_invocations.h>
+#include <aos/systime.h>
+
+#define DEBUG_RAM_CACHE 0
+
+/// Cache state of a core other than 0
+static struct {
+    bool enabled;
+    bool busy;                        ///< Talking to core 0, nested calls must not
+    bool fetch_scheduled;
+    systime_t last_alloc;             ///< Time of the last allocation, to detect idleness
+    struct deferred_event fetch_event;
+    struct periodic_event idle_event;
+} cache;
+
+/// RAM granted by core 0, so that it can be freed as a whole once returned
+struct ram_grant {
+    struct capref cap;
+    genpaddr_t base;
+    gensize_t bytes;
+    struct ram_grant *next;
+};
+
+static struct ram_grant *grants;  ///< Only on core 0
+
+static gensize_t free_bytes(void)
+{
+    struct mm_stats stats;
+    mm_get_stats(&aos_mm, &stats);
+    return stats.free_bytes;
+}
+
+/**
+ * Fetch a chunk of RAM from core 0 and add it to the local allocator.
+ * \return MON_ERR_RETRY if the channel to core 0 is in use further up the stack.
+ */
+static errval_t fetch(size_t size)
+{
+    errval_t err;
+
+    if (cache.busy) {
+        return MON_ERR_RETRY;
+    }
+    cache.busy = true;
+
+    struct aos_rpc_msg_ram msg = { .size = size, .alignment = BASE_PAGE_SIZE };
+    struct RAM *ram = NULL;
+    size_t ram_size = 0;
+    err = urpc_call_to_core(0, INTERNAL_RPC_REMOTE_RAM_REQUEST, &msg, sizeof(msg),
+                            (void **)&ram, &ram_size);
+    cache.busy = false;
+    if (err_is_fail(err)) {
+        goto RET;
+    }
+    if (ram_size < sizeof(struct RAM)) {
+        err = LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+        goto RET;
+    }
+
+    struct capref ram_cap;
+    err = slot_alloc(&ram_cap);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_SLOT_ALLOC);
+        goto RET;
+    }
+    err = ram_forge(ram_cap, ram->base, ram->bytes, disp_get_current_core_id());
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "ram_cache: failed to forge RAM");
+        goto RET;
+    }
+
+    err = mm_add(&aos_mm, ram_cap);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "ram_cache: mm_add failed");
+        goto RET;
+    }
+
+#if DEBUG_RAM_CACHE
+    DEBUG_PRINTF("ram_cache: add RAM 0x%lx/0x%lx from core 0\n", ram->base, ram->bytes);
+#endif
+
+RET:
+    free(ram);
+    return err;
+}
+
+static void fetch_handler(void *arg)
+{
+    cache.fetch_scheduled = false;
+    if (free_bytes() >= RAM_CACHE_LOW_WATERMARK) {
+        return;
+    }
+
+    errval_t err = fetch(RAM_CACHE_CHUNK_SIZE);
+    if (err == MON_ERR_RETRY) {
+        cache.fetch_scheduled = true;
+        err = deferred_event_register(&cache.fetch_event, get_default_waitset(),
+                                      RAM_CACHE_RETRY_US, MKCLOSURE(fetch_handler, NULL));
+        if (err_is_fail(err)) {
+            cache.fetch_scheduled = false;
+            DEBUG_ERR(err, "ram_cache: failed to reschedule fetch");
+        }
+    } else if (err_is_fail(err)) {
+        DEBUG_ERR(err, "ram_cache: background fetch failed");
+    }
+}
+
+/// Schedule a background fetch if the free memory fell below the low watermark
+static void check_low_watermark(void)
+{
+    if (cache.fetch_scheduled || free_bytes() >= RAM_CACHE_LOW_WATERMARK) {
+        return;
+    }
+
+    cache.fetch_scheduled = true;
+    errval_t err = deferred_event_register(&cache.fetch_event, get_default_waitset(), 0,
+                                           MKCLOSURE(fetch_handler, NULL));
+    if (err_is_fail(err)) {
+        cache.fetch_scheduled = false;
+        DEBUG_ERR(err, "ram_cache: failed to schedule fetch");
+    }
+}
+
+/// Return one chunk to core 0
+static errval_t trim(void)
+{
+    errval_t err;
+
+    struct capref cap;
+    err = mm_alloc(&aos_mm, RAM_CACHE_CHUNK_SIZE, &cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct capability c;
+    err = cap_direct_identify(cap, &c);
+    if (err_is_fail(err)) {
+        mm_free(&aos_mm, cap);
+        return err_push(err, LIB_ERR_CAP_IDENTIFY);
+    }
+    assert(c.type == ObjType_RAM);
+
+    struct RAM ram = { .base = c.u.ram.base, .bytes = c.u.ram.bytes, .pasid = c.u.ram.pasid };
+    cache.busy = true;
+    err = urpc_call_to_core(0, INTERNAL_RPC_REMOTE_RAM_RETURN, &ram, sizeof(ram), NULL,
+                            NULL);
+    cache.busy = false;
+    if (err_is_fail(err)) {
+        mm_free(&aos_mm, cap);
+        return err;
+    }
+
+    // Core 0 owns the chunk again, it must never be handed out here
+    err = mm_retire(&aos_mm, cap);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "ram_cache: failed to retire returned RAM");
+    }
+
+#if DEBUG_RAM_CACHE
+    DEBUG_PRINTF("ram_cache: return RAM 0x%lx/0x%lx to core 0\n", ram.base, ram.bytes);
+#endif
+    return SYS_ERR_OK;
+}
+
+static void idle_handler(void *arg)
+{
+    if (cache.busy || systime_to_us(systime_now() - cache.last_alloc) < RAM_CACHE_IDLE_US) {
+        return;
+    }
+
+    // One chunk per check, the core may become busy again
+    if (free_bytes() > RAM_CACHE_HIGH_WATERMARK) {
+        errval_t err = trim();
+        if (err_is_fail(err) && err != MON_ERR_RETRY) {
+            DEBUG_ERR(err, "ram_cache: failed to return RAM to core 0");
+        }
+    }
+}
+
+errval_t ram_cache_init(void)
+{
+    assert(disp_get_current_core_id() != 0);
+
+    cache.last_alloc = systime_now();
+    deferred_event_init(&cache.fetch_event);
+    errval_t err = periodic_event_create(&cache.idle_event, get_default_waitset(),
+                                         RAM_CACHE_IDLE_CHECK_US,
+                                         MKCLOSURE(idle_handler, NULL));
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    cache.enabled = true;
+    check_low_watermark();
+    return SYS_ERR_OK;
+}
+
+errval_t ram_cache_alloc(struct capref *ret, size_t size, size_t alignment)
+{
+    errval_t err = mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    if (!cache.enabled) {
+        return err;
+    }
+
+    if (err == MM_ERR_NO_MEMORY) {
+        // The background fetch did not keep up, wait for core 0
+#if DEBUG_RAM_CACHE
+        DEBUG_PRINTF("ram_cache: out of memory, fetching from core 0...\n");
+#endif
+        err = fetch(MAX(ROUND_UP(size, BASE_PAGE_SIZE) + alignment, RAM_CACHE_CHUNK_SIZE));
+        if (err_is_fail(err)) {
+            return err;
+        }
+        err = mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    }
+
+    if (err_is_ok(err)) {
+        cache.last_alloc = systime_now();
+        check_low_watermark();
+    }
+    return err;
+}
+
+errval_t ram_cache_grant(size_t size, size_t alignment, struct RAM *ret)
+{
+    errval_t err;
+
+    struct ram_grant *grant = malloc(sizeof(*grant));
+    if (grant == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    err = aos_ram_alloc_aligned(&grant->cap, size, alignment);
+    if (err_is_fail(err)) {
+        free(grant);
+        return err;
+    }
+
+    // The cap cannot be sent over UMP, the other core forges its own
+    struct capability c;
+    err = cap_direct_identify(grant->cap, &c);
+    if (err_is_fail(err)) {
+        aos_ram_free(grant->cap);
+        free(grant);
+        return err_push(err, LIB_ERR_CAP_IDENTIFY);
+    }
+    assert(c.type == ObjType_RAM);
+
+    grant->base = c.u.ram.base;
+    grant->bytes = c.u.ram.bytes;
+    grant->next = grants;
+    grants = grant;
+
+    ret->base = c.u.ram.base;
+    ret->bytes = c.u.ram.bytes;
+    ret->pasid = c.u.ram.pasid;
+    return SYS_ERR_OK;
+}
+
+errval_t ram_cache_take_back(const struct RAM *ram)
+{
+    errval_t err;
+
+    for (struct ram_grant **g = &grants; *g != NULL; g = &(*g)->next) {
+        struct ram_grant *grant = *g;
+        if (ram->base < grant->base || ram->base + ram->bytes > grant->base + grant->bytes) {
+            continue;
+        }
+
+        bool whole = grant->base == ram->base && grant->bytes == ram->bytes;
+        if (whole) {
+            // A whole grant goes back to where it came from
+            err = aos_ram_free(grant->cap);
+        } else {
+            // The grant cannot be freed in parts. The core keeps the rest of it as its own,
+            // as if it had been booted with it, and the part is added below as new memory.
+            err = mm_retire(&aos_mm, grant->cap);
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+        *g = grant->next;
+        free(grant);
+        if (whole) {
+            return SYS_ERR_OK;
+        }
+        break;
+    }
+
+    // Part of a grant or of the RAM the core was booted with, add it as new memory
+    struct capref ram_cap;
+    err = slot_alloc(&ram_cap);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = ram_forge(ram_cap, ram->base, ram->bytes, disp_get_current_core_id());
+    if (err_is_fail(err)) {
+        slot_free(ram_cap);
+        return err;
+    }
+    return mm_add(&aos_mm, ram_cap);
+}
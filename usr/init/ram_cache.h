@@ -0,0 +1,59 @@
+/**
+ * \file
+ * \brief Per-core cache of RAM in front of the local allocator of init
+ *
+ * Init on core 0 owns all the RAM and grants chunks of it to the other cores. On the
+ * other cores, the local aos_mm acts as a cache of these chunks: it is refilled in the
+ * background once it falls below a low watermark, and surplus chunks are returned to
+ * core 0 once it stays above a high watermark while the core is idle. Only an allocation
+ * that outruns the background refill waits for core 0.
+ */
+
+#ifndef _INIT_RAM_CACHE_H_
+#define _INIT_RAM_CACHE_H_
+
+#include <aos/aos.h>
+
+/// Size of a chunk fetched from or returned to core 0
+#define RAM_CACHE_CHUNK_SIZE (64UL << 20)
+
+/// Fetch a chunk in the background once less than this is free locally
+#define RAM_CACHE_LOW_WATERMARK (32UL << 20)
+
+/// Return chunks to core 0 while more than this is free locally and the core is idle
+#define RAM_CACHE_HIGH_WATERMARK (RAM_PER_CORE + RAM_CACHE_CHUNK_SIZE)
+
+/// How often the cache checks whether the core is idle
+#define RAM_CACHE_IDLE_CHECK_US 500000
+
+/// A core is idle after this long without an allocation
+#define RAM_CACHE_IDLE_US 1000000
+
+/// Delay before a background fetch is retried, if the URPC channel was busy
+#define RAM_CACHE_RETRY_US 1000
+
+/**
+ * \brief Start refilling and trimming the local allocator. Only on cores other than 0,
+ * after initialize_ram_alloc() and the URPC channel to core 0 are set up.
+ */
+errval_t ram_cache_init(void);
+
+/**
+ * \brief Allocate RAM from the local allocator, fetching from core 0 if it runs dry.
+ */
+errval_t ram_cache_alloc(struct capref *ret, size_t size, size_t alignment);
+
+/**
+ * \brief Core 0: grant RAM to another core, to be returned by ram_cache_take_back().
+ */
+errval_t ram_cache_grant(size_t size, size_t alignment, struct RAM *ret);
+
+/**
+ * \brief Core 0: take back RAM returned by another core.
+ *
+ * A whole grant is freed. Part of a grant is added as new memory, and the grant stops
+ * counting as memory of core 0, the rest of it now belongs to the other core.
+ */
+errval_t ram_cache_take_back(const struct RAM *ram);
+
+#endif /* _INIT_RAM_CACHE_H_ */
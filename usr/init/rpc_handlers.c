@@ -5,6 +5,7 @@
 #include "init_urpc.h"
 #include "rpc_handlers.h"
 #include "mem_alloc.h"
+#include "ram_cache.h"
 #include "mm/mm.h"
 #include <aos/kernel_cap_invocations.h>
 #include <spawn/spawn.h>
@@ -68,6 +69,99 @@ RPC_HANDLER(stress_test_handler)
     }
 }
 
+RPC_HANDLER(bench_echo_handler)
+{
+    CAST_IN_MSG_AT_LEAST_SIZE(msg, struct rpc_bench_echo_msg);
+    if (msg->core == disp_get_current_core_id()) {
+        MALLOC_OUT_MSG_WITH_SIZE(reply, uint8_t, in_size);
+        memcpy(reply, in_payload, in_size);
+        return SYS_ERR_OK;
+    } else {
+        return forward_to_core(msg->core, in_payload, in_size, out_payload, out_size);
+    }
+}
+
+static void fill_chan_stats(struct rpc_chan_stats_entry *e, domainid_t pid,
+                            const char *name, struct aos_chan *chan)
+{
+    e->pid = pid;
+    e->core = disp_get_current_core_id();
+    strncpy(e->name, name, DISP_NAME_LEN - 1);
+    e->name[DISP_NAME_LEN - 1] = '\0';
+    aos_chan_get_stats(chan, &e->stats);
+}
+
+RPC_HANDLER(chan_stats_handler)
+{
+    CAST_IN_MSG_EXACT_SIZE(core, coreid_t);
+    if (*core != disp_get_current_core_id()) {
+        if (*core >= MAX_COREID || urpc[*core] == NULL) {
+            return ERR_INVALID_ARGS;
+        }
+        return forward_to_core(*core, in_payload, in_size, out_payload, out_size);
+    }
+
+    domainid_t *pids = NULL;
+    size_t pid_count = 0;
+    errval_t err = spawn_get_all_pids(&pids, &pid_count);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Processes, URPC channels in both directions and the nameserver
+    size_t max_count = pid_count + 2 * MAX_COREID + 1;
+    struct rpc_chan_stats_reply *reply = malloc(sizeof(*reply)
+                                                + max_count * sizeof(reply->entries[0]));
+    if (reply == NULL) {
+        free(pids);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < pid_count; i++) {
+        struct proc_node *node = spawn_get_proc_node(pids[i]);
+        if (node != NULL) {
+            fill_chan_stats(&reply->entries[n++], node->pid, node->name, &node->chan);
+        }
+    }
+    free(pids);
+
+    char name[DISP_NAME_LEN];
+    for (coreid_t i = 0; i < MAX_COREID; i++) {
+        if (urpc[i] != NULL) {
+            snprintf(name, sizeof(name), "urpc to core %u", i);
+            fill_chan_stats(&reply->entries[n++], 0, name, &urpc[i]->chan);
+        }
+        if (urpc_listen_from[i] != NULL) {
+            snprintf(name, sizeof(name), "urpc from core %u", i);
+            fill_chan_stats(&reply->entries[n++], 0, name, urpc_listen_from[i]);
+        }
+    }
+    if (aos_chan_is_connected(&nameserver_rpc.chan)) {
+        fill_chan_stats(&reply->entries[n++], 0, "nameserver", &nameserver_rpc.chan);
+    }
+
+    reply->count = n;
+    *out_payload = reply;  // will be freed outside
+    *out_size = sizeof(*reply) + n * sizeof(reply->entries[0]);
+    return SYS_ERR_OK;
+}
+
+RPC_HANDLER(mem_stats_handler)
+{
+    CAST_IN_MSG_EXACT_SIZE(core, coreid_t);
+    if (*core != disp_get_current_core_id()) {
+        if (*core >= MAX_COREID || urpc[*core] == NULL) {
+            return ERR_INVALID_ARGS;
+        }
+        return forward_to_core(*core, in_payload, in_size, out_payload, out_size);
+    }
+
+    MALLOC_OUT_MSG(reply, struct mm_stats);
+    mm_get_stats(&aos_mm, reply);
+    return SYS_ERR_OK;
+}
+
 RPC_HANDLER(num_msg_handler)
 {
     if (disp_get_current_core_id() == 0) {
@@ -119,72 +213,28 @@ RPC_HANDLER(ram_request_msg_handler)
     CAST_IN_MSG_EXACT_SIZE(ram_msg, struct aos_rpc_msg_ram);
     grading_rpc_handler_ram_cap(ram_msg->size, ram_msg->alignment);
 
-    // Try to get frame
-    errval_t err = aos_ram_alloc_aligned(out_cap, ram_msg->size, ram_msg->alignment);
-    if (err == MM_ERR_NO_MEMORY) {
-        // Request RAM from core 0
-        DEBUG_PRINTF("no enough memory locally, requesting core 0...\n");
-
-        // XXX: trick to rewrite identifier
-        *(((uint8_t *)in_payload) - 1) = INTERNAL_RPC_REMOTE_RAM_REQUEST;
-
-        // Request for max(twice size, RAM_PER_CORE)
-        size_t original_request_size = ram_msg->size;
-        ram_msg->size = MAX(ram_msg->size * 2, RAM_PER_CORE);
-
-        // Request RAM from core 0
-        void *reply_payload = NULL;
-        size_t reply_size = 0;
-        err = forward_to_core(0, in_payload, in_size, &reply_payload, &reply_size);
-        if (err_is_fail(err)) {
-            goto RET;
-        }
-
-        // Decode reply
-        if (reply_size < sizeof(struct RAM)) {
-            DEBUG_PRINTF("%s: invalid payload size %lu < sizeof(%s) = %lu\n", __func__,
-                         reply_size, "struct RAM", sizeof(struct RAM));
-            err = LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
-            goto RET;
-        }
-        struct RAM *ram = reply_payload;
-
-        // Forge ram
-        struct capref ram_cap;
-        err = slot_alloc(&ram_cap);
-        if (err_is_fail(err)) {
-            err = err_push(err, LIB_ERR_SLOT_ALLOC);
-            goto RET;
-        }
-        err = ram_forge(ram_cap, ram->base, ram->bytes,
-                        disp_get_current_core_id());  // XXX: owner?
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "ram_request_msg_handler: failed to forge RAM");
-            goto RET;
-        }
-
-        err = mm_add(&aos_mm, ram_cap);
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "ram_request_msg_handler: mm_add failed");
-            goto RET;
-        }
-
-        DEBUG_PRINTF("add RAM of size 0x%lx/0x%lx from core 0\n", ram->base, ram->bytes);
-
-        err = aos_ram_alloc_aligned(out_cap, original_request_size, ram_msg->alignment);
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "ram_request_msg_handler: aos_ram_alloc_aligned still failed");
-            goto RET;
-        }
+    struct proc_node *proc = arg;
+    gensize_t bytes = 0;
 
-        err = SYS_ERR_OK;
-    RET:
-        free(reply_payload);
-        return err;
+    // Served from the local cache, which is refilled from core 0 in the background
+    errval_t err = aos_ram_hand_out(out_cap, ram_msg->size, ram_msg->alignment,
+                                    proc ? proc->pid : 0, &bytes);
+    if (err_is_ok(err) && proc != NULL) {
+        proc->ram_bytes += bytes;
+    }
+    return err;
+}
 
-    } else {
-        return err;
+RPC_HANDLER(ram_free_handler)
+{
+    ASSERT_ZERO_IN_SIZE;
+    if (capref_is_null(in_cap)) {
+        return ERR_INVALID_ARGS;
     }
+
+    // Handed out with pid 0 if the caller is not a domain we spawned, see ram_request_msg_handler
+    struct proc_node *proc = arg;
+    return aos_ram_take_back(in_cap, proc ? proc->pid : 0, proc ? &proc->ram_bytes : NULL);
 }
 
 RPC_HANDLER(remote_ram_request_handler)
@@ -197,32 +247,28 @@ RPC_HANDLER(remote_ram_request_handler)
                  ram_msg->size, ram_msg->alignment);
 #endif
 
-    // Allocate RAM locally
-    struct capref cap;
-    err = aos_ram_alloc_aligned(&cap, ram_msg->size, ram_msg->alignment);
+    // out_cap will be discarded by UMP, must serialize
+    MALLOC_OUT_MSG(reply, struct RAM);
+    err = ram_cache_grant(ram_msg->size, ram_msg->alignment, reply);
     if (err_is_fail(err)) {
         return err;
     }
 
-    // out_cap will be discarded by UMP, must serialize
-    struct capability c;
-    err = cap_direct_identify(cap, &c);
-    if (err_is_fail(err)) {
-        return err_push(err, LIB_ERR_CAP_IDENTIFY);
-    }
-    assert(c.type == ObjType_RAM);
+#if DEBUG_RPC_HANDLERS
+    DEBUG_PRINTF("< giving out RAM 0x%lx/0x%lx\n", reply->base, reply->bytes);
+#endif
+    return SYS_ERR_OK;
+}
 
+RPC_HANDLER(remote_ram_return_handler)
+{
+    CAST_IN_MSG_EXACT_SIZE(ram, struct RAM);
 
 #if DEBUG_RPC_HANDLERS
-    DEBUG_PRINTF("< giving out RAM 0x%lx/0x%lx\n", c.u.ram.base, c.u.ram.bytes);
+    DEBUG_PRINTF("> received RAM 0x%lx/0x%lx back\n", ram->base, ram->bytes);
 #endif
 
-    MALLOC_OUT_MSG(reply, struct RAM);
-    reply->base = c.u.ram.base;
-    reply->bytes = c.u.ram.bytes;
-    reply->pasid = c.u.ram.pasid;
-
-    return SYS_ERR_OK;
+    return ram_cache_take_back(ram);
 }
 
 RPC_HANDLER(spawn_msg_handler)
@@ -293,6 +339,28 @@ RPC_HANDLER(process_get_name_handler)
     }
 }
 
+RPC_HANDLER(process_get_mem_handler)
+{
+    CAST_IN_MSG_EXACT_SIZE(pid, domainid_t);
+
+    coreid_t core = pid_get_core(*pid);
+    if (disp_get_current_core_id() == core) {
+        struct proc_node *node = spawn_get_proc_node(*pid);
+        if (node == NULL) {
+            return PROC_MGMT_ERR_PID_NOT_FOUND;
+        }
+
+        MALLOC_OUT_MSG(reply, size_t);
+        *reply = node->ram_bytes;
+        return SYS_ERR_OK;
+    } else {
+        if (core >= MAX_COREID || urpc[core] == NULL) {
+            return ERR_INVALID_ARGS;
+        }
+        return forward_to_core(core, in_payload, in_size, out_payload, out_size);
+    }
+}
+
 RPC_HANDLER(get_local_pids_handler)
 {
     ASSERT_ZERO_IN_SIZE;
@@ -394,6 +462,9 @@ static errval_t kill_process_and_clean(domainid_t pid) {
     errval_t err = spawn_kill(pid);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "in spawn_kill");
+    } else {
+        // Before the pid is reused, the next domain with it must not free this RAM
+        aos_ram_take_back_all(pid);
     }
 
     if (disp_get_current_core_id() == 0) {
@@ -765,7 +836,7 @@ RPC_HANDLER(bind_core_urpc_handler)
 #endif
 
     // Forge frame
-    assert(msg->frame.bytes == (UMP_CHAN_SHARED_FRAME_SIZE * 2));
+    assert(msg->frame.bytes == INIT_BIDIRECTIONAL_URPC_FRAME_SIZE);
     struct capref urpc_frame;
     err = slot_alloc(&urpc_frame);
     if (err_is_fail(err)) {
@@ -798,47 +869,38 @@ RPC_HANDLER(bind_core_urpc_handler)
     return SYS_ERR_OK;
 }
 
-RPC_HANDLER(cap_transfer_handler)
+/**
+ * Hand in_cap on to the receiver of the ticket. in_cap is left to the caller on failure.
+ */
+static errval_t transfer_cap(struct proc_node *proc, void *in_payload, size_t in_size,
+                             struct capref in_cap)
 {
-    CAST_IN_MSG_EXACT_SIZE(pid, domainid_t);
-    if (capref_is_null(in_cap)) {
-        return ERR_INVALID_ARGS;
-    }
+    CAST_IN_MSG_EXACT_SIZE(in_ticket, struct aos_rpc_cap_ticket);
+
+    struct aos_rpc_cap_ticket ticket = *in_ticket;
+    ticket.from = proc->pid;  // don't trust the sender on who it is
 
 #if DEBUG_RPC_HANDLERS
-    DEBUG_PRINTF("> transfer cap to %u\n", *pid);
+    DEBUG_PRINTF("> transfer cap %u from %u to %u\n", ticket.seq, ticket.from, ticket.to);
 #endif
 
     errval_t err;
 
-    coreid_t core = pid_get_core(*pid);
+    coreid_t core = pid_get_core(ticket.to);
     if (core == disp_get_current_core_id()) {
-        struct aos_chan *chan;
-        err = spawn_get_chan(*pid, &chan);
-        if (err_is_fail(err)) {
-            return err;
-        }
-        assert(chan->type == AOS_CHAN_TYPE_LMP);
-
-        struct proc_node *p = spawn_get_proc_node(*pid);
-        if (p->accepting_cap <= 0) {
-            return MON_ERR_CAP_SEND;
+        struct proc_node *p = spawn_get_proc_node(ticket.to);
+        if (p == NULL) {
+            return PROC_MGMT_ERR_PID_NOT_FOUND;
         }
 
-
-        err = rpc_lmp_put_cap(&chan->lc, in_cap);  // not blocking, may return failure
+        // The receiver claims it whenever it sees the message, no handshake needed
+        err = proc_mgmt_cap_mailbox_put(p, &ticket, in_cap);
         if (err_is_fail(err)) {
-            if (lmp_err_is_transient(err)) {
-                return MON_ERR_RETRY;
-            } else {
-                return err;
-            }
+            return err;
         }
-
-        p->accepting_cap--;
     } else {
         struct internal_rpc_remote_cap_msg msg;
-        msg.pid = *pid;
+        msg.ticket = ticket;
 
         // Serialize the cap
         err = cap_direct_identify(in_cap, &msg.cap);
@@ -860,29 +922,63 @@ RPC_HANDLER(cap_transfer_handler)
         default:
             return MON_ERR_CAP_SEND;
         }
+
+        // The cap is forged again on the other core, drop our copy
+        err = cap_destroy(in_cap);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "cap_transfer_handler: failed to destroy forwarded cap\n");
+        }
     }
 
 #if DEBUG_RPC_HANDLERS
-    DEBUG_PRINTF("< transfer cap to %u done\n", *pid);
+    DEBUG_PRINTF("< transfer cap %u to %u done\n", ticket.seq, ticket.to);
 #endif
 
     return SYS_ERR_OK;
 }
 
+RPC_HANDLER(cap_transfer_handler)
+{
+    if (capref_is_null(in_cap)) {
+        return ERR_INVALID_ARGS;
+    }
+
+    errval_t err = transfer_cap(arg, in_payload, in_size, in_cap);
+    if (err_is_fail(err)) {
+        // Not handed on, the sender transfers a new copy if it retries on MON_ERR_RETRY
+        errval_t err2 = cap_destroy(in_cap);
+        if (err_is_fail(err2)) {
+            DEBUG_ERR(err2, "cap_transfer_handler: failed to destroy the cap\n");
+        }
+    }
+    return err;
+}
+
 RPC_HANDLER(cap_accept_handler)
 {
     struct proc_node *proc = arg;
-    proc->accepting_cap++;
-    return SYS_ERR_OK;
+    CAST_IN_MSG_EXACT_SIZE(ticket, struct aos_rpc_cap_ticket);
+    if (ticket->to != proc->pid) {
+        return ERR_INVALID_ARGS;
+    }
+    return proc_mgmt_cap_mailbox_take(proc, ticket, out_cap);  // may return MON_ERR_RETRY
 }
 
 RPC_HANDLER(remote_cap_transfer_handler)
 {
     CAST_IN_MSG_EXACT_SIZE(msg, struct internal_rpc_remote_cap_msg);
-    assert(pid_get_core(msg->pid) == disp_get_current_core_id());
+    assert(pid_get_core(msg->ticket.to) == disp_get_current_core_id());
 
     errval_t err;
 
+    struct proc_node *p = spawn_get_proc_node(msg->ticket.to);
+    if (p == NULL) {
+        return PROC_MGMT_ERR_PID_NOT_FOUND;
+    }
+    if (p->cap_mailbox_count >= PROC_CAP_MAILBOX_MAX) {
+        return PROC_MGMT_ERR_CAP_MAILBOX_FULL;  // check before forging the cap
+    }
+
     struct capref cap;
     err = slot_alloc(&cap);
     if (err_is_fail(err)) {
@@ -903,6 +999,7 @@ RPC_HANDLER(remote_cap_transfer_handler)
         if (err_is_fail(err)) {
             return err_push(err, MON_ERR_CAP_CREATE);
         }
+        break;
     case ObjType_RAM:
         err = ram_forge(cap, msg->cap.u.ram.base, msg->cap.u.ram.bytes,
                         disp_get_current_core_id());  // XXX: owner?
@@ -914,20 +1011,15 @@ RPC_HANDLER(remote_cap_transfer_handler)
         return MON_ERR_CAP_CREATE;
     }
 
-    // Put the cap
-    struct aos_chan *chan;
-    err = spawn_get_chan(msg->pid, &chan);
+    // Queue the cap
+    err = proc_mgmt_cap_mailbox_put(p, &msg->ticket, cap);
     if (err_is_fail(err)) {
+        cap_destroy(cap);
         return err;
     }
-    assert(chan->type == AOS_CHAN_TYPE_LMP);
-    err = rpc_lmp_put_cap(&chan->lc, cap);  // not blocking
-    if (err_is_fail(err)) {
-        return err;  // expose transient error to the caller
-    }
 
 #if DEBUG_RPC_HANDLERS
-    DEBUG_PRINTF("< put cap to %u done\n", msg->pid);
+    DEBUG_PRINTF("< put cap %u to %u done\n", msg->ticket.seq, msg->ticket.to);
 #endif
 
     return SYS_ERR_OK;
@@ -945,7 +1037,7 @@ static errval_t coordinate_nameserver_binding(domainid_t client_pid,
     errval_t err;
     struct capref frame;
     // The input frame contains two UMP channels: first for RPC, second for listener
-    err = frame_alloc(&frame, INIT_BIDIRECTIONAL_URPC_FRAME_SIZE, NULL);
+    err = frame_alloc(&frame, UMP_CHAN_SHARED_FRAME_SIZE * 2, NULL);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_FRAME_ALLOC);
     }
@@ -1059,9 +1151,11 @@ rpc_handler_t const rpc_handlers[INTERNAL_RPC_MSG_COUNT] = {
     [RPC_NUM] = num_msg_handler,
     [RPC_STR] = str_msg_handler,
     [RPC_RAM_REQUEST] = ram_request_msg_handler,
+    [RPC_RAM_FREE] = ram_free_handler,
     [RPC_PROCESS_SPAWN] = spawn_msg_handler,
     [RPC_PROCESS_SPAWN_WITH_STDIN] = spawn_msg_stdin_handler,
     [RPC_PROCESS_GET_NAME] = process_get_name_handler,
+    [RPC_PROCESS_GET_MEM] = process_get_mem_handler,
     [RPC_PROCESS_GET_ALL_PIDS] = process_get_all_pids_handler,
 	[RPC_PROCESS_KILL_PID] = process_kill_pid_handler,
 	[RPC_TERMINAL_AQUIRE] = terminal_aquire_handler,
@@ -1075,9 +1169,13 @@ rpc_handler_t const rpc_handlers[INTERNAL_RPC_MSG_COUNT] = {
 	[RPC_TERMINAL_HAS_STDIN] = terminal_has_stdin_handler,
     [RPC_STRESS_TEST] = stress_test_handler,
     [RPC_BIND_NAMESERVER] = bind_nameserver_handler,
+    [RPC_BENCH_ECHO] = bench_echo_handler,
+    [RPC_CHAN_STATS] = chan_stats_handler,
+    [RPC_MEM_STATS] = mem_stats_handler,
     [INTERNAL_RPC_BIND_CORE_URPC] = bind_core_urpc_handler,
     [INTERNAL_RPC_REMOTE_CAP_TRANSFER] = remote_cap_transfer_handler,
     [INTERNAL_RPC_REMOTE_RAM_REQUEST] = remote_ram_request_handler,
+    [INTERNAL_RPC_REMOTE_RAM_RETURN] = remote_ram_return_handler,
     [INTERNAL_RPC_REMOTE_BIND_NAMESERVER] = remote_bind_nameserver_handler,
     [INTERNAL_RPC_REMOTE_CLEAN_NAMESERVER] = remote_clean_nameserver_handler,
     [INTERNAL_RPC_GET_LOCAL_PIDS] = get_local_pids_handler,
@@ -11,6 +11,7 @@ enum internal_rpc_msg_type {
     INTERNAL_RPC_BIND_CORE_URPC = RPC_MSG_COUNT + 1,
     INTERNAL_RPC_REMOTE_CAP_TRANSFER,
     INTERNAL_RPC_REMOTE_RAM_REQUEST,
+    INTERNAL_RPC_REMOTE_RAM_RETURN,
     INTERNAL_RPC_REMOTE_BIND_NAMESERVER,
     INTERNAL_RPC_REMOTE_CLEAN_NAMESERVER,
     INTERNAL_RPC_GET_LOCAL_PIDS,
@@ -24,7 +25,7 @@ struct internal_rpc_bind_core_urpc_msg {
 };
 
 struct internal_rpc_remote_cap_msg {
-    domainid_t pid;
+    struct aos_rpc_cap_ticket ticket;
     struct capability cap;
 };
 
@@ -0,0 +1,166 @@
+/**
+ * \file
+ * \brief Benchmark of the size-class malloc against the K&R allocator
+ *
+ * Both allocators run the same workloads:
+ *
+ *   pattern  every thread allocates and frees like the RPC paths do per message: a copy
+ *            of the payload with an identifier in front, the received payload and a
+ *            small reply, with a few messages in flight at a time
+ *   echo     real RPC round trips to init on this core, only this end switches allocator
+ *
+ * Every result is printed as one line:
+ *
+ *   mallocbench,<allocator>,<workload>,<threads>,<ops>,<ns total>,<ns/op>
+ *
+ * Run "mallocbench <workload>" to measure a single workload.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/malloc.h>
+#include <aos/systime.h>
+
+#define PATTERN_OPS 20000
+#define ECHO_OPS 2000
+#define IN_FLIGHT 16
+#define MAX_THREADS 4
+
+// The payload sizes of rpcbench
+static const size_t sizes[] = { 8, 32, 64, 128, 256, 1024, 4000 };
+
+struct in_flight {
+    void *send;
+    void *recv;
+    void *reply;
+};
+
+static int pattern_thread(void *arg)
+{
+    size_t ops = (size_t)arg;
+    struct in_flight msgs[IN_FLIGHT] = { 0 };
+
+    for (size_t i = 0; i < ops; i++) {
+        struct in_flight *m = &msgs[i % IN_FLIGHT];
+        free(m->send);
+        free(m->recv);
+        free(m->reply);
+
+        size_t size = sizes[i % ARRAY_LENGTH(sizes)];
+        m->send = malloc(size + sizeof(uint64_t));
+        m->recv = malloc(size);
+        m->reply = malloc(sizeof(errval_t) * 2);
+        if (m->send == NULL || m->recv == NULL || m->reply == NULL) {
+            return EXIT_FAILURE;
+        }
+        // Touch them as a message would
+        ((uint8_t *)m->send)[size] = (uint8_t)i;
+        ((uint8_t *)m->recv)[size - 1] = (uint8_t)i;
+    }
+
+    for (size_t i = 0; i < IN_FLIGHT; i++) {
+        free(msgs[i].send);
+        free(msgs[i].recv);
+        free(msgs[i].reply);
+    }
+    return EXIT_SUCCESS;
+}
+
+static errval_t run_pattern(size_t thread_count, uint64_t *ns)
+{
+    struct thread *threads[MAX_THREADS];
+    size_t ops = PATTERN_OPS / thread_count;
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < thread_count; i++) {
+        threads[i] = thread_create(pattern_thread, (void *)ops);
+        if (threads[i] == NULL) {
+            return LIB_ERR_THREAD_CREATE;
+        }
+    }
+    errval_t err = SYS_ERR_OK;
+    for (size_t i = 0; i < thread_count; i++) {
+        int ret;
+        errval_t join_err = thread_join(threads[i], &ret);
+        if (err_is_fail(join_err)) {
+            err = join_err;
+        } else if (ret != EXIT_SUCCESS) {
+            err = LIB_ERR_MALLOC_FAIL;
+        }
+    }
+    *ns = systime_to_ns(systime_now() - start);
+    return err;
+}
+
+static errval_t run_echo(uint64_t *ns)
+{
+    errval_t err = SYS_ERR_OK;
+
+    struct rpc_bench_echo_msg *msg = calloc(sizeof(*msg) + 4000, 1);
+    if (msg == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    msg->core = disp_get_core_id();
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < ECHO_OPS; i++) {
+        size_t size = sizeof(*msg) + sizes[i % ARRAY_LENGTH(sizes)];
+        void *reply = NULL;
+        size_t reply_size = 0;
+        err = aos_rpc_bench_echo(aos_rpc_get_init_channel(), msg, size, &reply,
+                                 &reply_size);
+        free(reply);
+        if (err_is_fail(err)) {
+            break;
+        }
+    }
+    *ns = systime_to_ns(systime_now() - start);
+
+    free(msg);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = (argc >= 2) ? argv[1] : NULL;
+    bool pattern = (only == NULL || strcmp(only, "pattern") == 0);
+    bool echo = (only == NULL || strcmp(only, "echo") == 0);
+
+    static const char *allocators[] = { "kr", "sizeclass" };
+
+    printf("mallocbench,allocator,workload,threads,ops,total_ns,ns_per_op\n");
+    for (size_t a = 0; a < ARRAY_LENGTH(allocators); a++) {
+        malloc_set_size_classes(a == 1);
+
+        errval_t err;
+        uint64_t ns;
+        if (pattern) {
+            for (size_t t = 1; t <= MAX_THREADS; t *= 2) {
+                err = run_pattern(t, &ns);
+                if (err_is_fail(err)) {
+                    printf("mallocbench: pattern with %lu threads failed: %s\n", t,
+                           err_getstring(err));
+                    return EXIT_FAILURE;
+                }
+                printf("mallocbench,%s,pattern,%lu,%u,%lu,%lu\n", allocators[a], t,
+                       PATTERN_OPS, ns, ns / PATTERN_OPS);
+            }
+        }
+        if (echo) {
+            err = run_echo(&ns);
+            if (err_is_fail(err)) {
+                printf("mallocbench: echo failed: %s\n", err_getstring(err));
+                return EXIT_FAILURE;
+            }
+            printf("mallocbench,%s,echo,1,%u,%lu,%lu\n", allocators[a], ECHO_OPS, ns,
+                   ns / ECHO_OPS);
+        }
+    }
+
+    malloc_set_size_classes(true);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/**
+ * \file
+ * \brief Micro-benchmark of the UMP ring buffer publication modes
+ *
+ * The client spawns a server on another core and shares a pair of rings with it through
+ * the nameservice. For every ring mode and message size it measures the one-way
+ * throughput and the round-trip latency. Every result is printed as one line:
+ *
+ *   ringbench,<mode>,<test>,<size>,<count>,<ns total>,<msgs/s>,<MB/s>,<p50 ns>,<p99 ns>,<max ns>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/nameserver.h>
+#include <aos/paging.h>
+#include <aos/systime.h>
+#include <aos/deferred.h>
+#include <ringbuffer/ringbuffer.h>
+
+#define RINGBENCH_SERVICE "ringbench"
+#define RINGBENCH_SERVER_CORE 1
+#define RINGBENCH_FRAME_SIZE (2 * RING_BUFFER_SIZE)
+
+#define THROUGHPUT_COUNT 10000
+#define LATENCY_COUNT 1000
+#define BATCH_SIZE 16
+
+struct ringbench_setup {
+    enum ring_mode mode;
+    bool echo;     ///< Reply to every message instead of only to the last one
+    size_t count;  ///< Number of messages the server should consume
+};
+
+struct ringbench_server {
+    struct ringbench_setup setup;
+    struct ring_consumer recv;
+    struct ring_producer send;
+};
+
+static const size_t sizes[] = { 8, 64, 256, 1024, 1900, 4096, 16384 };
+
+static void *ring_frame_buf = NULL;  // server side, mapped once
+
+static int server_thread(void *arg)
+{
+    struct ringbench_server *st = arg;
+    errval_t err;
+
+    for (size_t i = 0; i < st->setup.count; i++) {
+        struct ring_msg_view view;
+        err = ring_consumer_peek_blocking(&st->recv, &view);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "ringbench: server failed to receive\n");
+            break;
+        }
+
+        // reply with the first word, which carries the timestamp of the client
+        bool reply = st->setup.echo || i == st->setup.count - 1;
+        uint64_t word = 0;
+        memcpy(&word, view.payload, MIN(view.size, sizeof(word)));
+
+        // commit before replying, the client reinitializes the rings after the last reply
+        err = ring_consumer_commit(&st->recv, &view);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "ringbench: server failed to commit\n");
+        }
+
+        if (reply) {
+            err = ring_producer_send(&st->send, &word, sizeof(word));
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "ringbench: server failed to reply\n");
+            }
+        }
+    }
+
+    free(st);
+    return 0;
+}
+
+static void setup_handler(void *arg, void *message, size_t bytes, void **response,
+                          size_t *response_bytes, struct capref tx_cap,
+                          struct capref *rx_cap)
+{
+    errval_t err;
+
+    *response = NULL;
+    *response_bytes = 0;
+
+    assert(bytes == sizeof(struct ringbench_setup));
+
+    if (ring_frame_buf == NULL) {
+        assert(!capref_is_null(tx_cap));
+        err = paging_map_frame(get_current_paging_state(), &ring_frame_buf,
+                               RINGBENCH_FRAME_SIZE, tx_cap);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "ringbench: failed to map the shared frame\n");
+            return;
+        }
+    }
+
+    struct ringbench_server *st = malloc(sizeof(*st));
+    if (st == NULL) {
+        DEBUG_PRINTF("ringbench: malloc failed\n");
+        return;
+    }
+    st->setup = *(struct ringbench_setup *)message;
+
+    // ring 0 goes from the client to the server, ring 1 back
+    uint8_t *b = ring_frame_buf;
+    ring_consumer_init(&st->recv, b, st->setup.mode);
+    ring_producer_init(&st->send, b + RING_BUFFER_SIZE, st->setup.mode);
+
+    struct thread *t = thread_create(server_thread, st);
+    if (t == NULL) {
+        DEBUG_PRINTF("ringbench: failed to create server thread\n");
+        free(st);
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+struct ringbench_client {
+    nameservice_chan_t chan;
+    struct capref frame;
+    uint8_t *buf;
+    bool frame_shared;
+    struct ring_producer send;
+    struct ring_consumer recv;
+    uint8_t *payload;
+};
+
+static errval_t start_test(struct ringbench_client *c, enum ring_mode mode, bool echo,
+                           size_t count)
+{
+    errval_t err;
+
+    // the server is done with the rings once it sent its last reply, it commits first
+    memset(c->buf, 0, RINGBENCH_FRAME_SIZE);
+    ring_producer_init(&c->send, c->buf, mode);
+    ring_consumer_init(&c->recv, c->buf + RING_BUFFER_SIZE, mode);
+
+    struct ringbench_setup setup = { .mode = mode, .echo = echo, .count = count };
+    void *response = NULL;
+    size_t response_bytes = 0;
+    err = nameservice_rpc(c->chan, &setup, sizeof(setup), &response, &response_bytes,
+                          c->frame_shared ? NULL_CAP : c->frame, NULL_CAP);
+    free(response);
+    if (err_is_ok(err)) {
+        c->frame_shared = true;
+    }
+    return err;
+}
+
+static void print_result(const char *mode_name, const char *test, size_t size,
+                         size_t count, uint64_t total_ns, uint64_t *samples)
+{
+    uint64_t msgs_per_s = total_ns ? (uint64_t)count * 1000000000ULL / total_ns : 0;
+    uint64_t mb_per_s = total_ns ? (uint64_t)count * size * 1000ULL / total_ns : 0;
+    uint64_t p50 = 0, p99 = 0, max = 0;
+    if (samples != NULL) {
+        qsort(samples, count, sizeof(uint64_t), compare_u64);
+        p50 = samples[count / 2];
+        p99 = samples[count * 99 / 100];
+        max = samples[count - 1];
+    }
+    printf("ringbench,%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", mode_name, test, size,
+           count, total_ns, msgs_per_s, mb_per_s, p50, p99, max);
+}
+
+static errval_t run_throughput(struct ringbench_client *c, enum ring_mode mode,
+                               const char *mode_name, size_t batch, size_t size)
+{
+    errval_t err = start_test(c, mode, false, THROUGHPUT_COUNT);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < THROUGHPUT_COUNT; i++) {
+        if (batch > 1 && i % batch == 0) {
+            ring_producer_batch_begin(&c->send);
+        }
+        err = ring_producer_send(&c->send, c->payload, size);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (batch > 1 && (i % batch == batch - 1 || i == THROUGHPUT_COUNT - 1)) {
+            ring_producer_batch_end(&c->send);
+        }
+    }
+
+    void *reply;
+    size_t reply_size;
+    err = ring_consumer_recv(&c->recv, &reply, &reply_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    systime_t stop = systime_now();
+    free(reply);
+
+    print_result(mode_name, "throughput", size, THROUGHPUT_COUNT,
+                 systime_to_ns(stop - start), NULL);
+    return SYS_ERR_OK;
+}
+
+static errval_t run_latency(struct ringbench_client *c, enum ring_mode mode,
+                            const char *mode_name, size_t size, uint64_t *samples)
+{
+    errval_t err = start_test(c, mode, true, LATENCY_COUNT);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    systime_t total = 0;
+    for (size_t i = 0; i < LATENCY_COUNT; i++) {
+        systime_t start = systime_now();
+        err = ring_producer_send(&c->send, c->payload, size);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        struct ring_msg_view view;
+        err = ring_consumer_peek_blocking(&c->recv, &view);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        systime_t stop = systime_now();
+        ring_consumer_commit(&c->recv, &view);
+
+        samples[i] = systime_to_ns(stop - start);
+        total += stop - start;
+    }
+
+    print_result(mode_name, "rtt", size, LATENCY_COUNT, systime_to_ns(total), samples);
+    return SYS_ERR_OK;
+}
+
+static int run_client(void)
+{
+    errval_t err;
+    struct ringbench_client c = { .frame_shared = false };
+
+    domainid_t pid;
+    err = aos_rpc_process_spawn(aos_rpc_get_process_channel(), "ringbench server",
+                                RINGBENCH_SERVER_CORE, &pid);
+    if (err_is_fail(err)) {
+        printf("ringbench: failed to spawn server: %s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    while (true) {
+        err = nameservice_lookup(RINGBENCH_SERVICE, &c.chan);
+        if (err_is_ok(err)) {
+            break;
+        }
+        barrelfish_usleep(10000);
+    }
+
+    err = frame_alloc(&c.frame, RINGBENCH_FRAME_SIZE, NULL);
+    if (err_is_fail(err)) {
+        printf("ringbench: frame_alloc failed: %s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+    err = paging_map_frame(get_current_paging_state(), (void **)&c.buf,
+                           RINGBENCH_FRAME_SIZE, c.frame);
+    if (err_is_fail(err)) {
+        printf("ringbench: paging_map_frame failed: %s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    size_t max_size = sizes[ARRAY_LENGTH(sizes) - 1];
+    c.payload = calloc(max_size, 1);
+    uint64_t *samples = malloc(LATENCY_COUNT * sizeof(uint64_t));
+    if (c.payload == NULL || samples == NULL) {
+        printf("ringbench: malloc failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("ringbench,mode,test,size,count,total_ns,msgs_per_s,mb_per_s,p50_ns,p99_ns,max_ns\n");
+    for (size_t i = 0; i < ARRAY_LENGTH(sizes); i++) {
+        size_t size = sizes[i];
+        err = run_throughput(&c, RING_MODE_READY_FLAG, "ready_flag", 1, size);
+        if (err_is_ok(err)) {
+            err = run_throughput(&c, RING_MODE_INDEX, "index", 1, size);
+        }
+        if (err_is_ok(err)) {
+            err = run_throughput(&c, RING_MODE_INDEX, "index_batch", BATCH_SIZE, size);
+        }
+        if (err_is_ok(err)) {
+            err = run_latency(&c, RING_MODE_READY_FLAG, "ready_flag", size, samples);
+        }
+        if (err_is_ok(err)) {
+            err = run_latency(&c, RING_MODE_INDEX, "index", size, samples);
+        }
+        if (err_is_fail(err)) {
+            printf("ringbench: size %lu failed: %s\n", size, err_getstring(err));
+            return EXIT_FAILURE;
+        }
+    }
+
+    free(samples);
+    free(c.payload);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    errval_t err;
+
+    if (argc >= 2 && strcmp(argv[1], "server") == 0) {
+        err = nameservice_register(RINGBENCH_SERVICE, setup_handler, NULL);
+        if (err_is_fail(err)) {
+            printf("ringbench: cannot start server, err: %s\n", err_getstring(err));
+            return EXIT_FAILURE;
+        }
+
+        aos_rpc_serial_release(aos_rpc_get_serial_channel());
+
+        while (1) event_dispatch(get_default_waitset());
+    }
+
+    return run_client();
+}
@@ -0,0 +1,247 @@
+/**
+ * \file
+ * \brief Micro-benchmark of RPC round trips over the different transports
+ *
+ * For every transport and payload size it makes a few warm-up calls, then times every
+ * call of a series with systime_now(). The transports are:
+ *
+ *   lmp        init on this core echoes the call (LMP)
+ *   lmp_ump    init on this core forwards the call to init on the other core (LMP + UMP)
+ *   ns_local   a nameservice server on this core echoes the call
+ *   ns_remote  a nameservice server on the other core echoes the call
+ *
+ * Every result is printed as one line:
+ *
+ *   rpcbench,<transport>,<size>,<count>,<ns total>,<calls/s>,<MB/s>,<p50 ns>,<p99 ns>,<p999 ns>,<max ns>
+ *
+ * Run "rpcbench <transport>" to measure a single transport.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/nameserver.h>
+#include <aos/systime.h>
+#include <aos/deferred.h>
+
+#define RPCBENCH_SERVICE_PREFIX "rpcbench"
+
+#define WARMUP_COUNT 16
+#define CALL_COUNT 2000
+#define MAX_SIZE 16384
+
+// Inline, fragment trains, frame pool and fresh frames on LMP, in-place and bulk on UMP
+static const size_t sizes[] = { 8, 32, 64, 128, 256, 1024, 4000, 16384 };
+
+static uint8_t response_buf[MAX_SIZE];
+
+static void echo_handler(void *st, void *message, size_t bytes, void **response,
+                         size_t *response_bytes, struct capref tx_cap,
+                         struct capref *rx_cap)
+{
+    // The response is not freed by the nameservice, but the message copy is ours
+    size_t size = MIN(bytes, sizeof(response_buf));
+    memcpy(response_buf, message, size);
+    free(message);
+
+    *response = response_buf;
+    *response_bytes = size;
+}
+
+static int run_server(const char *name)
+{
+    errval_t err = nameservice_register(name, echo_handler, NULL);
+    if (err_is_fail(err)) {
+        printf("rpcbench: cannot start server, err: %s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    aos_rpc_serial_release(aos_rpc_get_serial_channel());
+
+    while (1) event_dispatch(get_default_waitset());
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+enum transport {
+    TRANSPORT_LMP,
+    TRANSPORT_LMP_UMP,
+    TRANSPORT_NS_LOCAL,
+    TRANSPORT_NS_REMOTE,
+    TRANSPORT_COUNT
+};
+
+static const char *transport_names[TRANSPORT_COUNT] = {
+    [TRANSPORT_LMP] = "lmp",
+    [TRANSPORT_LMP_UMP] = "lmp_ump",
+    [TRANSPORT_NS_LOCAL] = "ns_local",
+    [TRANSPORT_NS_REMOTE] = "ns_remote",
+};
+
+struct rpcbench_client {
+    coreid_t local_core;
+    coreid_t remote_core;
+    nameservice_chan_t ns_chan[TRANSPORT_COUNT];  ///< For the nameservice transports
+    struct rpc_bench_echo_msg *payload;
+    uint64_t *samples;
+};
+
+static errval_t connect_server(struct rpcbench_client *c, enum transport t, coreid_t core)
+{
+    errval_t err;
+
+    char name[32];
+    snprintf(name, sizeof(name), RPCBENCH_SERVICE_PREFIX "%u", core);
+
+    char cmdline[64];
+    snprintf(cmdline, sizeof(cmdline), "rpcbench server %s", name);
+
+    domainid_t pid;
+    err = aos_rpc_process_spawn(aos_rpc_get_process_channel(), cmdline, core, &pid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    while (true) {
+        err = nameservice_lookup(name, &c->ns_chan[t]);
+        if (err_is_ok(err)) {
+            return SYS_ERR_OK;
+        }
+        barrelfish_usleep(10000);
+    }
+}
+
+static errval_t call_once(struct rpcbench_client *c, enum transport t, size_t size)
+{
+    errval_t err;
+    void *reply = NULL;
+    size_t reply_size = 0;
+
+    switch (t) {
+    case TRANSPORT_LMP:
+    case TRANSPORT_LMP_UMP:
+        c->payload->core = (t == TRANSPORT_LMP) ? c->local_core : c->remote_core;
+        err = aos_rpc_bench_echo(aos_rpc_get_init_channel(), c->payload, size, &reply,
+                                 &reply_size);
+        break;
+    default:
+        err = nameservice_rpc(c->ns_chan[t], c->payload, size, &reply, &reply_size,
+                              NULL_CAP, NULL_CAP);
+        break;
+    }
+    if (err_is_ok(err) && reply_size != size) {
+        err = LIB_ERR_RPC_INVALID_PAYLOAD_SIZE;
+    }
+    free(reply);
+    return err;
+}
+
+static errval_t run_series(struct rpcbench_client *c, enum transport t, size_t size)
+{
+    errval_t err;
+
+    for (size_t i = 0; i < WARMUP_COUNT; i++) {
+        err = call_once(c, t, size);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    systime_t total = 0;
+    for (size_t i = 0; i < CALL_COUNT; i++) {
+        systime_t start = systime_now();
+        err = call_once(c, t, size);
+        systime_t stop = systime_now();
+        if (err_is_fail(err)) {
+            return err;
+        }
+        c->samples[i] = systime_to_ns(stop - start);
+        total += stop - start;
+    }
+
+    uint64_t total_ns = systime_to_ns(total);
+    uint64_t calls_per_s = total_ns ? (uint64_t)CALL_COUNT * 1000000000ULL / total_ns : 0;
+    uint64_t mb_per_s = total_ns ? (uint64_t)CALL_COUNT * size * 1000ULL / total_ns : 0;
+
+    qsort(c->samples, CALL_COUNT, sizeof(uint64_t), compare_u64);
+    printf("rpcbench,%s,%lu,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", transport_names[t], size,
+           CALL_COUNT, total_ns, calls_per_s, mb_per_s, c->samples[CALL_COUNT / 2],
+           c->samples[CALL_COUNT * 99 / 100], c->samples[CALL_COUNT * 999 / 1000],
+           c->samples[CALL_COUNT - 1]);
+    return SYS_ERR_OK;
+}
+
+static int run_client(const char *only)
+{
+    errval_t err;
+    struct rpcbench_client c;
+
+    c.local_core = disp_get_core_id();
+    c.remote_core = (c.local_core == 0) ? 1 : 0;
+
+    c.payload = calloc(MAX_SIZE, 1);
+    c.samples = malloc(CALL_COUNT * sizeof(uint64_t));
+    if (c.payload == NULL || c.samples == NULL) {
+        printf("rpcbench: malloc failed\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = sizeof(struct rpc_bench_echo_msg); i < MAX_SIZE; i++) {
+        ((uint8_t *)c.payload)[i] = (uint8_t)i;
+    }
+
+    bool run[TRANSPORT_COUNT];
+    for (enum transport t = 0; t < TRANSPORT_COUNT; t++) {
+        run[t] = (only == NULL || strcmp(only, transport_names[t]) == 0);
+    }
+
+    if (run[TRANSPORT_NS_LOCAL]) {
+        err = connect_server(&c, TRANSPORT_NS_LOCAL, c.local_core);
+        if (err_is_fail(err)) {
+            printf("rpcbench: failed to start local server: %s\n", err_getstring(err));
+            return EXIT_FAILURE;
+        }
+    }
+    if (run[TRANSPORT_NS_REMOTE]) {
+        err = connect_server(&c, TRANSPORT_NS_REMOTE, c.remote_core);
+        if (err_is_fail(err)) {
+            printf("rpcbench: failed to start remote server: %s\n", err_getstring(err));
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("rpcbench,transport,size,count,total_ns,calls_per_s,mb_per_s,p50_ns,p99_ns,"
+           "p999_ns,max_ns\n");
+    for (enum transport t = 0; t < TRANSPORT_COUNT; t++) {
+        if (!run[t]) {
+            continue;
+        }
+        for (size_t i = 0; i < ARRAY_LENGTH(sizes); i++) {
+            err = run_series(&c, t, sizes[i]);
+            if (err_is_fail(err)) {
+                printf("rpcbench: %s size %lu failed: %s\n", transport_names[t], sizes[i],
+                       err_getstring(err));
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(c.samples);
+    free(c.payload);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "server") == 0) {
+        return run_server(argv[2]);
+    }
+
+    return run_client(argc >= 2 ? argv[1] : NULL);
+}
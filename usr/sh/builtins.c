@@ -389,9 +389,10 @@ static void sh_ps(struct shell_env *env)
 	struct aos_rpc *rpc = aos_rpc_get_process_channel();
 	
 	domainid_t *pids;
-	const char* line_format = "% 12d   %s\n";
-	size_t npids, out_size = 1024, out_offset = 0, overhead_length = strlen(line_format);
+	const char* line_format = "% 12d %12s   %s\n";
+	size_t npids, out_size = 1024, out_offset = 0, overhead_length = strlen(line_format) + 12;
 	char* name;
+	char ram[16];
 	char* out_text = (char*)malloc(sizeof(char) * out_size);
 	errval_t err = aos_rpc_process_get_all_pids(rpc, &pids, &npids);
 	
@@ -401,7 +402,7 @@ static void sh_ps(struct shell_env *env)
 		return;
 	}
 	
-	out_offset += snprintf(out_text, out_size - 1, "Running processes:\n");
+	out_offset += snprintf(out_text, out_size - 1, "Running processes:\n%12s %12s   %s\n", "PID", "RAM", "NAME");
 	
 	for (size_t i = 0; i < npids; i++) {
 		name = NULL;
@@ -411,12 +412,17 @@ static void sh_ps(struct shell_env *env)
 		if (err_is_ok(err)) free_needed = true;
 		else name = "N/A";
 		
+		size_t ram_bytes;
+		err = aos_rpc_process_get_mem(rpc, pids[i], &ram_bytes);
+		if (err_is_ok(err)) snprintf(ram, sizeof(ram), "%zu KiB", ram_bytes / 1024);
+		else strcpy(ram, "N/A");
+		
 		size_t line_len = strlen(name) + overhead_length;
 		if (out_offset + line_len + 1 >= out_size) {
 			out_size *= 2;
 			out_text = (char*)realloc(out_text, out_size);
 		}
-		out_offset += snprintf(out_text + out_offset, out_size - out_offset - 1, line_format, pids[i], name);
+		out_offset += snprintf(out_text + out_offset, out_size - out_offset - 1, line_format, pids[i], ram, name);
 		if (free_needed) free(name);
 	}
 	
@@ -540,6 +546,89 @@ exit:
 	free(tmp_cmd_buffer);
 }
 
+static void sh_rpcstat(struct shell_env *env)
+{
+	env->last_return_status = 1;
+	
+	coreid_t core = disp_get_core_id();
+	if (env->argc >= 2) {
+		unsigned int c;
+		if (sscanf(env->argv[1], "%u", &c) < 1) {
+			printf("Usage: rpcstat [core id]\n");
+			return;
+		}
+		core = c;
+	}
+	
+	struct rpc_chan_stats_entry *entries;
+	size_t count;
+	errval_t err = aos_rpc_get_chan_stats(aos_rpc_get_init_channel(), core, &entries, &count);
+	if (err_is_fail(err)) {
+		printf("rpcstat failed: %s\n", err_getcode(err));
+		return;
+	}
+	
+	printf("Channels of init on core %u:\n", core);
+	printf("%8s  %-20s %10s %10s %12s %12s %6s %6s %10s %8s\n", "pid", "name", "sent", "recv",
+	       "bytes out", "bytes in", "caps", "retry", "handled", "avg us");
+	for (size_t i = 0; i < count; i++) {
+		struct rpc_chan_stats_entry *e = &entries[i];
+		struct aos_chan_stats *st = &e->stats;
+		uint64_t avg_us = st->handled ? st->handler_ns / st->handled / 1000 : 0;
+		printf("%8u  %-20s %10lu %10lu %12lu %12lu %6lu %6lu %10lu %8lu\n", e->pid, e->name,
+		       st->msgs_sent, st->msgs_recv, st->bytes_sent, st->bytes_recv,
+		       st->caps_sent + st->caps_recv, st->retries, st->handled, avg_us);
+		
+		if (st->handled == 0) continue;
+		
+		// handler time histogram, only the buckets in use
+		printf("%8s  handler us:", "");
+		for (size_t b = 0; b < AOS_CHAN_STATS_HIST_BUCKETS; b++) {
+			if (st->handler_hist[b] == 0) continue;
+			if (b == 0) printf(" <1:%u", st->handler_hist[b]);
+			else if (b == AOS_CHAN_STATS_HIST_BUCKETS - 1) printf(" >=%lu:%u", 1UL << (b - 1), st->handler_hist[b]);
+			else printf(" %lu-%lu:%u", 1UL << (b - 1), 1UL << b, st->handler_hist[b]);
+		}
+		printf("\n");
+	}
+	
+	free(entries);
+	env->last_return_status = 0;
+}
+
+static void sh_memstat(struct shell_env *env)
+{
+	env->last_return_status = 1;
+	
+	coreid_t core = disp_get_core_id();
+	if (env->argc >= 2) {
+		unsigned int c;
+		if (sscanf(env->argv[1], "%u", &c) < 1) {
+			printf("Usage: memstat [core id]\n");
+			return;
+		}
+		core = c;
+	}
+	
+	struct mm_stats st;
+	errval_t err = aos_rpc_get_mem_stats(aos_rpc_get_init_channel(), core, &st);
+	if (err_is_fail(err)) {
+		printf("memstat failed: %s\n", err_getcode(err));
+		return;
+	}
+	
+	printf("RAM of init on core %u:\n", core);
+	printf("  total     %12lu KiB\n", st.total_bytes / 1024);
+	printf("  free      %12lu KiB\n", st.free_bytes / 1024);
+	printf("  allocated %12lu KiB in %lu caps\n", st.allocated_bytes / 1024, st.pending_count);
+	printf("  requested %12lu KiB\n", st.requested_bytes / 1024);
+	printf("  waste     %12lu KiB\n", st.waste_bytes / 1024);
+	printf("  carved    %12lu KiB in %lu of %lu allocations\n", st.carved_bytes / 1024,
+	       st.carve_count, st.alloc_count);
+	
+	env->last_return_status = 0;
+}
+
 static void sh_san(struct shell_env *env)
 {
 	if (env->argc != 2) return;
@@ -563,6 +652,8 @@ int builtin(struct shell_env *env)
 	REGISTER_BUILTIN(kill);
 	REGISTER_BUILTIN(oncore);
 	REGISTER_BUILTIN(time);
+	REGISTER_BUILTIN(rpcstat);
+	REGISTER_BUILTIN(memstat);
 	
 	// file system utilities
 	REGISTER_BUILTIN(ls);